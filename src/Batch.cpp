@@ -0,0 +1,392 @@
+#include "Batch.h"
+#include "BoundedQueue.h"
+#include "Compare.h"
+#include "Filter.h"
+#include "GrayscaleImage.h"
+#include "Pipeline.h"
+#include "ResultCache.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <glob.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <thread>
+
+typedef std::chrono::steady_clock Clock;
+
+// Frames of finished jobs, handed out again as output buffers
+class FramePool {
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<GrayscaleImage>> frames;
+    size_t capacity;
+
+public:
+    explicit FramePool(size_t capacity) : capacity(capacity) {}
+
+    // A frame of the given size; its pixels are whatever the last job left there
+    std::unique_ptr<GrayscaleImage> take(int width, int height) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < frames.size(); ++i) {
+                if (frames[i]->get_width() == width && frames[i]->get_height() == height) {
+                    std::unique_ptr<GrayscaleImage> frame = std::move(frames[i]);
+                    frames.erase(frames.begin() + i);
+                    return frame;
+                }
+            }
+        }
+        return std::unique_ptr<GrayscaleImage>(new GrayscaleImage(width, height));
+    }
+
+    void give(std::unique_ptr<GrayscaleImage> frame) {
+        if (!frame) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (frames.size() == capacity) {
+            frames.erase(frames.begin());  // Drop the oldest, most likely a size no longer in use
+        }
+        frames.push_back(std::move(frame));
+    }
+};
+
+// A job on its way through the stages
+struct BatchWork {
+    const BatchJob* job;
+    std::unique_ptr<GrayscaleImage> input;
+    std::unique_ptr<GrayscaleImage> operand;  // Second image for add/sub
+    std::unique_ptr<GrayscaleImage> output;
+    std::unique_ptr<Pipeline> pipeline;
+    std::string outputPath;
+    std::string cacheKey;  // Set when a result cache is in use
+};
+
+// Same as the single-file CLI, but kept next to the input when it lives in another directory
+static std::string output_path(const std::string& prefix, const std::string& input, const std::string& suffix) {
+    size_t slash = input.find_last_of('/');
+    std::string directory = (slash == std::string::npos) ? "" : input.substr(0, slash + 1);
+    std::string name = (slash == std::string::npos) ? input : input.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos && dot > 0) {
+        name = name.substr(0, dot);
+    }
+    return directory + prefix + name + suffix;
+}
+
+static std::string base_name(const std::string& path) {
+    return output_path("", path, "");
+}
+
+static void expect_args(const BatchJob& job, size_t minimum, size_t maximum, const char* usage) {
+    if (job.args.size() < minimum || job.args.size() > maximum) {
+        throw std::invalid_argument(std::string("Usage: ") + usage);
+    }
+}
+
+// Decode stage: check the arguments and load the input images. With a cache,
+// returns true if the result was found there and copied to the output path.
+static bool decode(BatchWork& work, ResultCache* cache) {
+    const BatchJob& job = *work.job;
+    const std::vector<std::string>& args = job.args;
+    const std::string& op = job.operation;
+    std::string operation;  // Same text as the single-file CLI uses for its cache keys
+
+    if (op == "mean" || op == "median" || op == "erode" || op == "dilate" || op == "open" || op == "close") {
+        expect_args(job, 2, 2, (op + " <img> <kernel_size>").c_str());
+        work.outputPath = output_path(op + "_filtered_", args[0], "_" + std::to_string(std::stoi(args[1])) + ".png");
+        operation = op + " " + std::to_string(std::stoi(args[1]));
+    } else if (op == "bilateral") {
+        expect_args(job, 3, 3, "bilateral <img> <kernel_size> <sigma_range>");
+        double sigmaRange = std::stof(args[2]);
+        work.outputPath = output_path("bilateral_filtered_", args[0],
+                                      "_" + std::to_string(std::stoi(args[1])) + "_" + std::to_string(sigmaRange) + ".png");
+        operation = op + " " + std::to_string(std::stoi(args[1])) + " " + ResultCache::number(sigmaRange);
+    } else if (op == "gauss" || op == "unsharp") {
+        expect_args(job, 3, 3, op == "gauss" ? "gauss <img> <kernel_size> <sigma>" : "unsharp <img> <kernel_size> <amount>");
+        double parameter = std::stof(args[2]);
+        work.outputPath = output_path(op == "gauss" ? "gaussian_filtered_" : "unsharp_filtered_", args[0],
+                                      "_" + std::to_string(std::stoi(args[1])) + "_" + std::to_string(parameter) + ".png");
+        operation = op + " " + std::to_string(std::stoi(args[1])) + " " + ResultCache::number(parameter);
+    } else if (op == "pipeline") {
+        expect_args(job, 2, 3, "pipeline <img> <stages> [<out>]");
+        work.pipeline.reset(new Pipeline(args[1]));
+        work.outputPath = args.size() == 3 ? args[2] : output_path("pipeline_", args[0], ".png");
+        if (cache) operation = "pipeline " + work.pipeline->describe();
+    } else if (op == "add" || op == "sub") {
+        expect_args(job, 2, 2, op == "add" ? "add <img1> <img2>" : "sub <img1> <img2>");
+        work.outputPath = output_path(op == "add" ? "added_" : "subtracted_", args[0], "_" + base_name(args[1]) + ".png");
+        work.operand.reset(new GrayscaleImage(args[1].c_str()));
+        if (cache) operation = op + " " + std::to_string(Compare::hash(*work.operand));
+    } else {
+        throw std::invalid_argument("Invalid operation for batch mode: " + op);
+    }
+    work.input.reset(new GrayscaleImage(args[0].c_str()));
+
+    if (cache) {
+        work.cacheKey = ResultCache::key(Compare::hash(*work.input), operation,
+                                         GrayscaleImageBase::format_for(work.outputPath));
+        return cache->fetch(work.cacheKey, work.outputPath);
+    }
+    return false;
+}
+
+// Filter stage: produce work.output, recycling frames where possible
+static void filter(BatchWork& work, FramePool& frames) {
+    const BatchJob& job = *work.job;
+    const std::string& op = job.operation;
+    GrayscaleImage& input = *work.input;
+
+    if (op == "add" || op == "sub") {
+        // Same in-place arithmetic as the single-file CLI; the input becomes the output
+        if (op == "add") {
+            input += *work.operand;
+        } else {
+            input -= *work.operand;
+        }
+        frames.give(std::move(work.operand));
+        work.output = std::move(work.input);
+        return;
+    }
+
+    work.output = frames.take(input.get_width(), input.get_height());
+    if (op == "mean") {
+        Filter::apply_mean_filter(input, *work.output, std::stoi(job.args[1]));
+    } else if (op == "gauss") {
+        Filter::apply_gaussian_smoothing(input, *work.output, std::stoi(job.args[1]), std::stof(job.args[2]));
+    } else if (op == "unsharp") {
+        Filter::apply_unsharp_mask(input, *work.output, std::stoi(job.args[1]), std::stof(job.args[2]));
+    } else if (op == "median") {
+        Filter::apply_median_filter(input, *work.output, std::stoi(job.args[1]));
+    } else if (op == "bilateral") {
+        Filter::apply_bilateral_filter(input, *work.output, std::stoi(job.args[1]), std::stof(job.args[2]));
+    } else if (op == "erode" || op == "dilate" || op == "open" || op == "close") {
+        Filter::apply_morphology(input, *work.output, Filter::parse_morphology(op), std::stoi(job.args[1]));
+    } else {
+        work.pipeline->run(input, *work.output);
+        work.pipeline.reset();
+    }
+    frames.give(std::move(work.input));
+}
+
+// Split a manifest line into arguments; "..." keeps spaces and '|' together
+static std::vector<std::string> split_arguments(const std::string& line) {
+    std::vector<std::string> words;
+    std::string word;
+    bool quoted = false, inWord = false;
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (c == '"') {
+            quoted = !quoted;
+            inWord = true;
+        } else if (!quoted && (c == ' ' || c == '\t' || c == '\r')) {
+            if (inWord) words.push_back(word);
+            word.clear();
+            inWord = false;
+        } else {
+            word += c;
+            inWord = true;
+        }
+    }
+    if (quoted) {
+        throw std::invalid_argument("Unterminated quote in: " + line);
+    }
+    if (inWord) words.push_back(word);
+    return words;
+}
+
+Batch Batch::from_manifest(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open manifest " + path);
+    }
+
+    std::vector<BatchJob> jobs;
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number) {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        std::vector<std::string> words = split_arguments(line);
+        BatchJob job;
+        job.operation = words[0];
+        job.args.assign(words.begin() + 1, words.end());
+        job.line = number;
+        jobs.push_back(job);
+    }
+    return Batch(jobs);
+}
+
+std::vector<std::string> Batch::expand_pattern(const std::string& pattern) {
+    std::string expanded = pattern;
+    struct stat info;
+    if (stat(pattern.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+        expanded = pattern + (pattern.empty() || pattern[pattern.size() - 1] == '/' ? "" : "/") + "*.png";
+    }
+
+    glob_t matches;
+    int status = glob(expanded.c_str(), 0, nullptr, &matches);
+    if (status != 0 && status != GLOB_NOMATCH) {
+        throw std::runtime_error("Could not expand " + expanded);
+    }
+
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < (status == 0 ? matches.gl_pathc : 0); ++i) {
+        paths.push_back(matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+    return paths;
+}
+
+Batch Batch::from_glob(const std::string& pattern, const std::string& operation, const std::vector<std::string>& args) {
+    std::vector<BatchJob> jobs;
+    for (const std::string& path : expand_pattern(pattern)) {
+        BatchJob job;
+        job.operation = operation;
+        job.args.push_back(path);
+        job.args.insert(job.args.end(), args.begin(), args.end());
+        job.line = 0;
+        jobs.push_back(job);
+    }
+    return Batch(jobs);
+}
+
+int Batch::run(std::ostream& report, std::ostream& errors) const {
+    // The filter stage gets the shared pool; decode and encode get a share of
+    // threads of their own so the three overlap
+    int threads = ThreadPool::shared().size();
+    int ioThreads = std::max(1, threads / 4);
+    int filterThreads = std::max(1, threads / 2);
+    size_t depth = static_cast<size_t>(threads) + 1;
+
+    BoundedQueue<std::unique_ptr<BatchWork>> toFilter(depth), toEncode(depth);
+    FramePool frames(2 * depth);
+    std::atomic<size_t> nextJob(0);
+    std::atomic<int> completed(0), fromCache(0);
+    std::atomic<long long> decodeNanos(0), filterNanos(0), encodeNanos(0);
+    std::mutex errorMutex;
+    std::vector<std::pair<size_t, std::string>> failures;
+
+    auto fail = [&](const BatchWork& work, const std::exception& e) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        failures.push_back(std::make_pair(static_cast<size_t>(work.job - jobs.data()), std::string(e.what())));
+    };
+    auto since = [](Clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    };
+
+    Clock::time_point wallStart = Clock::now();
+    std::vector<std::thread> decoders, filters, encoders;
+    std::atomic<int> decodersLeft(ioThreads), filtersLeft(filterThreads);
+
+    for (int t = 0; t < ioThreads; ++t) {
+        decoders.push_back(std::thread([&] {
+            size_t index;
+            while ((index = nextJob++) < jobs.size()) {
+                std::unique_ptr<BatchWork> work(new BatchWork());
+                work->job = &jobs[index];
+                Clock::time_point start = Clock::now();
+                bool cached;
+                try {
+                    cached = decode(*work, cache);
+                } catch (const std::exception& e) {
+                    fail(*work, e);
+                    continue;
+                }
+                decodeNanos += since(start);
+                if (cached) {
+                    ++completed;
+                    ++fromCache;
+                    frames.give(std::move(work->input));
+                    frames.give(std::move(work->operand));
+                    continue;
+                }
+                toFilter.push(std::move(work));
+            }
+            if (--decodersLeft == 0) toFilter.close();
+        }));
+    }
+    for (int t = 0; t < filterThreads; ++t) {
+        filters.push_back(std::thread([&] {
+            std::unique_ptr<BatchWork> work;
+            while (toFilter.pop(work)) {
+                Clock::time_point start = Clock::now();
+                try {
+                    filter(*work, frames);
+                } catch (const std::exception& e) {
+                    fail(*work, e);
+                    frames.give(std::move(work->input));
+                    frames.give(std::move(work->output));
+                    continue;
+                }
+                filterNanos += since(start);
+                toEncode.push(std::move(work));
+            }
+            if (--filtersLeft == 0) toEncode.close();
+        }));
+    }
+    for (int t = 0; t < ioThreads; ++t) {
+        encoders.push_back(std::thread([&] {
+            std::unique_ptr<BatchWork> work;
+            while (toEncode.pop(work)) {
+                Clock::time_point start = Clock::now();
+                try {
+                    work->output->save_to_file(work->outputPath.c_str());
+                    if (cache) cache->store(work->cacheKey, work->outputPath);
+                    encodeNanos += since(start);
+                    ++completed;
+                } catch (const std::exception& e) {
+                    fail(*work, e);
+                }
+                frames.give(std::move(work->output));
+            }
+        }));
+    }
+
+    for (size_t i = 0; i < decoders.size(); ++i) decoders[i].join();
+    for (size_t i = 0; i < filters.size(); ++i) filters[i].join();
+    for (size_t i = 0; i < encoders.size(); ++i) encoders[i].join();
+    double wall = std::chrono::duration<double>(Clock::now() - wallStart).count();
+
+    std::sort(failures.begin(), failures.end());
+    for (size_t i = 0; i < failures.size(); ++i) {
+        const BatchJob& job = jobs[failures[i].first];
+        errors << "Error: ";
+        if (job.line > 0) {
+            errors << "line " << job.line << ": ";
+        } else if (!job.args.empty()) {
+            errors << job.args[0] << ": ";
+        }
+        errors << failures[i].second << std::endl;
+    }
+
+    // Stage times are summed over all threads, so they can add up to more than the wall time
+    int done = completed.load();
+    auto stage = [&](const char* name, long long nanos) {
+        double seconds = nanos / 1e9;
+        report << "  " << std::left << std::setw(8) << name << std::right << std::fixed << std::setprecision(3)
+               << seconds << " s total, " << std::setprecision(2) << (done > 0 ? 1000.0 * seconds / done : 0.0)
+               << " ms/image" << std::endl;
+    };
+    report << "Batch: " << jobs.size() << " jobs, " << done << " done";
+    if (cache) report << " (" << fromCache.load() << " from cache)";
+    report << ", " << failures.size() << " failed, "
+           << std::fixed << std::setprecision(3) << wall << " s, " << std::setprecision(1)
+           << (wall > 0 ? done / wall : 0.0) << " images/sec on " << threads << (threads == 1 ? " thread" : " threads") << std::endl;
+    stage("decode", decodeNanos.load());
+    stage("filter", filterNanos.load());
+    stage("encode", encodeNanos.load());
+
+    return static_cast<int>(failures.size());
+}
@@ -0,0 +1,67 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+class ResultCache;
+
+// One image operation, written like a clearvision command line without the
+// program name, e.g. {"gauss", {"a.png", "5", "1.2"}}
+struct BatchJob {
+    std::string operation;
+    std::vector<std::string> args;
+    int line;  // Manifest line, for error messages (0 if not from a manifest)
+};
+
+// Runs many image jobs in one process. Jobs flow through three stages that
+// work concurrently: decode (load the inputs), filter (on the shared thread
+// pool) and encode (write the PNG). Bounded queues between the stages keep
+// only a handful of jobs in flight, and frames of finished jobs are recycled
+// as output buffers for later ones of the same size.
+//
+// Supported operations and the files they write (next to the input):
+//   mean <img> <kernel_size>            mean_filtered_<img>_<k>.png
+//   gauss <img> <kernel_size> <sigma>   gaussian_filtered_<img>_<k>_<sigma>.png
+//   unsharp <img> <kernel_size> <amt>   unsharp_filtered_<img>_<k>_<amount>.png
+//   median <img> <kernel_size>          median_filtered_<img>_<k>.png
+//   bilateral <img> <k> <sigma_range>   bilateral_filtered_<img>_<k>_<sigma>.png
+//   erode|dilate|open|close <img> <k>   erode_filtered_<img>_<k>.png, ...
+//   pipeline <img> <stages> [<out>]     <out>, or pipeline_<img>.png
+//   add <img1> <img2>                   added_<img1>_<img2>.png
+//   sub <img1> <img2>                   subtracted_<img1>_<img2>.png
+//
+// With a result cache, a job whose result is stored there is finished by the
+// decode stage: the file is copied and the job skips filter and encode.
+class Batch {
+private:
+    std::vector<BatchJob> jobs;
+    ResultCache* cache;
+
+public:
+    explicit Batch(const std::vector<BatchJob>& jobs) : jobs(jobs), cache(nullptr) {}
+
+    // One job per line; blank lines and lines starting with '#' are skipped.
+    // Arguments are separated by whitespace and may be wrapped in double quotes.
+    static Batch from_manifest(const std::string& path);
+
+    // Files matching a glob pattern, or every .png in a directory, in sorted order
+    static std::vector<std::string> expand_pattern(const std::string& pattern);
+
+    // The same job for every file matching a glob pattern (or every .png in a
+    // directory); the file becomes the first argument
+    static Batch from_glob(const std::string& pattern, const std::string& operation,
+                           const std::vector<std::string>& args);
+
+    int size() const { return static_cast<int>(jobs.size()); }
+
+    // Look results up in (and add them to) `cache`; nullptr for none
+    void set_cache(ResultCache* cache) { this->cache = cache; }
+
+    // Run every job, print failures to `errors` and a timing summary to
+    // `report`. Returns the number of failed jobs.
+    int run(std::ostream& report, std::ostream& errors) const;
+};
+
+#endif // BATCH_H
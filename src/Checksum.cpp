@@ -0,0 +1,152 @@
+#include "Checksum.h"
+
+// Slicing-by-4 tables: table[0] is the classic byte table, table[k] advances
+// a byte that sits k positions further back in a 4-byte word.
+struct Crc32Tables {
+    uint32_t table[4][256];
+
+    Crc32Tables() {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+            table[0][n] = c;
+        }
+        for (uint32_t n = 0; n < 256; ++n) {
+            for (int k = 1; k < 4; ++k) {
+                table[k][n] = (table[k - 1][n] >> 8) ^ table[0][table[k - 1][n] & 0xFF];
+            }
+        }
+    }
+};
+
+uint32_t Checksum::crc32(const unsigned char* data, std::size_t length, uint32_t crc) {
+    static const Crc32Tables tables;
+    const uint32_t (*t)[256] = tables.table;
+
+    crc = ~crc;
+    while (length >= 4) {
+        crc ^= static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+               (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+        crc = t[3][crc & 0xFF] ^ t[2][(crc >> 8) & 0xFF] ^ t[1][(crc >> 16) & 0xFF] ^ t[0][crc >> 24];
+        data += 4;
+        length -= 4;
+    }
+    while (length-- > 0) {
+        crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+uint32_t Checksum::adler32(const unsigned char* data, std::size_t length, uint32_t adler) {
+    const uint32_t BASE = 65521;
+    // Largest n such that 255 n (n + 1) / 2 + (n + 1)(BASE - 1) fits in 32 bits
+    const std::size_t NMAX = 5552;
+
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+    while (length > 0) {
+        std::size_t n = length < NMAX ? length : NMAX;
+        length -= n;
+        while (n-- > 0) {
+            a += *data++;
+            b += a;
+        }
+        a %= BASE;
+        b %= BASE;
+    }
+    return (b << 16) | a;
+}
+
+// With A = 1 + sum of bytes and B = sum of the A's after each byte, appending
+// n bytes adds A2 - 1 to A and B2 - n + n * A1 to B (all mod BASE)
+uint32_t Checksum::adler32_combine(uint32_t first, uint32_t second, std::size_t secondLength) {
+    const uint32_t BASE = 65521;
+    uint32_t n = static_cast<uint32_t>(secondLength % BASE);
+    uint32_t a1 = first & 0xFFFF, b1 = first >> 16;
+    uint32_t a2 = second & 0xFFFF, b2 = second >> 16;
+    uint32_t a = (a1 + a2 + BASE - 1) % BASE;
+    uint32_t b = static_cast<uint32_t>((b1 + b2 + BASE - n + static_cast<uint64_t>(n) * a1) % BASE);
+    return (b << 16) | a;
+}
+
+// XXH64 primes
+static const uint64_t XXH_PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t XXH_PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t XXH_PRIME3 = 0x165667B19E3779F9ULL;
+static const uint64_t XXH_PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t XXH_PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static uint64_t rotate_left(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Little-endian loads, so the hash is the same on every host
+static uint64_t read64(const unsigned char* p) {
+    uint64_t value = 0;
+    for (int k = 7; k >= 0; --k) value = (value << 8) | p[k];
+    return value;
+}
+
+static uint32_t read32(const unsigned char* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) |
+           (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static uint64_t xxh_round(uint64_t accumulator, uint64_t input) {
+    accumulator += input * XXH_PRIME2;
+    return rotate_left(accumulator, 31) * XXH_PRIME1;
+}
+
+static uint64_t xxh_merge(uint64_t hash, uint64_t accumulator) {
+    hash ^= xxh_round(0, accumulator);
+    return hash * XXH_PRIME1 + XXH_PRIME4;
+}
+
+uint64_t Checksum::xxh64(const unsigned char* data, std::size_t length, uint64_t seed) {
+    const unsigned char* end = data + length;
+    uint64_t hash;
+    if (length >= 32) {
+        // Four independent lanes over 32-byte stripes
+        uint64_t v1 = seed + XXH_PRIME1 + XXH_PRIME2, v2 = seed + XXH_PRIME2, v3 = seed, v4 = seed - XXH_PRIME1;
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = xxh_round(v1, read64(data));
+            v2 = xxh_round(v2, read64(data + 8));
+            v3 = xxh_round(v3, read64(data + 16));
+            v4 = xxh_round(v4, read64(data + 24));
+            data += 32;
+        } while (data <= limit);
+        hash = rotate_left(v1, 1) + rotate_left(v2, 7) + rotate_left(v3, 12) + rotate_left(v4, 18);
+        hash = xxh_merge(hash, v1);
+        hash = xxh_merge(hash, v2);
+        hash = xxh_merge(hash, v3);
+        hash = xxh_merge(hash, v4);
+    } else {
+        hash = seed + XXH_PRIME5;
+    }
+    hash += length;
+
+    for (; data + 8 <= end; data += 8) {
+        hash ^= xxh_round(0, read64(data));
+        hash = rotate_left(hash, 27) * XXH_PRIME1 + XXH_PRIME4;
+    }
+    if (data + 4 <= end) {
+        hash ^= read32(data) * XXH_PRIME1;
+        hash = rotate_left(hash, 23) * XXH_PRIME2 + XXH_PRIME3;
+        data += 4;
+    }
+    for (; data < end; ++data) {
+        hash ^= *data * XXH_PRIME5;
+        hash = rotate_left(hash, 11) * XXH_PRIME1;
+    }
+
+    // Avalanche
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
@@ -0,0 +1,25 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <stdint.h>
+
+class Checksum {
+public:
+    // CRC-32 (IEEE 802.3, as used by zlib and PNG). Pass the previous result
+    // as `crc` to continue a running checksum over several buffers.
+    static uint32_t crc32(const unsigned char* data, std::size_t length, uint32_t crc = 0);
+
+    // Adler-32 (the zlib stream checksum); continue a running checksum the same way
+    static uint32_t adler32(const unsigned char* data, std::size_t length, uint32_t adler = 1);
+
+    // Adler-32 of two buffers back to back, from the checksum of each and the
+    // length of the second, so pieces can be checksummed in parallel
+    static uint32_t adler32_combine(uint32_t first, uint32_t second, std::size_t secondLength);
+
+    // 64-bit XXH64 hash (not cryptographic: for telling contents apart and
+    // deduplicating, not for resisting a forger)
+    static uint64_t xxh64(const unsigned char* data, std::size_t length, uint64_t seed = 0);
+};
+
+#endif // CHECKSUM_H
@@ -0,0 +1,235 @@
+#include "ColorImage.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "stb_image.h"
+#include <climits>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+static bool starts_with_pgm_magic(const char* filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[2];
+    return file.read(magic, 2) && magic[0] == 'P' && magic[1] == '5';
+}
+
+// stb_image at 8 bits for 8-bit pixels and 16 for the others, keeping the file's channels
+template <typename Pixel>
+static void* stb_load_file(const char* filename, int& w, int& h, int& channels) {
+    if (PixelTraits<Pixel>::BITS == 8) {
+        return stbi_load(filename, &w, &h, &channels, STBI_default);
+    }
+    return stbi_load_16(filename, &w, &h, &channels, STBI_default);
+}
+
+template <typename Pixel>
+static void* stb_load_memory(const unsigned char* bytes, int size, int& w, int& h, int& channels) {
+    if (PixelTraits<Pixel>::BITS == 8) {
+        return stbi_load_from_memory(bytes, size, &w, &h, &channels, STBI_default);
+    }
+    return stbi_load_16_from_memory(bytes, size, &w, &h, &channels, STBI_default);
+}
+
+// Channel c of packed, interleaved samples into one plane, rescaled to the pixel type
+template <typename Pixel, typename Sample>
+static void deinterleave(const Sample* samples, int channels, int c, BasicGrayscaleImage<Pixel>& plane) {
+    int w = plane.get_width();
+    for (int i = 0; i < plane.get_height(); ++i) {
+        const Sample* in = samples + static_cast<std::size_t>(i) * w * channels + c;
+        Pixel* out = plane.row(i);
+        for (int j = 0; j < w; ++j) {
+            out[j] = convert_pixel<Pixel>(in[static_cast<std::size_t>(j) * channels]);
+        }
+    }
+}
+
+template <typename Pixel>
+void BasicColorImage<Pixel>::adopt_interleaved(const void* samples, int w, int h, int channels) {
+    if (channels < 1 || channels > MAX_CHANNELS) {
+        throw std::runtime_error("Unsupported number of channels: " + std::to_string(channels));
+    }
+    planes.clear();
+    for (int c = 0; c < channels; ++c) {
+        planes.emplace_back(w, h);
+    }
+    // One plane per task; each writes only its own buffer
+    ThreadPool::shared().parallel_for(channels, [&](int c) {
+        if (PixelTraits<Pixel>::BITS == 8) {
+            deinterleave(static_cast<const unsigned char*>(samples), channels, c, planes[c]);
+        } else {
+            deinterleave(static_cast<const uint16_t*>(samples), channels, c, planes[c]);
+        }
+    });
+}
+
+// Constructor: load from a file
+template <typename Pixel>
+BasicColorImage<Pixel>::BasicColorImage(const char* filename) {
+    TRACE_SCOPE(scope, "load.color");
+    if (starts_with_pgm_magic(filename)) {
+        planes.push_back(BasicGrayscaleImage<Pixel>(filename));
+    } else {
+        int w, h, channels;
+        void* samples = stb_load_file<Pixel>(filename, w, h, channels);
+        if (samples == nullptr) {
+            throw std::runtime_error(std::string("Could not load image ") + filename);
+        }
+        try {
+            adopt_interleaved(samples, w, h, channels);
+        } catch (...) {
+            stbi_image_free(samples);
+            throw;
+        }
+        stbi_image_free(samples);
+    }
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(get_width()) * get_height() * get_channels() * sizeof(Pixel),
+                 static_cast<uint64_t>(get_width()) * get_height());
+}
+
+template <typename Pixel>
+BasicColorImage<Pixel>::BasicColorImage(int w, int h, int channels) {
+    if (channels < 1 || channels > MAX_CHANNELS) {
+        throw std::invalid_argument("Images have 1 to 4 channels.");
+    }
+    for (int c = 0; c < channels; ++c) {
+        planes.emplace_back(w, h);
+    }
+}
+
+template <typename Pixel>
+BasicColorImage<Pixel>::BasicColorImage(BasicGrayscaleImage<Pixel> grey) {
+    planes.push_back(std::move(grey));
+}
+
+template <typename Pixel>
+bool BasicColorImage<Pixel>::operator==(const BasicColorImage& other) const {
+    return planes == other.planes;
+}
+
+template <typename Pixel>
+BasicColorImage<Pixel> BasicColorImage<Pixel>::decode(const unsigned char* bytes, std::size_t size) {
+    TRACE_SCOPE(scope, "decode.color");
+    if (size >= 2 && bytes[0] == 'P' && bytes[1] == '5') {
+        return BasicColorImage(BasicGrayscaleImage<Pixel>::decode(bytes, size));
+    }
+    if (size > static_cast<std::size_t>(INT_MAX)) {
+        throw std::runtime_error("Encoded image too large to decode");
+    }
+    int w, h, channels;
+    void* samples = stb_load_memory<Pixel>(bytes, static_cast<int>(size), w, h, channels);
+    if (samples == nullptr) {
+        throw std::runtime_error("Could not decode image from memory");
+    }
+    BasicColorImage image(0, 0, 1);
+    try {
+        image.adopt_interleaved(samples, w, h, channels);
+    } catch (...) {
+        stbi_image_free(samples);
+        throw;
+    }
+    stbi_image_free(samples);
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(w) * h * channels * sizeof(Pixel), static_cast<uint64_t>(w) * h);
+    return image;
+}
+
+// The planes handed to the PNG encoder must all be there and share a size
+template <typename Pixel>
+static void check_planes(const std::vector<BasicGrayscaleImage<Pixel>>& planes) {
+    for (const BasicGrayscaleImage<Pixel>& plane : planes) {
+        if (plane.get_width() != planes[0].get_width() || plane.get_height() != planes[0].get_height()) {
+            throw std::invalid_argument("All channels of an image must have the same dimensions.");
+        }
+        if (plane.get_data() == nullptr) {
+            throw std::runtime_error("Pixel data is not initialized.");
+        }
+    }
+}
+
+// PNG at the pixel type's depth, float going out as 16-bit like grey images.
+// Planes with a stride of their own (e.g. wrapped buffers) are copied first.
+template <typename Pixel>
+static void encode_planes_png(const std::vector<BasicGrayscaleImage<Pixel>>& planes, const PngEncoder::Options& png,
+                              PngEncoder::Writer output) {
+    check_planes(planes);
+    int channels = static_cast<int>(planes.size());
+    int w = planes[0].get_width(), h = planes[0].get_height();
+    if (PixelTraits<Pixel>::INTEGRAL) {
+        std::vector<BasicGrayscaleImage<Pixel>> copies;
+        const std::vector<BasicGrayscaleImage<Pixel>>* source = &planes;
+        for (const BasicGrayscaleImage<Pixel>& plane : planes) {
+            if (plane.get_stride() != planes[0].get_stride()) {
+                copies.assign(planes.begin(), planes.end());
+                source = &copies;
+                break;
+            }
+        }
+        const Pixel* pointers[4];
+        for (int c = 0; c < channels; ++c) {
+            pointers[c] = (*source)[c].get_data();
+        }
+        if (PixelTraits<Pixel>::BITS == 8) {
+            PngEncoder::encode_planes(reinterpret_cast<const unsigned char* const*>(pointers), channels, w, h,
+                                      (*source)[0].get_stride(), png, output);
+        } else {
+            PngEncoder::encode_planes(reinterpret_cast<const uint16_t* const*>(pointers), channels, w, h,
+                                      (*source)[0].get_stride(), png, output);
+        }
+        return;
+    }
+    std::vector<GrayscaleImage16> wide(channels, GrayscaleImage16(0, 0));
+    ThreadPool::shared().parallel_for(channels, [&](int c) {
+        wide[c] = planes[c].template convert<uint16_t>();
+    });
+    const uint16_t* pointers[4];
+    for (int c = 0; c < channels; ++c) {
+        pointers[c] = wide[c].get_data();
+    }
+    PngEncoder::encode_planes(pointers, channels, w, h, wide[0].get_stride(), png, output);
+}
+
+template <typename Pixel>
+std::vector<unsigned char> BasicColorImage<Pixel>::encode(GrayscaleImageBase::Format format,
+                                                          const PngEncoder::Options& png) const {
+    if (format == GrayscaleImageBase::PGM) {
+        if (planes.size() != 1) {
+            throw std::invalid_argument("PGM holds one channel; save colour images as PNG.");
+        }
+        return planes[0].encode(format, png);
+    }
+    TRACE_SCOPE(scope, "encode.color");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(get_width()) * get_height() * get_channels() * sizeof(Pixel),
+                 static_cast<uint64_t>(get_width()) * get_height());
+    std::vector<unsigned char> bytes;
+    encode_planes_png(planes, png, [&bytes](const unsigned char* chunk, size_t length) {
+        bytes.insert(bytes.end(), chunk, chunk + length);
+    });
+    return bytes;
+}
+
+template <typename Pixel>
+void BasicColorImage<Pixel>::save_to_file(const char* filename, const PngEncoder::Options& png) const {
+    if (GrayscaleImageBase::format_for(filename) == GrayscaleImageBase::PGM) {
+        if (planes.size() != 1) {
+            throw std::invalid_argument("PGM holds one channel; save colour images as PNG.");
+        }
+        planes[0].save_to_file(filename, png);
+        return;
+    }
+    TRACE_SCOPE(scope, "save.color");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(get_width()) * get_height() * get_channels() * sizeof(Pixel),
+                 static_cast<uint64_t>(get_width()) * get_height());
+
+    std::ofstream file(filename, std::ios::binary);
+    encode_planes_png(planes, png, [&file](const unsigned char* chunk, size_t length) {
+        file.write(reinterpret_cast<const char*>(chunk), static_cast<std::streamsize>(length));
+    });
+    file.close();
+    if (!file) {
+        throw std::runtime_error(std::string("Could not save image to file ") + filename);
+    }
+}
+
+template class BasicColorImage<unsigned char>;
+template class BasicColorImage<uint16_t>;
+template class BasicColorImage<float>;
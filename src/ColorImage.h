@@ -0,0 +1,73 @@
+#ifndef COLOR_IMAGE_H
+#define COLOR_IMAGE_H
+
+#include "GrayscaleImage.h"
+#include <cstddef>
+#include <vector>
+
+// An image with 1 to 4 channels stored as planes: one BasicGrayscaleImage per
+// channel (structure of arrays), so every grey filter and kernel runs on a
+// channel unchanged. Channel counts follow PNG: 1 grey, 2 grey + alpha,
+// 3 RGB, 4 RGBA. Instantiated in ColorImage.cpp for the same pixel types as
+// BasicGrayscaleImage.
+template <typename Pixel>
+class BasicColorImage {
+private:
+    std::vector<BasicGrayscaleImage<Pixel>> planes;
+
+    // Split samples stb_image decoded (channels interleaved, rows packed) into planes
+    void adopt_interleaved(const void* samples, int w, int h, int channels);
+
+public:
+    static const int MAX_CHANNELS = 4;
+
+    // Constructor: loads an image with the channels it has. PNG goes through
+    // stb_image, binary PGM becomes one grey plane. Throws std::runtime_error
+    // if it can't be read.
+    BasicColorImage(const char* filename);
+
+    // Constructor: a black image; throws std::invalid_argument for a channel count outside 1..4
+    BasicColorImage(int w, int h, int channels);
+
+    // Constructor: a single grey plane, taking over the image
+    explicit BasicColorImage(BasicGrayscaleImage<Pixel> grey);
+
+    int get_width() const { return planes[0].get_width(); }
+    int get_height() const { return planes[0].get_height(); }
+    int get_channels() const { return static_cast<int>(planes.size()); }
+
+    // Whether the last channel is alpha (2 and 4 channels)
+    bool has_alpha() const { return planes.size() == 2 || planes.size() == 4; }
+
+    // The channels that hold colour, i.e. all but alpha; filters touch only these
+    int color_channels() const { return get_channels() - (has_alpha() ? 1 : 0); }
+
+    // Channel c as a grey image
+    BasicGrayscaleImage<Pixel>& plane(int c) { return planes[c]; }
+    const BasicGrayscaleImage<Pixel>& plane(int c) const { return planes[c]; }
+
+    bool operator==(const BasicColorImage& other) const;
+
+    // Write the image to a file: PNG of the matching colour type, or PGM for
+    // names ending in .pgm, which only holds one channel (std::invalid_argument
+    // otherwise). Throws std::runtime_error on failure.
+    void save_to_file(const char* filename, const PngEncoder::Options& png = PngEncoder::defaults()) const;
+
+    // Decode an image held in memory (PNG or PGM, told apart by content).
+    // Throws std::runtime_error if it can't be decoded.
+    static BasicColorImage decode(const unsigned char* bytes, std::size_t size);
+
+    // Encode the image into memory; PGM as for save_to_file
+    std::vector<unsigned char> encode(GrayscaleImageBase::Format format = GrayscaleImageBase::PNG,
+                                      const PngEncoder::Options& png = PngEncoder::defaults()) const;
+};
+
+typedef BasicColorImage<unsigned char> ColorImage;
+typedef BasicColorImage<uint16_t> ColorImage16;
+typedef BasicColorImage<float> ColorImageF;
+
+extern template class BasicColorImage<unsigned char>;
+extern template class BasicColorImage<uint16_t>;
+extern template class BasicColorImage<float>;
+
+#endif // COLOR_IMAGE_H
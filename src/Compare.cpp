@@ -0,0 +1,377 @@
+#include "Compare.h"
+#include "Checksum.h"
+#include "FilterKernels.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CLEARVISION_X86_SIMD 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Smallest band worth scheduling for the row-by-row checks
+static const int MIN_BAND_ROWS = 32;
+
+// SSIM works on BLOCK x BLOCK squares
+static const int BLOCK = 8;
+
+// The planes of one image, grey images having a single one
+template <typename Pixel>
+using Planes = std::vector<const BasicGrayscaleImage<Pixel>*>;
+
+template <typename Pixel>
+static Planes<Pixel> planes_of(const BasicGrayscaleImage<Pixel>& image) {
+    return Planes<Pixel>(1, &image);
+}
+
+template <typename Pixel>
+static Planes<Pixel> planes_of(const BasicColorImage<Pixel>& image) {
+    Planes<Pixel> planes;
+    for (int c = 0; c < image.get_channels(); ++c) {
+        planes.push_back(&image.plane(c));
+    }
+    return planes;
+}
+
+template <typename Pixel>
+static bool same_shape(const Planes<Pixel>& a, const Planes<Pixel>& b) {
+    return a.size() == b.size() && a[0]->get_width() == b[0]->get_width() && a[0]->get_height() == b[0]->get_height();
+}
+
+// ---------------------------------------------------------------------------
+// Largest difference along a row
+// ---------------------------------------------------------------------------
+
+template <typename Pixel>
+static double max_abs_diff_row(const Pixel* a, const Pixel* b, int width) {
+    double largest = 0.0;
+    for (int j = 0; j < width; ++j) {
+        largest = std::max(largest, std::fabs(static_cast<double>(a[j]) - static_cast<double>(b[j])));
+    }
+    return largest;
+}
+
+static int max_abs_diff_scalar(const unsigned char* a, const unsigned char* b, int width) {
+    int largest = 0;
+    for (int j = 0; j < width; ++j) {
+        largest = std::max(largest, std::abs(a[j] - b[j]));
+    }
+    return largest;
+}
+
+#ifdef CLEARVISION_X86_SIMD
+
+// |a - b| of unsigned bytes as the larger of the two saturating differences
+TARGET_SSE2
+static int max_abs_diff_sse2(const unsigned char* a, const unsigned char* b, int width) {
+    __m128i largest = _mm_setzero_si128();
+    int j = 0;
+    for (; j + 16 <= width; j += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + j));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+        largest = _mm_max_epu8(largest, _mm_or_si128(_mm_subs_epu8(x, y), _mm_subs_epu8(y, x)));
+    }
+    unsigned char lanes[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), largest);
+    int result = *std::max_element(lanes, lanes + 16);
+    return std::max(result, max_abs_diff_scalar(a + j, b + j, width - j));
+}
+
+TARGET_AVX2
+static int max_abs_diff_avx2(const unsigned char* a, const unsigned char* b, int width) {
+    __m256i largest = _mm256_setzero_si256();
+    int j = 0;
+    for (; j + 32 <= width; j += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + j));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+        largest = _mm256_max_epu8(largest, _mm256_or_si256(_mm256_subs_epu8(x, y), _mm256_subs_epu8(y, x)));
+    }
+    unsigned char lanes[32];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), largest);
+    int result = *std::max_element(lanes, lanes + 32);
+    return std::max(result, max_abs_diff_scalar(a + j, b + j, width - j));
+}
+
+#endif
+
+static double max_abs_diff_row(const unsigned char* a, const unsigned char* b, int width) {
+    switch (FilterKernels::simd_level()) {
+#ifdef CLEARVISION_X86_SIMD
+    case FilterKernels::SIMD_AVX2:
+        return max_abs_diff_avx2(a, b, width);
+    case FilterKernels::SIMD_SSE2:
+        return max_abs_diff_sse2(a, b, width);
+#endif
+    default:
+        return max_abs_diff_scalar(a, b, width);
+    }
+}
+
+// Whether row_ok(a, b, i) holds for every row of every plane pair, stopping
+// all bands at the first row that fails
+template <typename Pixel, typename RowCheck>
+static bool all_rows(const Planes<Pixel>& a, const Planes<Pixel>& b, RowCheck row_ok) {
+    std::atomic<bool> failed(false);
+    ThreadPool::shared().parallel_bands(a[0]->get_height(), MIN_BAND_ROWS, [&](int first, int last) {
+        for (int i = first; i < last && !failed.load(std::memory_order_relaxed); ++i) {
+            for (size_t c = 0; c < a.size(); ++c) {
+                if (!row_ok(a[c]->row(i), b[c]->row(i))) {
+                    failed.store(true, std::memory_order_relaxed);
+                    return;
+                }
+            }
+        }
+    });
+    return !failed.load();
+}
+
+template <typename Pixel>
+static bool equal_planes(const Planes<Pixel>& a, const Planes<Pixel>& b) {
+    if (!same_shape(a, b)) return false;
+    TRACE_SCOPE(scope, "compare.equal");
+    std::size_t bytes = static_cast<std::size_t>(a[0]->get_width()) * sizeof(Pixel);
+    return all_rows(a, b, [bytes](const Pixel* x, const Pixel* y) {
+        return std::memcmp(x, y, bytes) == 0;
+    });
+}
+
+template <typename Pixel>
+static bool planes_within(const Planes<Pixel>& a, const Planes<Pixel>& b, double tolerance) {
+    if (!(tolerance >= 0.0)) {
+        throw std::invalid_argument("Tolerance must not be negative.");
+    }
+    if (!same_shape(a, b)) return false;
+    TRACE_SCOPE(scope, "compare.within");
+    int width = a[0]->get_width();
+    return all_rows(a, b, [width, tolerance](const Pixel* x, const Pixel* y) {
+        return max_abs_diff_row(x, y, width) <= tolerance;
+    });
+}
+
+// ---------------------------------------------------------------------------
+// Metrics
+// ---------------------------------------------------------------------------
+
+// Totals over one row of SSIM blocks
+struct BlockRowTotals {
+    uint64_t differing = 0;
+    double maxAbsDiff = 0.0;
+    double squared = 0.0;
+    double ssim = 0.0;
+    int blocks = 0;
+};
+
+// SSIM of one block from its sums (Wang et al. 2004, with K1 = 0.01 and K2 = 0.03)
+static double block_ssim(double n, double sx, double sy, double sxx, double syy, double sxy, double white) {
+    const double c1 = (0.01 * white) * (0.01 * white);
+    const double c2 = (0.03 * white) * (0.03 * white);
+    double mx = sx / n, my = sy / n;
+    double vx = sxx / n - mx * mx, vy = syy / n - my * my, cxy = sxy / n - mx * my;
+    return ((2 * mx * my + c1) * (2 * cxy + c2)) / ((mx * mx + my * my + c1) * (vx + vy + c2));
+}
+
+// Differences and SSIM sums of rows [top, bottom) of one plane pair. Rows are
+// accumulated into per-column sums CHUNK columns at a time (local arrays the
+// compiler can vectorize over), which are then added up block by block.
+// Integer pixels sum exactly in PixelTraits::Sum.
+template <typename Pixel>
+static void block_row_totals(const BasicGrayscaleImage<Pixel>& a, const BasicGrayscaleImage<Pixel>& b, int top, int bottom,
+                             BlockRowTotals& totals) {
+    typedef typename PixelTraits<Pixel>::Sum Sum;
+    const int CHUNK = 8 * BLOCK;
+    int width = a.get_width();
+    for (int start = 0; start < width; start += CHUNK) {
+        int count = std::min(CHUNK, width - start);
+        Sum sx[CHUNK] = {}, sy[CHUNK] = {}, sxx[CHUNK] = {}, syy[CHUNK] = {}, sxy[CHUNK] = {};
+        Sum squared[CHUNK] = {}, largest[CHUNK] = {}, differing[CHUNK] = {};
+        for (int i = top; i < bottom; ++i) {
+            const Pixel* x = a.row(i) + start;
+            const Pixel* y = b.row(i) + start;
+            for (int j = 0; j < count; ++j) {
+                Sum u = x[j], v = y[j], d = u - v;
+                Sum distance = d < 0 ? -d : d;
+                sx[j] += u;
+                sy[j] += v;
+                sxx[j] += u * u;
+                syy[j] += v * v;
+                sxy[j] += u * v;
+                squared[j] += d * d;
+                largest[j] = largest[j] < distance ? distance : largest[j];
+                differing[j] += d != 0;
+            }
+        }
+
+        for (int left = 0; left < count; left += BLOCK) {
+            int right = std::min(left + BLOCK, count);
+            Sum bx = 0, by = 0, bxx = 0, byy = 0, bxy = 0, blockSquared = 0, blockLargest = 0, blockDiffering = 0;
+            for (int j = left; j < right; ++j) {
+                bx += sx[j];
+                by += sy[j];
+                bxx += sxx[j];
+                byy += syy[j];
+                bxy += sxy[j];
+                blockSquared += squared[j];
+                blockLargest = std::max(blockLargest, largest[j]);
+                blockDiffering += differing[j];
+            }
+            totals.differing += static_cast<uint64_t>(blockDiffering);
+            totals.maxAbsDiff = std::max(totals.maxAbsDiff, static_cast<double>(blockLargest));
+            totals.squared += static_cast<double>(blockSquared);
+            double n = static_cast<double>(right - left) * (bottom - top);
+            totals.ssim += block_ssim(n, static_cast<double>(bx), static_cast<double>(by), static_cast<double>(bxx),
+                                      static_cast<double>(byy), static_cast<double>(bxy), PixelTraits<Pixel>::white());
+            ++totals.blocks;
+        }
+    }
+}
+
+template <typename Pixel>
+static Compare::Metrics planes_metrics(const Planes<Pixel>& a, const Planes<Pixel>& b) {
+    if (!same_shape(a, b)) {
+        throw std::invalid_argument("Images must have the same dimensions and channels to be compared.");
+    }
+    int width = a[0]->get_width(), height = a[0]->get_height();
+    TRACE_SCOPE(scope, "compare.metrics");
+    uint64_t samples = static_cast<uint64_t>(width) * height * a.size();
+    TRACE_AMOUNT(scope, 2 * samples * sizeof(Pixel), samples);
+
+    // One slot per row of blocks, summed in order afterwards so the result
+    // is the same for any thread count
+    int blockRows = (height + BLOCK - 1) / BLOCK;
+    std::vector<BlockRowTotals> rows(blockRows);
+    ThreadPool::shared().parallel_bands(blockRows, std::max(1, MIN_BAND_ROWS / BLOCK), [&](int first, int last) {
+        for (int r = first; r < last; ++r) {
+            for (size_t c = 0; c < a.size(); ++c) {
+                block_row_totals(*a[c], *b[c], r * BLOCK, std::min((r + 1) * BLOCK, height), rows[r]);
+            }
+        }
+    });
+
+    BlockRowTotals total;
+    for (const BlockRowTotals& row : rows) {
+        total.differing += row.differing;
+        total.maxAbsDiff = std::max(total.maxAbsDiff, row.maxAbsDiff);
+        total.squared += row.squared;
+        total.ssim += row.ssim;
+        total.blocks += row.blocks;
+    }
+
+    Compare::Metrics metrics;
+    metrics.differing = total.differing;
+    metrics.maxAbsDiff = total.maxAbsDiff;
+    metrics.mse = samples > 0 ? total.squared / samples : 0.0;
+    double white = PixelTraits<Pixel>::white();
+    metrics.psnr = metrics.mse > 0 ? 10.0 * std::log10(white * white / metrics.mse) : std::numeric_limits<double>::infinity();
+    metrics.ssim = total.blocks > 0 ? total.ssim / total.blocks : 1.0;
+    return metrics;
+}
+
+// ---------------------------------------------------------------------------
+// Hash
+// ---------------------------------------------------------------------------
+
+static void put_u64(std::vector<unsigned char>& bytes, uint64_t value) {
+    for (int k = 0; k < 8; ++k) {
+        bytes.push_back(static_cast<unsigned char>(value >> (8 * k)));
+    }
+}
+
+// Rows are hashed in parallel, then the header and row hashes together
+template <typename Pixel>
+static uint64_t hash_planes(const Planes<Pixel>& planes) {
+    int width = planes[0]->get_width(), height = planes[0]->get_height();
+    TRACE_SCOPE(scope, "hash");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(width) * height * planes.size() * sizeof(Pixel),
+                 static_cast<uint64_t>(width) * height * planes.size());
+
+    std::size_t rowBytes = static_cast<std::size_t>(width) * sizeof(Pixel);
+    std::vector<uint64_t> rowHashes(planes.size() * static_cast<std::size_t>(height));
+    ThreadPool::shared().parallel_bands(height, MIN_BAND_ROWS, [&](int first, int last) {
+        for (size_t c = 0; c < planes.size(); ++c) {
+            for (int i = first; i < last; ++i) {
+                const unsigned char* row = reinterpret_cast<const unsigned char*>(planes[c]->row(i));
+                rowHashes[c * height + i] = Checksum::xxh64(row, rowBytes);
+            }
+        }
+    });
+
+    std::vector<unsigned char> bytes;
+    bytes.reserve(8 * (4 + rowHashes.size()));
+    put_u64(bytes, static_cast<uint64_t>(width));
+    put_u64(bytes, static_cast<uint64_t>(height));
+    put_u64(bytes, planes.size());
+    put_u64(bytes, static_cast<uint64_t>(PixelTraits<Pixel>::BITS));
+    for (uint64_t rowHash : rowHashes) {
+        put_u64(bytes, rowHash);
+    }
+    return Checksum::xxh64(bytes.data(), bytes.size());
+}
+
+// ---------------------------------------------------------------------------
+// Compare
+// ---------------------------------------------------------------------------
+
+template <typename Pixel>
+bool Compare::equal(const BasicGrayscaleImage<Pixel>& a, const BasicGrayscaleImage<Pixel>& b) {
+    return equal_planes(planes_of(a), planes_of(b));
+}
+
+template <typename Pixel>
+bool Compare::equal(const BasicColorImage<Pixel>& a, const BasicColorImage<Pixel>& b) {
+    return equal_planes(planes_of(a), planes_of(b));
+}
+
+template <typename Pixel>
+bool Compare::within(const BasicGrayscaleImage<Pixel>& a, const BasicGrayscaleImage<Pixel>& b, double tolerance) {
+    return planes_within(planes_of(a), planes_of(b), tolerance);
+}
+
+template <typename Pixel>
+bool Compare::within(const BasicColorImage<Pixel>& a, const BasicColorImage<Pixel>& b, double tolerance) {
+    return planes_within(planes_of(a), planes_of(b), tolerance);
+}
+
+template <typename Pixel>
+Compare::Metrics Compare::metrics(const BasicGrayscaleImage<Pixel>& a, const BasicGrayscaleImage<Pixel>& b) {
+    return planes_metrics(planes_of(a), planes_of(b));
+}
+
+template <typename Pixel>
+Compare::Metrics Compare::metrics(const BasicColorImage<Pixel>& a, const BasicColorImage<Pixel>& b) {
+    return planes_metrics(planes_of(a), planes_of(b));
+}
+
+template <typename Pixel>
+uint64_t Compare::hash(const BasicGrayscaleImage<Pixel>& image) {
+    return hash_planes(planes_of(image));
+}
+
+template <typename Pixel>
+uint64_t Compare::hash(const BasicColorImage<Pixel>& image) {
+    return hash_planes(planes_of(image));
+}
+
+// The comparisons for every pixel type
+#define INSTANTIATE_COMPARE(Pixel) \
+    template bool Compare::equal<Pixel>(const BasicGrayscaleImage<Pixel>&, const BasicGrayscaleImage<Pixel>&); \
+    template bool Compare::equal<Pixel>(const BasicColorImage<Pixel>&, const BasicColorImage<Pixel>&); \
+    template bool Compare::within<Pixel>(const BasicGrayscaleImage<Pixel>&, const BasicGrayscaleImage<Pixel>&, double); \
+    template bool Compare::within<Pixel>(const BasicColorImage<Pixel>&, const BasicColorImage<Pixel>&, double); \
+    template Compare::Metrics Compare::metrics<Pixel>(const BasicGrayscaleImage<Pixel>&, const BasicGrayscaleImage<Pixel>&); \
+    template Compare::Metrics Compare::metrics<Pixel>(const BasicColorImage<Pixel>&, const BasicColorImage<Pixel>&); \
+    template uint64_t Compare::hash<Pixel>(const BasicGrayscaleImage<Pixel>&); \
+    template uint64_t Compare::hash<Pixel>(const BasicColorImage<Pixel>&);
+
+INSTANTIATE_COMPARE(unsigned char)
+INSTANTIATE_COMPARE(uint16_t)
+INSTANTIATE_COMPARE(float)
@@ -0,0 +1,57 @@
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include "ColorImage.h"
+#include "GrayscaleImage.h"
+#include <cstdint>
+
+// Image comparison for regression checks: exact equality, equality within a
+// tolerance, "how different" metrics and a content hash. Rows are compared in
+// parallel bands on the shared thread pool; the yes/no checks stop at the
+// first row that settles the answer. Colour images compare plane by plane and
+// must have the same channel count to be equal.
+//
+// Differences are in units of the pixel type: grey levels for 8 and 16 bits,
+// 0.0 to 1.0 for float.
+class Compare {
+public:
+    struct Metrics {
+        uint64_t differing;  // Samples that differ at all
+        double maxAbsDiff;
+        double mse;          // Mean squared difference over all samples
+        double psnr;         // dB against the pixel type's white; infinity when the images are equal
+        double ssim;         // Mean SSIM over 8x8 blocks (clipped at the edges); 1 when equal
+    };
+
+    // Same dimensions and pixels
+    template <typename Pixel>
+    static bool equal(const BasicGrayscaleImage<Pixel>& a, const BasicGrayscaleImage<Pixel>& b);
+    template <typename Pixel>
+    static bool equal(const BasicColorImage<Pixel>& a, const BasicColorImage<Pixel>& b);
+
+    // Same dimensions and no two pixels further apart than `tolerance`;
+    // throws std::invalid_argument for a negative tolerance
+    template <typename Pixel>
+    static bool within(const BasicGrayscaleImage<Pixel>& a, const BasicGrayscaleImage<Pixel>& b, double tolerance);
+    template <typename Pixel>
+    static bool within(const BasicColorImage<Pixel>& a, const BasicColorImage<Pixel>& b, double tolerance);
+
+    // All the metrics in one pass over both images. The result does not depend
+    // on the thread count. Throws std::invalid_argument if the dimensions or
+    // channel counts differ.
+    template <typename Pixel>
+    static Metrics metrics(const BasicGrayscaleImage<Pixel>& a, const BasicGrayscaleImage<Pixel>& b);
+    template <typename Pixel>
+    static Metrics metrics(const BasicColorImage<Pixel>& a, const BasicColorImage<Pixel>& b);
+
+    // 64-bit content hash (XXH64) of the dimensions, channel count, pixel type
+    // and pixels in native byte order, so equal images hash alike whatever
+    // their row stride or the file they came from. A grey image hashes like
+    // the same image with one colour channel.
+    template <typename Pixel>
+    static uint64_t hash(const BasicGrayscaleImage<Pixel>& image);
+    template <typename Pixel>
+    static uint64_t hash(const BasicColorImage<Pixel>& image);
+};
+
+#endif // COMPARE_H
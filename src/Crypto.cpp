@@ -1,106 +1,798 @@
 #include "Crypto.h"
+#include "Checksum.h"
+#include "ColorImage.h"
+#include "FilterKernels.h"
 #include "GrayscaleImage.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include <cstring>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CLEARVISION_X86_BMI2 1
+#include <immintrin.h>
+#define TARGET_BMI2 __attribute__((target("bmi2")))
+#endif
 
+// The lowest bit of each of the 8 pixels held in a 64-bit word
+static const uint64_t LSB_LANES = 0x0101010101010101ULL;
 
-// Extract the least significant bits (LSBs) from SecretImage, calculating x, y based on message length
-std::vector<int> Crypto::extract_LSBits(SecretImage& secret_image, int message_length) {
-    std::vector<int> LSB_array;
-    // Reconstruct the SecretImage to a GrayscaleImage.
-    GrayscaleImage image = secret_image.reconstruct();
+// ---------------------------------------------------------------------------
+// PackedBits
+// ---------------------------------------------------------------------------
 
-    // Calculate the image dimensions.
-    int imageWidth = secret_image.get_width();
-    int imageHeight = secret_image.get_height();
+uint64_t PackedBits::get_bits(std::size_t pos, int n) const {
+    if (n <= 0 || pos >= count) return 0;
+    std::size_t index = pos / 64;
+    int shift = static_cast<int>(pos % 64);
+    uint64_t value = words[index] >> shift;
+    if (shift != 0 && index + 1 < words.size()) {
+        value |= words[index + 1] << (64 - shift);
+    }
+    if (n < 64) value &= (uint64_t(1) << n) - 1;
+    return value;
+}
 
-    // Determine the total bits required based on message length.
-    int total_bits = message_length * 7;
+void PackedBits::append_bits(uint64_t value, int n) {
+    if (n <= 0) return;
+    if (n < 64) value &= (uint64_t(1) << n) - 1;
+    int shift = static_cast<int>(count % 64);
+    if (shift == 0) {
+        words.push_back(value);
+    } else {
+        words.back() |= value << shift;
+        if (shift + n > 64) words.push_back(value >> (64 - shift));
+    }
+    count += n;
+}
 
-    // Ensure the image has enough pixels; if not, throw an error.
-    if (total_bits > imageWidth * imageHeight) {
-        throw std::runtime_error("Not enough pixels in the image to extract the message.");
+void PackedBits::append(const PackedBits& other, std::size_t pos, std::size_t n) {
+    reserve(count + n);
+    for (std::size_t done = 0; done < n; done += 64) {
+        int take = static_cast<int>(std::min<std::size_t>(64, n - done));
+        append_bits(other.get_bits(pos + done, take), take);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Lookup tables
+// ---------------------------------------------------------------------------
+
+// 7-bit values with their bit order reversed: appending reversed[c] lowest bit
+// first emits the bits of c most significant first
+struct Reverse7Table {
+    unsigned char value[128];
+    Reverse7Table() {
+        for (int c = 0; c < 128; ++c) {
+            int r = 0;
+            for (int b = 0; b < 7; ++b) {
+                if (c & (1 << b)) r |= 1 << (6 - b);
+            }
+            value[c] = static_cast<unsigned char>(r);
+        }
+    }
+};
+
+// Byte b spread over 8 pixel lanes: bit k of b becomes the LSB of byte k
+struct SpreadTable {
+    uint64_t value[256];
+    SpreadTable() {
+        for (int b = 0; b < 256; ++b) {
+            uint64_t lanes = 0;
+            for (int k = 0; k < 8; ++k) {
+                if (b & (1 << k)) lanes |= uint64_t(1) << (8 * k);
+            }
+            value[b] = lanes;
+        }
+    }
+};
+
+static const Reverse7Table& reverse7() {
+    static const Reverse7Table table;
+    return table;
+}
+
+static const SpreadTable& spread_table() {
+    static const SpreadTable table;
+    return table;
+}
+
+// ---------------------------------------------------------------------------
+// Pixel runs. Eight pixels are loaded as one little-endian word, so pixel k
+// sits in byte k and matches bit k of the corresponding message byte.
+// ---------------------------------------------------------------------------
+
+static inline uint64_t load_pixels(const unsigned char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline void store_pixels(unsigned char* p, uint64_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    std::memcpy(p, &v, sizeof(v));
+}
+
+// Collect the LSBs of 8 pixels into one byte (pixel k -> bit k). The partial
+// products of the multiply never overlap, so the top byte is exactly the gather.
+static inline uint64_t gather_lsbs(uint64_t pixels) {
+    return ((pixels & LSB_LANES) * 0x0102040810204080ULL) >> 56;
+}
+
+// Set the LSBs of pixels[0, n) to bits[pos, pos + n)
+static void embed_run_portable(unsigned char* pixels, std::size_t n, const PackedBits& bits, std::size_t pos) {
+    const uint64_t* spread = spread_table().value;
+    std::size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t word = bits.get_bits(pos + i, 64);
+        for (int k = 0; k < 8; ++k) {
+            unsigned char* p = pixels + i + 8 * k;
+            store_pixels(p, (load_pixels(p) & ~LSB_LANES) | spread[(word >> (8 * k)) & 0xFF]);
+        }
+    }
+    for (; i + 8 <= n; i += 8) {
+        store_pixels(pixels + i, (load_pixels(pixels + i) & ~LSB_LANES) | spread[bits.get_bits(pos + i, 8)]);
+    }
+    for (; i < n; ++i) {
+        pixels[i] = static_cast<unsigned char>((pixels[i] & ~1) | bits[pos + i]);
+    }
+}
+
+// Append the LSBs of pixels[0, n) to out
+static void extract_run_portable(const unsigned char* pixels, std::size_t n, PackedBits& out) {
+    std::size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t word = 0;
+        for (int k = 0; k < 8; ++k) {
+            word |= gather_lsbs(load_pixels(pixels + i + 8 * k)) << (8 * k);
+        }
+        out.append_bits(word, 64);
     }
+    for (; i + 8 <= n; i += 8) {
+        out.append_bits(gather_lsbs(load_pixels(pixels + i)), 8);
+    }
+    for (; i < n; ++i) {
+        out.append_bits(pixels[i] & 1, 1);
+    }
+}
+
+#ifdef CLEARVISION_X86_BMI2
 
-    // Calculate the starting pixel from the message_length knowing that  
-    //    the last LSB to extract is in the last pixel of the image.
-    int start_pixel = (imageWidth * imageHeight) - total_bits;
+// Same as the portable runs with pdep/pext in place of the table and multiply
+TARGET_BMI2
+static void embed_run_bmi2(unsigned char* pixels, std::size_t n, const PackedBits& bits, std::size_t pos) {
+    std::size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t word = bits.get_bits(pos + i, 64);
+        for (int k = 0; k < 8; ++k) {
+            unsigned char* p = pixels + i + 8 * k;
+            store_pixels(p, (load_pixels(p) & ~LSB_LANES) | _pdep_u64(word >> (8 * k), LSB_LANES));
+        }
+    }
+    for (; i + 8 <= n; i += 8) {
+        store_pixels(pixels + i, (load_pixels(pixels + i) & ~LSB_LANES) | _pdep_u64(bits.get_bits(pos + i, 8), LSB_LANES));
+    }
+    for (; i < n; ++i) {
+        pixels[i] = static_cast<unsigned char>((pixels[i] & ~1) | bits[pos + i]);
+    }
+}
 
-    // Extract LSBs from the image pixels and return the result.
-    for (int i = start_pixel; i < imageWidth * imageHeight; ++i) {
-        int pixelValue = image.get_pixel(i / imageWidth, i % imageWidth);
-        LSB_array.push_back(pixelValue & 1); // Get the LSB
+TARGET_BMI2
+static void extract_run_bmi2(const unsigned char* pixels, std::size_t n, PackedBits& out) {
+    std::size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t word = 0;
+        for (int k = 0; k < 8; ++k) {
+            word |= _pext_u64(load_pixels(pixels + i + 8 * k), LSB_LANES) << (8 * k);
+        }
+        out.append_bits(word, 64);
+    }
+    for (; i + 8 <= n; i += 8) {
+        out.append_bits(_pext_u64(load_pixels(pixels + i), LSB_LANES), 8);
     }
+    for (; i < n; ++i) {
+        out.append_bits(pixels[i] & 1, 1);
+    }
+}
+
+static bool detect_bmi2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2");
+}
+
+#endif
+
+// BMI2 is used when the CPU has it, unless the portable loops are forced (--scalar)
+static bool use_bmi2() {
+#ifdef CLEARVISION_X86_BMI2
+    static const bool supported = detect_bmi2();
+    return supported && FilterKernels::simd_level() != FilterKernels::SIMD_SCALAR;
+#else
+    return false;
+#endif
+}
 
+static void embed_run(unsigned char* pixels, std::size_t n, const PackedBits& bits, std::size_t pos, bool bmi2) {
+#ifdef CLEARVISION_X86_BMI2
+    if (bmi2) return embed_run_bmi2(pixels, n, bits, pos);
+#endif
+    (void)bmi2;
+    embed_run_portable(pixels, n, bits, pos);
+}
+
+static void extract_run(const unsigned char* pixels, std::size_t n, PackedBits& out, bool bmi2) {
+#ifdef CLEARVISION_X86_BMI2
+    if (bmi2) return extract_run_bmi2(pixels, n, out);
+#endif
+    (void)bmi2;
+    extract_run_portable(pixels, n, out);
+}
+
+// Conversions for the one-int-per-bit interface
+static std::vector<int> to_int_bits(const PackedBits& bits) {
+    std::vector<int> LSB_array(bits.size());
+    for (std::size_t i = 0; i < bits.size(); ++i) {
+        LSB_array[i] = bits[i];
+    }
     return LSB_array;
 }
 
+static PackedBits from_int_bits(const std::vector<int>& LSB_array) {
+    PackedBits bits;
+    bits.reserve(LSB_array.size());
+    for (int bit : LSB_array) {
+        bits.append_bits(bit & 1, 1);
+    }
+    return bits;
+}
 
-// Decrypt message by converting LSB array into ASCII characters
-std::string Crypto::decrypt_message(const std::vector<int>& LSB_array) {
-    std::string message;
-    //1. Verify that the LSB array size is a multiple of 7, else throw an error.
-    if (LSB_array.size() % 7 != 0) {
+// ---------------------------------------------------------------------------
+// Packed interface
+// ---------------------------------------------------------------------------
+
+// Pack characters 7 bits each; nine of them fill 63 bits of one append
+PackedBits Crypto::pack_message(const unsigned char* message, std::size_t length) {
+    const unsigned char* reversed = reverse7().value;
+    PackedBits bits;
+    bits.reserve(length * 7);
+
+    uint64_t pending = 0;
+    int pendingBits = 0;
+    for (std::size_t i = 0; i < length; ++i) {
+        pending |= static_cast<uint64_t>(reversed[message[i] & 0x7F]) << pendingBits;
+        pendingBits += 7;
+        if (pendingBits == 63) {
+            bits.append_bits(pending, pendingBits);
+            pending = 0;
+            pendingBits = 0;
+        }
+    }
+    bits.append_bits(pending, pendingBits);
+    return bits;
+}
+
+PackedBits Crypto::pack_message(const std::string& message) {
+    return pack_message(reinterpret_cast<const unsigned char*>(message.data()), message.size());
+}
+
+std::string Crypto::unpack_message(const PackedBits& bits) {
+    if (bits.size() % 7 != 0) {
         throw std::runtime_error("LSB array size is not a multiple of 7.");
     }
 
-    // 2. Convert each group of 7 bits into an ASCII character.
-    for (size_t i = 0; i < LSB_array.size(); i += 7) {
-        std::bitset<7> bits;
-        for (int j = 0; j < 7; ++j) {
-            bits[6-j] = LSB_array[i + j];
+    const unsigned char* reversed = reverse7().value;
+    std::string message;
+    message.reserve(bits.size() / 7);
+    for (std::size_t pos = 0; pos < bits.size(); pos += 63) {
+        int take = static_cast<int>(std::min<std::size_t>(63, bits.size() - pos));
+        uint64_t chunk = bits.get_bits(pos, take);
+        for (int shift = 0; shift < take; shift += 7) {
+            message += static_cast<char>(reversed[(chunk >> shift) & 0x7F]);
         }
-        message += static_cast<char>(bits.to_ulong()); // Convert to char
     }
-
-    // 4. Return the resulting message.
     return message;
+}
 
+// Set the LSBs of pixels [start_pixel, end of image) to bits [pos, ..)
+static void embed_pixel_tail(GrayscaleImage& image, std::size_t start_pixel, const PackedBits& bits, std::size_t pos,
+                             bool bmi2) {
+    std::size_t width = image.get_width();
+    std::size_t height = image.get_height();
+    for (std::size_t row = start_pixel / width; row < height; ++row) {
+        std::size_t first_col = (row == start_pixel / width) ? start_pixel % width : 0;
+        embed_run(image.row(static_cast<int>(row)) + first_col, width - first_col, bits, pos, bmi2);
+        pos += width - first_col;
+    }
 }
 
-// Encrypt message by converting ASCII characters into LSBs
-std::vector<int> Crypto::encrypt_message(const std::string& message) {
-    std::vector<int> LSB_array;
-    // Convert each character of the message into a 7-bit binary representation.
-    for (char c : message) {
-        std::bitset<7> bits(c); // 7-bit representation
-        for (int i = 0; i < 7; ++i) {
-            LSB_array.push_back(bits[6-i]); // Add each bit to the array
+// Embed bits into the image so that the last one lands in the last pixel
+void Crypto::embed_bits(GrayscaleImage& image, const PackedBits& bits) {
+    TRACE_SCOPE(scope, "stego.embed");
+    TRACE_AMOUNT(scope, bits.size(), bits.size());
+    std::size_t width = image.get_width();
+    std::size_t height = image.get_height();
+    if (bits.size() > width * height) {
+        throw std::runtime_error("Not enough pixels in the image to embed the message.");
+    }
+    if (bits.empty()) return;
+
+    embed_pixel_tail(image, width * height - bits.size(), bits, 0, use_bmi2());
+}
+
+// Append the LSBs of `count` pixels starting at pixel index `start_pixel` (row-major) to out
+static void append_pixel_range(const GrayscaleImage& image, std::size_t start_pixel, std::size_t count,
+                               PackedBits& out, bool bmi2) {
+    std::size_t width = image.get_width();
+    if (count == 0) return;
+    std::size_t end_pixel = start_pixel + count;
+    for (std::size_t row = start_pixel / width; row * width < end_pixel; ++row) {
+        std::size_t first_col = (row == start_pixel / width) ? start_pixel % width : 0;
+        std::size_t last_col = std::min(width, end_pixel - row * width);
+        extract_run(image.row(static_cast<int>(row)) + first_col, last_col - first_col, out, bmi2);
+    }
+}
+
+// LSBs of `count` pixels starting at pixel index `start_pixel` (row-major)
+static PackedBits extract_pixel_range(const GrayscaleImage& image, std::size_t start_pixel, std::size_t count) {
+    PackedBits bits;
+    bits.reserve(count);
+    append_pixel_range(image, start_pixel, count, bits, use_bmi2());
+    return bits;
+}
+
+PackedBits Crypto::extract_bits(const GrayscaleImage& image, std::size_t count) {
+    TRACE_SCOPE(scope, "stego.extract");
+    TRACE_AMOUNT(scope, count, count);
+    std::size_t pixels = static_cast<std::size_t>(image.get_width()) * image.get_height();
+    if (count > pixels) {
+        throw std::runtime_error("Not enough pixels in the image to extract the message.");
+    }
+    return extract_pixel_range(image, pixels - count, count);
+}
+
+// A colour carrier's samples are its planes one after another, so one that
+// has a single channel holds bits exactly where a grey image would
+static std::size_t sample_count(const ColorImage& image) {
+    return static_cast<std::size_t>(image.get_width()) * image.get_height() * image.get_channels();
+}
+
+// LSBs of `count` samples starting at sample index `start`
+static PackedBits extract_sample_range(const ColorImage& image, std::size_t start, std::size_t count) {
+    std::size_t plane_size = static_cast<std::size_t>(image.get_width()) * image.get_height();
+    PackedBits bits;
+    bits.reserve(count);
+    bool bmi2 = use_bmi2();
+    for (int c = 0; c < image.get_channels() && plane_size > 0; ++c) {
+        std::size_t begin = c * plane_size;
+        std::size_t first = std::max(start, begin);
+        std::size_t last = std::min(start + count, begin + plane_size);
+        if (first < last) {
+            append_pixel_range(image.plane(c), first - begin, last - first, bits, bmi2);
         }
     }
+    return bits;
+}
 
-    // Return the array of bits.
-    return LSB_array;
+// Every plane the bits reach takes its share in parallel, ending in the last sample of the last plane
+void Crypto::embed_bits(ColorImage& image, const PackedBits& bits) {
+    TRACE_SCOPE(scope, "stego.embed");
+    TRACE_AMOUNT(scope, bits.size(), bits.size());
+    std::size_t samples = sample_count(image);
+    if (bits.size() > samples) {
+        throw std::runtime_error("Not enough pixels in the image to embed the message.");
+    }
+    if (bits.empty()) return;
+
+    bool bmi2 = use_bmi2();
+    std::size_t plane_size = samples / image.get_channels();
+    std::size_t start = samples - bits.size();
+    ThreadPool::shared().parallel_for(image.get_channels(), [&](int c) {
+        std::size_t begin = c * plane_size;
+        std::size_t first = std::max(start, begin);
+        if (first < begin + plane_size) {
+            embed_pixel_tail(image.plane(c), first - begin, bits, first - start, bmi2);
+        }
+    });
 }
 
-// Embed LSB array into GrayscaleImage starting from the last bit of the image
-SecretImage Crypto::embed_LSBits(GrayscaleImage& image, const std::vector<int>& LSB_array) {
-    
-    // Ensure the image has enough pixels to store the LSB array, else throw an error.
-    int total_bits = LSB_array.size();
-    int width = image.get_width();
-    int height = image.get_height();
+PackedBits Crypto::extract_bits(const ColorImage& image, std::size_t count) {
+    TRACE_SCOPE(scope, "stego.extract");
+    TRACE_AMOUNT(scope, count, count);
+    std::size_t samples = sample_count(image);
+    if (count > samples) {
+        throw std::runtime_error("Not enough pixels in the image to extract the message.");
+    }
+    return extract_sample_range(image, samples - count, count);
+}
 
-    if (total_bits > width * height) {
+// Same walk over a secret image: each row is a lower and an upper piece
+void Crypto::embed_bits(SecretImage& secret_image, const PackedBits& bits) {
+    TRACE_SCOPE(scope, "stego.embed");
+    TRACE_AMOUNT(scope, bits.size(), bits.size());
+    std::size_t width = secret_image.get_width();
+    std::size_t height = secret_image.get_height();
+    if (bits.size() > width * height) {
         throw std::runtime_error("Not enough pixels in the image to embed the message.");
     }
+    if (bits.empty()) return;
 
+    bool bmi2 = use_bmi2();
+    std::size_t start_pixel = width * height - bits.size();
+    std::size_t pos = 0;
+    for (std::size_t row = start_pixel / width; row < height; ++row) {
+        std::size_t first_col = (row == start_pixel / width) ? start_pixel % width : 0;
+        SecretImage::RowSpan span = secret_image.row_span(static_cast<int>(row));
+        std::size_t split = span.split;
+        if (first_col < split) {
+            embed_run(span.lower + first_col, split - first_col, bits, pos, bmi2);
+            pos += split - first_col;
+        }
+        std::size_t col = std::max(first_col, split);
+        embed_run(span.upper + (col - split), width - col, bits, pos, bmi2);
+        pos += width - col;
+    }
+}
 
-    // Iterate over the image pixels, embedding LSBs from the array.
-    int start_pixel = (width * height) - total_bits; // Starting pixel index
-    for (int i = start_pixel; i < width * height; ++i) {
-        int row = i / width;
-        int col = i % width;
-        int pixelValue = image.get_pixel(row, col);
-        
-        // Replace the LSB
-        pixelValue = (pixelValue & ~1) | LSB_array[i - start_pixel]; // Clear LSB and set new LSB
-        image.set_pixel(row, col, pixelValue); // Update the pixel
+PackedBits Crypto::extract_bits(const SecretImage& secret_image, std::size_t count) {
+    TRACE_SCOPE(scope, "stego.extract");
+    TRACE_AMOUNT(scope, count, count);
+    std::size_t width = secret_image.get_width();
+    std::size_t height = secret_image.get_height();
+    if (count > width * height) {
+        throw std::runtime_error("Not enough pixels in the image to extract the message.");
     }
 
-    // Construct the SecretImage using the modified GrayscaleImage
+    PackedBits bits;
+    if (count == 0) return bits;
+    bits.reserve(count);
 
-    SecretImage secret_image(image);
+    bool bmi2 = use_bmi2();
+    std::size_t start_pixel = width * height - count;
+    for (std::size_t row = start_pixel / width; row < height; ++row) {
+        std::size_t first_col = (row == start_pixel / width) ? start_pixel % width : 0;
+        SecretImage::RowSpan span = secret_image.row_span(static_cast<int>(row));
+        std::size_t split = span.split;
+        if (first_col < split) {
+            extract_run(span.lower + first_col, split - first_col, bits, bmi2);
+        }
+        std::size_t col = std::max(first_col, split);
+        extract_run(span.upper + (col - split), width - col, bits, bmi2);
+    }
+    return bits;
+}
+
+// ---------------------------------------------------------------------------
+// Self-describing messages
+// ---------------------------------------------------------------------------
+
+// CRC-32 of the bits as little-endian bytes; unused bits of the last byte are zero
+static uint32_t bits_crc(const PackedBits& bits) {
+    uint32_t crc = 0;
+    unsigned char buffer[512];
+    std::size_t bytes = (bits.size() + 7) / 8;
+    for (std::size_t done = 0; done < bytes;) {
+        std::size_t chunk = std::min(bytes - done, sizeof(buffer));
+        for (std::size_t i = 0; i < chunk; ++i) {
+            buffer[i] = static_cast<unsigned char>(bits.get_bits(8 * (done + i), 8));
+        }
+        crc = Checksum::crc32(buffer, chunk, crc);
+        done += chunk;
+    }
+    return crc;
+}
+
+static const uint32_t MESSAGE_MAGIC = 0x534D5643;  // "CVMS"
+static const uint32_t MESSAGE_VERSION = 1;
+
+static int bits_per_character(Crypto::Encoding encoding) {
+    return encoding == Crypto::ENCODING_ASCII7 ? 7 : 8;
+}
+
+// Payload bits followed by the message header
+static PackedBits message_bits(const std::string& message) {
+    bool ascii = true;
+    for (char c : message) {
+        if (static_cast<unsigned char>(c) > 0x7F) {
+            ascii = false;
+            break;
+        }
+    }
+    if (message.size() > 0xFFFFFFFFu) {
+        throw std::runtime_error("Message is too long.");
+    }
+
+    PackedBits bits;
+    if (ascii) {
+        bits = Crypto::pack_message(message);
+    } else {
+        bits.reserve(message.size() * 8 + Crypto::MESSAGE_HEADER_BITS);
+        for (char c : message) {
+            bits.append_bits(static_cast<unsigned char>(c), 8);
+        }
+    }
+    uint32_t crc = bits_crc(bits);
+    bits.append_bits(MESSAGE_MAGIC, 32);
+    bits.append_bits(MESSAGE_VERSION, 8);
+    bits.append_bits(ascii ? Crypto::ENCODING_ASCII7 : Crypto::ENCODING_BYTES, 8);
+    bits.append_bits(0, 16);
+    bits.append_bits(message.size(), 32);
+    bits.append_bits(crc, 32);
+    return bits;
+}
+
+// Decode the header bits of a carrier with `samples` LSBs; false if they are not a header
+static bool parse_message_header(const PackedBits& bits, std::size_t samples, Crypto::MessageHeader& header) {
+    if (bits.get_bits(0, 32) != MESSAGE_MAGIC || bits.get_bits(32, 8) != MESSAGE_VERSION || bits.get_bits(48, 16) != 0) {
+        return false;
+    }
+    uint64_t encoding = bits.get_bits(40, 8);
+    if (encoding != Crypto::ENCODING_ASCII7 && encoding != Crypto::ENCODING_BYTES) {
+        return false;
+    }
+
+    header.encoding = static_cast<Crypto::Encoding>(encoding);
+    header.length = static_cast<uint32_t>(bits.get_bits(64, 32));
+    header.crc = static_cast<uint32_t>(bits.get_bits(96, 32));
+    header.bits = static_cast<std::size_t>(header.length) * bits_per_character(header.encoding);
+    return header.bits <= samples - Crypto::MESSAGE_HEADER_BITS;
+}
+
+// Check the payload bits against the header's CRC and turn them back into characters
+static std::string decode_payload(const PackedBits& bits, const Crypto::MessageHeader& header) {
+    if (bits_crc(bits) != header.crc) {
+        throw std::runtime_error("Checksum mismatch: the message in the image is damaged.");
+    }
+
+    if (header.encoding == Crypto::ENCODING_ASCII7) {
+        return Crypto::unpack_message(bits);
+    }
+    std::string message;
+    message.reserve(header.length);
+    for (std::size_t pos = 0; pos < bits.size(); pos += 64) {
+        int take = static_cast<int>(std::min<std::size_t>(64, bits.size() - pos));
+        uint64_t chunk = bits.get_bits(pos, take);
+        for (int shift = 0; shift < take; shift += 8) {
+            message += static_cast<char>((chunk >> shift) & 0xFF);
+        }
+    }
+    return message;
+}
+
+void Crypto::embed_message(GrayscaleImage& image, const std::string& message) {
+    embed_bits(image, message_bits(message));
+}
+
+bool Crypto::read_message_header(const GrayscaleImage& image, MessageHeader& header) {
+    std::size_t pixels = static_cast<std::size_t>(image.get_width()) * image.get_height();
+    if (pixels < static_cast<std::size_t>(MESSAGE_HEADER_BITS)) {
+        return false;
+    }
+    return parse_message_header(extract_bits(image, MESSAGE_HEADER_BITS), pixels, header);
+}
+
+std::string Crypto::extract_message(const GrayscaleImage& image, const MessageHeader& header) {
+    // The payload sits right before the header
+    std::size_t pixels = static_cast<std::size_t>(image.get_width()) * image.get_height();
+    if (header.bits + MESSAGE_HEADER_BITS > pixels) {
+        throw std::runtime_error("Not enough pixels in the image to extract the message.");
+    }
+    return decode_payload(extract_pixel_range(image, pixels - MESSAGE_HEADER_BITS - header.bits, header.bits), header);
+}
+
+std::string Crypto::extract_message(const GrayscaleImage& image) {
+    MessageHeader header;
+    if (!read_message_header(image, header)) {
+        throw std::runtime_error("The image does not carry a message.");
+    }
+    return extract_message(image, header);
+}
+
+void Crypto::embed_message(ColorImage& image, const std::string& message) {
+    embed_bits(image, message_bits(message));
+}
+
+bool Crypto::read_message_header(const ColorImage& image, MessageHeader& header) {
+    std::size_t samples = sample_count(image);
+    if (samples < static_cast<std::size_t>(MESSAGE_HEADER_BITS)) {
+        return false;
+    }
+    return parse_message_header(extract_bits(image, MESSAGE_HEADER_BITS), samples, header);
+}
+
+std::string Crypto::extract_message(const ColorImage& image, const MessageHeader& header) {
+    std::size_t samples = sample_count(image);
+    if (header.bits + MESSAGE_HEADER_BITS > samples) {
+        throw std::runtime_error("Not enough pixels in the image to extract the message.");
+    }
+    return decode_payload(extract_sample_range(image, samples - MESSAGE_HEADER_BITS - header.bits, header.bits), header);
+}
+
+std::string Crypto::extract_message(const ColorImage& image) {
+    MessageHeader header;
+    if (!read_message_header(image, header)) {
+        throw std::runtime_error("The image does not carry a message.");
+    }
+    return extract_message(image, header);
+}
+
+// ---------------------------------------------------------------------------
+// Multiple carriers
+// ---------------------------------------------------------------------------
+
+static const uint32_t CARRIER_MAGIC = 0x434D5643;  // "CVMC"
+static const std::size_t MAX_CARRIERS = 0xFFFF;
+
+struct CarrierHeader {
+    uint32_t magic;
+    uint32_t crc;
+    uint32_t index;
+    uint32_t count;
+    uint32_t bits;
+};
+
+static std::size_t carrier_capacity(const GrayscaleImage& carrier) {
+    std::size_t pixels = static_cast<std::size_t>(carrier.get_width()) * carrier.get_height();
+    return pixels > static_cast<std::size_t>(Crypto::CARRIER_HEADER_BITS) ? pixels - Crypto::CARRIER_HEADER_BITS : 0;
+}
+
+void Crypto::embed_multi(std::vector<GrayscaleImage>& carriers, const PackedBits& bits) {
+    if (carriers.empty() || carriers.size() > MAX_CARRIERS) {
+        throw std::invalid_argument("A message needs between 1 and " + std::to_string(MAX_CARRIERS) + " carrier images.");
+    }
+
+    // Shares proportional to capacity; rounding leaves fewer bits than
+    // carriers over, and each carrier that was rounded down has room for one
+    std::size_t n = carriers.size();
+    std::vector<std::size_t> capacity(n);
+    unsigned long long totalCapacity = 0;
+    for (std::size_t c = 0; c < n; ++c) {
+        capacity[c] = carrier_capacity(carriers[c]);
+        totalCapacity += capacity[c];
+    }
+    if (bits.size() > totalCapacity) {
+        throw std::runtime_error("Not enough pixels in the images to embed the message.");
+    }
+    std::vector<std::size_t> share(n);
+    std::size_t assigned = 0;
+    for (std::size_t c = 0; c < n; ++c) {
+        share[c] = totalCapacity ? static_cast<std::size_t>(bits.size() * static_cast<unsigned long long>(capacity[c]) / totalCapacity) : 0;
+        assigned += share[c];
+    }
+    for (std::size_t c = 0; c < n && assigned < bits.size(); ++c) {
+        if (share[c] < capacity[c]) {
+            ++share[c];
+            ++assigned;
+        }
+    }
+
+    std::vector<std::size_t> offset(n, 0);
+    for (std::size_t c = 1; c < n; ++c) {
+        offset[c] = offset[c - 1] + share[c - 1];
+    }
+
+    uint32_t crc = bits_crc(bits);
+    ThreadPool::shared().parallel_for(static_cast<int>(n), [&](int c) {
+        PackedBits shard;
+        shard.reserve(share[c] + CARRIER_HEADER_BITS);
+        shard.append(bits, offset[c], share[c]);
+        shard.append_bits(CARRIER_MAGIC, 32);
+        shard.append_bits(crc, 32);
+        shard.append_bits(static_cast<uint64_t>(c), 16);
+        shard.append_bits(static_cast<uint64_t>(n), 16);
+        shard.append_bits(share[c], 32);
+        embed_bits(carriers[c], shard);
+    });
+}
+
+PackedBits Crypto::extract_multi(const std::vector<GrayscaleImage>& carriers) {
+    if (carriers.empty() || carriers.size() > MAX_CARRIERS) {
+        throw std::invalid_argument("A message needs between 1 and " + std::to_string(MAX_CARRIERS) + " carrier images.");
+    }
+
+    // Read every header and shard in parallel; carrier c lands in slot headers[c].index
+    std::size_t n = carriers.size();
+    std::vector<CarrierHeader> headers(n);
+    std::vector<PackedBits> shards(n);
+    ThreadPool::shared().parallel_for(static_cast<int>(n), [&](int c) {
+        const GrayscaleImage& carrier = carriers[c];
+        if (static_cast<std::size_t>(carrier.get_width()) * carrier.get_height() < static_cast<std::size_t>(CARRIER_HEADER_BITS)) {
+            throw std::runtime_error("Image " + std::to_string(c + 1) + " is too small to be a carrier.");
+        }
+        PackedBits header = extract_bits(carrier, CARRIER_HEADER_BITS);
+        CarrierHeader& h = headers[c];
+        h.magic = static_cast<uint32_t>(header.get_bits(0, 32));
+        h.crc = static_cast<uint32_t>(header.get_bits(32, 32));
+        h.index = static_cast<uint32_t>(header.get_bits(64, 16));
+        h.count = static_cast<uint32_t>(header.get_bits(80, 16));
+        h.bits = static_cast<uint32_t>(header.get_bits(96, 32));
+        if (h.magic != CARRIER_MAGIC) {
+            throw std::runtime_error("Image " + std::to_string(c + 1) + " does not carry part of a message.");
+        }
+        if (h.bits > carrier_capacity(carrier)) {
+            throw std::runtime_error("Image " + std::to_string(c + 1) + " has a damaged carrier header.");
+        }
+        std::size_t pixels = static_cast<std::size_t>(carrier.get_width()) * carrier.get_height();
+        shards[c] = extract_pixel_range(carrier, pixels - CARRIER_HEADER_BITS - h.bits, h.bits);
+    });
+
+    // The headers must describe one complete set
+    std::vector<int> slot(n, -1);
+    for (std::size_t c = 0; c < n; ++c) {
+        const CarrierHeader& h = headers[c];
+        if (h.count != n) {
+            throw std::runtime_error("The message is spread over " + std::to_string(h.count) + " images, but " +
+                                     std::to_string(n) + " were given.");
+        }
+        if (h.crc != headers[0].crc || h.index >= n || slot[h.index] != -1) {
+            throw std::runtime_error("The images do not belong to the same message.");
+        }
+        slot[h.index] = static_cast<int>(c);
+    }
 
-    
-    return secret_image;
+    PackedBits bits;
+    std::size_t total = 0;
+    for (std::size_t c = 0; c < n; ++c) {
+        total += shards[c].size();
+    }
+    bits.reserve(total);
+    for (std::size_t i = 0; i < n; ++i) {
+        const PackedBits& shard = shards[slot[i]];
+        bits.append(shard, 0, shard.size());
+    }
+    if (bits_crc(bits) != headers[0].crc) {
+        throw std::runtime_error("Checksum mismatch: the message in the images is damaged.");
+    }
+    return bits;
+}
+
+void Crypto::embed_message_multi(std::vector<GrayscaleImage>& carriers, const std::string& message) {
+    embed_multi(carriers, message_bits(message));
+}
+
+std::string Crypto::extract_message_multi(const std::vector<GrayscaleImage>& carriers) {
+    PackedBits bits = extract_multi(carriers);
+    MessageHeader header;
+    if (bits.size() >= static_cast<std::size_t>(MESSAGE_HEADER_BITS)) {
+        std::size_t payloadBits = bits.size() - MESSAGE_HEADER_BITS;
+        PackedBits headerBits;
+        headerBits.append(bits, payloadBits, MESSAGE_HEADER_BITS);
+        if (parse_message_header(headerBits, bits.size(), header) && header.bits == payloadBits) {
+            PackedBits payload;
+            payload.append(bits, 0, payloadBits);
+            return decode_payload(payload, header);
+        }
+    }
+    return unpack_message(bits);
+}
+
+// ---------------------------------------------------------------------------
+// One-int-per-bit interface
+// ---------------------------------------------------------------------------
+
+// Extract the least significant bits (LSBs) from SecretImage, calculating x, y based on message length
+std::vector<int> Crypto::extract_LSBits(SecretImage& secret_image, int message_length) {
+    if (message_length < 0) {
+        throw std::runtime_error("Message length must not be negative.");
+    }
+    return to_int_bits(extract_bits(secret_image, static_cast<std::size_t>(message_length) * 7));
+}
+
+// Decrypt message by converting LSB array into ASCII characters
+std::string Crypto::decrypt_message(const std::vector<int>& LSB_array) {
+    return unpack_message(from_int_bits(LSB_array));
+}
+
+// Encrypt message by converting ASCII characters into LSBs
+std::vector<int> Crypto::encrypt_message(const std::string& message) {
+    return to_int_bits(pack_message(message));
+}
+
+// Embed LSB array into GrayscaleImage starting from the last bit of the image
+SecretImage Crypto::embed_LSBits(GrayscaleImage& image, const std::vector<int>& LSB_array) {
+    embed_bits(image, from_int_bits(LSB_array));
+    return SecretImage(image);
 }
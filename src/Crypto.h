@@ -1,7 +1,10 @@
 #ifndef CRYPTO_H
 #define CRYPTO_H
 
+#include "ColorImage.h"
 #include "SecretImage.h"
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <bitset>
@@ -9,8 +12,145 @@
 #include <iostream>
 #include <algorithm>
 
+// A sequence of bits packed 64 to a word: bit i is (words[i / 64] >> (i % 64)) & 1.
+// Bits past size() in the last word are always zero.
+class PackedBits {
+private:
+    std::vector<uint64_t> words;
+    std::size_t count;
+
+public:
+    PackedBits() : count(0) {}
+
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    void reserve(std::size_t bits) { words.reserve((bits + 63) / 64); }
+
+    int operator[](std::size_t i) const { return static_cast<int>((words[i / 64] >> (i % 64)) & 1); }
+
+    // Up to 64 bits starting at bit `pos`, first bit in the lowest position.
+    // Bits past the end read as zero.
+    uint64_t get_bits(std::size_t pos, int n) const;
+
+    // Append the low `n` bits of value (n <= 64), lowest bit first
+    void append_bits(uint64_t value, int n);
+
+    // Append bits [pos, pos + n) of another sequence
+    void append(const PackedBits& other, std::size_t pos, std::size_t n);
+
+    const uint64_t* data() const { return words.data(); }
+};
+
+// LSB steganography. A message is stored 7 bits per character, most
+// significant bit first, in the least significant bits of the last pixels of
+// the image (row-major order), so the final bit lands in the last pixel.
+//
+// The packed functions move 8 pixels per 64-bit word with mask-and-or (or
+// BMI2 pdep/pext where the CPU has them); the std::vector<int> functions are
+// the original one-int-per-bit interface, kept for existing callers.
+//
+// embed_message writes a self-describing message instead: the payload bits
+// followed by a MESSAGE_HEADER_BITS header ending in the last pixel:
+//   32 bits  magic 0x534D5643 ("CVMS")
+//    8 bits  header version (1), 8 bits payload encoding, 16 bits zero
+//   32 bits  payload length in characters
+//   32 bits  CRC-32 of the payload bits
+// Readers look at the header bits first and reject images without one
+// before touching the payload.
+//
+// Colour carriers use every channel: their samples are taken plane after
+// plane (all of channel 0 row-major, then channel 1, ...), which holds
+// get_channels() times as many bits and makes a one-channel carrier match a
+// grey one. Alpha counts as a channel.
+//
+// A message too long for one image can be spread over several carriers. Each
+// carrier holds a share of the bits proportional to its size, followed by a
+// CARRIER_HEADER_BITS header ending in its last pixel:
+//   32 bits  magic 0x434D5643 ("CVMC")
+//   32 bits  CRC-32 of the whole message bits (also ties the carriers together)
+//   16 bits  index of this carrier, 16 bits number of carriers
+//   32 bits  number of message bits in this carrier
+// so the carriers can be decoded without knowing the message length, and in any order.
+// embed_message_multi spreads the message bits with their message header, so
+// the payload encoding travels with them as it does in a single image.
 class Crypto {
 public:
+    static const int CARRIER_HEADER_BITS = 128;
+    static const int MESSAGE_HEADER_BITS = 128;
+
+    // How the characters of a message are turned into bits
+    enum Encoding {
+        ENCODING_ASCII7 = 0,  // 7 bits per character, most significant first (pack_message)
+        ENCODING_BYTES = 1    // 8 bits per byte, least significant first
+    };
+
+    // Decoded message header
+    struct MessageHeader {
+        Encoding encoding;
+        uint32_t length;   // Characters
+        uint32_t crc;      // CRC-32 of the payload bits
+        std::size_t bits;  // Payload bits in the image
+    };
+
+    // Pack `length` characters into message bits
+    static PackedBits pack_message(const unsigned char* message, std::size_t length);
+    static PackedBits pack_message(const std::string& message);
+
+    // Turn message bits back into characters; throws if the count is not a multiple of 7
+    static std::string unpack_message(const PackedBits& bits);
+
+    // Write the bits into the LSBs of the last bits.size() pixels, in place.
+    // Throws std::runtime_error if the image is too small.
+    static void embed_bits(GrayscaleImage& image, const PackedBits& bits);
+
+    // Same, writing straight into the triangular arrays of a secret image
+    static void embed_bits(SecretImage& secret_image, const PackedBits& bits);
+
+    // Read the LSBs of the last `count` pixels
+    static PackedBits extract_bits(const GrayscaleImage& image, std::size_t count);
+
+    // Same over the samples of every channel of a colour image, planes in parallel
+    static void embed_bits(ColorImage& image, const PackedBits& bits);
+    static PackedBits extract_bits(const ColorImage& image, std::size_t count);
+
+    // Same, reading straight from the triangular arrays without reconstructing the image
+    static PackedBits extract_bits(const SecretImage& secret_image, std::size_t count);
+
+    // Embed a message with its header. ASCII7 is used when every character
+    // fits in 7 bits, BYTES otherwise. Throws std::runtime_error if the image is too small.
+    static void embed_message(GrayscaleImage& image, const std::string& message);
+
+    // Read only the header bits; false if the image carries no message
+    static bool read_message_header(const GrayscaleImage& image, MessageHeader& header);
+
+    // Read the payload described by a header and check its CRC
+    static std::string extract_message(const GrayscaleImage& image, const MessageHeader& header);
+
+    // Header, then payload. Throws std::runtime_error if there is no message or it is damaged.
+    static std::string extract_message(const GrayscaleImage& image);
+
+    // The message functions for colour carriers
+    static void embed_message(ColorImage& image, const std::string& message);
+    static bool read_message_header(const ColorImage& image, MessageHeader& header);
+    static std::string extract_message(const ColorImage& image, const MessageHeader& header);
+    static std::string extract_message(const ColorImage& image);
+
+    // Spread the bits over the carriers and embed them, one carrier per task on
+    // the shared thread pool. Throws std::runtime_error if they are too small.
+    static void embed_multi(std::vector<GrayscaleImage>& carriers, const PackedBits& bits);
+
+    // Collect the bits back from a complete set of carriers, given in any order.
+    // Throws std::runtime_error if a carrier is missing, foreign or damaged.
+    static PackedBits extract_multi(const std::vector<GrayscaleImage>& carriers);
+
+    // embed_multi of a message with its header (see embed_message)
+    static void embed_message_multi(std::vector<GrayscaleImage>& carriers, const std::string& message);
+
+    // The message back from a complete set of carriers. Sets written without a
+    // message header are read as 7-bit characters, as they used to be.
+    static std::string extract_message_multi(const std::vector<GrayscaleImage>& carriers);
+
     // Function to extract LSBs from SecretImage
     static std::vector<int> extract_LSBits(SecretImage& secret_image, int message_length);
 
@@ -0,0 +1,753 @@
+#include "Deflate.h"
+#include "Checksum.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+
+// Length and distance alphabets of RFC 1951, section 3.2.5
+static const uint16_t LENGTH_BASE[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                         31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                         2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t DISTANCE_BASE[30] = {1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+                                           33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+                                           1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                           6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Order in which code length code lengths are stored in a dynamic block header
+static const uint8_t CODE_LENGTH_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// Huffman codes are sent most significant bit first into an LSB-first stream
+static uint32_t reverse_bits(uint32_t code, int length) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < length; ++i) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    return reversed;
+}
+
+// Alphabet index of a match length (3..258) or distance (1..32768)
+static int length_symbol(int length) {
+    return static_cast<int>(std::upper_bound(LENGTH_BASE, LENGTH_BASE + 29, length) - LENGTH_BASE) - 1;
+}
+
+static int distance_symbol(int distance) {
+    return static_cast<int>(std::upper_bound(DISTANCE_BASE, DISTANCE_BASE + 30, distance) - DISTANCE_BASE) - 1;
+}
+
+// Huffman code lengths for the given symbol frequencies, none longer than
+// maxLength. Unused symbols get length 0; a code always gets at least two
+// symbols so it is complete. Trees that come out too deep are rebuilt from
+// flattened frequencies.
+static void build_lengths(const uint32_t* frequencies, int n, int maxLength, uint8_t* lengths) {
+    std::fill(lengths, lengths + n, 0);
+    std::vector<int> used;
+    for (int s = 0; s < n; ++s) {
+        if (frequencies[s] != 0) used.push_back(s);
+    }
+    if (used.size() < 2) {
+        int only = used.empty() ? 0 : used[0];
+        lengths[only] = 1;
+        lengths[only == 0 ? 1 : 0] = 1;
+        return;
+    }
+
+    int leaves = static_cast<int>(used.size());
+    std::vector<uint64_t> weights(leaves);
+    for (int i = 0; i < leaves; ++i) {
+        weights[i] = frequencies[used[i]];
+    }
+    typedef std::pair<uint64_t, int> Node;
+    std::vector<int> parent(2 * leaves - 1);
+    std::vector<int> depth(2 * leaves - 1);
+    for (;;) {
+        // Leaves are nodes [0, leaves); every internal node gets a higher index than its children
+        std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+        for (int i = 0; i < leaves; ++i) {
+            queue.push(Node(weights[i], i));
+        }
+        int next = leaves;
+        while (queue.size() > 1) {
+            Node a = queue.top();
+            queue.pop();
+            Node b = queue.top();
+            queue.pop();
+            parent[a.second] = next;
+            parent[b.second] = next;
+            queue.push(Node(a.first + b.first, next++));
+        }
+
+        int longest = 0;
+        depth[next - 1] = 0;
+        for (int node = next - 2; node >= 0; --node) {
+            depth[node] = depth[parent[node]] + 1;
+            if (node < leaves) longest = std::max(longest, depth[node]);
+        }
+        if (longest <= maxLength) {
+            for (int i = 0; i < leaves; ++i) {
+                lengths[used[i]] = static_cast<uint8_t>(depth[i]);
+            }
+            return;
+        }
+        for (int i = 0; i < leaves; ++i) {
+            weights[i] = (weights[i] >> 1) | 1;
+        }
+    }
+}
+
+// Canonical codes for the lengths (RFC 1951, section 3.2.2), bit-reversed for the stream
+static void build_codes(const uint8_t* lengths, int n, uint16_t* codes) {
+    int count[16] = {0};
+    for (int s = 0; s < n; ++s) {
+        ++count[lengths[s]];
+    }
+    count[0] = 0;
+    uint32_t next[16];
+    uint32_t code = 0;
+    for (int len = 1; len < 16; ++len) {
+        code = (code + count[len - 1]) << 1;
+        next[len] = code;
+    }
+    for (int s = 0; s < n; ++s) {
+        codes[s] = lengths[s] != 0 ? static_cast<uint16_t>(reverse_bits(next[lengths[s]]++, lengths[s])) : 0;
+    }
+}
+
+// Run-length code a sequence of code lengths with symbols 16 (repeat the
+// previous length 3-6 times), 17 (3-10 zeros) and 18 (11-138 zeros)
+static void run_length_code(const uint8_t* lengths, int n, std::vector<uint8_t>& symbols, std::vector<uint8_t>& extra) {
+    int i = 0;
+    while (i < n) {
+        uint8_t value = lengths[i];
+        int run = 1;
+        while (i + run < n && lengths[i + run] == value) {
+            ++run;
+        }
+        if (value == 0 && run >= 3) {
+            int take = std::min(run, 138);
+            symbols.push_back(take >= 11 ? 18 : 17);
+            extra.push_back(static_cast<uint8_t>(take >= 11 ? take - 11 : take - 3));
+            i += take;
+        } else if (value != 0 && run >= 4) {
+            symbols.push_back(value);
+            extra.push_back(0);
+            for (run -= 1, i += 1; run >= 3; ) {
+                int take = std::min(run, 6);
+                symbols.push_back(16);
+                extra.push_back(static_cast<uint8_t>(take - 3));
+                i += take;
+                run -= take;
+            }
+        } else {
+            symbols.push_back(value);
+            extra.push_back(0);
+            ++i;
+        }
+    }
+}
+
+static const int RUN_EXTRA_BITS[19] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7};
+
+// The fixed Huffman code (RFC 1951, section 3.2.6)
+struct FixedCode {
+    uint8_t literalLengths[288];
+    uint16_t literalCodes[288];
+    uint8_t distanceLengths[30];
+    uint16_t distanceCodes[30];
+
+    FixedCode() {
+        for (int s = 0; s < 288; ++s) {
+            literalLengths[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+        }
+        std::fill(distanceLengths, distanceLengths + 30, 5);
+        build_codes(literalLengths, 288, literalCodes);
+        build_codes(distanceLengths, 30, distanceCodes);
+    }
+};
+
+static const FixedCode& fixed_code() {
+    static const FixedCode code;
+    return code;
+}
+
+// Deflater
+
+Deflater::Deflater(Writer output, Level level, Framing framing)
+    : output(output), framing(framing), maxChain(16), lazyLimit(32), historyLength(0), basePosition(0),
+      hashedPosition(0), head(1 << HASH_BITS, 0), chain(65536, 0), adler(1), bits(0), bitCount(0), finished(false) {
+    if (level == FASTEST) {
+        maxChain = 1;
+        lazyLimit = 0;
+    } else if (level == SMALLEST) {
+        maxChain = 512;
+        lazyLimit = 259;
+    }
+    buffer.reserve(WINDOW_SIZE + BLOCK_SIZE);
+    tokens.reserve(BLOCK_SIZE);
+    if (framing == ZLIB) {
+        unsigned char header[2];
+        zlib_header(level, header);
+        out.assign(header, header + 2);
+    }
+}
+
+// CMF: deflate with a 32 KiB window; FLG: no dictionary, the level, check bits
+void Deflater::zlib_header(Level level, unsigned char header[2]) {
+    header[0] = 0x78;
+    header[1] = level == FASTEST ? 0x01 : level == BALANCED ? 0x9C : 0xDA;
+}
+
+void Deflater::put_bits(uint32_t value, int count) {
+    bits |= static_cast<uint64_t>(value) << bitCount;
+    bitCount += count;
+    while (bitCount >= 8) {
+        out.push_back(static_cast<unsigned char>(bits));
+        bits >>= 8;
+        bitCount -= 8;
+    }
+}
+
+// A stored block (at most 65535 bytes); it ends byte-aligned
+void Deflater::put_stored(const unsigned char* data, size_t length, bool last) {
+    put_bits(last ? 1 : 0, 1);
+    put_bits(0, 2);
+    if (bitCount > 0) {
+        put_bits(0, 8 - bitCount);
+    }
+    put_bits(static_cast<uint32_t>(length), 16);
+    put_bits(static_cast<uint32_t>(~length) & 0xFFFF, 16);
+    out.insert(out.end(), data, data + length);
+}
+
+void Deflater::put_tokens(const uint16_t* literalCodes, const uint8_t* literalLengths,
+                          const uint16_t* distanceCodes, const uint8_t* distanceLengths) {
+    for (uint32_t token : tokens) {
+        if (token < 256) {
+            put_bits(literalCodes[token], literalLengths[token]);
+            continue;
+        }
+        int length = static_cast<int>(token >> 16);
+        int distance = static_cast<int>(token & 0xFFFF);
+        int l = length_symbol(length);
+        put_bits(literalCodes[257 + l], literalLengths[257 + l]);
+        put_bits(length - LENGTH_BASE[l], LENGTH_EXTRA[l]);
+        int d = distance_symbol(distance);
+        put_bits(distanceCodes[d], distanceLengths[d]);
+        put_bits(distance - DISTANCE_BASE[d], DISTANCE_EXTRA[d]);
+    }
+    put_bits(literalCodes[256], literalLengths[256]);  // End of block
+}
+
+void Deflater::flush_output() {
+    if (!out.empty()) {
+        output(out.data(), out.size());
+        out.clear();
+    }
+}
+
+static uint32_t hash3(const unsigned char* p) {
+    uint32_t v = static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16);
+    return (v * 2654435761u) >> (32 - 15);
+}
+
+void Deflater::hash_up_to(uint32_t position) {
+    uint32_t end = basePosition + static_cast<uint32_t>(buffer.size());
+    while (hashedPosition != position && end - hashedPosition >= 3) {
+        uint32_t h = hash3(&buffer[hashedPosition - basePosition]);
+        chain[hashedPosition & 0xFFFF] = head[h];
+        head[h] = hashedPosition + 1;
+        ++hashedPosition;
+    }
+}
+
+// Longest earlier match for the bytes at `position`, up to 258 bytes and the
+// end of the buffered input. Positions are compared with wrapping arithmetic;
+// candidates are verified byte by byte, so a stale chain entry can only cost
+// time, never produce a wrong match.
+int Deflater::longest_match(uint32_t position, int& distance) const {
+    size_t index = position - basePosition;
+    int limit = static_cast<int>(std::min<size_t>(258, buffer.size() - index));
+    if (limit < 3) {
+        return 0;
+    }
+
+    const unsigned char* current = &buffer[index];
+    int best = 0;
+    uint32_t candidate = head[hash3(current)];
+    for (int tries = 0; tries < maxChain && candidate != 0; ++tries) {
+        uint32_t earlier = candidate - 1;
+        uint32_t gap = position - earlier;
+        if (gap == 0 || gap > WINDOW_SIZE || earlier - basePosition >= index) {
+            break;
+        }
+        const unsigned char* match = &buffer[earlier - basePosition];
+        if (match[best] == current[best]) {
+            int length = 0;
+            while (length < limit && match[length] == current[length]) {
+                ++length;
+            }
+            if (length > best) {
+                best = length;
+                distance = static_cast<int>(gap);
+                if (best == limit) {
+                    break;
+                }
+            }
+        }
+        candidate = chain[earlier & 0xFFFF];
+    }
+    return best >= 3 ? best : 0;
+}
+
+void Deflater::compress_block(bool last) {
+    tokens.clear();
+    size_t i = historyLength;
+    while (i < buffer.size()) {
+        uint32_t position = basePosition + static_cast<uint32_t>(i);
+        hash_up_to(position);
+        int distance = 0;
+        int length = longest_match(position, distance);
+
+        // One step of lazy matching: a longer match at the next byte wins
+        if (length > 0 && length < lazyLimit && i + 1 < buffer.size()) {
+            hash_up_to(position + 1);
+            int nextDistance = 0;
+            if (longest_match(position + 1, nextDistance) > length) {
+                length = 0;
+            }
+        }
+
+        if (length > 0) {
+            tokens.push_back((static_cast<uint32_t>(length) << 16) | static_cast<uint32_t>(distance));
+            i += length;
+        } else {
+            tokens.push_back(buffer[i]);
+            ++i;
+        }
+    }
+    emit_block(last);
+
+    // Keep the last window of input as history for the next block
+    if (buffer.size() > WINDOW_SIZE) {
+        size_t drop = buffer.size() - WINDOW_SIZE;
+        buffer.erase(buffer.begin(), buffer.begin() + drop);
+        basePosition += static_cast<uint32_t>(drop);
+    }
+    historyLength = buffer.size();
+    flush_output();
+}
+
+void Deflater::emit_block(bool last) {
+    uint32_t literalFrequencies[286] = {0};
+    uint32_t distanceFrequencies[30] = {0};
+    uint64_t extraBits = 0;
+    for (uint32_t token : tokens) {
+        if (token < 256) {
+            ++literalFrequencies[token];
+            continue;
+        }
+        int l = length_symbol(static_cast<int>(token >> 16));
+        int d = distance_symbol(static_cast<int>(token & 0xFFFF));
+        ++literalFrequencies[257 + l];
+        ++distanceFrequencies[d];
+        extraBits += LENGTH_EXTRA[l] + DISTANCE_EXTRA[d];
+    }
+    literalFrequencies[256] = 1;
+
+    // Dynamic code: literal/length and distance lengths, run-length coded
+    // with a third Huffman code
+    uint8_t literalLengths[286], distanceLengths[30];
+    build_lengths(literalFrequencies, 286, 15, literalLengths);
+    build_lengths(distanceFrequencies, 30, 15, distanceLengths);
+    int hlit = 286;
+    while (hlit > 257 && literalLengths[hlit - 1] == 0) --hlit;
+    int hdist = 30;
+    while (hdist > 1 && distanceLengths[hdist - 1] == 0) --hdist;
+
+    uint8_t allLengths[286 + 30];
+    std::memcpy(allLengths, literalLengths, hlit);
+    std::memcpy(allLengths + hlit, distanceLengths, hdist);
+    std::vector<uint8_t> runs, runExtra;
+    run_length_code(allLengths, hlit + hdist, runs, runExtra);
+    uint32_t runFrequencies[19] = {0};
+    for (uint8_t symbol : runs) {
+        ++runFrequencies[symbol];
+    }
+    uint8_t runLengths[19];
+    build_lengths(runFrequencies, 19, 7, runLengths);
+    int hclen = 19;
+    while (hclen > 4 && runLengths[CODE_LENGTH_ORDER[hclen - 1]] == 0) --hclen;
+
+    // Sizes in bits of the three block types
+    const FixedCode& fixed = fixed_code();
+    uint64_t dynamicBits = 3 + 5 + 5 + 4 + 3 * hclen + extraBits;
+    uint64_t fixedBits = 3 + extraBits;
+    for (int s = 0; s < 19; ++s) {
+        dynamicBits += static_cast<uint64_t>(runFrequencies[s]) * (runLengths[s] + RUN_EXTRA_BITS[s]);
+    }
+    for (int s = 0; s < 286; ++s) {
+        dynamicBits += static_cast<uint64_t>(literalFrequencies[s]) * literalLengths[s];
+        fixedBits += static_cast<uint64_t>(literalFrequencies[s]) * fixed.literalLengths[s];
+    }
+    for (int s = 0; s < 30; ++s) {
+        dynamicBits += static_cast<uint64_t>(distanceFrequencies[s]) * distanceLengths[s];
+        fixedBits += static_cast<uint64_t>(distanceFrequencies[s]) * 5;
+    }
+    size_t rawLength = buffer.size() - historyLength;
+    uint64_t storedBits = 3 + 7 + 32 + 8 * static_cast<uint64_t>(rawLength);
+
+    if (storedBits <= fixedBits && storedBits <= dynamicBits) {
+        put_stored(buffer.data() + historyLength, rawLength, last);
+        return;
+    }
+    put_bits(last ? 1 : 0, 1);
+    if (fixedBits <= dynamicBits) {
+        put_bits(1, 2);
+        put_tokens(fixed.literalCodes, fixed.literalLengths, fixed.distanceCodes, fixed.distanceLengths);
+        return;
+    }
+
+    put_bits(2, 2);
+    put_bits(hlit - 257, 5);
+    put_bits(hdist - 1, 5);
+    put_bits(hclen - 4, 4);
+    for (int i = 0; i < hclen; ++i) {
+        put_bits(runLengths[CODE_LENGTH_ORDER[i]], 3);
+    }
+    uint16_t runCodes[19];
+    build_codes(runLengths, 19, runCodes);
+    for (size_t i = 0; i < runs.size(); ++i) {
+        put_bits(runCodes[runs[i]], runLengths[runs[i]]);
+        put_bits(runExtra[i], RUN_EXTRA_BITS[runs[i]]);
+    }
+
+    uint16_t literalCodes[286], distanceCodes[30];
+    build_codes(literalLengths, 286, literalCodes);
+    build_codes(distanceLengths, 30, distanceCodes);
+    put_tokens(literalCodes, literalLengths, distanceCodes, distanceLengths);
+}
+
+void Deflater::write(const unsigned char* data, size_t length) {
+    if (finished) {
+        throw std::runtime_error("Deflater: write after finish");
+    }
+    adler = Checksum::adler32(data, length, adler);
+    while (length > 0) {
+        size_t room = historyLength + BLOCK_SIZE - buffer.size();
+        size_t take = std::min(room, length);
+        buffer.insert(buffer.end(), data, data + take);
+        data += take;
+        length -= take;
+        if (buffer.size() == historyLength + BLOCK_SIZE) {
+            compress_block(false);
+        }
+    }
+}
+
+void Deflater::finish() {
+    if (finished) {
+        return;
+    }
+    compress_block(framing != SEGMENT);
+    if (framing == SEGMENT) {
+        put_stored(nullptr, 0, false);  // Sync flush
+    } else if (bitCount > 0) {
+        put_bits(0, 8 - bitCount);
+    }
+    if (framing == ZLIB) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out.push_back(static_cast<unsigned char>(adler >> shift));
+        }
+    }
+    flush_output();
+    finished = true;
+}
+
+// Inflater
+
+void Inflater::Huffman::build(const unsigned char* lengths, int n) {
+    std::memset(count, 0, sizeof(count));
+    for (int s = 0; s < n; ++s) {
+        ++count[lengths[s]];
+    }
+    count[0] = 0;
+
+    // Reject over-subscribed codes; incomplete ones are legal (e.g. a single distance code)
+    int left = 1;
+    for (int len = 1; len < 16; ++len) {
+        left = (left << 1) - count[len];
+        if (left < 0) {
+            throw std::runtime_error("Corrupt compressed data (bad Huffman table)");
+        }
+    }
+
+    uint16_t offsets[16];
+    offsets[1] = 0;
+    for (int len = 1; len < 15; ++len) {
+        offsets[len + 1] = offsets[len] + count[len];
+    }
+    symbols.assign(n, 0);
+    for (int s = 0; s < n; ++s) {
+        if (lengths[s] != 0) {
+            symbols[offsets[lengths[s]]++] = static_cast<uint16_t>(s);
+        }
+    }
+
+    // Direct lookup entries for every code short enough
+    std::memset(fast, 0, sizeof(fast));
+    uint32_t code = 0;
+    int index = 0;
+    for (int len = 1; len <= FAST_BITS; ++len) {
+        for (int k = 0; k < count[len]; ++k, ++code, ++index) {
+            uint32_t reversed = reverse_bits(code, len);
+            for (uint32_t fill = reversed; fill < (1u << FAST_BITS); fill += 1u << len) {
+                fast[fill] = static_cast<uint16_t>((len << 9) | symbols[index]);
+            }
+        }
+        code <<= 1;
+    }
+}
+
+Inflater::Inflater(Reader input)
+    : input(input), inBuffer(65536), inPos(0), inEnd(0), bits(0), bitCount(0), window(32768), produced(0),
+      adlerA(1), adlerB(0), headerDone(false), lastBlock(false), streamDone(false), blockType(-1), storedLeft(0),
+      copyLeft(0), copyDistance(0) {}
+
+unsigned char Inflater::next_byte() {
+    if (inPos == inEnd) {
+        inEnd = input(inBuffer.data(), inBuffer.size());
+        inPos = 0;
+        if (inEnd == 0) {
+            throw std::runtime_error("Compressed data ends early");
+        }
+    }
+    return inBuffer[inPos++];
+}
+
+void Inflater::need_bits(int count) {
+    while (bitCount < count) {
+        bits |= static_cast<uint64_t>(next_byte()) << bitCount;
+        bitCount += 8;
+    }
+}
+
+uint32_t Inflater::get_bits(int count) {
+    need_bits(count);
+    uint32_t value = static_cast<uint32_t>(bits & ((1u << count) - 1));
+    bits >>= count;
+    bitCount -= count;
+    return value;
+}
+
+int Inflater::decode(const Huffman& table) {
+    // Every code is followed by at least the end-of-block code and the
+    // 4-byte trailer, so looking 16 bits ahead never reads past the stream
+    need_bits(16);
+    uint16_t entry = table.fast[bits & ((1u << Huffman::FAST_BITS) - 1)];
+    if (entry != 0) {
+        int length = entry >> 9;
+        bits >>= length;
+        bitCount -= length;
+        return entry & 0x1FF;
+    }
+
+    // Canonical decode one bit at a time (codes longer than FAST_BITS)
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; ++len) {
+        code |= static_cast<int>(bits & 1);
+        bits >>= 1;
+        --bitCount;
+        int count = table.count[len];
+        if (code - first < count) {
+            return table.symbols[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    throw std::runtime_error("Corrupt compressed data (bad Huffman code)");
+}
+
+void Inflater::read_header() {
+    uint32_t cmf = get_bits(8);
+    uint32_t flg = get_bits(8);
+    if ((cmf & 0x0F) != 8 || (cmf >> 4) > 7 || (cmf * 256 + flg) % 31 != 0 || (flg & 0x20)) {
+        throw std::runtime_error("Not a zlib stream");
+    }
+    headerDone = true;
+}
+
+void Inflater::read_dynamic_tables() {
+    int literalCount = get_bits(5) + 257;
+    int distanceCount = get_bits(5) + 1;
+    int codeLengthCount = get_bits(4) + 4;
+    if (literalCount > 286 || distanceCount > 30) {
+        throw std::runtime_error("Corrupt compressed data (bad table sizes)");
+    }
+
+    unsigned char lengths[286 + 30] = {};
+    for (int i = 0; i < codeLengthCount; ++i) {
+        lengths[CODE_LENGTH_ORDER[i]] = static_cast<unsigned char>(get_bits(3));
+    }
+    Huffman codeLengths;
+    codeLengths.build(lengths, 19);
+
+    std::memset(lengths, 0, sizeof(lengths));
+    int total = literalCount + distanceCount;
+    for (int i = 0; i < total;) {
+        int symbol = decode(codeLengths);
+        if (symbol < 16) {
+            lengths[i++] = static_cast<unsigned char>(symbol);
+            continue;
+        }
+        int repeat;
+        unsigned char value = 0;
+        if (symbol == 16) {
+            if (i == 0) throw std::runtime_error("Corrupt compressed data (repeat with no previous length)");
+            value = lengths[i - 1];
+            repeat = 3 + get_bits(2);
+        } else if (symbol == 17) {
+            repeat = 3 + get_bits(3);
+        } else {
+            repeat = 11 + get_bits(7);
+        }
+        if (i + repeat > total) {
+            throw std::runtime_error("Corrupt compressed data (too many code lengths)");
+        }
+        while (repeat-- > 0) {
+            lengths[i++] = value;
+        }
+    }
+    if (lengths[256] == 0) {
+        throw std::runtime_error("Corrupt compressed data (no end-of-block code)");
+    }
+    literals.build(lengths, literalCount);
+    distances.build(lengths + literalCount, distanceCount);
+}
+
+void Inflater::start_block() {
+    lastBlock = get_bits(1) != 0;
+    blockType = static_cast<int>(get_bits(2));
+    if (blockType == 0) {
+        get_bits(bitCount % 8);  // Stored blocks start on a byte boundary
+        uint32_t length = get_bits(16);
+        uint32_t complement = get_bits(16);
+        if ((length ^ 0xFFFF) != complement) {
+            throw std::runtime_error("Corrupt compressed data (bad stored block length)");
+        }
+        storedLeft = length;
+    } else if (blockType == 1) {
+        unsigned char lengths[288 + 30];
+        std::memset(lengths, 8, 144);
+        std::memset(lengths + 144, 9, 112);
+        std::memset(lengths + 256, 7, 24);
+        std::memset(lengths + 280, 8, 8);
+        std::memset(lengths + 288, 5, 30);
+        literals.build(lengths, 288);
+        distances.build(lengths + 288, 30);
+    } else if (blockType == 2) {
+        read_dynamic_tables();
+    } else {
+        throw std::runtime_error("Corrupt compressed data (bad block type)");
+    }
+}
+
+void Inflater::end_block() {
+    blockType = -1;
+    if (!lastBlock) {
+        return;
+    }
+
+    get_bits(bitCount % 8);
+    uint32_t expected = 0;
+    for (int i = 0; i < 4; ++i) {
+        expected = (expected << 8) | get_bits(8);
+    }
+    adlerA %= 65521;
+    adlerB %= 65521;
+    if (((adlerB << 16) | adlerA) != expected) {
+        throw std::runtime_error("Compressed data checksum mismatch");
+    }
+    streamDone = true;
+}
+
+int Inflater::step() {
+    if (streamDone) {
+        throw std::runtime_error("Compressed data ends early");
+    }
+    if (!headerDone) {
+        read_header();
+        return -1;
+    }
+    if (blockType < 0) {
+        start_block();
+        return -1;
+    }
+
+    int value;
+    if (copyLeft > 0) {
+        value = window[(produced - copyDistance) & 0x7FFF];
+        --copyLeft;
+    } else if (blockType == 0) {
+        if (storedLeft == 0) {
+            end_block();
+            return -1;
+        }
+        value = static_cast<int>(get_bits(8));
+        --storedLeft;
+    } else {
+        int symbol = decode(literals);
+        if (symbol < 256) {
+            value = symbol;
+        } else if (symbol == 256) {
+            end_block();
+            return -1;
+        } else {
+            symbol -= 257;
+            if (symbol >= 29) throw std::runtime_error("Corrupt compressed data (bad length code)");
+            int length = LENGTH_BASE[symbol] + static_cast<int>(get_bits(LENGTH_EXTRA[symbol]));
+            int d = decode(distances);
+            if (d >= 30) throw std::runtime_error("Corrupt compressed data (bad distance code)");
+            int distance = DISTANCE_BASE[d] + static_cast<int>(get_bits(DISTANCE_EXTRA[d]));
+            if (static_cast<uint64_t>(distance) > produced) {
+                throw std::runtime_error("Corrupt compressed data (distance too far back)");
+            }
+            copyDistance = distance;
+            copyLeft = length - 1;
+            value = window[(produced - distance) & 0x7FFF];
+        }
+    }
+
+    window[produced & 0x7FFF] = static_cast<unsigned char>(value);
+    ++produced;
+    adlerA += value;
+    adlerB += adlerA;
+    if ((produced & 1023) == 0) {
+        adlerA %= 65521;
+        adlerB %= 65521;
+    }
+    return value;
+}
+
+void Inflater::read(unsigned char* data, size_t length) {
+    size_t filled = 0;
+    while (filled < length) {
+        int value = step();
+        if (value >= 0) {
+            data[filled++] = static_cast<unsigned char>(value);
+        }
+    }
+}
+
+void Inflater::finish() {
+    while (!streamDone) {
+        if (step() >= 0) {
+            throw std::runtime_error("Compressed data is longer than expected");
+        }
+    }
+}
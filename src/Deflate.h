@@ -0,0 +1,153 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <cstddef>
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+// Streaming zlib (RFC 1950/1951) compressor. Data goes in with write() in
+// pieces of any size and compressed bytes come out through the writer
+// callback as they become available, so only the 32 KiB history window and
+// one block of input are held in memory at a time.
+//
+// Matches are found with hash chains. Each block goes out stored, with the
+// fixed Huffman table or with a dynamic table built for it, whichever is
+// smallest; the level sets how hard the match search tries.
+class Deflater {
+public:
+    typedef std::function<void(const unsigned char*, size_t)> Writer;
+
+    enum Level {
+        FASTEST,   // First hash candidate only, no lazy matching
+        BALANCED,  // Up to 16 candidates and short lazy matches (stb_image_write's effort)
+        SMALLEST   // Up to 512 candidates, lazy matching at every length
+    };
+
+    // How the output is framed. Pieces of one stream compressed separately
+    // (e.g. in parallel) are raw deflate: each but the last ends in a sync
+    // flush (an empty stored block), leaving it byte-aligned, so the pieces
+    // concatenate into one valid stream.
+    enum Framing {
+        ZLIB,          // zlib header, blocks, Adler-32 trailer
+        SEGMENT,       // Raw blocks ending in a sync flush
+        LAST_SEGMENT   // Raw blocks ending in the final block
+    };
+
+    explicit Deflater(Writer output, Level level = BALANCED, Framing framing = ZLIB);
+
+    // Compress more input
+    void write(const unsigned char* data, size_t length);
+
+    // Compress what is left and end the output as the framing asks
+    void finish();
+
+    // Adler-32 of the input so far
+    uint32_t checksum() const { return adler; }
+
+    // The two zlib header bytes for the level, to put before joined segments
+    static void zlib_header(Level level, unsigned char header[2]);
+
+private:
+    static const int WINDOW_SIZE = 32768;
+    static const int BLOCK_SIZE = 32768;       // New input compressed per block
+    static const int HASH_BITS = 15;
+
+    Writer output;
+    Framing framing;
+    int maxChain;                       // Candidates tried per position
+    int lazyLimit;                      // Matches shorter than this try the next position too
+    std::vector<unsigned char> buffer;  // Up to WINDOW_SIZE bytes of history, then pending input
+    size_t historyLength;               // Bytes at the front of buffer that were already compressed
+    uint32_t basePosition;              // Stream position of buffer[0]
+    uint32_t hashedPosition;            // Positions below this are in the hash chains
+    std::vector<uint32_t> head;         // Hash -> most recent stream position + 1
+    std::vector<uint32_t> chain;        // Position & 0xFFFF -> previous position + 1 with the same hash
+    uint32_t adler;
+    uint64_t bits;
+    int bitCount;
+    std::vector<unsigned char> out;
+    std::vector<uint32_t> tokens;       // The block's literals (< 256) and matches (length << 16 | distance)
+    bool finished;
+
+    void put_bits(uint32_t value, int count);
+    void put_stored(const unsigned char* data, size_t length, bool last);
+    void put_tokens(const uint16_t* literalCodes, const uint8_t* literalLengths,
+                    const uint16_t* distanceCodes, const uint8_t* distanceLengths);
+    void flush_output();
+
+    // Compress every pending byte as one block
+    void compress_block(bool last);
+
+    // Write the tokens in whichever block type comes out smallest
+    void emit_block(bool last);
+
+    // Add every position below `position` that has three bytes to hash
+    void hash_up_to(uint32_t position);
+    int longest_match(uint32_t position, int& distance) const;
+};
+
+// Streaming zlib decompressor. Compressed bytes are pulled through the reader
+// callback when needed and read() hands out exactly the number of bytes
+// asked for, so a caller can decode an image a row at a time.
+class Inflater {
+public:
+    // Fill the buffer with up to `size` compressed bytes; return 0 at end of input
+    typedef std::function<size_t(unsigned char*, size_t)> Reader;
+
+    explicit Inflater(Reader input);
+
+    // Decompress exactly `length` bytes. Throws std::runtime_error if the
+    // data is corrupt or ends early.
+    void read(unsigned char* data, size_t length);
+
+    // Consume the rest of the stream (which must not hold more data) and
+    // verify the Adler-32 trailer
+    void finish();
+
+private:
+    // Canonical Huffman decoding table: a direct lookup on the first
+    // FAST_BITS bits, then a per-length walk for longer codes
+    struct Huffman {
+        static const int FAST_BITS = 9;
+        uint16_t fast[1 << FAST_BITS];  // (length << 9) | symbol, 0 if the code is longer
+        uint16_t count[16];             // Codes of each length
+        std::vector<uint16_t> symbols;  // Symbols ordered by code
+
+        void build(const unsigned char* lengths, int n);
+    };
+
+    Reader input;
+    std::vector<unsigned char> inBuffer;
+    size_t inPos, inEnd;
+    uint64_t bits;
+    int bitCount;
+
+    std::vector<unsigned char> window;  // Last 32 KiB of output, for back references
+    uint64_t produced;                  // Bytes decompressed so far
+    uint32_t adlerA, adlerB;            // Running Adler-32 halves, reduced every KiB
+
+    bool headerDone;
+    bool lastBlock;
+    bool streamDone;
+    int blockType;           // -1 between blocks, else BTYPE of the current block
+    uint32_t storedLeft;     // Bytes left in a stored block
+    int copyLeft;            // Bytes left of the current match
+    int copyDistance;
+    Huffman literals, distances;
+
+    unsigned char next_byte();
+    void need_bits(int count);
+    uint32_t get_bits(int count);
+    int decode(const Huffman& table);
+    void read_header();
+    void start_block();
+    void end_block();
+    void read_dynamic_tables();
+
+    // Advance the decoder; returns the next output byte, or -1 if this step
+    // only changed state (block header, end of block, end of stream)
+    int step();
+};
+
+#endif // DEFLATE_H
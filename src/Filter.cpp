@@ -1,136 +1,507 @@
 #include "Filter.h"
+#include "FilterKernels.h"
+#include "Pipeline.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 #include <algorithm>
 #include <cmath>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <numeric>
 #include <math.h>
+#include <stdexcept>
+#include <utility>
 
 
-// Mean Filter
-void Filter::apply_mean_filter(GrayscaleImage& image, int kernelSize) {
-    GrayscaleImage original = image;
-
-    int halfKernelSize = kernelSize / 2; // Half of the kernel size
-    int height = image.get_height();  // Image height
-    int width = image.get_width();    // Image width
-
-    // Calculate the average of the neighboring pixels for each pixel
-    for (int i = 0; i < height; ++i) {
-        for (int j = 0; j < width; ++j) {
-            int sum = 0;
-            int count = 0;
-
-            // Sum the pixels within the kernel area
-            for (int k = -halfKernelSize; k <= halfKernelSize; ++k) {
-                for (int l = -halfKernelSize; l <= halfKernelSize; ++l) {
-                    int newRow = i + k;
-                    int newCol = j + l;
-
-                    
-                    if (newRow >= 0 && newRow < height && newCol >= 0 && newCol < width) {
-                        sum += original.get_pixel(newRow, newCol);  
-                        count++;  // Increase valid pixel count
-                    } else {
-                        sum += 0;
-                        count++;
-                    }
-                }
-            }
+// Make sure dst has the same dimensions as src, reallocating only when needed
+template <typename Pixel>
+static void prepare_destination(const BasicGrayscaleImage<Pixel>& src, BasicGrayscaleImage<Pixel>& dst) {
+    if (dst.get_width() != src.get_width() || dst.get_height() != src.get_height()) {
+        dst = BasicGrayscaleImage<Pixel>(src.get_width(), src.get_height());
+    }
+}
+
+// Row i of the image, or nullptr (zero padding) when i falls outside it
+template <typename Pixel>
+static const Pixel* row_or_null(const BasicGrayscaleImage<Pixel>& image, int i) {
+    return (i >= 0 && i < image.get_height()) ? image.row(i) : nullptr;
+}
+
+// Fill the 2 * radius + 1 row pointers centred on row `center`
+template <typename Pixel>
+static void fill_window(const BasicGrayscaleImage<Pixel>& image, int center, int radius, const Pixel** window) {
+    for (int t = -radius; t <= radius; ++t) {
+        window[t + radius] = row_or_null(image, center + t);
+    }
+}
+
+static void check_kernel_size(int kernelSize) {
+    if (kernelSize < 0) {
+        throw std::invalid_argument("Kernel size must not be negative.");
+    }
+}
+
+// Smallest band worth scheduling: every band re-primes its sliding state from its halo rows
+static const int MIN_BAND_ROWS = 16;
 
-            // Calculate the mean and update
-            int meanValue;
-            if (count > 0) {
-                meanValue = int(sum / count);
+// Run fn(first, last) over row bands on the shared pool.
+// Each band reads its halo rows straight from the shared source, and every
+// output row depends only on the input, so the result is the same for any thread count.
+static void for_each_band(int height, const std::function<void(int, int)>& fn) {
+    ThreadPool::shared().parallel_bands(height, MIN_BAND_ROWS, fn);
+}
+
+// Box filter over a (2 * radius + 1)^2 window with zero padding.
+// Column sums slide down one row at a time and a running sum walks each row,
+// so the cost per pixel does not depend on the kernel size.
+template <typename Pixel, typename Sum>
+static void box_filter_with(const BasicGrayscaleImage<Pixel>& src, BasicGrayscaleImage<Pixel>& dst, int radius, bool round_to_nearest) {
+    int width = src.get_width();
+    int size = 2 * radius + 1;
+
+    for_each_band(src.get_height(), [&](int first, int last) {
+        std::vector<Sum> sums(width);
+        std::vector<Sum> scratch(width + 1);
+        std::vector<const Pixel*> window(size);
+
+        for (int i = first; i < last; ++i) {
+            if (i == first) {
+                fill_window(src, i, radius, window.data());
+                FilterKernels::box_column_sums(window.data(), size, width, sums.data());
             } else {
-                meanValue = original.get_pixel(i, j);
+                FilterKernels::box_slide(sums.data(), row_or_null(src, i + radius), row_or_null(src, i - radius - 1), width);
             }
-            image.set_pixel(i, j, meanValue);  // Place the updated value
+            FilterKernels::box_row_mean(sums.data(), width, radius, dst.row(i), scratch.data(), round_to_nearest);
         }
+    });
+}
+
+template <typename Pixel>
+static void box_filter(const BasicGrayscaleImage<Pixel>& src, BasicGrayscaleImage<Pixel>& dst, int radius, bool round_to_nearest) {
+    box_filter_with<Pixel, typename PixelTraits<Pixel>::Sum>(src, dst, radius, round_to_nearest);
+}
+
+// 8-bit sums are ints, which the largest windows would overflow
+static void box_filter(const GrayscaleImage& src, GrayscaleImage& dst, int radius, bool round_to_nearest) {
+    if (FilterKernels::box_sums_fit(src.get_width(), src.get_height(), radius)) {
+        box_filter_with<unsigned char, int>(src, dst, radius, round_to_nearest);
+    } else {
+        box_filter_with<unsigned char, int64_t>(src, dst, radius, round_to_nearest);
+    }
+}
+
+// Mean Filter
+template <typename Pixel>
+void Filter::apply_mean_filter(BasicGrayscaleImage<Pixel>& image, int kernelSize) {
+    BasicGrayscaleImage<Pixel> filtered(image.get_width(), image.get_height());
+    apply_mean_filter(image, filtered, kernelSize);
+    image = std::move(filtered);
+}
+
+template <typename Pixel>
+void Filter::apply_mean_filter(const BasicGrayscaleImage<Pixel>& src, BasicGrayscaleImage<Pixel>& dst, int kernelSize) {
+    if (&src == &dst) {
+        apply_mean_filter(dst, kernelSize);
+        return;
     }
+    TRACE_SCOPE(scope, "mean");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(src.get_width()) * src.get_height() * sizeof(Pixel),
+                 static_cast<uint64_t>(src.get_width()) * src.get_height());
+    check_kernel_size(kernelSize);
+    prepare_destination(src, dst);
+
+    // Every tap counts towards the divisor, out-of-image ones as zeros
+    box_filter(src, dst, kernelSize / 2, false);
 }
 
 // Gaussian Smoothing Filter
-void Filter::apply_gaussian_smoothing(GrayscaleImage& image, int kernelSize, double sigma) {
- // Create the Gaussian kernel
-    std::vector<std::vector<double>> kernel(kernelSize, std::vector<double>(kernelSize));
-    double sum = 0.0;
-
-    int halfKernelSize = kernelSize / 2;
-
-    
-    for (int x = -halfKernelSize; x <= halfKernelSize; ++x) {
-        for (int y = -halfKernelSize; y <= halfKernelSize; ++y) {
-            double value = (1.0 / (2.0 * M_PI * sigma * sigma)) * exp(-(x * x + y * y) / (2.0 * sigma * sigma));
-            kernel[x + halfKernelSize][y + halfKernelSize] = value;
-            sum += value;  // Sum the kernel values
-        }
+template <typename Pixel>
+void Filter::apply_gaussian_smoothing(BasicGrayscaleImage<Pixel>& image, int kernelSize, double sigma) {
+    BasicGrayscaleImage<Pixel> filtered(image.get_width(), image.get_height());
+    apply_gaussian_smoothing(image, filtered, kernelSize, sigma);
+    image = std::move(filtered);
+}
+
+template <typename Pixel>
+void Filter::apply_gaussian_smoothing(const BasicGrayscaleImage<Pixel>& src, BasicGrayscaleImage<Pixel>& dst, int kernelSize, double sigma) {
+    if (&src == &dst) {
+        apply_gaussian_smoothing(dst, kernelSize, sigma);
+        return;
     }
+    TRACE_SCOPE(scope, "gauss");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(src.get_width()) * src.get_height() * sizeof(Pixel),
+                 static_cast<uint64_t>(src.get_width()) * src.get_height());
+    check_kernel_size(kernelSize);
+    prepare_destination(src, dst);
 
-    // Normalize the kernel
-    for (int i = 0; i < kernelSize; ++i) {
-        for (int j = 0; j < kernelSize; ++j) {
-            kernel[i][j] /= sum;  // Normalize to make the total sum 1
+    std::shared_ptr<const GaussianKernel> kernel = GaussianKernel::cached(kernelSize, sigma);
+    int radius = kernel->radius;
+    int imageHeight = src.get_height();
+    int imageWidth = src.get_width();
+
+    // Separable vertical + horizontal passes per output row
+    for_each_band(imageHeight, [&](int first, int last) {
+        std::vector<double> scratch(2 * imageWidth);
+        std::vector<const Pixel*> window(2 * radius + 1);
+        for (int i = first; i < last; ++i) {
+            fill_window(src, i, radius, window.data());
+            FilterKernels::gaussian_row(window.data(), imageWidth, *kernel, scratch.data(), dst.row(i));
         }
+    });
+}
+
+// Approximate Gaussian Smoothing from repeated box filters
+template <typename Pixel>
+void Filter::apply_gaussian_box_approximation(BasicGrayscaleImage<Pixel>& image, double sigma, int passes) {
+    BasicGrayscaleImage<Pixel> filtered(image.get_width(), image.get_height());
+    apply_gaussian_box_approximation(image, filtered, sigma, passes);
+    image = std::move(filtered);
+}
+
+template <typename Pixel>
+void Filter::apply_gaussian_box_approximation(const BasicGrayscaleImage<Pixel>& src, BasicGrayscaleImage<Pixel>& dst, double sigma, int passes) {
+    if (&src == &dst) {
+        apply_gaussian_box_approximation(dst, sigma, passes);
+        return;
     }
+    TRACE_SCOPE(scope, "gauss.box");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(src.get_width()) * src.get_height() * sizeof(Pixel),
+                 static_cast<uint64_t>(src.get_width()) * src.get_height());
+    if (passes < 1) {
+        throw std::invalid_argument("Box approximation needs at least one pass.");
+    }
+    prepare_destination(src, dst);
 
-    GrayscaleImage original = image;  // Keep the original image
+    std::vector<int> sizes = FilterKernels::gaussian_box_sizes(sigma, passes);
 
-    int imageHeight = image.get_height();
-    int imageWidth = image.get_width();
+    // Ping-pong between dst and one scratch frame, ending in dst
+    BasicGrayscaleImage<Pixel> scratch(src.get_width(), src.get_height());
+    BasicGrayscaleImage<Pixel>* buffers[2] = { &dst, &scratch };
+    int target = (passes % 2 == 1) ? 0 : 1;
+    const BasicGrayscaleImage<Pixel>* input = &src;
+    for (int p = 0; p < passes; ++p) {
+        box_filter(*input, *buffers[target], sizes[p] / 2, true);
+        input = buffers[target];
+        target ^= 1;
+    }
+}
 
-    // Calculate the weighted sum for each pixel
-    for (int i = 0; i < imageHeight; ++i) {
-        for (int j = 0; j < imageWidth; ++j) {
-            double sum = 0.0;
+// Unsharp Masking Filter
+template <typename Pixel>
+void Filter::apply_unsharp_mask(BasicGrayscaleImage<Pixel>& image, int kernelSize, double amount) {
+    BasicGrayscaleImage<Pixel> sharpened(image.get_width(), image.get_height());
+    apply_unsharp_mask(image, sharpened, kernelSize, amount);
+    image = std::move(sharpened);
+}
 
-            // Apply the kernel to the pixels around the current pixel
-            for (int k = -halfKernelSize; k <= halfKernelSize; ++k) {
-                for (int l = -halfKernelSize; l <= halfKernelSize; ++l) {
-                    int newRow = i + k;
-                    int newCol = j + l;
+template <typename Pixel>
+void Filter::apply_unsharp_mask(const BasicGrayscaleImage<Pixel>& image, BasicGrayscaleImage<Pixel>& result, int kernelSize, double amount) {
+    if (&image == &result) {
+        apply_unsharp_mask(result, kernelSize, amount);
+        return;
+    }
+    TRACE_SCOPE(scope, "unsharp");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(image.get_width()) * image.get_height() * sizeof(Pixel),
+                 static_cast<uint64_t>(image.get_width()) * image.get_height());
 
-                    // Check boundaries of neighboring pixels
-                    if (newRow >= 0 && newRow < imageHeight && newCol >= 0 && newCol < imageWidth) {
-                        sum += original.get_pixel(newRow, newCol) * kernel[k + halfKernelSize][l + halfKernelSize];
-                    }
-                }
-            }
+    // Blur the image using Gaussian smoothing with sigma = 1.0, straight into the destination
+    apply_gaussian_smoothing(image, result, kernelSize, 1.0);
 
-            // Place the updated value
-            int newValue = static_cast<int>(sum);
-            // Clamping is applied
-            newValue = std::max(0, std::min(newValue, 255));
-            image.set_pixel(i, j, newValue);
+    // For each pixel, apply the unsharp mask formula: original + amount * (original - blurred).
+    for_each_band(image.get_height(), [&](int first, int last) {
+        for (int i = first; i < last; ++i) {
+            FilterKernels::unsharp_row(image.row(i), result.row(i), image.get_width(), amount, result.row(i));
         }
+    });
+}
+
+// Median and bilateral: run row_fn(histograms, i) for every row i, with the
+// column histograms holding the rows of its window (clipped to the image)
+static void histogram_filter(const GrayscaleImage& src, int radius,
+                             const std::function<void(const ColumnHistograms&, int)>& row_fn) {
+    if (std::min(2 * radius + 1, src.get_height()) > ColumnHistograms::MAX_ROWS) {
+        throw std::invalid_argument("Kernel too large for the histogram filters.");
     }
+    for_each_band(src.get_height(), [&](int first, int last) {
+        ColumnHistograms histograms(src.get_width());
+        for (int t = first - radius; t <= first + radius; ++t) {
+            histograms.add_row(row_or_null(src, t));
+        }
+        for (int i = first; i < last; ++i) {
+            if (i > first) {
+                histograms.add_row(row_or_null(src, i + radius));
+                histograms.remove_row(row_or_null(src, i - radius - 1));
+            }
+            row_fn(histograms, i);
+        }
+    });
 }
 
-// Unsharp Masking Filter
-void Filter::apply_unsharp_mask(GrayscaleImage& image, int kernelSize, double amount) {
-    // Blur the image using Gaussian smoothing with sigma = 1.0
-    GrayscaleImage blurredImage = image;  
-    apply_gaussian_smoothing(blurredImage, kernelSize, 1.0);  
+// Median Filter
+void Filter::apply_median_filter(GrayscaleImage& image, int kernelSize) {
+    GrayscaleImage filtered(image.get_width(), image.get_height());
+    apply_median_filter(image, filtered, kernelSize);
+    image = std::move(filtered);
+}
 
-    // For each pixel, apply the unsharp mask formula: original + amount * (original - blurred).
-    int image_height = image.get_height();
-    int image_width = image.get_width();
-
-    for (int i = 0; i < image_height; ++i) {
-        for (int j = 0; j < image_width; ++j) {
-            double originalValue = image.get_pixel(i, j);          // Original pixel value
-            double blurredValue = blurredImage.get_pixel(i, j);    // Blurred pixel value
-
-            // Calculate the difference and apply the sharpening amount
-            double edgeValue = originalValue - blurredValue;
-
-            // Increase the amount value
-            double sharpenedValue = originalValue + static_cast<double>(amount * edgeValue);
-            int sharpened_value = int(sharpenedValue);
-            
-            // Clamping
-            sharpened_value = std::max(0, std::min(sharpened_value, 255)); // Clamp between 0-255
-            
-            image.set_pixel(i, j, sharpened_value);  // Place the updated value
+void Filter::apply_median_filter(const GrayscaleImage& src, GrayscaleImage& dst, int kernelSize) {
+    if (&src == &dst) {
+        apply_median_filter(dst, kernelSize);
+        return;
+    }
+    TRACE_SCOPE(scope, "median");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(src.get_width()) * src.get_height(),
+                 static_cast<uint64_t>(src.get_width()) * src.get_height());
+    check_kernel_size(kernelSize);
+    prepare_destination(src, dst);
+
+    int radius = kernelSize / 2;
+    histogram_filter(src, radius, [&](const ColumnHistograms& histograms, int i) {
+        histograms.median_row(radius, dst.row(i));
+    });
+}
+
+// Bilateral Filter
+void Filter::apply_bilateral_filter(GrayscaleImage& image, int kernelSize, double sigmaRange) {
+    GrayscaleImage filtered(image.get_width(), image.get_height());
+    apply_bilateral_filter(image, filtered, kernelSize, sigmaRange);
+    image = std::move(filtered);
+}
+
+void Filter::apply_bilateral_filter(const GrayscaleImage& src, GrayscaleImage& dst, int kernelSize, double sigmaRange) {
+    if (&src == &dst) {
+        apply_bilateral_filter(dst, kernelSize, sigmaRange);
+        return;
+    }
+    TRACE_SCOPE(scope, "bilateral");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(src.get_width()) * src.get_height(),
+                 static_cast<uint64_t>(src.get_width()) * src.get_height());
+    check_kernel_size(kernelSize);
+    if (!(sigmaRange > 0.0)) {
+        throw std::invalid_argument("Range sigma must be positive.");
+    }
+    prepare_destination(src, dst);
+
+    // Range weights by grey-level difference, cut off past 3 sigma
+    float weights[256];
+    int cutoff = static_cast<int>(std::min(256.0, std::ceil(3.0 * sigmaRange) + 1.0));
+    for (int d = 0; d < 256; ++d) {
+        weights[d] = d < cutoff ? static_cast<float>(std::exp(-d * d / (2.0 * sigmaRange * sigmaRange))) : 0.0f;
+    }
+
+    int radius = kernelSize / 2;
+    histogram_filter(src, radius, [&](const ColumnHistograms& histograms, int i) {
+        histograms.bilateral_row(radius, weights, cutoff, src.row(i), dst.row(i));
+    });
+}
+
+// Minimum (maximum) over a (2 * radius + 1)^2 square clipped to the image, in
+// two van Herk / Gil-Werman passes: along the rows with FilterKernels::min_max_row,
+// then down the columns with whole rows as the elements
+template <typename Pixel>
+static void min_max_filter(const BasicGrayscaleImage<Pixel>& src, BasicGrayscaleImage<Pixel>& dst, int radius, bool maximum) {
+    int width = src.get_width();
+    int height = src.get_height();
+    int size = 2 * radius + 1;
+    if (radius == 0) {
+        for (int i = 0; i < height; ++i) {
+            std::copy(src.row(i), src.row(i) + width, dst.row(i));
+        }
+        return;
+    }
+
+    BasicGrayscaleImage<Pixel> across(width, height);
+    for_each_band(height, [&](int first, int last) {
+        std::vector<Pixel> scratch(2 * (static_cast<size_t>(width) + 4 * radius + 1));
+        for (int i = first; i < last; ++i) {
+            FilterKernels::min_max_row(src.row(i), width, radius, maximum, scratch.data(), across.row(i));
         }
+    });
+
+    // Padded row p is image row p - radius (identity outside) and belongs to
+    // block p / size. Output row i combines the backward run from p = i to its
+    // block end with the forward run from the start of its block to p = i + 2 * radius.
+    // Runs are filled only as far as the band's rows reach, so a row costs
+    // about three min_max_rows calls whatever the radius.
+    for_each_band(height, [&](int first, int last) {
+        std::vector<Pixel> identity(width, FilterKernels::min_max_identity<Pixel>(maximum));
+        std::vector<Pixel> backward(static_cast<size_t>(size) * width), forward(static_cast<size_t>(size) * width);
+        int backwardBlock = -1, forwardBlock = -1, forwardFilled = 0;
+        auto padded_row = [&](int p) -> const Pixel* {
+            int i = p - radius;
+            return (i >= 0 && i < height) ? across.row(i) : identity.data();
+        };
+
+        for (int i = first; i < last; ++i) {
+            int back = i, ahead = i + 2 * radius;
+            if (back / size != backwardBlock) {
+                // Later rows of the band need later offsets in this block, never earlier ones
+                backwardBlock = back / size;
+                int start = backwardBlock * size;
+                const Pixel* end = padded_row(start + size - 1);
+                std::copy(end, end + width, &backward[static_cast<size_t>(size - 1) * width]);
+                for (int t = size - 2; t >= back % size; --t) {
+                    Pixel* run = &backward[static_cast<size_t>(t) * width];
+                    FilterKernels::min_max_rows(padded_row(start + t), run + width, width, maximum, run);
+                }
+            }
+            if (ahead / size != forwardBlock) {
+                forwardBlock = ahead / size;
+                forwardFilled = 0;
+            }
+            for (; forwardFilled <= ahead % size; ++forwardFilled) {
+                int t = forwardFilled;
+                Pixel* run = &forward[static_cast<size_t>(t) * width];
+                const Pixel* row = padded_row(forwardBlock * size + t);
+                if (t == 0) {
+                    std::copy(row, row + width, run);
+                } else {
+                    FilterKernels::min_max_rows(run - width, row, width, maximum, run);
+                }
+            }
+            FilterKernels::min_max_rows(&backward[static_cast<size_t>(back % size) * width],
+                                        &forward[static_cast<size_t>(ahead % size) * width], width, maximum, dst.row(i));
+        }
+    });
+}
+
+Filter::Morphology Filter::parse_morphology(const std::string& name) {
+    if (name == "erode") return ERODE;
+    if (name == "dilate") return DILATE;
+    if (name == "open") return OPEN;
+    if (name == "close") return CLOSE;
+    throw std::invalid_argument("Unknown morphology '" + name + "' (erode, dilate, open or close)");
+}
+
+// Morphology
+template <typename Pixel>
+void Filter::apply_morphology(BasicGrayscaleImage<Pixel>& image, Morphology op, int kernelSize) {
+    BasicGrayscaleImage<Pixel> filtered(image.get_width(), image.get_height());
+    apply_morphology(image, filtered, op, kernelSize);
+    image = std::move(filtered);
+}
+
+template <typename Pixel>
+void Filter::apply_morphology(const BasicGrayscaleImage<Pixel>& src, BasicGrayscaleImage<Pixel>& dst, Morphology op,
+                              int kernelSize) {
+    if (&src == &dst) {
+        apply_morphology(dst, op, kernelSize);
+        return;
     }
+    if (op < ERODE || op > CLOSE) {
+        throw std::invalid_argument("Unknown morphology operation.");
+    }
+    TRACE_SCOPE(scope, op == ERODE ? "erode" : op == DILATE ? "dilate" : op == OPEN ? "open" : "close");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(src.get_width()) * src.get_height() * sizeof(Pixel),
+                 static_cast<uint64_t>(src.get_width()) * src.get_height());
+    check_kernel_size(kernelSize);
+    prepare_destination(src, dst);
+
+    int radius = kernelSize / 2;
+    if (op == ERODE || op == DILATE) {
+        min_max_filter(src, dst, radius, op == DILATE);
+        return;
+    }
+    BasicGrayscaleImage<Pixel> first(src.get_width(), src.get_height());
+    min_max_filter(src, first, radius, op == CLOSE);
+    min_max_filter(first, dst, radius, op == OPEN);
+}
+
+// Run fn on every colour plane, one plane per task. Each plane's filter splits
+// into row bands on the same pool, which the waiting threads help with.
+template <typename Pixel>
+static void for_each_color_plane(BasicColorImage<Pixel>& image, const std::function<void(BasicGrayscaleImage<Pixel>&)>& fn) {
+    ThreadPool::shared().parallel_for(image.color_channels(), [&](int c) {
+        fn(image.plane(c));
+    });
+}
+
+template <typename Pixel>
+void Filter::apply_mean_filter(BasicColorImage<Pixel>& image, int kernelSize) {
+    check_kernel_size(kernelSize);
+    for_each_color_plane<Pixel>(image, [&](BasicGrayscaleImage<Pixel>& plane) {
+        apply_mean_filter(plane, kernelSize);
+    });
+}
+
+template <typename Pixel>
+void Filter::apply_gaussian_smoothing(BasicColorImage<Pixel>& image, int kernelSize, double sigma) {
+    check_kernel_size(kernelSize);
+    for_each_color_plane<Pixel>(image, [&](BasicGrayscaleImage<Pixel>& plane) {
+        apply_gaussian_smoothing(plane, kernelSize, sigma);
+    });
+}
+
+template <typename Pixel>
+void Filter::apply_unsharp_mask(BasicColorImage<Pixel>& image, int kernelSize, double amount) {
+    check_kernel_size(kernelSize);
+    for_each_color_plane<Pixel>(image, [&](BasicGrayscaleImage<Pixel>& plane) {
+        apply_unsharp_mask(plane, kernelSize, amount);
+    });
+}
+
+template <typename Pixel>
+void Filter::apply_gaussian_box_approximation(BasicColorImage<Pixel>& image, double sigma, int passes) {
+    for_each_color_plane<Pixel>(image, [&](BasicGrayscaleImage<Pixel>& plane) {
+        apply_gaussian_box_approximation(plane, sigma, passes);
+    });
+}
+
+void Filter::apply_median_filter(ColorImage& image, int kernelSize) {
+    check_kernel_size(kernelSize);
+    for_each_color_plane<unsigned char>(image, [&](GrayscaleImage& plane) {
+        apply_median_filter(plane, kernelSize);
+    });
+}
+
+void Filter::apply_bilateral_filter(ColorImage& image, int kernelSize, double sigmaRange) {
+    check_kernel_size(kernelSize);
+    for_each_color_plane<unsigned char>(image, [&](GrayscaleImage& plane) {
+        apply_bilateral_filter(plane, kernelSize, sigmaRange);
+    });
+}
+
+template <typename Pixel>
+void Filter::apply_morphology(BasicColorImage<Pixel>& image, Morphology op, int kernelSize) {
+    check_kernel_size(kernelSize);
+    for_each_color_plane<Pixel>(image, [&](BasicGrayscaleImage<Pixel>& plane) {
+        apply_morphology(plane, op, kernelSize);
+    });
+}
+
+// The filters for every pixel type
+#define INSTANTIATE_FILTERS(Pixel) \
+    template void Filter::apply_mean_filter<Pixel>(BasicGrayscaleImage<Pixel>&, int); \
+    template void Filter::apply_gaussian_smoothing<Pixel>(BasicGrayscaleImage<Pixel>&, int, double); \
+    template void Filter::apply_unsharp_mask<Pixel>(BasicGrayscaleImage<Pixel>&, int, double); \
+    template void Filter::apply_gaussian_box_approximation<Pixel>(BasicGrayscaleImage<Pixel>&, double, int); \
+    template void Filter::apply_mean_filter<Pixel>(const BasicGrayscaleImage<Pixel>&, BasicGrayscaleImage<Pixel>&, int); \
+    template void Filter::apply_gaussian_smoothing<Pixel>(const BasicGrayscaleImage<Pixel>&, BasicGrayscaleImage<Pixel>&, int, double); \
+    template void Filter::apply_unsharp_mask<Pixel>(const BasicGrayscaleImage<Pixel>&, BasicGrayscaleImage<Pixel>&, int, double); \
+    template void Filter::apply_gaussian_box_approximation<Pixel>(const BasicGrayscaleImage<Pixel>&, BasicGrayscaleImage<Pixel>&, double, int); \
+    template void Filter::apply_mean_filter<Pixel>(BasicColorImage<Pixel>&, int); \
+    template void Filter::apply_gaussian_smoothing<Pixel>(BasicColorImage<Pixel>&, int, double); \
+    template void Filter::apply_unsharp_mask<Pixel>(BasicColorImage<Pixel>&, int, double); \
+    template void Filter::apply_gaussian_box_approximation<Pixel>(BasicColorImage<Pixel>&, double, int); \
+    template void Filter::apply_morphology<Pixel>(BasicGrayscaleImage<Pixel>&, Morphology, int); \
+    template void Filter::apply_morphology<Pixel>(const BasicGrayscaleImage<Pixel>&, BasicGrayscaleImage<Pixel>&, Morphology, int); \
+    template void Filter::apply_morphology<Pixel>(BasicColorImage<Pixel>&, Morphology, int);
+
+INSTANTIATE_FILTERS(unsigned char)
+INSTANTIATE_FILTERS(uint16_t)
+INSTANTIATE_FILTERS(float)
+
+// Secret images go through the fused pipeline stages, which produce the same
+// values as the filters above while reading and writing the arrays row by row
+void Filter::apply_mean_filter(SecretImage& image, int kernelSize) {
+    Pipeline::mean(kernelSize).run(image);
+}
+
+void Filter::apply_gaussian_smoothing(SecretImage& image, int kernelSize, double sigma) {
+    Pipeline::gaussian(kernelSize, sigma).run(image);
+}
+
+void Filter::apply_unsharp_mask(SecretImage& image, int kernelSize, double amount) {
+    Pipeline::unsharp(kernelSize, amount).run(image);
 }
@@ -1,18 +1,99 @@
 #ifndef FILTER_H
 #define FILTER_H
 
+#include "ColorImage.h"
 #include "GrayscaleImage.h"
+#include "SecretImage.h"
+#include <string>
 
+// The image filters are templates over the pixel type, instantiated for
+// GrayscaleImage, GrayscaleImage16 and GrayscaleImageF. Each runs the
+// FilterKernels variant for its pixel type: SIMD and fixed point for 8 bits,
+// wider accumulators for 16 bits and double arithmetic for float.
 class Filter {
 public:
     // Apply the Mean Filter
-    static void apply_mean_filter(GrayscaleImage& image, int kernelSize = 3);
+    template <typename Pixel>
+    static void apply_mean_filter(BasicGrayscaleImage<Pixel>& image, int kernelSize = 3);
 
     // Apply Gaussian Smoothing Filter
-    static void apply_gaussian_smoothing(GrayscaleImage& image, int kernelSize = 3, double sigma = 1.0);
+    template <typename Pixel>
+    static void apply_gaussian_smoothing(BasicGrayscaleImage<Pixel>& image, int kernelSize = 3, double sigma = 1.0);
 
     // Apply Unsharp Masking Filter
-    static void apply_unsharp_mask(GrayscaleImage& image, int kernelSize = 3, double amount = 1.5);
+    template <typename Pixel>
+    static void apply_unsharp_mask(BasicGrayscaleImage<Pixel>& image, int kernelSize = 3, double amount = 1.5);
+
+    // Approximate Gaussian Smoothing with repeated box filters.
+    // Cost is independent of sigma; useful for large sigma where the exact kernel gets wide.
+    template <typename Pixel>
+    static void apply_gaussian_box_approximation(BasicGrayscaleImage<Pixel>& image, double sigma, int passes = 3);
+
+    // Out-of-place variants: read src, write the result into dst.
+    // dst is reallocated only if its dimensions differ from src, so two
+    // frames can be ping-ponged through a filter chain without copies.
+    template <typename Pixel>
+    static void apply_mean_filter(const BasicGrayscaleImage<Pixel>& src, BasicGrayscaleImage<Pixel>& dst, int kernelSize = 3);
+    template <typename Pixel>
+    static void apply_gaussian_smoothing(const BasicGrayscaleImage<Pixel>& src, BasicGrayscaleImage<Pixel>& dst,
+                                         int kernelSize = 3, double sigma = 1.0);
+    template <typename Pixel>
+    static void apply_unsharp_mask(const BasicGrayscaleImage<Pixel>& src, BasicGrayscaleImage<Pixel>& dst,
+                                   int kernelSize = 3, double amount = 1.5);
+    template <typename Pixel>
+    static void apply_gaussian_box_approximation(const BasicGrayscaleImage<Pixel>& src, BasicGrayscaleImage<Pixel>& dst,
+                                                 double sigma, int passes = 3);
+
+    // Rank and edge-preserving filters over a square window of radius
+    // kernelSize / 2, clipped to the image so borders are not darkened by zero
+    // padding. Their cost per pixel does not grow with the kernel size.
+
+    // Median, from sliding 256-bin histograms; the lower median where a
+    // clipped window holds an even count. 8-bit pixels only.
+    static void apply_median_filter(GrayscaleImage& image, int kernelSize = 3);
+    static void apply_median_filter(const GrayscaleImage& src, GrayscaleImage& dst, int kernelSize = 3);
+
+    // Bilateral filter with a box spatial window: the window's pixels averaged
+    // with weights exp(-d^2 / (2 sigmaRange^2)) for a difference of d grey
+    // levels from the centre pixel (none past 3 sigmaRange). 8-bit pixels only.
+    static void apply_bilateral_filter(GrayscaleImage& image, int kernelSize = 5, double sigmaRange = 20.0);
+    static void apply_bilateral_filter(const GrayscaleImage& src, GrayscaleImage& dst, int kernelSize = 5,
+                                       double sigmaRange = 20.0);
+
+    // Morphology with a square structuring element: erode takes the window
+    // minimum, dilate the maximum, open erodes then dilates (removing bright
+    // specks) and close dilates then erodes (filling dark ones)
+    enum Morphology { ERODE, DILATE, OPEN, CLOSE };
+
+    // "erode", "dilate", "open" or "close"; throws std::invalid_argument otherwise
+    static Morphology parse_morphology(const std::string& name);
+
+    template <typename Pixel>
+    static void apply_morphology(BasicGrayscaleImage<Pixel>& image, Morphology op, int kernelSize = 3);
+    template <typename Pixel>
+    static void apply_morphology(const BasicGrayscaleImage<Pixel>& src, BasicGrayscaleImage<Pixel>& dst, Morphology op,
+                                 int kernelSize = 3);
+
+    // Colour images: the grey filter on every colour plane, planes in parallel
+    // on the shared pool. An alpha plane is left as it is.
+    template <typename Pixel>
+    static void apply_mean_filter(BasicColorImage<Pixel>& image, int kernelSize = 3);
+    template <typename Pixel>
+    static void apply_gaussian_smoothing(BasicColorImage<Pixel>& image, int kernelSize = 3, double sigma = 1.0);
+    template <typename Pixel>
+    static void apply_unsharp_mask(BasicColorImage<Pixel>& image, int kernelSize = 3, double amount = 1.5);
+    template <typename Pixel>
+    static void apply_gaussian_box_approximation(BasicColorImage<Pixel>& image, double sigma, int passes = 3);
+    static void apply_median_filter(ColorImage& image, int kernelSize = 3);
+    static void apply_bilateral_filter(ColorImage& image, int kernelSize = 5, double sigmaRange = 20.0);
+    template <typename Pixel>
+    static void apply_morphology(BasicColorImage<Pixel>& image, Morphology op, int kernelSize = 3);
+
+    // In-place variants on a secret image: rows are read from and written back
+    // to the triangular arrays, without reconstructing the full image
+    static void apply_mean_filter(SecretImage& image, int kernelSize = 3);
+    static void apply_gaussian_smoothing(SecretImage& image, int kernelSize = 3, double sigma = 1.0);
+    static void apply_unsharp_mask(SecretImage& image, int kernelSize = 3, double amount = 1.5);
 };
 
 #endif // FILTER_H
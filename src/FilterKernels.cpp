@@ -0,0 +1,1422 @@
+#include "FilterKernels.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <math.h>
+#include <mutex>
+#include <utility>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CLEARVISION_X86_SIMD 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Separable sums that land this close to an integer are re-evaluated with the
+// direct 2-D kernel, so truncation matches the original filter bit for bit.
+// The separable and direct sums differ by a few ulps of 255, far below this.
+static const double TIE_TOLERANCE = 1e-7;
+
+// Fixed point: vertical sums of Q15 taps keep 7 fractional bits (so they fit
+// in int16 for the horizontal pass), and the horizontal Q7 x Q15 sums are
+// truncated to whole pixel values like the double path
+static const int FIXED_ONE = 1 << 15;
+static const int FIXED_VERTICAL_SHIFT = 8;
+static const int FIXED_OUTPUT_SHIFT = 22;
+
+// Kernels kept by GaussianKernel::cached
+static const size_t KERNEL_CACHE_SIZE = 16;
+
+GaussianKernel::GaussianKernel(int kernelSize, double sigma) : radius(kernelSize / 2) {
+    int size = 2 * radius + 1;
+
+    // 2-D weights, same formula and summation order as the direct filter
+    reference.resize(size * size);
+    double sum = 0.0;
+    for (int x = -radius; x <= radius; ++x) {
+        for (int y = -radius; y <= radius; ++y) {
+            double value = (1.0 / (2.0 * M_PI * sigma * sigma)) * exp(-(x * x + y * y) / (2.0 * sigma * sigma));
+            reference[(x + radius) * size + (y + radius)] = value;
+            sum += value;
+        }
+    }
+    for (int i = 0; i < size * size; ++i) {
+        reference[i] /= sum;
+    }
+
+    // 1-D weights for the separable passes
+    taps.resize(size);
+    double tapSum = 0.0;
+    for (int x = -radius; x <= radius; ++x) {
+        taps[x + radius] = exp(-(x * x) / (2.0 * sigma * sigma));
+        tapSum += taps[x + radius];
+    }
+    for (int i = 0; i < size; ++i) {
+        taps[i] /= tapSum;
+    }
+
+    // Q15 taps rounded to nearest; the rounding residue goes to the centre tap
+    // so they sum to exactly 1.0 and flat areas keep their value
+    fixedIdentity = false;
+    if (std::isfinite(tapSum) && tapSum > 0.0) {
+        std::vector<int> rounded(size);
+        int others = 0;
+        for (int i = 0; i < size; ++i) {
+            rounded[i] = static_cast<int>(std::floor(taps[i] * FIXED_ONE + 0.5));
+            if (i != radius) others += rounded[i];
+        }
+        rounded[radius] = FIXED_ONE - others;
+        wideTaps.assign(rounded.begin(), rounded.end());
+        if (size <= MAX_FIXED_SIZE) {
+            fixedIdentity = rounded[radius] >= FIXED_ONE;
+            if (!fixedIdentity) {
+                fixedTaps.assign(rounded.begin(), rounded.end());
+            } else {
+                fixedTaps.assign(size, 0);
+            }
+        }
+    }
+}
+
+std::shared_ptr<const GaussianKernel> GaussianKernel::cached(int kernelSize, double sigma) {
+    typedef std::pair<std::pair<int, double>, std::shared_ptr<const GaussianKernel>> Entry;
+    static std::mutex mutex;
+    static std::vector<Entry> recent;  // Most recently used first
+    std::pair<int, double> key(kernelSize, sigma);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < recent.size(); ++i) {
+            if (recent[i].first == key) {
+                std::rotate(recent.begin(), recent.begin() + i, recent.begin() + i + 1);
+                return recent[0].second;
+            }
+        }
+    }
+
+    // Build outside the lock; a racing thread may build the same kernel, which is harmless
+    std::shared_ptr<const GaussianKernel> kernel = std::make_shared<GaussianKernel>(kernelSize, sigma);
+    std::lock_guard<std::mutex> lock(mutex);
+    recent.insert(recent.begin(), Entry(key, kernel));
+    if (recent.size() > KERNEL_CACHE_SIZE) {
+        recent.pop_back();
+    }
+    return kernel;
+}
+
+// ---------------------------------------------------------------------------
+// Runtime dispatch
+// ---------------------------------------------------------------------------
+
+static FilterKernels::SimdLevel detect_simd_level() {
+#ifdef CLEARVISION_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return FilterKernels::SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2")) return FilterKernels::SIMD_SSE2;
+#endif
+    return FilterKernels::SIMD_SCALAR;
+}
+
+// True if the environment variable is set to anything but "" or "0"
+static bool environment_flag(const char* name) {
+    const char* value = std::getenv(name);
+    return value != nullptr && *value != '\0' && std::strcmp(value, "0") != 0;
+}
+
+// Highest level the kernels may use; SIMD_AVX2 means "whatever the CPU has"
+static std::atomic<int>& simd_limit() {
+    static std::atomic<int> limit(environment_flag("CLEARVISION_FORCE_SCALAR") ? FilterKernels::SIMD_SCALAR : FilterKernels::SIMD_AVX2);
+    return limit;
+}
+
+static std::atomic<bool>& exact_mode() {
+    static std::atomic<bool> exact(environment_flag("CLEARVISION_EXACT"));
+    return exact;
+}
+
+FilterKernels::SimdLevel FilterKernels::detected_simd_level() {
+    static const SimdLevel level = detect_simd_level();
+    return level;
+}
+
+FilterKernels::SimdLevel FilterKernels::simd_level() {
+    return static_cast<SimdLevel>(std::min<int>(simd_limit().load(std::memory_order_relaxed), detected_simd_level()));
+}
+
+void FilterKernels::set_simd_limit(SimdLevel limit) {
+    simd_limit().store(limit);
+}
+
+void FilterKernels::set_force_scalar(bool force) {
+    set_simd_limit(force ? SIMD_SCALAR : SIMD_AVX2);
+}
+
+void FilterKernels::set_exact(bool exact) {
+    exact_mode().store(exact);
+}
+
+bool FilterKernels::exact() {
+    return exact_mode().load(std::memory_order_relaxed);
+}
+
+const char* FilterKernels::simd_level_name(SimdLevel level) {
+    switch (level) {
+        case SIMD_AVX2: return "avx2";
+        case SIMD_SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Vector loops. Each returns how many leading pixels it handled; the caller
+// finishes the tail with the scalar loop. Per pixel they perform the same
+// operations in the same order as the scalar code (no FMA contraction), so
+// results agree bit for bit.
+// ---------------------------------------------------------------------------
+
+#ifdef CLEARVISION_X86_SIMD
+
+// sums += plus - minus, 16 pixels at a time with 16-bit differences widened to 32 bits
+TARGET_SSE2
+static int box_accumulate_sse2(int* sums, const unsigned char* plus, const unsigned char* minus, int width) {
+    const __m128i zero = _mm_setzero_si128();
+    int j = 0;
+    for (; j + 16 <= width; j += 16) {
+        __m128i in = plus ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(plus + j)) : zero;
+        __m128i out = minus ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(minus + j)) : zero;
+        __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(in, zero), _mm_unpacklo_epi8(out, zero));
+        __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(in, zero), _mm_unpackhi_epi8(out, zero));
+
+        __m128i* s = reinterpret_cast<__m128i*>(sums + j);
+        _mm_storeu_si128(s + 0, _mm_add_epi32(_mm_loadu_si128(s + 0), _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16)));
+        _mm_storeu_si128(s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1), _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16)));
+        _mm_storeu_si128(s + 2, _mm_add_epi32(_mm_loadu_si128(s + 2), _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16)));
+        _mm_storeu_si128(s + 3, _mm_add_epi32(_mm_loadu_si128(s + 3), _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16)));
+    }
+    return j;
+}
+
+TARGET_AVX2
+static int box_accumulate_avx2(int* sums, const unsigned char* plus, const unsigned char* minus, int width) {
+    const __m256i zero = _mm256_setzero_si256();
+    int j = 0;
+    for (; j + 16 <= width; j += 16) {
+        __m256i in = plus ? _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(plus + j))) : zero;
+        __m256i out = minus ? _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(minus + j))) : zero;
+        __m256i diff = _mm256_sub_epi16(in, out);
+
+        __m256i* s = reinterpret_cast<__m256i*>(sums + j);
+        _mm256_storeu_si256(s + 0, _mm256_add_epi32(_mm256_loadu_si256(s + 0), _mm256_cvtepi16_epi32(_mm256_castsi256_si128(diff))));
+        _mm256_storeu_si256(s + 1, _mm256_add_epi32(_mm256_loadu_si256(s + 1), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(diff, 1))));
+    }
+    return j;
+}
+
+// out[j] = (prefix[j + radius + 1] - prefix[j - radius] + bias) / divisor over [from, to), 8 at a time.
+// Division runs in double precision, which is exact for these integer ranges.
+TARGET_SSE2
+static int box_divide_sse2(const uint32_t* prefix, int radius, int bias, int divisor, int from, int to, unsigned char* out) {
+    const __m128i biasVector = _mm_set1_epi32(bias);
+    const __m128d divisorVector = _mm_set1_pd(static_cast<double>(divisor));
+    int j = from;
+    for (; j + 8 <= to; j += 8) {
+        __m128i quotients[2];
+        for (int half = 0; half < 2; ++half) {
+            const uint32_t* hi = prefix + j + 4 * half + radius + 1;
+            const uint32_t* lo = prefix + j + 4 * half - radius;
+            __m128i acc = _mm_add_epi32(_mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hi)),
+                                                      _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo))), biasVector);
+            __m128d a = _mm_div_pd(_mm_cvtepi32_pd(acc), divisorVector);
+            __m128d b = _mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2))), divisorVector);
+            quotients[half] = _mm_unpacklo_epi64(_mm_cvttpd_epi32(a), _mm_cvttpd_epi32(b));
+        }
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(quotients[0], quotients[1]), _mm_setzero_si128());
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + j), packed);
+    }
+    return j;
+}
+
+TARGET_AVX2
+static int box_divide_avx2(const uint32_t* prefix, int radius, int bias, int divisor, int from, int to, unsigned char* out) {
+    const __m256i biasVector = _mm256_set1_epi32(bias);
+    const __m256d divisorVector = _mm256_set1_pd(static_cast<double>(divisor));
+    int j = from;
+    for (; j + 8 <= to; j += 8) {
+        __m256i acc = _mm256_add_epi32(_mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(prefix + j + radius + 1)),
+                                                        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prefix + j - radius))), biasVector);
+        __m256d a = _mm256_div_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(acc)), divisorVector);
+        __m256d b = _mm256_div_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(acc, 1)), divisorVector);
+        __m128i packed16 = _mm_packs_epi32(_mm256_cvttpd_epi32(a), _mm256_cvttpd_epi32(b));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + j), _mm_packus_epi16(packed16, packed16));
+    }
+    return j;
+}
+
+// scratch[j] += weight * pixels[j]
+TARGET_SSE2
+static int weighted_accumulate_sse2(double* scratch, const unsigned char* pixels, double weight, int width) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128d w = _mm_set1_pd(weight);
+    int j = 0;
+    for (; j + 8 <= width; j += 8) {
+        __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixels + j));
+        __m128i words = _mm_unpacklo_epi8(bytes, zero);
+        __m128i lo = _mm_unpacklo_epi16(words, zero);
+        __m128i hi = _mm_unpackhi_epi16(words, zero);
+        __m128d p[4] = {
+            _mm_cvtepi32_pd(lo), _mm_cvtepi32_pd(_mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2))),
+            _mm_cvtepi32_pd(hi), _mm_cvtepi32_pd(_mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2)))
+        };
+        for (int q = 0; q < 4; ++q) {
+            double* s = scratch + j + 2 * q;
+            _mm_storeu_pd(s, _mm_add_pd(_mm_loadu_pd(s), _mm_mul_pd(w, p[q])));
+        }
+    }
+    return j;
+}
+
+TARGET_AVX2
+static int weighted_accumulate_avx2(double* scratch, const unsigned char* pixels, double weight, int width) {
+    const __m256d w = _mm256_set1_pd(weight);
+    int j = 0;
+    for (; j + 8 <= width; j += 8) {
+        __m256i ints = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixels + j)));
+        __m256d lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(ints));
+        __m256d hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(ints, 1));
+        _mm256_storeu_pd(scratch + j, _mm256_add_pd(_mm256_loadu_pd(scratch + j), _mm256_mul_pd(w, lo)));
+        _mm256_storeu_pd(scratch + j + 4, _mm256_add_pd(_mm256_loadu_pd(scratch + j + 4), _mm256_mul_pd(w, hi)));
+    }
+    return j;
+}
+
+// sums[j] = sum_t taps[t] * scratch[j - radius + t] over [from, to)
+TARGET_SSE2
+static int horizontal_taps_sse2(const double* scratch, const double* taps, int size, int radius, int from, int to, double* sums) {
+    int j = from;
+    for (; j + 2 <= to; j += 2) {
+        __m128d acc = _mm_setzero_pd();
+        const double* base = scratch + j - radius;
+        for (int t = 0; t < size; ++t) {
+            acc = _mm_add_pd(acc, _mm_mul_pd(_mm_set1_pd(taps[t]), _mm_loadu_pd(base + t)));
+        }
+        _mm_storeu_pd(sums + j, acc);
+    }
+    return j;
+}
+
+TARGET_AVX2
+static int horizontal_taps_avx2(const double* scratch, const double* taps, int size, int radius, int from, int to, double* sums) {
+    int j = from;
+    for (; j + 4 <= to; j += 4) {
+        __m256d acc = _mm256_setzero_pd();
+        const double* base = scratch + j - radius;
+        for (int t = 0; t < size; ++t) {
+            acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_set1_pd(taps[t]), _mm256_loadu_pd(base + t)));
+        }
+        _mm256_storeu_pd(sums + j, acc);
+    }
+    return j;
+}
+
+// out = saturate_u8(trunc(o + amount * (o - b)))
+TARGET_SSE2
+static int unsharp_sse2(const unsigned char* original, const unsigned char* blurred, int width, double amount, unsigned char* out) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128d a = _mm_set1_pd(amount);
+    int j = 0;
+    for (; j + 8 <= width; j += 8) {
+        __m128i o16 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(original + j)), zero);
+        __m128i b16 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(blurred + j)), zero);
+        __m128i o32[2] = { _mm_unpacklo_epi16(o16, zero), _mm_unpackhi_epi16(o16, zero) };
+        __m128i b32[2] = { _mm_unpacklo_epi16(b16, zero), _mm_unpackhi_epi16(b16, zero) };
+        __m128i result[2];
+        for (int half = 0; half < 2; ++half) {
+            __m128d o0 = _mm_cvtepi32_pd(o32[half]);
+            __m128d o1 = _mm_cvtepi32_pd(_mm_shuffle_epi32(o32[half], _MM_SHUFFLE(1, 0, 3, 2)));
+            __m128d b0 = _mm_cvtepi32_pd(b32[half]);
+            __m128d b1 = _mm_cvtepi32_pd(_mm_shuffle_epi32(b32[half], _MM_SHUFFLE(1, 0, 3, 2)));
+            __m128d s0 = _mm_add_pd(o0, _mm_mul_pd(a, _mm_sub_pd(o0, b0)));
+            __m128d s1 = _mm_add_pd(o1, _mm_mul_pd(a, _mm_sub_pd(o1, b1)));
+            result[half] = _mm_unpacklo_epi64(_mm_cvttpd_epi32(s0), _mm_cvttpd_epi32(s1));
+        }
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(result[0], result[1]), zero);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + j), packed);
+    }
+    return j;
+}
+
+TARGET_AVX2
+static int unsharp_avx2(const unsigned char* original, const unsigned char* blurred, int width, double amount, unsigned char* out) {
+    const __m256d a = _mm256_set1_pd(amount);
+    int j = 0;
+    for (; j + 8 <= width; j += 8) {
+        __m256i o = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(original + j)));
+        __m256i b = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(blurred + j)));
+        __m256d o0 = _mm256_cvtepi32_pd(_mm256_castsi256_si128(o));
+        __m256d o1 = _mm256_cvtepi32_pd(_mm256_extracti128_si256(o, 1));
+        __m256d b0 = _mm256_cvtepi32_pd(_mm256_castsi256_si128(b));
+        __m256d b1 = _mm256_cvtepi32_pd(_mm256_extracti128_si256(b, 1));
+        __m256d s0 = _mm256_add_pd(o0, _mm256_mul_pd(a, _mm256_sub_pd(o0, b0)));
+        __m256d s1 = _mm256_add_pd(o1, _mm256_mul_pd(a, _mm256_sub_pd(o1, b1)));
+        __m128i packed16 = _mm_packs_epi32(_mm256_cvttpd_epi32(s0), _mm256_cvttpd_epi32(s1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + j), _mm_packus_epi16(packed16, packed16));
+    }
+    return j;
+}
+
+// Two adjacent Q15 taps as the int16 pair _mm_madd_epi16 multiplies with
+// (the second one 0 past the end)
+static inline int tap_pair(const int16_t* taps, int t, int size) {
+    unsigned lo = static_cast<uint16_t>(taps[t]);
+    unsigned hi = (t + 1 < size) ? static_cast<uint16_t>(taps[t + 1]) : 0u;
+    return static_cast<int>(lo | (hi << 16));
+}
+
+// Fixed-point vertical pass: out[j] = round(sum_t taps[t] * rows[t][j] / 2^8).
+// N > 0 fixes the tap count at compile time so the tap loop unrolls.
+// Rows are paired so one madd applies two taps to 4 pixels.
+template <int N>
+TARGET_SSE2
+static int fixed_vertical_sse2(const unsigned char* const* rows, const int16_t* taps, int runtimeSize, int width, int16_t* out) {
+    const int size = N > 0 ? N : runtimeSize;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << (FIXED_VERTICAL_SHIFT - 1));
+    int j = 0;
+    for (; j + 8 <= width; j += 8) {
+        __m128i lo = round, hi = round;
+        for (int t = 0; t < size; t += 2) {
+            __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[t] + j)), zero);
+            __m128i b = (t + 1 < size) ? _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[t + 1] + j)), zero) : zero;
+            __m128i w = _mm_set1_epi32(tap_pair(taps, t, size));
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+        }
+        lo = _mm_srai_epi32(lo, FIXED_VERTICAL_SHIFT);
+        hi = _mm_srai_epi32(hi, FIXED_VERTICAL_SHIFT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j), _mm_packs_epi32(lo, hi));
+    }
+    return j;
+}
+
+// 16 pixels per step; unpacking and packing stay within 128-bit lanes, so
+// pixel order is preserved without a permute
+template <int N>
+TARGET_AVX2
+static int fixed_vertical_avx2(const unsigned char* const* rows, const int16_t* taps, int runtimeSize, int width, int16_t* out) {
+    const int size = N > 0 ? N : runtimeSize;
+    const __m256i round = _mm256_set1_epi32(1 << (FIXED_VERTICAL_SHIFT - 1));
+    int j = 0;
+    for (; j + 16 <= width; j += 16) {
+        __m256i lo = round, hi = round;
+        for (int t = 0; t < size; t += 2) {
+            __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[t] + j)));
+            __m256i b = (t + 1 < size) ? _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[t + 1] + j)))
+                                       : _mm256_setzero_si256();
+            __m256i w = _mm256_set1_epi32(tap_pair(taps, t, size));
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+        }
+        lo = _mm256_srai_epi32(lo, FIXED_VERTICAL_SHIFT);
+        hi = _mm256_srai_epi32(hi, FIXED_VERTICAL_SHIFT);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j), _mm256_packs_epi32(lo, hi));
+    }
+    return j;
+}
+
+// Fixed-point horizontal pass over [from, to), where every tap stays inside the row:
+// out[j] = sum_t taps[t] * v[j - radius + t] / 2^22, truncated
+template <int N>
+TARGET_SSE2
+static int fixed_horizontal_sse2(const int16_t* v, const int16_t* taps, int runtimeSize, int radius, int from, int to,
+                                 unsigned char* out) {
+    const int size = N > 0 ? N : runtimeSize;
+    int j = from;
+    for (; j + 8 <= to; j += 8) {
+        __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+        const int16_t* base = v + j - radius;
+        for (int t = 0; t < size; t += 2) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(base + t));
+            __m128i y = (t + 1 < size) ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(base + t + 1)) : x;
+            __m128i w = _mm_set1_epi32(tap_pair(taps, t, size));
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(x, y), w));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(x, y), w));
+        }
+        __m128i packed = _mm_packs_epi32(_mm_srai_epi32(lo, FIXED_OUTPUT_SHIFT), _mm_srai_epi32(hi, FIXED_OUTPUT_SHIFT));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + j), _mm_packus_epi16(packed, packed));
+    }
+    return j;
+}
+
+template <int N>
+TARGET_AVX2
+static int fixed_horizontal_avx2(const int16_t* v, const int16_t* taps, int runtimeSize, int radius, int from, int to,
+                                 unsigned char* out) {
+    const int size = N > 0 ? N : runtimeSize;
+    int j = from;
+    for (; j + 16 <= to; j += 16) {
+        __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+        const int16_t* base = v + j - radius;
+        for (int t = 0; t < size; t += 2) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(base + t));
+            __m256i y = (t + 1 < size) ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(base + t + 1)) : x;
+            __m256i w = _mm256_set1_epi32(tap_pair(taps, t, size));
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(x, y), w));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(x, y), w));
+        }
+        __m256i packed = _mm256_packs_epi32(_mm256_srai_epi32(lo, FIXED_OUTPUT_SHIFT), _mm256_srai_epi32(hi, FIXED_OUTPUT_SHIFT));
+        __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(packed, packed), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j), _mm256_castsi256_si128(bytes));
+    }
+    return j;
+}
+
+// Fixed-point unsharp: out = saturate_u8(floor((o * 2^shift + scaled * (o - b)) / 2^shift)),
+// one madd per 4 pixels on (o, o - b) pairs
+TARGET_SSE2
+static int unsharp_fixed_sse2(const unsigned char* original, const unsigned char* blurred, int width, int shift, int scaled,
+                              unsigned char* out) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w = _mm_set1_epi32(static_cast<int>((1u << shift) | (static_cast<unsigned>(static_cast<uint16_t>(scaled)) << 16)));
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    int j = 0;
+    for (; j + 8 <= width; j += 8) {
+        __m128i o = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(original + j)), zero);
+        __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(blurred + j)), zero);
+        __m128i d = _mm_sub_epi16(o, b);
+        __m128i lo = _mm_sra_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(o, d), w), count);
+        __m128i hi = _mm_sra_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(o, d), w), count);
+        __m128i packed = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + j), _mm_packus_epi16(packed, packed));
+    }
+    return j;
+}
+
+TARGET_AVX2
+static int unsharp_fixed_avx2(const unsigned char* original, const unsigned char* blurred, int width, int shift, int scaled,
+                              unsigned char* out) {
+    const __m256i w = _mm256_set1_epi32(static_cast<int>((1u << shift) | (static_cast<unsigned>(static_cast<uint16_t>(scaled)) << 16)));
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    int j = 0;
+    for (; j + 16 <= width; j += 16) {
+        __m256i o = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(original + j)));
+        __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blurred + j)));
+        __m256i d = _mm256_sub_epi16(o, b);
+        __m256i lo = _mm256_sra_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(o, d), w), count);
+        __m256i hi = _mm256_sra_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(o, d), w), count);
+        __m256i packed = _mm256_packs_epi32(lo, hi);
+        __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(packed, packed), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j), _mm256_castsi256_si128(bytes));
+    }
+    return j;
+}
+
+#endif // CLEARVISION_X86_SIMD
+
+// ---------------------------------------------------------------------------
+// Kernels
+// ---------------------------------------------------------------------------
+
+// sums += plus - minus, vector body plus scalar tail
+static void box_accumulate(int* sums, const unsigned char* plus, const unsigned char* minus, int width) {
+    int j = 0;
+#ifdef CLEARVISION_X86_SIMD
+    switch (FilterKernels::simd_level()) {
+        case FilterKernels::SIMD_AVX2: j = box_accumulate_avx2(sums, plus, minus, width); break;
+        case FilterKernels::SIMD_SSE2: j = box_accumulate_sse2(sums, plus, minus, width); break;
+        default: break;
+    }
+#endif
+    if (plus != nullptr && minus != nullptr) {
+        for (; j < width; ++j) {
+            sums[j] += plus[j] - minus[j];
+        }
+    } else if (plus != nullptr) {
+        for (; j < width; ++j) {
+            sums[j] += plus[j];
+        }
+    } else if (minus != nullptr) {
+        for (; j < width; ++j) {
+            sums[j] -= minus[j];
+        }
+    }
+}
+
+// Per-column sums over a vertical window of rows
+void FilterKernels::box_column_sums(const unsigned char* const* window, int count, int width, int* sums) {
+    std::fill(sums, sums + width, 0);
+    for (int t = 0; t < count; ++t) {
+        if (window[t] != nullptr) {  // nullptr rows are zero padding
+            box_accumulate(sums, window[t], nullptr, width);
+        }
+    }
+}
+
+// Slide the column sums one row down
+void FilterKernels::box_slide(int* sums, const unsigned char* entering, const unsigned char* leaving, int width) {
+    if (entering != nullptr || leaving != nullptr) {
+        box_accumulate(sums, entering, leaving, width);
+    }
+}
+
+// Horizontal sum over column sums, one add and one subtract per pixel
+void FilterKernels::box_row_mean(const int* sums, int width, int radius, unsigned char* out, int* scratch,
+                                 bool round_to_nearest) {
+    int size = 2 * radius + 1;
+    int divisor = size * size;  // Out-of-image taps count as zeros
+    int bias = round_to_nearest ? divisor / 2 : 0;
+
+    if (simd_level() == SIMD_SCALAR) {
+        int acc = 0;
+        for (int t = 0; t <= radius && t < width; ++t) {
+            acc += sums[t];
+        }
+        for (int j = 0; j < width; ++j) {
+            out[j] = static_cast<unsigned char>((acc + bias) / divisor);
+
+            int entering = j + radius + 1;
+            int leaving = j - radius;
+            if (entering < width) acc += sums[entering];
+            if (leaving >= 0) acc -= sums[leaving];
+        }
+        return;
+    }
+
+    // Prefix sums turn every window into one subtraction, which vectorizes.
+    // Over a wide row they pass 2^31, so they wrap modulo 2^32 (unsigned, to
+    // stay defined); callers keep every window sum within an int (box_sums_fit),
+    // so the differences are exact.
+    uint32_t* prefix = reinterpret_cast<uint32_t*>(scratch);
+    prefix[0] = 0;
+    for (int c = 0; c < width; ++c) {
+        prefix[c + 1] = prefix[c] + static_cast<uint32_t>(sums[c]);
+    }
+
+    // Windows fully inside the row go through the vector loop
+    int interiorFrom = std::min(radius, width);
+    int interiorTo = std::max(interiorFrom, width - radius);
+    int done = interiorFrom;
+#ifdef CLEARVISION_X86_SIMD
+    if (simd_level() == SIMD_AVX2) {
+        done = box_divide_avx2(prefix, radius, bias, divisor, interiorFrom, interiorTo, out);
+    } else {
+        done = box_divide_sse2(prefix, radius, bias, divisor, interiorFrom, interiorTo, out);
+    }
+#endif
+    for (int j = 0; j < width; ++j) {
+        if (j >= interiorFrom && j < done) {
+            continue;
+        }
+        int acc = static_cast<int>(prefix[std::min(j + radius + 1, width)] - prefix[std::max(j - radius, 0)]);
+        out[j] = static_cast<unsigned char>((acc + bias) / divisor);
+    }
+}
+
+// Direct k x k weighted sum at one pixel, in the original summation order
+static double reference_sum(const unsigned char* const* window, int width, const GaussianKernel& kernel, int col) {
+    int radius = kernel.radius;
+    int size = 2 * radius + 1;
+    double sum = 0.0;
+    for (int k = -radius; k <= radius; ++k) {
+        const unsigned char* pixels = window[k + radius];
+        if (pixels == nullptr) {
+            continue;
+        }
+        for (int l = -radius; l <= radius; ++l) {
+            int newCol = col + l;
+            if (newCol >= 0 && newCol < width) {
+                sum += pixels[newCol] * kernel.reference[(k + radius) * size + (l + radius)];
+            }
+        }
+    }
+    return sum;
+}
+
+// Fixed-point vertical pass for columns [from, width), same arithmetic as the vector variants
+template <int N>
+static void fixed_vertical(const unsigned char* const* rows, const int16_t* taps, int runtimeSize, int from, int width,
+                           int16_t* out) {
+    const int size = N > 0 ? N : runtimeSize;
+    for (int j = from; j < width; ++j) {
+        int acc = 1 << (FIXED_VERTICAL_SHIFT - 1);
+        for (int t = 0; t < size; ++t) {
+            acc += taps[t] * rows[t][j];
+        }
+        out[j] = static_cast<int16_t>(acc >> FIXED_VERTICAL_SHIFT);
+    }
+}
+
+// Fixed-point horizontal pass over [from, to), where every tap stays inside the row
+template <int N>
+static void fixed_horizontal(const int16_t* v, const int16_t* taps, int runtimeSize, int radius, int from, int to,
+                             unsigned char* out) {
+    const int size = N > 0 ? N : runtimeSize;
+    for (int j = from; j < to; ++j) {
+        const int16_t* base = v + j - radius;
+        int acc = 0;
+        for (int t = 0; t < size; ++t) {
+            acc += taps[t] * base[t];
+        }
+        out[j] = static_cast<unsigned char>(std::min(acc >> FIXED_OUTPUT_SHIFT, 255));
+    }
+}
+
+// Fixed-point horizontal pass at one column near the edge; taps past the row read as zeros
+static void fixed_horizontal_edge(const int16_t* v, const int16_t* taps, int radius, int width, int j, unsigned char* out) {
+    int first = std::max(0, j - radius);
+    int last = std::min(width - 1, j + radius);
+    int acc = 0;
+    for (int c = first; c <= last; ++c) {
+        acc += taps[c - j + radius] * v[c];
+    }
+    out[j] = static_cast<unsigned char>(std::min(acc >> FIXED_OUTPUT_SHIFT, 255));
+}
+
+// Both fixed-point passes; `rows` has no nullptr entries. N is the tap count, or 0 for any.
+template <int N>
+static void fixed_gaussian_row(const unsigned char* const* rows, int width, const GaussianKernel& kernel, int16_t* v,
+                               unsigned char* out, FilterKernels::SimdLevel level) {
+    int radius = kernel.radius;
+    int size = 2 * radius + 1;
+    const int16_t* taps = kernel.fixedTaps.data();
+
+    int j = 0;
+#ifdef CLEARVISION_X86_SIMD
+    if (level == FilterKernels::SIMD_AVX2) j = fixed_vertical_avx2<N>(rows, taps, size, width, v);
+    else if (level == FilterKernels::SIMD_SSE2) j = fixed_vertical_sse2<N>(rows, taps, size, width, v);
+#endif
+    fixed_vertical<N>(rows, taps, size, j, width, v);
+
+    int interiorFrom = std::min(radius, width);
+    int interiorTo = std::max(interiorFrom, width - radius);
+    int done = interiorFrom;
+#ifdef CLEARVISION_X86_SIMD
+    if (level == FilterKernels::SIMD_AVX2) done = fixed_horizontal_avx2<N>(v, taps, size, radius, interiorFrom, interiorTo, out);
+    else if (level == FilterKernels::SIMD_SSE2) done = fixed_horizontal_sse2<N>(v, taps, size, radius, interiorFrom, interiorTo, out);
+#else
+    (void)level;
+#endif
+    fixed_horizontal<N>(v, taps, size, radius, done, interiorTo, out);
+
+    for (int c = 0; c < interiorFrom; ++c) {
+        fixed_horizontal_edge(v, taps, radius, width, c, out);
+    }
+    for (int c = interiorTo; c < width; ++c) {
+        fixed_horizontal_edge(v, taps, radius, width, c, out);
+    }
+}
+
+// Vertical 1-D pass into scratch, then horizontal 1-D pass into out
+void FilterKernels::gaussian_row(const unsigned char* const* window, int width, const GaussianKernel& kernel,
+                                 double* scratch, unsigned char* out) {
+    int radius = kernel.radius;
+    int size = 2 * radius + 1;
+    const double* taps = kernel.taps.data();
+    SimdLevel level = simd_level();
+
+    if (!exact() && !kernel.fixedTaps.empty()) {
+        if (kernel.fixedIdentity) {
+            std::memcpy(out, window[radius], width);
+            return;
+        }
+
+        // The int16 vertical sums and a row of zeros standing in for rows outside the image share the scratch space
+        int16_t* v = reinterpret_cast<int16_t*>(scratch);
+        unsigned char* zeros = reinterpret_cast<unsigned char*>(v + width);
+        const unsigned char* rows[GaussianKernel::MAX_FIXED_SIZE];
+        bool padded = false;
+        for (int t = 0; t < size; ++t) {
+            rows[t] = window[t] != nullptr ? window[t] : zeros;
+            padded = padded || window[t] == nullptr;
+        }
+        if (padded) {
+            std::memset(zeros, 0, width);
+        }
+
+        switch (size) {
+            case 3: fixed_gaussian_row<3>(rows, width, kernel, v, out, level); break;
+            case 5: fixed_gaussian_row<5>(rows, width, kernel, v, out, level); break;
+            case 7: fixed_gaussian_row<7>(rows, width, kernel, v, out, level); break;
+            default: fixed_gaussian_row<0>(rows, width, kernel, v, out, level); break;
+        }
+        return;
+    }
+
+    std::fill(scratch, scratch + width, 0.0);
+    for (int t = 0; t < size; ++t) {
+        const unsigned char* pixels = window[t];
+        if (pixels == nullptr) {
+            continue;
+        }
+        double weight = taps[t];
+        int j = 0;
+#ifdef CLEARVISION_X86_SIMD
+        if (level == SIMD_AVX2) j = weighted_accumulate_avx2(scratch, pixels, weight, width);
+        else if (level == SIMD_SSE2) j = weighted_accumulate_sse2(scratch, pixels, weight, width);
+#endif
+        for (; j < width; ++j) {
+            scratch[j] += weight * pixels[j];
+        }
+    }
+
+    // Horizontal sums for taps that stay inside the row, computed ahead in vector lanes
+    double* sums = scratch + width;
+    int interiorFrom = std::min(radius, width);
+    int interiorTo = std::max(interiorFrom, width - radius);
+    int done = interiorFrom;
+#ifdef CLEARVISION_X86_SIMD
+    if (level == SIMD_AVX2) done = horizontal_taps_avx2(scratch, taps, size, radius, interiorFrom, interiorTo, sums);
+    else if (level == SIMD_SSE2) done = horizontal_taps_sse2(scratch, taps, size, radius, interiorFrom, interiorTo, sums);
+#endif
+
+    for (int j = 0; j < width; ++j) {
+        double sum;
+        if (j >= interiorFrom && j < done) {
+            sum = sums[j];
+        } else {
+            int first = std::max(0, j - radius);
+            int last = std::min(width - 1, j + radius);
+            sum = 0.0;
+            for (int c = first; c <= last; ++c) {
+                sum += taps[c - j + radius] * scratch[c];
+            }
+        }
+
+        // Too close to call: settle it the way the direct filter would
+        if (std::fabs(sum - std::floor(sum + 0.5)) < TIE_TOLERANCE) {
+            sum = reference_sum(window, width, kernel, j);
+        }
+
+        int newValue = static_cast<int>(sum);
+        out[j] = static_cast<unsigned char>(std::max(0, std::min(newValue, 255)));
+    }
+}
+
+// The amount as amount * 2^shift rounded to an int16, with the largest shift
+// up to 14 that fits; false if even a shift of 0 does not fit
+static bool fixed_amount(double amount, int& shift, int& scaled) {
+    for (shift = 14; shift >= 0; --shift) {
+        double value = std::floor(amount * (1 << shift) + 0.5);
+        if (std::fabs(value) <= 32767.0) {
+            scaled = static_cast<int>(value);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Unsharp mask formula per pixel
+void FilterKernels::unsharp_row(const unsigned char* original, const unsigned char* blurred, int width, double amount,
+                                unsigned char* out) {
+    int shift, scaled;
+    if (!exact() && fixed_amount(amount, shift, scaled)) {
+        int j = 0;
+#ifdef CLEARVISION_X86_SIMD
+        switch (simd_level()) {
+            case SIMD_AVX2: j = unsharp_fixed_avx2(original, blurred, width, shift, scaled, out); break;
+            case SIMD_SSE2: j = unsharp_fixed_sse2(original, blurred, width, shift, scaled, out); break;
+            default: break;
+        }
+#endif
+        for (; j < width; ++j) {
+            int o = original[j];
+            int sum = o * (1 << shift) + scaled * (o - blurred[j]);
+            out[j] = static_cast<unsigned char>(sum < 0 ? 0 : std::min(sum >> shift, 255));
+        }
+        return;
+    }
+
+    int j = 0;
+#ifdef CLEARVISION_X86_SIMD
+    switch (simd_level()) {
+        case SIMD_AVX2: j = unsharp_avx2(original, blurred, width, amount, out); break;
+        case SIMD_SSE2: j = unsharp_sse2(original, blurred, width, amount, out); break;
+        default: break;
+    }
+#endif
+    for (; j < width; ++j) {
+        double originalValue = original[j];
+        double blurredValue = blurred[j];
+
+        // Calculate the difference and apply the sharpening amount
+        double edgeValue = originalValue - blurredValue;
+        double sharpenedValue = originalValue + static_cast<double>(amount * edgeValue);
+        int sharpened_value = int(sharpenedValue);
+
+        out[j] = static_cast<unsigned char>(std::max(0, std::min(sharpened_value, 255)));  // Clamp between 0-255
+    }
+}
+
+// Box widths for an n-pass approximation of a Gaussian (Kovesi's ideal-width construction)
+std::vector<int> FilterKernels::gaussian_box_sizes(double sigma, int passes) {
+    double idealWidth = std::sqrt((12.0 * sigma * sigma / passes) + 1.0);
+    int lower = static_cast<int>(std::floor(idealWidth));
+    if (lower % 2 == 0) {
+        lower--;
+    }
+    int upper = lower + 2;
+
+    double idealCount = (12.0 * sigma * sigma - passes * lower * lower - 4.0 * passes * lower - 3.0 * passes) / (-4.0 * lower - 4.0);
+    int lowerCount = static_cast<int>(std::floor(idealCount + 0.5));
+
+    std::vector<int> sizes(passes);
+    for (int i = 0; i < passes; ++i) {
+        sizes[i] = (i < lowerCount) ? lower : upper;
+    }
+    return sizes;
+}
+
+// ---------------------------------------------------------------------------
+// 16-bit and float kernels. Plain loops specialized per pixel type at compile
+// time (and per tap count for the common Gaussian sizes), which the compiler
+// vectorizes on its own.
+// ---------------------------------------------------------------------------
+
+template <typename Pixel, typename Sum>
+static void plain_box_column_sums(const Pixel* const* window, int count, int width, Sum* sums) {
+    std::fill(sums, sums + width, Sum());
+    for (int t = 0; t < count; ++t) {
+        const Pixel* pixels = window[t];
+        if (pixels == nullptr) {
+            continue;
+        }
+        for (int j = 0; j < width; ++j) {
+            sums[j] += pixels[j];
+        }
+    }
+}
+
+template <typename Pixel, typename Sum>
+static void plain_box_slide(Sum* sums, const Pixel* entering, const Pixel* leaving, int width) {
+    if (entering != nullptr) {
+        for (int j = 0; j < width; ++j) sums[j] += entering[j];
+    }
+    if (leaving != nullptr) {
+        for (int j = 0; j < width; ++j) sums[j] -= leaving[j];
+    }
+}
+
+// Prefix sums over the column sums, then one subtraction per window
+template <typename Pixel, typename Sum>
+static void plain_box_row_mean(const Sum* sums, int width, int radius, Pixel* out, Sum* scratch, bool round_to_nearest) {
+    int size = 2 * radius + 1;
+    Sum divisor = static_cast<Sum>(size) * size;  // Out-of-image taps count as zeros
+    Sum bias = (PixelTraits<Pixel>::INTEGRAL && round_to_nearest) ? divisor / 2 : Sum();
+
+    Sum* prefix = scratch;
+    prefix[0] = Sum();
+    for (int c = 0; c < width; ++c) {
+        prefix[c + 1] = prefix[c] + sums[c];
+    }
+    for (int j = 0; j < width; ++j) {
+        Sum acc = prefix[std::min(j + radius + 1, width)] - prefix[std::max(j - radius, 0)];
+        out[j] = static_cast<Pixel>((acc + bias) / divisor);
+    }
+}
+
+template <typename Pixel>
+void FilterKernels::box_column_sums(const Pixel* const* window, int count, int width, typename PixelTraits<Pixel>::Sum* sums) {
+    plain_box_column_sums(window, count, width, sums);
+}
+
+template <typename Pixel>
+void FilterKernels::box_slide(typename PixelTraits<Pixel>::Sum* sums, const Pixel* entering, const Pixel* leaving, int width) {
+    plain_box_slide(sums, entering, leaving, width);
+}
+
+template <typename Pixel>
+void FilterKernels::box_row_mean(const typename PixelTraits<Pixel>::Sum* sums, int width, int radius, Pixel* out,
+                                 typename PixelTraits<Pixel>::Sum* scratch, bool round_to_nearest) {
+    plain_box_row_mean(sums, width, radius, out, scratch, round_to_nearest);
+}
+
+// The largest window sum is 255 for every tap inside the image; the rounding
+// bias and the divisor are half and all of the (2 * radius + 1)^2 taps
+bool FilterKernels::box_sums_fit(int width, int height, int radius) {
+    int64_t size = 2 * static_cast<int64_t>(radius) + 1;
+    int64_t window = 255 * std::min<int64_t>(size, width) * std::min<int64_t>(size, height);
+    return size * size <= INT_MAX && window + size * size / 2 <= INT_MAX;
+}
+
+void FilterKernels::box_column_sums(const unsigned char* const* window, int count, int width, int64_t* sums) {
+    plain_box_column_sums(window, count, width, sums);
+}
+
+void FilterKernels::box_slide(int64_t* sums, const unsigned char* entering, const unsigned char* leaving, int width) {
+    plain_box_slide(sums, entering, leaving, width);
+}
+
+void FilterKernels::box_row_mean(const int64_t* sums, int width, int radius, unsigned char* out, int64_t* scratch,
+                                 bool round_to_nearest) {
+    plain_box_row_mean(sums, width, radius, out, scratch, round_to_nearest);
+}
+
+// Gaussian in double for float pixels, and for 16-bit ones in exact mode:
+// the separable passes, truncated and clamped for integer pixels
+template <typename Pixel>
+static void floating_gaussian_row(const Pixel* const* window, int width, const GaussianKernel& kernel, double* scratch,
+                                  Pixel* out) {
+    int radius = kernel.radius;
+    int size = 2 * radius + 1;
+    const double* taps = kernel.taps.data();
+
+    std::fill(scratch, scratch + width, 0.0);
+    for (int t = 0; t < size; ++t) {
+        const Pixel* pixels = window[t];
+        if (pixels == nullptr) {
+            continue;
+        }
+        double weight = taps[t];
+        for (int j = 0; j < width; ++j) {
+            scratch[j] += weight * pixels[j];
+        }
+    }
+    for (int j = 0; j < width; ++j) {
+        int first = std::max(0, j - radius);
+        int last = std::min(width - 1, j + radius);
+        double sum = 0.0;
+        for (int c = first; c <= last; ++c) {
+            sum += taps[c - j + radius] * scratch[c];
+        }
+        out[j] = PixelTraits<Pixel>::saturate(sum);
+    }
+}
+
+// Q15 x 16-bit vertical sums stay below 2^31 and the horizontal Q15 x Q15
+// ones below 2^46, so neither pass loses a bit before the final truncation
+static const int WIDE_OUTPUT_SHIFT = 30;
+
+static uint16_t wide_output(int64_t acc) {
+    return static_cast<uint16_t>(std::max<int64_t>(0, std::min<int64_t>(acc >> WIDE_OUTPUT_SHIFT, 65535)));
+}
+
+// Horizontal pass at one column near the edge; taps past the row read as zeros
+static uint16_t wide_horizontal_edge(const int64_t* v, const int32_t* taps, int radius, int width, int j) {
+    int first = std::max(0, j - radius);
+    int last = std::min(width - 1, j + radius);
+    int64_t acc = 0;
+    for (int c = first; c <= last; ++c) {
+        acc += taps[c - j + radius] * v[c];
+    }
+    return wide_output(acc);
+}
+
+// Both fixed-point passes for 16-bit rows; `rows` has no nullptr entries. N is the tap count, or 0 for any.
+template <int N>
+static void wide_gaussian_row(const uint16_t* const* rows, int width, const int32_t* taps, int radius, int64_t* v,
+                              uint16_t* out) {
+    const int size = N > 0 ? N : 2 * radius + 1;
+    for (int j = 0; j < width; ++j) {
+        int64_t acc = 0;
+        for (int t = 0; t < size; ++t) {
+            acc += static_cast<int64_t>(taps[t]) * rows[t][j];
+        }
+        v[j] = acc;
+    }
+
+    int interiorFrom = std::min(radius, width);
+    int interiorTo = std::max(interiorFrom, width - radius);
+    for (int j = interiorFrom; j < interiorTo; ++j) {
+        const int64_t* base = v + j - radius;
+        int64_t acc = 0;
+        for (int t = 0; t < size; ++t) {
+            acc += taps[t] * base[t];
+        }
+        out[j] = wide_output(acc);
+    }
+    for (int c = 0; c < interiorFrom; ++c) {
+        out[c] = wide_horizontal_edge(v, taps, radius, width, c);
+    }
+    for (int c = interiorTo; c < width; ++c) {
+        out[c] = wide_horizontal_edge(v, taps, radius, width, c);
+    }
+}
+
+static void typed_gaussian_row(const uint16_t* const* window, int width, const GaussianKernel& kernel, double* scratch,
+                               uint16_t* out) {
+    if (FilterKernels::exact() || kernel.wideTaps.empty()) {
+        floating_gaussian_row(window, width, kernel, scratch, out);
+        return;
+    }
+
+    // The int64 vertical sums and a row of zeros standing in for rows outside the image share the scratch space
+    int radius = kernel.radius;
+    int size = 2 * radius + 1;
+    int64_t* v = reinterpret_cast<int64_t*>(scratch);
+    uint16_t* zeros = reinterpret_cast<uint16_t*>(v + width);
+    const uint16_t* small[GaussianKernel::MAX_FIXED_SIZE];
+    std::vector<const uint16_t*> large(size > GaussianKernel::MAX_FIXED_SIZE ? size : 0);
+    const uint16_t** rows = large.empty() ? small : large.data();
+    bool padded = false;
+    for (int t = 0; t < size; ++t) {
+        rows[t] = window[t] != nullptr ? window[t] : zeros;
+        padded = padded || window[t] == nullptr;
+    }
+    if (padded) {
+        std::fill(zeros, zeros + width, 0);
+    }
+
+    const int32_t* taps = kernel.wideTaps.data();
+    switch (size) {
+        case 3: wide_gaussian_row<3>(rows, width, taps, radius, v, out); break;
+        case 5: wide_gaussian_row<5>(rows, width, taps, radius, v, out); break;
+        case 7: wide_gaussian_row<7>(rows, width, taps, radius, v, out); break;
+        default: wide_gaussian_row<0>(rows, width, taps, radius, v, out); break;
+    }
+}
+
+static void typed_gaussian_row(const float* const* window, int width, const GaussianKernel& kernel, double* scratch,
+                               float* out) {
+    floating_gaussian_row(window, width, kernel, scratch, out);
+}
+
+template <typename Pixel>
+void FilterKernels::gaussian_row(const Pixel* const* window, int width, const GaussianKernel& kernel, double* scratch,
+                                 Pixel* out) {
+    typed_gaussian_row(window, width, kernel, scratch, out);
+}
+
+static void typed_unsharp_row(const uint16_t* original, const uint16_t* blurred, int width, double amount, uint16_t* out) {
+    int shift, scaled;
+    if (!FilterKernels::exact() && fixed_amount(amount, shift, scaled)) {
+        for (int j = 0; j < width; ++j) {
+            int64_t o = original[j];
+            int64_t sum = o * (1 << shift) + scaled * (o - blurred[j]);
+            out[j] = static_cast<uint16_t>(sum < 0 ? 0 : std::min<int64_t>(sum >> shift, 65535));
+        }
+        return;
+    }
+    for (int j = 0; j < width; ++j) {
+        double o = original[j];
+        out[j] = PixelTraits<uint16_t>::saturate(o + amount * (o - blurred[j]));
+    }
+}
+
+static void typed_unsharp_row(const float* original, const float* blurred, int width, double amount, float* out) {
+    for (int j = 0; j < width; ++j) {
+        double o = original[j];
+        out[j] = static_cast<float>(o + amount * (o - blurred[j]));
+    }
+}
+
+template <typename Pixel>
+void FilterKernels::unsharp_row(const Pixel* original, const Pixel* blurred, int width, double amount, Pixel* out) {
+    typed_unsharp_row(original, blurred, width, amount, out);
+}
+
+template void FilterKernels::box_column_sums<uint16_t>(const uint16_t* const*, int, int, int64_t*);
+template void FilterKernels::box_column_sums<float>(const float* const*, int, int, double*);
+template void FilterKernels::box_slide<uint16_t>(int64_t*, const uint16_t*, const uint16_t*, int);
+template void FilterKernels::box_slide<float>(double*, const float*, const float*, int);
+template void FilterKernels::box_row_mean<uint16_t>(const int64_t*, int, int, uint16_t*, int64_t*, bool);
+template void FilterKernels::box_row_mean<float>(const double*, int, int, float*, double*, bool);
+template void FilterKernels::gaussian_row<uint16_t>(const uint16_t* const*, int, const GaussianKernel&, double*, uint16_t*);
+template void FilterKernels::gaussian_row<float>(const float* const*, int, const GaussianKernel&, double*, float*);
+template void FilterKernels::unsharp_row<uint16_t>(const uint16_t*, const uint16_t*, int, double, uint16_t*);
+template void FilterKernels::unsharp_row<float>(const float*, const float*, int, double, float*);
+
+// ---------------------------------------------------------------------------
+// Erosion and dilation
+// ---------------------------------------------------------------------------
+
+template <typename Pixel>
+Pixel FilterKernels::min_max_identity(bool maximum) {
+    typedef std::numeric_limits<Pixel> Limits;
+    if (Limits::has_infinity) {
+        return maximum ? -Limits::infinity() : Limits::infinity();
+    }
+    return maximum ? Limits::min() : Limits::max();
+}
+
+template <typename Pixel, bool Maximum>
+static inline Pixel min_max(Pixel a, Pixel b) {
+    return Maximum ? std::max(a, b) : std::min(a, b);
+}
+
+// The row padded with `radius` identity pixels on both sides is cut into
+// blocks of the window size. Forward runs g restart at every block start and
+// backward runs h at every block end, so window [x, x + 2 * radius] of the
+// padded row, which spans at most two blocks, is min_max(h[x], g[x + 2 * radius]).
+template <typename Pixel, bool Maximum>
+static void van_herk_row(const Pixel* in, int width, int radius, Pixel* scratch, Pixel* out) {
+    int size = 2 * radius + 1;
+    int padded = width + 2 * radius;
+    int total = (padded + size - 1) / size * size;
+    Pixel identity = FilterKernels::min_max_identity<Pixel>(Maximum);
+    Pixel* g = scratch;
+    Pixel* h = scratch + total;
+
+    for (int start = 0; start < total; start += size) {
+        int end = start + size;
+        for (int p = start; p < end; ++p) {
+            Pixel value = (p >= radius && p < radius + width) ? in[p - radius] : identity;
+            g[p] = (p == start) ? value : min_max<Pixel, Maximum>(g[p - 1], value);
+        }
+        for (int p = end - 1; p >= start; --p) {
+            Pixel value = (p >= radius && p < radius + width) ? in[p - radius] : identity;
+            h[p] = (p == end - 1) ? value : min_max<Pixel, Maximum>(h[p + 1], value);
+        }
+    }
+    for (int x = 0; x < width; ++x) {
+        out[x] = min_max<Pixel, Maximum>(h[x], g[x + 2 * radius]);
+    }
+}
+
+template <typename Pixel>
+void FilterKernels::min_max_row(const Pixel* in, int width, int radius, bool maximum, Pixel* scratch, Pixel* out) {
+    if (maximum) {
+        van_herk_row<Pixel, true>(in, width, radius, scratch, out);
+    } else {
+        van_herk_row<Pixel, false>(in, width, radius, scratch, out);
+    }
+}
+
+#ifdef CLEARVISION_X86_SIMD
+
+TARGET_SSE2
+static int min_max_rows_sse2(const unsigned char* a, const unsigned char* b, int width, bool maximum, unsigned char* out) {
+    int j = 0;
+    for (; j + 16 <= width; j += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + j));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j), maximum ? _mm_max_epu8(x, y) : _mm_min_epu8(x, y));
+    }
+    return j;
+}
+
+TARGET_AVX2
+static int min_max_rows_avx2(const unsigned char* a, const unsigned char* b, int width, bool maximum, unsigned char* out) {
+    int j = 0;
+    for (; j + 32 <= width; j += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + j));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + j), maximum ? _mm256_max_epu8(x, y) : _mm256_min_epu8(x, y));
+    }
+    return j;
+}
+
+#endif // CLEARVISION_X86_SIMD
+
+template <typename Pixel>
+static int min_max_rows_vector(const Pixel*, const Pixel*, int, bool, Pixel*) {
+    return 0;
+}
+
+static int min_max_rows_vector(const unsigned char* a, const unsigned char* b, int width, bool maximum, unsigned char* out) {
+#ifdef CLEARVISION_X86_SIMD
+    switch (FilterKernels::simd_level()) {
+        case FilterKernels::SIMD_AVX2: return min_max_rows_avx2(a, b, width, maximum, out);
+        case FilterKernels::SIMD_SSE2: return min_max_rows_sse2(a, b, width, maximum, out);
+        default: break;
+    }
+#else
+    (void)a, (void)b, (void)width, (void)maximum, (void)out;
+#endif
+    return 0;
+}
+
+template <typename Pixel>
+void FilterKernels::min_max_rows(const Pixel* a, const Pixel* b, int width, bool maximum, Pixel* out) {
+    int j = min_max_rows_vector(a, b, width, maximum, out);
+    if (maximum) {
+        for (; j < width; ++j) out[j] = std::max(a[j], b[j]);
+    } else {
+        for (; j < width; ++j) out[j] = std::min(a[j], b[j]);
+    }
+}
+
+template unsigned char FilterKernels::min_max_identity<unsigned char>(bool);
+template uint16_t FilterKernels::min_max_identity<uint16_t>(bool);
+template float FilterKernels::min_max_identity<float>(bool);
+template void FilterKernels::min_max_row<unsigned char>(const unsigned char*, int, int, bool, unsigned char*, unsigned char*);
+template void FilterKernels::min_max_row<uint16_t>(const uint16_t*, int, int, bool, uint16_t*, uint16_t*);
+template void FilterKernels::min_max_row<float>(const float*, int, int, bool, float*, float*);
+template void FilterKernels::min_max_rows<unsigned char>(const unsigned char*, const unsigned char*, int, bool, unsigned char*);
+template void FilterKernels::min_max_rows<uint16_t>(const uint16_t*, const uint16_t*, int, bool, uint16_t*);
+template void FilterKernels::min_max_rows<float>(const float*, const float*, int, bool, float*);
+
+// ---------------------------------------------------------------------------
+// Column histograms
+// ---------------------------------------------------------------------------
+
+ColumnHistograms::ColumnHistograms(int width)
+    : width(width), rowCount(0), fine(static_cast<size_t>(width) * 256, 0), coarse(static_cast<size_t>(width) * 16, 0) {}
+
+void ColumnHistograms::add_row(const unsigned char* row) {
+    if (row == nullptr) return;
+    uint16_t* f = fine.data();
+    uint16_t* c = coarse.data();
+    for (int x = 0; x < width; ++x) {
+        ++f[static_cast<size_t>(x) * 256 + row[x]];
+        ++c[static_cast<size_t>(x) * 16 + (row[x] >> 4)];
+    }
+    ++rowCount;
+}
+
+void ColumnHistograms::remove_row(const unsigned char* row) {
+    if (row == nullptr) return;
+    uint16_t* f = fine.data();
+    uint16_t* c = coarse.data();
+    for (int x = 0; x < width; ++x) {
+        --f[static_cast<size_t>(x) * 256 + row[x]];
+        --c[static_cast<size_t>(x) * 16 + (row[x] >> 4)];
+    }
+    --rowCount;
+}
+
+// window += bins of column `plus` - bins of column `minus`, columns `stride`
+// counts apart; -1 for neither. Fixed trip counts over plain arrays, which the
+// compiler vectorizes.
+template <typename Count, int Bins>
+static void slide_bins(Count* window, const uint16_t* columns, int stride, int plus, int minus) {
+    const uint16_t* p = columns + static_cast<size_t>(plus) * stride;
+    const uint16_t* m = columns + static_cast<size_t>(minus) * stride;
+    if (plus >= 0 && minus >= 0) {
+        for (int b = 0; b < Bins; ++b) window[b] = static_cast<Count>(window[b] + p[b] - m[b]);
+    } else if (plus >= 0) {
+        for (int b = 0; b < Bins; ++b) window[b] = static_cast<Count>(window[b] + p[b]);
+    } else if (minus >= 0) {
+        for (int b = 0; b < Bins; ++b) window[b] = static_cast<Count>(window[b] - m[b]);
+    }
+}
+
+// The histogram of 2 * radius + 1 columns sliding along a row. The coarse
+// bins move with every step; the 16 fine bins under a coarse bin are brought
+// up to date only when read, replaying the columns that entered and left
+// since or recounting the window, whichever is less work (Perreault and
+// Hebert). Reads cluster around the median, so most steps touch 16 + 16 bins
+// rather than 256 + 16.
+template <typename Count>
+class RowWindow {
+public:
+    RowWindow(const uint16_t* fine, const uint16_t* coarse, int width, int radius)
+        : fineColumns(fine), coarseColumns(coarse), width(width), radius(radius), x(0) {
+        std::fill(fineBins, fineBins + 256, Count(0));
+        std::fill(coarseBins, coarseBins + 16, Count(0));
+        std::fill(updated, updated + 16, static_cast<int>(NEVER));
+        for (int c = 0; c <= radius && c < width; ++c) {
+            slide_bins<Count, 16>(coarseBins, coarseColumns, 16, c, -1);
+        }
+    }
+
+    // Move the window one column right
+    void advance() {
+        int plus = (x + radius + 1 < width) ? x + radius + 1 : -1;
+        int minus = (x - radius >= 0) ? x - radius : -1;
+        slide_bins<Count, 16>(coarseBins, coarseColumns, 16, plus, minus);
+        ++x;
+    }
+
+    const Count* coarse() const { return coarseBins; }
+
+    // The fine bins 16 * b .. 16 * b + 15 of the current window
+    const Count* fine(int b) {
+        Count* bins = fineBins + 16 * b;
+        const uint16_t* columns = fineColumns + 16 * b;
+        int first = std::max(x - radius, 0), last = std::min(x + radius, width - 1);
+        if (updated[b] == NEVER || 2 * (x - updated[b]) >= last - first + 1) {
+            std::fill(bins, bins + 16, Count(0));
+            for (int c = first; c <= last; ++c) {
+                slide_bins<Count, 16>(bins, columns, 256, c, -1);
+            }
+        } else {
+            for (int t = updated[b] + 1; t <= x; ++t) {
+                int plus = (t + radius < width) ? t + radius : -1;
+                int minus = (t - radius - 1 >= 0) ? t - radius - 1 : -1;
+                slide_bins<Count, 16>(bins, columns, 256, plus, minus);
+            }
+        }
+        updated[b] = x;
+        return bins;
+    }
+
+private:
+    enum { NEVER = -1 };
+
+    const uint16_t* fineColumns;
+    const uint16_t* coarseColumns;
+    int width, radius;
+    int x;                  // Centre column of the window
+    int updated[16];        // Column each fine segment was last brought up to date for
+    Count fineBins[256];
+    Count coarseBins[16];
+};
+
+// Window counts fit 16 bits up to 65535 pixels, which halves the work of every slide
+void ColumnHistograms::median_row(int radius, unsigned char* out) const {
+    if (static_cast<long long>(std::min(2 * radius + 1, width)) * rowCount <= 65535) {
+        median_row_with<uint16_t>(radius, out);
+    } else {
+        median_row_with<uint32_t>(radius, out);
+    }
+}
+
+void ColumnHistograms::bilateral_row(int radius, const float* rangeWeights, int cutoff, const unsigned char* centre,
+                                     unsigned char* out) const {
+    if (static_cast<long long>(std::min(2 * radius + 1, width)) * rowCount <= 65535) {
+        bilateral_row_with<uint16_t>(radius, rangeWeights, cutoff, centre, out);
+    } else {
+        bilateral_row_with<uint32_t>(radius, rangeWeights, cutoff, centre, out);
+    }
+}
+
+template <typename Count>
+void ColumnHistograms::median_row_with(int radius, unsigned char* out) const {
+    RowWindow<Count> window(fine.data(), coarse.data(), width, radius);
+    for (int x = 0; x < width; ++x) {
+        if (x > 0) window.advance();
+        int columns = std::min(x + radius, width - 1) - std::max(x - radius, 0) + 1;
+        uint32_t target = (static_cast<uint32_t>(columns) * rowCount + 1) / 2;
+        uint32_t below = 0;
+        const Count* coarseBins = window.coarse();
+        int b = 0;
+        while (b < 15 && below + coarseBins[b] < target) below += coarseBins[b++];
+        const Count* fineBins = window.fine(b);
+        int v = 0;
+        while (v < 15 && below + fineBins[v] < target) below += fineBins[v++];
+        out[x] = static_cast<unsigned char>(16 * b + v);
+    }
+}
+
+template <typename Count>
+void ColumnHistograms::bilateral_row_with(int radius, const float* rangeWeights, int cutoff, const unsigned char* centre,
+                                          unsigned char* out) const {
+    // byDifference[255 + d] weighs a difference of d, so a fine segment is
+    // weighed with one contiguous, branch-free loop
+    float byDifference[511];
+    for (int d = 0; d < 256; ++d) {
+        byDifference[255 + d] = byDifference[255 - d] = d < cutoff ? rangeWeights[d] : 0.0f;
+    }
+
+    RowWindow<Count> window(fine.data(), coarse.data(), width, radius);
+    for (int x = 0; x < width; ++x) {
+        if (x > 0) window.advance();
+        // Only coarse bins within the cutoff are read, and empty ones are skipped whole
+        int c = centre[x];
+        int lo = std::max(0, c - cutoff + 1);
+        int hi = std::min(255, c + cutoff - 1);
+        // One partial sum per lane keeps the loop vectorizable without reassociating
+        float sums[16] = {}, weightSums[16] = {};
+        for (int b = lo >> 4; b <= hi >> 4; ++b) {
+            if (window.coarse()[b] == 0) continue;
+            const Count* fineBins = window.fine(b);
+            const float* weights = byDifference + 255 + 16 * b - c;
+            for (int v = 0; v < 16; ++v) {
+                float w = weights[v] * static_cast<float>(fineBins[v]);
+                sums[v] += w * static_cast<float>(16 * b + v);
+                weightSums[v] += w;
+            }
+        }
+        float sum = 0.0f, weight = 0.0f;
+        for (int v = 0; v < 16; ++v) {
+            sum += sums[v];
+            weight += weightSums[v];
+        }
+        // The centre pixel itself is in the window with weight rangeWeights[0] > 0
+        out[x] = static_cast<unsigned char>(std::min(255.0f, sum / weight + 0.5f));
+    }
+}
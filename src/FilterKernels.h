@@ -0,0 +1,190 @@
+#ifndef FILTER_KERNELS_H
+#define FILTER_KERNELS_H
+
+#include "PixelTraits.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Precomputed weights for a Gaussian of a given size and sigma
+struct GaussianKernel {
+    // Largest kernel with fixed-point taps; beyond it the error bound below no longer holds
+    static const int MAX_FIXED_SIZE = 63;
+
+    int radius;                     // Taps on each side of the centre pixel
+    std::vector<double> taps;       // Normalized 1-D weights, 2 * radius + 1 of them
+    std::vector<double> reference;  // Normalized 2-D weights, row-major, as the direct k x k filter builds them
+    std::vector<int16_t> fixedTaps; // Q15 1-D weights summing to exactly 32768; empty past MAX_FIXED_SIZE
+    std::vector<int32_t> wideTaps;  // The same Q15 weights for 16-bit pixels, at any size; empty if sigma is degenerate
+    bool fixedIdentity;             // The Q15 kernel is a single tap of 1.0 (it does not fit in int16)
+
+    GaussianKernel(int kernelSize, double sigma);
+
+    // Shared kernel for (kernelSize, sigma). The most recently used kernels are
+    // kept, so filters called over and over skip the exp() calls.
+    static std::shared_ptr<const GaussianKernel> cached(int kernelSize, double sigma);
+};
+
+// Per-column 256-bin histograms of 8-bit pixels over a vertical window of
+// rows, for the median and bilateral filters (Perreault and Hebert's
+// constant-time median): moving down a row adds one pixel to each column
+// and removes one, and each output pixel's window histogram gains the column
+// entering on the right and loses the one leaving on the left. 16 coarse bins
+// (sums of 16 fine bins each) kept alongside narrow a rank search to 32 steps.
+// Rows outside the image are simply not added, so windows are clipped to it.
+class ColumnHistograms {
+public:
+    // Largest number of rows a column may count
+    static const int MAX_ROWS = 65535;
+
+    explicit ColumnHistograms(int width);
+
+    // Count a row into, or out of, every column; nullptr rows are skipped
+    void add_row(const unsigned char* row);
+    void remove_row(const unsigned char* row);
+
+    // Rows currently counted
+    int rows() const { return rowCount; }
+
+    // The median of every window of 2 * radius + 1 columns (clipped to the
+    // row), the lower one when a clipped window holds an even count
+    void median_row(int radius, unsigned char* out) const;
+
+    // Edge-preserving smoothing with a box spatial window: each output is the
+    // mean of the window's pixels weighted by rangeWeights[|pixel - centre|],
+    // rounded; weights of 0 from `cutoff` on are skipped without being read.
+    void bilateral_row(int radius, const float* rangeWeights, int cutoff, const unsigned char* centre,
+                       unsigned char* out) const;
+
+private:
+    int width;
+    int rowCount;
+    std::vector<uint16_t> fine;    // 256 bins per column
+    std::vector<uint16_t> coarse;  // 16 bins per column
+
+    template <typename Count>
+    void median_row_with(int radius, unsigned char* out) const;
+    template <typename Count>
+    void bilateral_row_with(int radius, const float* rangeWeights, int cutoff, const unsigned char* centre,
+                            unsigned char* out) const;
+};
+
+// Row-level building blocks behind the Filter functions.
+// A "window" is an array of 2 * radius + 1 row pointers centred on the output
+// row; rows outside the image are nullptr and read as zeros.
+//
+// Each kernel has a portable scalar loop and SSE2/AVX2 variants picked at
+// runtime from CPUID. All variants produce bit-identical output.
+//
+// The Gaussian and unsharp kernels have two precisions. By default they run
+// in integer fixed point (Q15 taps, 7 fractional bits between the passes;
+// the unsharp amount in up to Q14), with sizes 3, 5 and 7 unrolled at compile
+// time. Compared with exact mode a Gaussian pixel differs by at most 1 and an
+// unsharp pixel by at most 1 + |amount| (the blur's difference, amplified).
+// Exact mode does the arithmetic in double and reproduces the direct 2-D
+// convolution bit for bit; kernels larger than GaussianKernel::MAX_FIXED_SIZE
+// and amounts of 32768 or more always use it.
+class FilterKernels {
+public:
+    // Instruction sets the kernels can use
+    enum SimdLevel { SIMD_SCALAR = 0, SIMD_SSE2 = 1, SIMD_AVX2 = 2 };
+
+    // Best level the CPU supports, detected once at startup
+    static SimdLevel detected_simd_level();
+
+    // Level the kernels currently run with
+    static SimdLevel simd_level();
+
+    // Cap the level used, e.g. to compare SSE2 and AVX2 output
+    static void set_simd_limit(SimdLevel limit);
+
+    // Force the scalar loops, e.g. to check vector output bit for bit.
+    // Also enabled by setting CLEARVISION_FORCE_SCALAR=1 in the environment.
+    static void set_force_scalar(bool force);
+
+    static const char* simd_level_name(SimdLevel level);
+
+    // Use the exact double-precision Gaussian and unsharp arithmetic instead of
+    // fixed point. Also enabled by setting CLEARVISION_EXACT=1 in the environment.
+    static void set_exact(bool exact);
+    static bool exact();
+
+    // Mean filter: per-column sums over a vertical window of `count` rows
+    static void box_column_sums(const unsigned char* const* window, int count, int width, int* sums);
+
+    // Mean filter: move the column sums one row down (either row may be nullptr)
+    static void box_slide(int* sums, const unsigned char* entering, const unsigned char* leaving, int width);
+
+    // Mean filter: horizontal running sum over the column sums, divided by
+    // the full (2 * radius + 1)^2 tap count. Rounds to nearest when asked,
+    // otherwise truncates like the direct filter. `scratch` must hold width + 1 ints.
+    static void box_row_mean(const int* sums, int width, int radius, unsigned char* out, int* scratch,
+                             bool round_to_nearest = false);
+
+    // Whether the int sums above hold every window of a (2 * radius + 1)^2
+    // box over a width x height image. Larger windows take the 64-bit
+    // overloads below: plain loops, same results.
+    static bool box_sums_fit(int width, int height, int radius);
+    static void box_column_sums(const unsigned char* const* window, int count, int width, int64_t* sums);
+    static void box_slide(int64_t* sums, const unsigned char* entering, const unsigned char* leaving, int width);
+    static void box_row_mean(const int64_t* sums, int width, int radius, unsigned char* out, int64_t* scratch,
+                             bool round_to_nearest = false);
+
+    // Gaussian: one output row from a window of input rows. `scratch` must hold 2 * width doubles.
+    // In exact mode produces exactly the values of the direct 2-D convolution.
+    static void gaussian_row(const unsigned char* const* window, int width, const GaussianKernel& kernel,
+                             double* scratch, unsigned char* out);
+
+    // Unsharp mask: out = clamp(original + amount * (original - blurred)), truncated
+    static void unsharp_row(const unsigned char* original, const unsigned char* blurred, int width, double amount,
+                            unsigned char* out);
+
+    // Widths of the box passes whose repeated application approximates a Gaussian of the given sigma
+    static std::vector<int> gaussian_box_sizes(double sigma, int passes);
+
+    // The same kernels for 16-bit and float pixels, instantiated for uint16_t
+    // and float (8-bit pixels pick the overloads above). Window sums use
+    // PixelTraits<Pixel>::Sum. 16-bit Gaussians run in Q15 fixed point with
+    // 64-bit accumulators and the unsharp amount in up to Q14, both exact up
+    // to truncation; exact mode and float pixels use double arithmetic.
+    // Integer results are truncated and clamped like the 8-bit ones.
+    template <typename Pixel>
+    static void box_column_sums(const Pixel* const* window, int count, int width, typename PixelTraits<Pixel>::Sum* sums);
+
+    template <typename Pixel>
+    static void box_slide(typename PixelTraits<Pixel>::Sum* sums, const Pixel* entering, const Pixel* leaving, int width);
+
+    // `scratch` must hold width + 1 sums
+    template <typename Pixel>
+    static void box_row_mean(const typename PixelTraits<Pixel>::Sum* sums, int width, int radius, Pixel* out,
+                             typename PixelTraits<Pixel>::Sum* scratch, bool round_to_nearest = false);
+
+    // `scratch` must hold 2 * width doubles
+    template <typename Pixel>
+    static void gaussian_row(const Pixel* const* window, int width, const GaussianKernel& kernel, double* scratch, Pixel* out);
+
+    template <typename Pixel>
+    static void unsharp_row(const Pixel* original, const Pixel* blurred, int width, double amount, Pixel* out);
+
+    // Erosion and dilation, for every pixel type. Windows are clipped to the
+    // image: out-of-image taps are skipped (read as the identity of min or
+    // max), not zeros.
+
+    // Minimum or maximum of every horizontal window of 2 * radius + 1 pixels,
+    // van Herk / Gil-Werman style: running minima/maxima forwards and
+    // backwards through blocks of the window size, three comparisons per pixel
+    // whatever the radius. `scratch` must hold 2 * (width + 4 * radius + 1) pixels.
+    template <typename Pixel>
+    static void min_max_row(const Pixel* in, int width, int radius, bool maximum, Pixel* scratch, Pixel* out);
+
+    // out = min or max of a and b pixel by pixel, the vertical half of the same
+    // scheme. SSE2/AVX2 for 8-bit pixels. out may alias a or b.
+    template <typename Pixel>
+    static void min_max_rows(const Pixel* a, const Pixel* b, int width, bool maximum, Pixel* out);
+
+    // The value min_max_row pads the row with: white-most for min, black-most for max
+    template <typename Pixel>
+    static Pixel min_max_identity(bool maximum);
+};
+
+#endif // FILTER_KERNELS_H
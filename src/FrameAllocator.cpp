@@ -0,0 +1,213 @@
+#include "FrameAllocator.h"
+#include "Trace.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+
+static const std::size_t SMALL_CLASS_LIMIT = 4096;
+
+static std::size_t round_up(std::size_t value, std::size_t step) {
+    return (value + step - 1) / step * step;
+}
+
+// ---------------------------------------------------------------------------
+// FrameAllocator
+// ---------------------------------------------------------------------------
+
+FrameAllocator::FrameAllocator() {
+    std::memset(&counters, 0, sizeof(counters));
+}
+
+FrameAllocator::Stats FrameAllocator::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+void FrameAllocator::reset_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    counters.hits = 0;
+    counters.misses = 0;
+    counters.peakBytes = counters.bytesInUse;
+}
+
+void FrameAllocator::count_allocation(std::size_t bytes, bool hit) {
+    TRACE_ALLOCATION();
+    if (hit) {
+        ++counters.hits;
+    } else {
+        ++counters.misses;
+    }
+    counters.bytesInUse += bytes;
+    if (counters.bytesInUse > counters.peakBytes) {
+        counters.peakBytes = counters.bytesInUse;
+    }
+}
+
+void FrameAllocator::count_deallocation(std::size_t bytes) {
+    counters.bytesInUse -= bytes;
+}
+
+static bool environment_wants_huge_pages() {
+    const char* value = std::getenv("CLEARVISION_HUGE_PAGES");
+    return value != nullptr && *value != '\0' && std::strcmp(value, "0") != 0;
+}
+
+// The default pool is never destroyed: images with static storage may still
+// hand their buffers back to it during exit
+static FrameAllocator& default_allocator() {
+    static FrameAllocator* pool = new FramePoolAllocator(environment_wants_huge_pages());
+    return *pool;
+}
+
+static std::atomic<FrameAllocator*> current_allocator(nullptr);
+
+FrameAllocator& FrameAllocator::current() {
+    FrameAllocator* allocator = current_allocator.load(std::memory_order_acquire);
+    return allocator != nullptr ? *allocator : default_allocator();
+}
+
+void FrameAllocator::set_current(FrameAllocator* allocator) {
+    current_allocator.store(allocator, std::memory_order_release);
+}
+
+// ---------------------------------------------------------------------------
+// SystemFrameAllocator
+// ---------------------------------------------------------------------------
+
+void* SystemFrameAllocator::allocate(std::size_t bytes) {
+    void* buffer = nullptr;
+    if (posix_memalign(&buffer, FRAME_ALIGNMENT, bytes == 0 ? FRAME_ALIGNMENT : bytes) != 0) {
+        throw std::bad_alloc();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    count_allocation(bytes, false);
+    return buffer;
+}
+
+void SystemFrameAllocator::deallocate(void* buffer, std::size_t bytes) {
+    if (buffer == nullptr) {
+        return;
+    }
+    std::free(buffer);
+    std::lock_guard<std::mutex> lock(mutex);
+    count_deallocation(bytes);
+}
+
+// ---------------------------------------------------------------------------
+// FramePoolAllocator
+// ---------------------------------------------------------------------------
+
+FramePoolAllocator::FramePoolAllocator(bool hugePages, std::size_t cacheLimit)
+    : hugePages(hugePages), cacheLimit(cacheLimit) {}
+
+FramePoolAllocator::~FramePoolAllocator() {
+    std::lock_guard<std::mutex> lock(mutex);
+    shrink_to(0);
+}
+
+std::size_t FramePoolAllocator::size_class(std::size_t bytes) const {
+    if (bytes <= SMALL_CLASS_LIMIT) {
+        return round_up(bytes == 0 ? 1 : bytes, FRAME_ALIGNMENT);
+    }
+    // Four classes between consecutive powers of two
+    std::size_t power = SMALL_CLASS_LIMIT;
+    while (power < bytes - power) {
+        power *= 2;
+    }
+    std::size_t classBytes = round_up(bytes, power / 4);
+    if (hugePages && classBytes >= HUGE_PAGE_SIZE) {
+        classBytes = round_up(classBytes, HUGE_PAGE_SIZE);
+    }
+    return classBytes;
+}
+
+void* FramePoolAllocator::system_allocate(std::size_t classBytes) {
+#ifdef MADV_HUGEPAGE
+    if (hugePages && classBytes >= HUGE_PAGE_SIZE) {
+        void* buffer = mmap(nullptr, classBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        madvise(buffer, classBytes, MADV_HUGEPAGE);  // Only a hint; fine if the kernel declines
+        return buffer;
+    }
+#endif
+    void* buffer = nullptr;
+    if (posix_memalign(&buffer, FRAME_ALIGNMENT, classBytes) != 0) {
+        throw std::bad_alloc();
+    }
+    return buffer;
+}
+
+void FramePoolAllocator::system_free(void* buffer, std::size_t classBytes) {
+#ifdef MADV_HUGEPAGE
+    if (hugePages && classBytes >= HUGE_PAGE_SIZE) {
+        munmap(buffer, classBytes);
+        return;
+    }
+#endif
+    std::free(buffer);
+}
+
+void* FramePoolAllocator::allocate(std::size_t bytes) {
+    std::size_t classBytes = size_class(bytes);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<std::size_t, std::vector<void*>>::iterator it = cached.find(classBytes);
+        if (it != cached.end() && !it->second.empty()) {
+            void* buffer = it->second.back();
+            it->second.pop_back();
+            counters.bytesCached -= classBytes;
+            count_allocation(classBytes, true);
+            return buffer;
+        }
+    }
+
+    void* buffer = system_allocate(classBytes);
+    std::lock_guard<std::mutex> lock(mutex);
+    count_allocation(classBytes, false);
+    return buffer;
+}
+
+void FramePoolAllocator::deallocate(void* buffer, std::size_t bytes) {
+    if (buffer == nullptr) {
+        return;
+    }
+    std::size_t classBytes = size_class(bytes);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        count_deallocation(classBytes);
+        if (counters.bytesCached + classBytes <= cacheLimit) {
+            cached[classBytes].push_back(buffer);
+            counters.bytesCached += classBytes;
+            return;
+        }
+    }
+    system_free(buffer, classBytes);
+}
+
+void FramePoolAllocator::trim() {
+    std::lock_guard<std::mutex> lock(mutex);
+    shrink_to(0);
+}
+
+void FramePoolAllocator::set_cache_limit(std::size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    cacheLimit = bytes;
+    shrink_to(cacheLimit);
+}
+
+void FramePoolAllocator::shrink_to(std::size_t limit) {
+    std::map<std::size_t, std::vector<void*>>::reverse_iterator it = cached.rbegin();
+    while (counters.bytesCached > limit && it != cached.rend()) {
+        std::vector<void*>& buffers = it->second;
+        while (counters.bytesCached > limit && !buffers.empty()) {
+            system_free(buffers.back(), it->first);
+            buffers.pop_back();
+            counters.bytesCached -= it->first;
+        }
+        ++it;
+    }
+}
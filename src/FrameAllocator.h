@@ -0,0 +1,111 @@
+#ifndef FRAME_ALLOCATOR_H
+#define FRAME_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Source of the pixel buffers behind GrayscaleImage, SecretImage and the
+// filter temporaries. Buffers are FRAME_ALIGNMENT-aligned and not zeroed;
+// each one goes back to the allocator it came from, with the size it was
+// requested with.
+class FrameAllocator {
+public:
+    static const std::size_t FRAME_ALIGNMENT = 64;
+
+    struct Stats {
+        uint64_t hits;             // Requests served from a cached buffer
+        uint64_t misses;           // Requests that went to the system
+        std::size_t bytesInUse;    // Handed out and not returned yet
+        std::size_t peakBytes;     // Highest bytesInUse since the last reset
+        std::size_t bytesCached;   // Returned and kept for reuse
+    };
+
+    FrameAllocator();
+    virtual ~FrameAllocator() {}
+
+    FrameAllocator(const FrameAllocator&) = delete;
+    FrameAllocator& operator=(const FrameAllocator&) = delete;
+
+    // A buffer of at least `bytes` bytes; throws std::bad_alloc
+    virtual void* allocate(std::size_t bytes) = 0;
+
+    // Give back a buffer from allocate() (nullptr is ignored)
+    virtual void deallocate(void* buffer, std::size_t bytes) = 0;
+
+    // Drop whatever is cached for reuse
+    virtual void trim() {}
+
+    Stats stats() const;
+
+    // Zero the hit and miss counters and restart the peak from the bytes in use
+    void reset_stats();
+
+    // The allocator images draw from: a FramePoolAllocator unless replaced.
+    // Setting CLEARVISION_HUGE_PAGES=1 in the environment backs its large
+    // buffers with transparent huge pages.
+    static FrameAllocator& current();
+
+    // Draw later images from another allocator (nullptr: back to the default
+    // pool). It must outlive every buffer it hands out.
+    static void set_current(FrameAllocator* allocator);
+
+protected:
+    mutable std::mutex mutex;  // Guards counters, and whatever the subclass keeps
+    Stats counters;
+
+    // Bookkeeping for one buffer handed out or returned; call with mutex held
+    void count_allocation(std::size_t bytes, bool hit);
+    void count_deallocation(std::size_t bytes);
+};
+
+// Straight to posix_memalign and free every time
+class SystemFrameAllocator : public FrameAllocator {
+public:
+    void* allocate(std::size_t bytes);
+    void deallocate(void* buffer, std::size_t bytes);
+};
+
+// Keeps returned buffers in size classes and hands them out again. Requests
+// are rounded up to a class: multiples of 64 bytes up to 4 KiB, then four
+// classes per power of two, so at most a quarter of a buffer is slack.
+// Returned buffers beyond the cache limit go back to the system.
+//
+// With huge pages, buffers of HUGE_PAGE_SIZE and up are mapped directly,
+// rounded to whole huge pages and advised as huge page candidates, which
+// saves TLB misses when filtering large frames.
+class FramePoolAllocator : public FrameAllocator {
+public:
+    static const std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+    static const std::size_t DEFAULT_CACHE_LIMIT = 256 * 1024 * 1024;
+
+    explicit FramePoolAllocator(bool hugePages = false, std::size_t cacheLimit = DEFAULT_CACHE_LIMIT);
+    ~FramePoolAllocator();
+
+    void* allocate(std::size_t bytes);
+    void deallocate(void* buffer, std::size_t bytes);
+    void trim();
+
+    // Most bytes kept in the cache
+    void set_cache_limit(std::size_t bytes);
+
+    bool huge_pages() const { return hugePages; }
+
+    // Size of the buffer actually reserved for a request
+    std::size_t size_class(std::size_t bytes) const;
+
+private:
+    const bool hugePages;
+    std::size_t cacheLimit;
+    std::map<std::size_t, std::vector<void*>> cached;  // Free buffers by size class
+
+    void* system_allocate(std::size_t classBytes);
+    void system_free(void* buffer, std::size_t classBytes);
+
+    // Free cached buffers, largest classes first, until at most `limit` bytes remain; mutex held
+    void shrink_to(std::size_t limit);
+};
+
+#endif // FRAME_ALLOCATOR_H
@@ -1,177 +1,617 @@
 #include "GrayscaleImage.h"
+#include "FrameAllocator.h"
+#include "Trace.h"
 #include <iostream>
+#include <cstdlib>
 #include <cstring>  // For memcpy
+#include <algorithm>
+#include <utility>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
+#include <cctype>
+#include <climits>
+#include <fstream>
 #include <stdexcept>
+#include <string>
 
-// Constructor: load from a file
-GrayscaleImage::GrayscaleImage(const char* filename) {
+// Longest PGM header we read before giving up (comments included)
+static const size_t PGM_HEADER_LIMIT = 4096;
+
+// Round a row length in bytes up to the next multiple of the row alignment
+static int aligned_stride(int bytes) {
+    return (bytes + GrayscaleImageBase::ROW_ALIGNMENT - 1) / GrayscaleImageBase::ROW_ALIGNMENT * GrayscaleImageBase::ROW_ALIGNMENT;
+}
+
+template <typename Pixel>
+static int row_bytes(int w) {
+    return w * static_cast<int>(sizeof(Pixel));
+}
+
+// Bytes per sample in the files an image type writes: 1 for GrayscaleImage, 2 otherwise
+template <typename Pixel>
+static int file_sample_bytes() {
+    return PixelTraits<Pixel>::BITS == 8 ? 1 : 2;
+}
+
+// Allocate an aligned buffer for a w x h image from the frame allocator
+template <typename Pixel>
+void BasicGrayscaleImage<Pixel>::allocate(int w, int h, bool zero) {
+    width = w;
+    height = h;
+    stride = aligned_stride(row_bytes<Pixel>(w));
+    allocator = nullptr;
+    borrowed = false;
+    data = nullptr;
+
+    std::size_t bytes = static_cast<std::size_t>(stride) * height;
+    if (bytes == 0) {
+        return;
+    }
+    FrameAllocator& frames = FrameAllocator::current();
+    data = static_cast<Pixel*>(frames.allocate(bytes));
+    allocator = &frames;
+    if (zero) {
+        std::memset(data, 0, bytes);  // Black image, padding bytes included
+    }
+}
+
+// Release the pixel buffer with the matching deallocator
+template <typename Pixel>
+void BasicGrayscaleImage<Pixel>::release() {
+    if (data != nullptr && !borrowed) {
+        if (allocator != nullptr) {
+            allocator->deallocate(data, static_cast<std::size_t>(stride) * height);
+        } else {
+            stbi_image_free(data);
+        }
+    }
+    data = nullptr;
+    borrowed = false;
+}
+
+// stb_image hands back tightly packed rows, which integer images keep as-is
+template <typename Pixel>
+void BasicGrayscaleImage<Pixel>::adopt_decoded(void* pixels, int w, int h) {
+    if (PixelTraits<Pixel>::INTEGRAL) {
+        data = static_cast<Pixel*>(pixels);
+        width = w;
+        height = h;
+        stride = row_bytes<Pixel>(w);
+        allocator = nullptr;
+        borrowed = false;
+        return;
+    }
+    allocate(w, h, false);
+    const uint16_t* values = static_cast<const uint16_t*>(pixels);
+    for (int i = 0; i < h; ++i) {
+        Pixel* out = row(i);
+        for (int j = 0; j < w; ++j) {
+            out[j] = convert_pixel<Pixel>(values[static_cast<std::size_t>(i) * w + j]);
+        }
+        std::memset(out + w, 0, stride - row_bytes<Pixel>(w));
+    }
+    stbi_image_free(pixels);
+}
+
+// stb_image at 8 bits for GrayscaleImage and 16 for the others
+template <typename Pixel>
+static void* stb_load_file(const char* filename, int& w, int& h) {
     int channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, STBI_grey);
+    if (PixelTraits<Pixel>::BITS == 8) {
+        return stbi_load(filename, &w, &h, &channels, STBI_grey);
+    }
+    return stbi_load_16(filename, &w, &h, &channels, STBI_grey);
+}
 
-    if (image == nullptr) {
-        std::cerr << "Error: Could not load image " << filename << std::endl;
-        exit(1);
+template <typename Pixel>
+static void* stb_load_memory(const unsigned char* bytes, int size, int& w, int& h) {
+    int channels;
+    if (PixelTraits<Pixel>::BITS == 8) {
+        return stbi_load_from_memory(bytes, size, &w, &h, &channels, STBI_grey);
     }
+    return stbi_load_16_from_memory(bytes, size, &w, &h, &channels, STBI_grey);
+}
 
-    // Allocate memory for the 2D pixel data matrix
-    data = new int*[height];
-    for (int i = 0; i < height; ++i) {
-        data[i] = new int[width];
+// Parse a binary PGM header: "P5", width, height and maxval separated by
+// whitespace or # comments, then a single whitespace byte. Returns its length,
+// or 0 if the bytes end inside it. Samples are 2 bytes (big-endian) when
+// maxval is over 255. Throws for anything but a binary PGM, and for an empty
+// image or rows too long for an int stride of pixelBytes-sized pixels.
+static size_t parse_pgm_header(const unsigned char* bytes, size_t size, int pixelBytes, int& width, int& height,
+                               int& maxval) {
+    if (size < 2 || bytes[0] != 'P' || bytes[1] != '5') {
+        throw std::runtime_error("Not a binary PGM image");
+    }
+    size_t pos = 2;
+    long values[3];
+    for (int v = 0; v < 3; ++v) {
+        for (;;) {
+            if (pos >= size) return 0;
+            if (bytes[pos] == '#') {
+                while (pos < size && bytes[pos] != '\n') ++pos;
+            } else if (std::isspace(bytes[pos])) {
+                ++pos;
+            } else {
+                break;
+            }
+        }
+        if (!std::isdigit(bytes[pos])) {
+            throw std::runtime_error("Malformed PGM header");
+        }
+        long value = 0;
+        while (pos < size && std::isdigit(bytes[pos])) {
+            value = value * 10 + (bytes[pos++] - '0');
+            if (value > INT_MAX) throw std::runtime_error("PGM dimensions too large");
+        }
+        values[v] = value;
+    }
+    if (pos >= size) return 0;
+    if (!std::isspace(bytes[pos])) {
+        throw std::runtime_error("Malformed PGM header");
     }
+    if (values[2] < 1 || values[2] > 65535) {
+        throw std::runtime_error("PGM maxval must be between 1 and 65535");
+    }
+    if (values[0] < 1 || values[1] < 1) {
+        throw std::runtime_error("PGM width and height must be at least 1");
+    }
+    if (values[0] > (INT_MAX - GrayscaleImageBase::ROW_ALIGNMENT) / pixelBytes) {
+        throw std::runtime_error("PGM dimensions too large");
+    }
+    width = static_cast<int>(values[0]);
+    height = static_cast<int>(values[1]);
+    maxval = static_cast<int>(values[2]);
+    return pos + 1;
+}
 
-    // Fill the matrix with pixel values from the image
-    for (int i = 0; i < height; ++i) {
-        for (int j = 0; j < width; ++j) {
-            data[i][j] = static_cast<int>(image[i * width + j]);
+static bool is_pgm_file(const char* filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[2];
+    return file.read(magic, 2) && magic[0] == 'P' && magic[1] == '5';
+}
+
+static std::string pgm_header(int width, int height, int sampleBytes) {
+    return "P5\n" + std::to_string(width) + " " + std::to_string(height) + (sampleBytes == 1 ? "\n255\n" : "\n65535\n");
+}
+
+// One row of PGM samples into pixels, rescaled from the file's depth (not its
+// maxval) to the pixel type's
+template <typename Pixel>
+static void read_samples(const unsigned char* samples, int sampleBytes, int width, Pixel* out) {
+    for (int j = 0; j < width; ++j) {
+        if (sampleBytes == 1) {
+            out[j] = convert_pixel<Pixel>(samples[j]);
+        } else {
+            out[j] = convert_pixel<Pixel>(static_cast<uint16_t>(samples[2 * j] << 8 | samples[2 * j + 1]));
+        }
+    }
+}
+
+// One row of pixels as the PGM samples of file_sample_bytes<Pixel>()
+template <typename Pixel>
+static void write_samples(const Pixel* pixels, int width, unsigned char* out) {
+    for (int j = 0; j < width; ++j) {
+        if (file_sample_bytes<Pixel>() == 1) {
+            out[j] = convert_pixel<unsigned char>(pixels[j]);
+        } else {
+            uint16_t value = convert_pixel<uint16_t>(pixels[j]);
+            out[2 * j] = static_cast<unsigned char>(value >> 8);
+            out[2 * j + 1] = static_cast<unsigned char>(value);
         }
     }
+}
+
+// Read the rows straight into a freshly allocated buffer; samples of another
+// size than the pixels go through a row buffer first
+template <typename Pixel>
+void BasicGrayscaleImage<Pixel>::load_pgm(const char* filename) {
+    std::ifstream file(filename, std::ios::binary);
+    unsigned char header[PGM_HEADER_LIMIT];
+    file.read(reinterpret_cast<char*>(header), sizeof(header));
+    int w, h, maxval;
+    size_t length = parse_pgm_header(header, static_cast<size_t>(file.gcount()), static_cast<int>(sizeof(Pixel)), w, h, maxval);
+    if (length == 0) {
+        throw std::runtime_error(std::string("PGM header is truncated or too long: ") + filename);
+    }
+    file.clear();
+    file.seekg(static_cast<std::streamoff>(length));
 
-    // Free the stb image memory
-    stbi_image_free(image);
+    int sampleBytes = maxval > 255 ? 2 : 1;
+    bool direct = sampleBytes == 1 && sizeof(Pixel) == 1;
+    std::vector<unsigned char> samples(direct ? 0 : static_cast<size_t>(w) * sampleBytes);
+    allocate(w, h, false);
+    for (int i = 0; i < height && file; ++i) {
+        if (direct) {
+            file.read(reinterpret_cast<char*>(row(i)), width);
+        } else {
+            file.read(reinterpret_cast<char*>(samples.data()), static_cast<std::streamsize>(samples.size()));
+            read_samples(samples.data(), sampleBytes, width, row(i));
+        }
+        std::memset(row(i) + width, 0, stride - row_bytes<Pixel>(width));
+    }
+    if (!file) {
+        release();
+        throw std::runtime_error(std::string("PGM file is truncated: ") + filename);
+    }
+}
+
+template <typename Pixel>
+void BasicGrayscaleImage<Pixel>::save_pgm(const char* filename) const {
+    std::ofstream file(filename, std::ios::binary);
+    int sampleBytes = file_sample_bytes<Pixel>();
+    std::string header = pgm_header(width, height, sampleBytes);
+    file.write(header.data(), header.size());
+    if (sizeof(Pixel) == 1 && stride == width && data != nullptr) {
+        file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(width) * height);
+    } else if (sizeof(Pixel) == 1) {
+        for (int i = 0; i < height; ++i) {
+            file.write(reinterpret_cast<const char*>(row(i)), width);
+        }
+    } else {
+        std::vector<unsigned char> samples(static_cast<size_t>(width) * sampleBytes);
+        for (int i = 0; i < height; ++i) {
+            write_samples(row(i), width, samples.data());
+            file.write(reinterpret_cast<const char*>(samples.data()), static_cast<std::streamsize>(samples.size()));
+        }
+    }
+    if (!file) {
+        throw std::runtime_error(std::string("Could not save image to file ") + filename);
+    }
+}
+
+// Constructor: load from a file
+template <typename Pixel>
+BasicGrayscaleImage<Pixel>::BasicGrayscaleImage(const char* filename)
+    : data(nullptr), width(0), height(0), stride(0), allocator(nullptr), borrowed(false) {
+    TRACE_SCOPE(scope, "load");
+    if (is_pgm_file(filename)) {
+        load_pgm(filename);
+    } else {
+        int w, h;
+        void* pixels = stb_load_file<Pixel>(filename, w, h);
+        if (pixels == nullptr) {
+            throw std::runtime_error(std::string("Could not load image ") + filename);
+        }
+        adopt_decoded(pixels, w, h);
+    }
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(row_bytes<Pixel>(width)) * height, static_cast<uint64_t>(width) * height);
 }
 
 // Constructor: initialize from a pre-existing data matrix
-GrayscaleImage::GrayscaleImage(int** inputData, int h, int w) : width(w), height(h) {
-    // Allocate memory for the 2D pixel data matrix
-    data = new int*[height];
+template <typename Pixel>
+BasicGrayscaleImage<Pixel>::BasicGrayscaleImage(int** inputData, int h, int w) {
+    allocate(w, h);
     for (int i = 0; i < height; ++i) {
-        data[i] = new int[width];
-        std::memcpy(data[i], inputData[i], width * sizeof(int));  // Copy each row from inputData
+        Pixel* dst = row(i);
+        for (int j = 0; j < width; ++j) {
+            dst[j] = PixelTraits<Pixel>::saturate(inputData[i][j]);
+        }
     }
 }
 
 // Constructor to create a blank image of given width and height
-GrayscaleImage::GrayscaleImage(int w, int h) : width(w), height(h) {
-    data = new int*[height];
-    for (int i = 0; i < height; ++i) {
-        data[i] = new int[width];
-        std::memset(data[i], 0, width * sizeof(int));  // Initialize all values to 0 (black image)
-    }
+template <typename Pixel>
+BasicGrayscaleImage<Pixel>::BasicGrayscaleImage(int w, int h) {
+    allocate(w, h);
 }
 
 // Copy constructor
-GrayscaleImage::GrayscaleImage(const GrayscaleImage& other) : width(other.width), height(other.height) {
-    data = new int*[height];
+template <typename Pixel>
+BasicGrayscaleImage<Pixel>::BasicGrayscaleImage(const BasicGrayscaleImage& other) {
+    bool sameLayout = aligned_stride(row_bytes<Pixel>(other.width)) == other.stride;
+    allocate(other.width, other.height, !sameLayout);
+    if (sameLayout && data != nullptr) {
+        std::memcpy(data, other.data, static_cast<std::size_t>(stride) * height);  // Padding included
+        return;
+    }
     for (int i = 0; i < height; ++i) {
-        data[i] = new int[width];
-        std::memcpy(data[i], other.data[i], width * sizeof(int));  // Copy each row
+        std::memcpy(row(i), other.row(i), row_bytes<Pixel>(width));  // Copy each row
     }
+}
 
-    if (data == nullptr) {
-    std::cerr << "Error: Data is not initialized." << std::endl;
-    exit(1);
+// Move constructor
+template <typename Pixel>
+BasicGrayscaleImage<Pixel>::BasicGrayscaleImage(BasicGrayscaleImage&& other) noexcept
+    : data(other.data), width(other.width), height(other.height), stride(other.stride), allocator(other.allocator),
+      borrowed(other.borrowed) {
+    other.data = nullptr;
+    other.width = 0;
+    other.height = 0;
+    other.stride = 0;
+    other.allocator = nullptr;
+    other.borrowed = false;
 }
 
+// Copy assignment: reuses the current buffer when the dimensions already match
+template <typename Pixel>
+BasicGrayscaleImage<Pixel>& BasicGrayscaleImage<Pixel>::operator=(const BasicGrayscaleImage& other) {
+    if (this == &other) {
+        return *this;
+    }
+    if (width != other.width || height != other.height || data == nullptr) {
+        BasicGrayscaleImage copy(other);
+        swap(copy);
+        return *this;
+    }
+    for (int i = 0; i < height; ++i) {
+        std::memcpy(row(i), other.row(i), row_bytes<Pixel>(width));
+    }
+    return *this;
 }
 
-// Destructor
-GrayscaleImage::~GrayscaleImage() {
-    if (data != nullptr) {
-        for (int i = 0; i < height; ++i) {
-            delete[] data[i];  // Free each row
-        }
-        delete[] data;  // Free the array of rows
-        data = nullptr;  // Nullify the pointer to avoid double free
+// Move assignment
+template <typename Pixel>
+BasicGrayscaleImage<Pixel>& BasicGrayscaleImage<Pixel>::operator=(BasicGrayscaleImage&& other) noexcept {
+    if (this != &other) {
+        release();
+        data = other.data;
+        width = other.width;
+        height = other.height;
+        stride = other.stride;
+        allocator = other.allocator;
+        borrowed = other.borrowed;
+        other.data = nullptr;
+        other.width = 0;
+        other.height = 0;
+        other.stride = 0;
+        other.allocator = nullptr;
+        other.borrowed = false;
     }
+    return *this;
 }
 
+// Destructor
+template <typename Pixel>
+BasicGrayscaleImage<Pixel>::~BasicGrayscaleImage() {
+    release();
+}
 
-// Equality operator
-bool GrayscaleImage::operator==(const GrayscaleImage& other) const {
+// View of pixels owned elsewhere
+template <typename Pixel>
+BasicGrayscaleImage<Pixel> BasicGrayscaleImage<Pixel>::wrap(Pixel* pixels, int w, int h, int stride) {
+    BasicGrayscaleImage view(0, 0);
+    view.data = pixels;
+    view.width = w;
+    view.height = h;
+    view.stride = stride;
+    view.borrowed = true;
+    return view;
+}
+
+// Swap buffers and dimensions with another image
+template <typename Pixel>
+void BasicGrayscaleImage<Pixel>::swap(BasicGrayscaleImage& other) noexcept {
+    std::swap(data, other.data);
+    std::swap(width, other.width);
+    std::swap(height, other.height);
+    std::swap(stride, other.stride);
+    std::swap(allocator, other.allocator);
+    std::swap(borrowed, other.borrowed);
+}
+
+
+// Equality operator: bit for bit, so float images compare their exact values
+template <typename Pixel>
+bool BasicGrayscaleImage<Pixel>::operator==(const BasicGrayscaleImage& other) const {
     if (width != other.width || height != other.height) {
         return false;  // Dimensions mismatch
     }
     for (int i = 0; i < height; ++i) {
-        for (int j = 0; j < width; ++j) {
-            if (data[i][j] != other.data[i][j]) {
-                return false;  // Pixel value mismatch
-            }
+        if (std::memcmp(row(i), other.row(i), row_bytes<Pixel>(width)) != 0) {
+            return false;  // Pixel value mismatch
         }
     }
     return true;  // All pixel values are the same
 }
 
+// Per-pixel sums and differences: saturating for integer pixels, plain for float
+static unsigned char add_pixels(unsigned char a, unsigned char b) { return static_cast<unsigned char>(std::min(a + b, 255)); }
+static uint16_t add_pixels(uint16_t a, uint16_t b) { return static_cast<uint16_t>(std::min(a + b, 65535)); }
+static float add_pixels(float a, float b) { return a + b; }
+static unsigned char subtract_pixels(unsigned char a, unsigned char b) { return static_cast<unsigned char>(std::max(a - b, 0)); }
+static uint16_t subtract_pixels(uint16_t a, uint16_t b) { return static_cast<uint16_t>(std::max(a - b, 0)); }
+static float subtract_pixels(float a, float b) { return a - b; }
+
 // Addition operator
-GrayscaleImage GrayscaleImage::operator+(const GrayscaleImage& other) const {
+template <typename Pixel>
+BasicGrayscaleImage<Pixel> BasicGrayscaleImage<Pixel>::operator+(const BasicGrayscaleImage& other) const {
     if (width != other.width || height != other.height) {
         throw std::invalid_argument("Images must have the same dimensions for addition.");
     }
-    GrayscaleImage result(width, height);
+    BasicGrayscaleImage result(width, height);
     for (int i = 0; i < height; ++i) {
+        const Pixel* a = row(i);
+        const Pixel* b = other.row(i);
+        Pixel* out = result.row(i);
         for (int j = 0; j < width; ++j) {
-            result.data[i][j] = std::min(data[i][j] + other.data[i][j], 255);  // Clamp to 255
+            out[j] = add_pixels(a[j], b[j]);  // Clamp to white
         }
     }
     return result;
 }
 
 // Subtraction operator
-GrayscaleImage GrayscaleImage::operator-(const GrayscaleImage& other) const {
+template <typename Pixel>
+BasicGrayscaleImage<Pixel> BasicGrayscaleImage<Pixel>::operator-(const BasicGrayscaleImage& other) const {
     if (width != other.width || height != other.height) {
         throw std::invalid_argument("Images must have the same dimensions for subtraction.");
     }
-    GrayscaleImage result(width, height);
+    BasicGrayscaleImage result(width, height);
     for (int i = 0; i < height; ++i) {
+        const Pixel* a = row(i);
+        const Pixel* b = other.row(i);
+        Pixel* out = result.row(i);
         for (int j = 0; j < width; ++j) {
-            result.data[i][j] = std::max(data[i][j] - other.data[i][j], 0);  // Clamp to 0
+            out[j] = subtract_pixels(a[j], b[j]);  // Clamp to 0
         }
     }
     return result;
 }
 
-// Get a specific pixel value
-int GrayscaleImage::get_pixel(int row, int col) const {
-    if (row < 0 || row >= height || col < 0 || col >= width) {
-        throw std::out_of_range("Pixel coordinates are out of range.");
+// In-place addition, clamped to white
+template <typename Pixel>
+BasicGrayscaleImage<Pixel>& BasicGrayscaleImage<Pixel>::operator+=(const BasicGrayscaleImage& other) {
+    if (width != other.width || height != other.height) {
+        throw std::invalid_argument("Images must have the same dimensions for addition.");
+    }
+    for (int i = 0; i < height; ++i) {
+        Pixel* a = row(i);
+        const Pixel* b = other.row(i);
+        for (int j = 0; j < width; ++j) {
+            a[j] = add_pixels(a[j], b[j]);
+        }
     }
-    return data[row][col];
+    return *this;
 }
 
-int clamp(int value, int low, int high) {
-    if (value < low) return low;
-    if (value > high) return high;
-    return value;
+// In-place subtraction, clamped to 0
+template <typename Pixel>
+BasicGrayscaleImage<Pixel>& BasicGrayscaleImage<Pixel>::operator-=(const BasicGrayscaleImage& other) {
+    if (width != other.width || height != other.height) {
+        throw std::invalid_argument("Images must have the same dimensions for subtraction.");
+    }
+    for (int i = 0; i < height; ++i) {
+        Pixel* a = row(i);
+        const Pixel* b = other.row(i);
+        for (int j = 0; j < width; ++j) {
+            a[j] = subtract_pixels(a[j], b[j]);
+        }
+    }
+    return *this;
 }
 
-void GrayscaleImage::set_pixel(int row, int col, int value) {
-    if (row < 0 || row >= height || col < 0 || col >= width) {
+// Get a specific pixel value
+template <typename Pixel>
+typename BasicGrayscaleImage<Pixel>::Value BasicGrayscaleImage<Pixel>::get_pixel(int r, int col) const {
+    if (r < 0 || r >= height || col < 0 || col >= width) {
         throw std::out_of_range("Pixel coordinates are out of range.");
     }
-    data[row][col] = clamp(value, 0, 255);  // Ensure value is between 0 and 255
+    return row(r)[col];
 }
 
-// Function to save the image to a PNG file
-void GrayscaleImage::save_to_file(const char* filename) const {
-    if (data == nullptr) {
-    std::cerr << "Error: Pixel data is not initialized." << std::endl;
-    return; // Veya başka bir hata işleme
+template <typename Pixel>
+void BasicGrayscaleImage<Pixel>::set_pixel(int r, int col, Value value) {
+    if (r < 0 || r >= height || col < 0 || col >= width) {
+        throw std::out_of_range("Pixel coordinates are out of range.");
+    }
+    row(r)[col] = PixelTraits<Pixel>::saturate(value);  // Ensure value is between 0 and white
+}
+
+GrayscaleImageBase::Format GrayscaleImageBase::format_for(const std::string& filename) {
+    size_t dot = filename.find_last_of('.');
+    std::string extension = (dot == std::string::npos) ? "" : filename.substr(dot + 1);
+    for (size_t i = 0; i < extension.size(); ++i) {
+        extension[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(extension[i])));
+    }
+    return extension == "pgm" ? PGM : PNG;
 }
 
-    unsigned char* imageBuffer = new unsigned char[width * height];
+template <typename Pixel>
+BasicGrayscaleImage<Pixel> BasicGrayscaleImage<Pixel>::decode(const unsigned char* bytes, std::size_t size) {
+    TRACE_SCOPE(scope, "decode");
+    BasicGrayscaleImage image(0, 0);
+    if (size >= 2 && bytes[0] == 'P' && bytes[1] == '5') {
+        int w, h, maxval;
+        size_t length = parse_pgm_header(bytes, size, static_cast<int>(sizeof(Pixel)), w, h, maxval);
+        int sampleBytes = maxval > 255 ? 2 : 1;
+        if (length == 0 || (size - length) / sampleBytes < static_cast<size_t>(w) * h) {
+            throw std::runtime_error("PGM data is truncated");
+        }
+        image.allocate(w, h, false);
+        for (int i = 0; i < h; ++i) {
+            const unsigned char* samples = bytes + length + static_cast<size_t>(i) * w * sampleBytes;
+            if (sampleBytes == 1 && sizeof(Pixel) == 1) {
+                std::memcpy(image.row(i), samples, w);
+            } else {
+                read_samples(samples, sampleBytes, w, image.row(i));
+            }
+            std::memset(image.row(i) + w, 0, image.stride - row_bytes<Pixel>(w));
+        }
+        TRACE_AMOUNT(scope, static_cast<uint64_t>(row_bytes<Pixel>(w)) * h, static_cast<uint64_t>(w) * h);
+        return image;
+    }
 
-    if (imageBuffer == nullptr) {
-    std::cerr << "Error: Could not allocate memory for image buffer." << std::endl;
-    return;
+    if (size > static_cast<std::size_t>(INT_MAX)) {
+        throw std::runtime_error("Encoded image too large to decode");
+    }
+    int w, h;
+    void* pixels = stb_load_memory<Pixel>(bytes, static_cast<int>(size), w, h);
+    if (pixels == nullptr) {
+        throw std::runtime_error("Could not decode image from memory");
+    }
+    image.adopt_decoded(pixels, w, h);
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(row_bytes<Pixel>(w)) * h, static_cast<uint64_t>(w) * h);
+    return image;
 }
 
+template <typename Pixel>
+void BasicGrayscaleImage<Pixel>::encode_png(const PngEncoder::Options& png, PngEncoder::Writer output) const {
+    if (data == nullptr) {
+        throw std::runtime_error("Pixel data is not initialized.");
+    }
+    if (PixelTraits<Pixel>::BITS == 8) {
+        PngEncoder::encode(reinterpret_cast<const unsigned char*>(data), width, height, stride, png, output);
+    } else if (PixelTraits<Pixel>::INTEGRAL) {
+        PngEncoder::encode(reinterpret_cast<const uint16_t*>(data), width, height, stride, png, output);
+    } else {
+        GrayscaleImage16 wide = convert<uint16_t>();
+        PngEncoder::encode(wide.get_data(), width, height, wide.get_stride(), png, output);
+    }
+}
 
-    // Fill the buffer with pixel data (convert int to unsigned char)
-    for (int i = 0; i < height; ++i) {
-        for (int j = 0; j < width; ++j) {
-            imageBuffer[i * width + j] = static_cast<unsigned char>(data[i][j]);
+template <typename Pixel>
+std::vector<unsigned char> BasicGrayscaleImage<Pixel>::encode(Format format, const PngEncoder::Options& png) const {
+    TRACE_SCOPE(scope, "encode");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(row_bytes<Pixel>(width)) * height, static_cast<uint64_t>(width) * height);
+    std::vector<unsigned char> bytes;
+    if (format == PGM) {
+        int sampleBytes = file_sample_bytes<Pixel>();
+        std::string header = pgm_header(width, height, sampleBytes);
+        bytes.reserve(header.size() + static_cast<size_t>(width) * height * sampleBytes);
+        bytes.insert(bytes.end(), header.begin(), header.end());
+        std::vector<unsigned char> samples(static_cast<size_t>(width) * sampleBytes);
+        for (int i = 0; i < height; ++i) {
+            if (sizeof(Pixel) == 1) {
+                const unsigned char* pixels = reinterpret_cast<const unsigned char*>(row(i));
+                bytes.insert(bytes.end(), pixels, pixels + width);
+            } else {
+                write_samples(row(i), width, samples.data());
+                bytes.insert(bytes.end(), samples.begin(), samples.end());
+            }
         }
+        return bytes;
     }
 
+    encode_png(png, [&bytes](const unsigned char* chunk, size_t length) {
+        bytes.insert(bytes.end(), chunk, chunk + length);
+    });
+    return bytes;
+}
 
-    // Write the buffer to a PNG file
-    if (!stbi_write_png(filename, width, height, 1, imageBuffer, width)) {
-        std::cerr << "Error: Could not save image to file " << filename << std::endl;
+// Function to save the image to a file
+template <typename Pixel>
+void BasicGrayscaleImage<Pixel>::save_to_file(const char* filename, const PngEncoder::Options& png) const {
+    TRACE_SCOPE(scope, "save");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(row_bytes<Pixel>(width)) * height, static_cast<uint64_t>(width) * height);
+    if (format_for(filename) == PGM) {
+        save_pgm(filename);
+        return;
+    }
+    if (data == nullptr) {
+        throw std::runtime_error("Pixel data is not initialized.");
     }
 
-    // Clean up the allocated buffer
-    delete[] imageBuffer;
+    // Encode straight from the pixel buffer, honouring the row stride
+    std::ofstream file(filename, std::ios::binary);
+    encode_png(png, [&file](const unsigned char* chunk, size_t length) {
+        file.write(reinterpret_cast<const char*>(chunk), static_cast<std::streamsize>(length));
+    });
+    file.close();
+    if (!file) {
+        throw std::runtime_error(std::string("Could not save image to file ") + filename);
+    }
 }
+
+template class BasicGrayscaleImage<unsigned char>;
+template class BasicGrayscaleImage<uint16_t>;
+template class BasicGrayscaleImage<float>;
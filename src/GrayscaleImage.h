@@ -1,50 +1,167 @@
 #ifndef GRAYSCALE_IMAGE_H
 #define GRAYSCALE_IMAGE_H
 
-class GrayscaleImage {
+#include "PixelTraits.h"
+#include "PngEncoder.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class FrameAllocator;
+
+// The parts of an image that don't depend on its pixel type
+class GrayscaleImageBase {
+public:
+    // Alignment of the pixel buffer and of every row start in images allocated
+    // here. Decoded 8- and 16-bit images keep stb_image's buffer instead: only
+    // malloc-aligned, with tightly packed rows. Don't assume aligned rows.
+    static const int ROW_ALIGNMENT = 64;
+
+    // Encodings for files and memory buffers. PNG is the default; PGM is binary
+    // netpbm ("P5"), uncompressed, for hops where compression isn't worth it.
+    enum Format { PNG, PGM };
+
+    // Format save_to_file uses for a file name
+    static Format format_for(const std::string& filename);
+};
+
+// A grey image with pixels of type unsigned char (GrayscaleImage), uint16_t
+// (GrayscaleImage16) or float (GrayscaleImageF, nominally 0 to 1), instantiated
+// in GrayscaleImage.cpp for those three. Files are 8-bit for GrayscaleImage and
+// 16-bit for the other two: PNG and PGM of either depth load into any of them,
+// rescaled to the pixel type's range, and float images save as 16-bit.
+template <typename Pixel>
+class BasicGrayscaleImage : public GrayscaleImageBase {
 private:
-    int** data;
+    Pixel* data;          // Contiguous pixel buffer, rows are `stride` bytes apart
     int width, height;
+    int stride;           // Distance in bytes between the starts of two consecutive rows
+    FrameAllocator* allocator;  // Where data came from, or nullptr when stbi_load allocated it
+    bool borrowed;              // data belongs to someone else (see wrap) and is never freed here
 
+    typedef typename PixelTraits<Pixel>::Value Value;
+
+    // Allocate an aligned buffer for a w x h image from the current frame
+    // allocator, zero-filled unless the caller overwrites every byte
+    void allocate(int w, int h, bool zero = true);
+
+    // Release the pixel buffer with the matching deallocator
+    void release();
+
+    // Take over a buffer stb_image decoded (8-bit for GrayscaleImage, 16-bit
+    // otherwise); float images convert it into a buffer of their own instead
+    void adopt_decoded(void* pixels, int w, int h);
+
+    // PNG at the pixel type's depth; float pixels go out as 16-bit
+    void encode_png(const PngEncoder::Options& png, PngEncoder::Writer output) const;
+
+    // Binary PGM, read and written row by row straight from and into the buffer
+    void load_pgm(const char* filename);
+    void save_pgm(const char* filename) const;
 
 public:
-    // Constructor: loads an image from a file
-    GrayscaleImage(const char* filename);
+    // Constructor: loads an image from a file, PGM if it starts with "P5" and
+    // through stb_image otherwise. Both decode into the image's own buffer.
+    // Throws std::runtime_error if it can't be read.
+    BasicGrayscaleImage(const char* filename);
 
     // Constructor: initializes from a 2D data matrix
-    GrayscaleImage(int** inputData, int h, int w);
+    BasicGrayscaleImage(int** inputData, int h, int w);
 
     // Constructor to create a blank image of given width and height
-    GrayscaleImage(int w, int h);
+    BasicGrayscaleImage(int w, int h);
 
     // Copy constructor
-    GrayscaleImage(const GrayscaleImage& other);
+    BasicGrayscaleImage(const BasicGrayscaleImage& other);
+
+    // Move constructor: steals the pixel buffer, leaving other empty
+    BasicGrayscaleImage(BasicGrayscaleImage&& other) noexcept;
+
+    // Copy and move assignment
+    BasicGrayscaleImage& operator=(const BasicGrayscaleImage& other);
+    BasicGrayscaleImage& operator=(BasicGrayscaleImage&& other) noexcept;
 
     // Destructor
-    ~GrayscaleImage();
+    ~BasicGrayscaleImage();
 
-    // Operator overloads
-    bool operator==(const GrayscaleImage& other) const;
-    GrayscaleImage operator+(const GrayscaleImage& other) const;
-    GrayscaleImage operator-(const GrayscaleImage& other) const;
+    // An image over pixels owned by someone else, e.g. shared memory, with
+    // rows `stride` bytes apart. The pixels must outlive the image. Filters
+    // writing into a view of the right size write straight into those pixels.
+    static BasicGrayscaleImage wrap(Pixel* pixels, int w, int h, int stride);
+
+    // Copy with every pixel rescaled to another type's range (see convert_pixel)
+    template <typename Other>
+    BasicGrayscaleImage<Other> convert() const {
+        BasicGrayscaleImage<Other> result(width, height);
+        for (int i = 0; i < height; ++i) {
+            const Pixel* in = row(i);
+            Other* out = result.row(i);
+            for (int j = 0; j < width; ++j) {
+                out[j] = convert_pixel<Other>(in[j]);
+            }
+        }
+        return result;
+    }
+
+    // Exchange pixel buffers with another image without copying
+    void swap(BasicGrayscaleImage& other) noexcept;
+
+    // Operator overloads; integer pixels saturate, float pixels don't
+    bool operator==(const BasicGrayscaleImage& other) const;
+    BasicGrayscaleImage operator+(const BasicGrayscaleImage& other) const;
+    BasicGrayscaleImage operator-(const BasicGrayscaleImage& other) const;
+
+    // In-place variants that reuse this image's buffer
+    BasicGrayscaleImage& operator+=(const BasicGrayscaleImage& other);
+    BasicGrayscaleImage& operator-=(const BasicGrayscaleImage& other);
 
     // Method to get image dimensions
     int get_width() const { return width; }
     int get_height() const { return height; }
 
     // Get a specific pixel value
-    int get_pixel(int row, int col) const;
+    Value get_pixel(int row, int col) const;
+
+    // Set a specific pixel value, clamped to the range of integer pixels
+    void set_pixel(int row, int col, Value value);
+
+    // Write the image to a file, PGM for names ending in .pgm and PNG otherwise
+    // (encoded with the given options); throws std::runtime_error on failure
+    void save_to_file(const char* filename, const PngEncoder::Options& png = PngEncoder::defaults()) const;
 
-    // Set a specific pixel value
-    void set_pixel(int row, int col, int value);
+    // Decode an image held in memory (PNG or PGM, told apart by content), so
+    // images can travel between services without temp files. A decoded PNG
+    // keeps the decoder's buffer. Throws std::runtime_error if it can't be decoded.
+    static BasicGrayscaleImage decode(const unsigned char* bytes, std::size_t size);
 
-    // Function to write the image data back to a PNG file
-    void save_to_file(const char* filename) const;
+    // Encode the image into memory
+    std::vector<unsigned char> encode(Format format = PNG, const PngEncoder::Options& png = PngEncoder::defaults()) const;
+
+    // Row views: pointer to the first pixel of row r, valid for get_width() pixels.
+    // Walking from row(r) to row(r + 1) is a step of get_stride() bytes.
+    Pixel* row(int r) {
+        return reinterpret_cast<Pixel*>(reinterpret_cast<unsigned char*>(data) + static_cast<std::size_t>(r) * stride);
+    }
+    const Pixel* row(int r) const {
+        return reinterpret_cast<const Pixel*>(reinterpret_cast<const unsigned char*>(data) + static_cast<std::size_t>(r) * stride);
+    }
+
+    // Distance in bytes between consecutive rows
+    int get_stride() const { return stride; }
 
     // Getter function for data.
-    int** get_data() const {
+    Pixel* get_data() const {
         return data;
     }
 };
 
+typedef BasicGrayscaleImage<unsigned char> GrayscaleImage;
+typedef BasicGrayscaleImage<uint16_t> GrayscaleImage16;
+typedef BasicGrayscaleImage<float> GrayscaleImageF;
+
+extern template class BasicGrayscaleImage<unsigned char>;
+extern template class BasicGrayscaleImage<uint16_t>;
+extern template class BasicGrayscaleImage<float>;
+
 #endif // GRAYSCALE_IMAGE_H
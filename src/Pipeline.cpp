@@ -0,0 +1,391 @@
+#include "Pipeline.h"
+#include "Checksum.h"
+#include "Compare.h"
+#include "FilterKernels.h"
+#include "PngStream.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+PipelineStage::PipelineStage(RowSource& upstream, int radius)
+    : upstream(upstream), radius(radius), ringRows(2 * radius + 2),
+      ring(ringRows, nullptr), output(upstream.get_width()), nextInput(0), nextOutput(0), firstOutput(0) {
+    if (!upstream.rows_are_stable()) {
+        storage.resize(static_cast<size_t>(ringRows) * upstream.get_width());
+    }
+}
+
+void PipelineStage::begin(int first) {
+    firstOutput = first;
+    nextOutput = first;
+    nextInput = std::max(0, first - radius);
+    upstream.begin(nextInput);
+}
+
+void PipelineStage::fill_to(int last) {
+    int width = get_width();
+    last = std::min(last, get_height() - 1);
+    while (nextInput <= last) {
+        const unsigned char* row = upstream.next_row();
+        int slot = nextInput % ringRows;
+        if (storage.empty()) {
+            ring[slot] = row;
+        } else {
+            unsigned char* copy = &storage[static_cast<size_t>(slot) * width];
+            std::memcpy(copy, row, width);
+            ring[slot] = copy;
+        }
+        ++nextInput;
+    }
+}
+
+const unsigned char* PipelineStage::input(int r) const {
+    if (r < 0 || r >= get_height()) {
+        return nullptr;
+    }
+    return ring[r % ringRows];
+}
+
+const unsigned char* PipelineStage::next_row() {
+    int i = nextOutput++;
+    fill_to(i + radius);
+    produce(i, i == firstOutput, output.data());
+    return output.data();
+}
+
+// Sliding-window mean: column sums move down one row per output row.
+// Sums are 64-bit only for windows too large for int (box_sums_fit).
+class MeanStage : public PipelineStage {
+private:
+    std::vector<int> sums;
+    std::vector<int> scratch;
+    std::vector<int64_t> wideSums;
+    std::vector<int64_t> wideScratch;
+    std::vector<const unsigned char*> window;
+
+    template <typename Sum>
+    void produce_with(int i, bool first, unsigned char* out, std::vector<Sum>& sums, std::vector<Sum>& scratch) {
+        int width = get_width();
+        int radius = get_radius();
+        if (first) {
+            for (int t = -radius; t <= radius; ++t) {
+                window[t + radius] = input(i + t);
+            }
+            FilterKernels::box_column_sums(window.data(), 2 * radius + 1, width, sums.data());
+        } else {
+            FilterKernels::box_slide(sums.data(), input(i + radius), input(i - radius - 1), width);
+        }
+        FilterKernels::box_row_mean(sums.data(), width, radius, out, scratch.data());
+    }
+
+public:
+    MeanStage(RowSource& upstream, int kernelSize)
+        : PipelineStage(upstream, kernelSize / 2), window(2 * (kernelSize / 2) + 1) {
+        std::size_t width = static_cast<std::size_t>(upstream.get_width());
+        if (FilterKernels::box_sums_fit(upstream.get_width(), upstream.get_height(), kernelSize / 2)) {
+            sums.resize(width);
+            scratch.resize(width + 1);
+        } else {
+            wideSums.resize(width);
+            wideScratch.resize(width + 1);
+        }
+    }
+
+protected:
+    void produce(int i, bool first, unsigned char* out) {
+        if (sums.empty() && !wideSums.empty()) {
+            produce_with(i, first, out, wideSums, wideScratch);
+        } else {
+            produce_with(i, first, out, sums, scratch);
+        }
+    }
+};
+
+// Separable Gaussian over the rolling window
+class GaussianStage : public PipelineStage {
+private:
+    std::shared_ptr<const GaussianKernel> kernel;
+    std::vector<double> scratch;
+    std::vector<const unsigned char*> window;
+
+public:
+    GaussianStage(RowSource& upstream, int kernelSize, double sigma)
+        : PipelineStage(upstream, kernelSize / 2), kernel(GaussianKernel::cached(kernelSize, sigma)),
+          scratch(2 * upstream.get_width()), window(2 * kernel->radius + 1) {}
+
+protected:
+    void produce(int i, bool, unsigned char* out) {
+        for (int t = -kernel->radius; t <= kernel->radius; ++t) {
+            window[t + kernel->radius] = input(i + t);
+        }
+        FilterKernels::gaussian_row(window.data(), get_width(), *kernel, scratch.data(), out);
+    }
+};
+
+// Unsharp mask: blurs one line into a line buffer and sharpens straight from it,
+// so the blurred frame never exists as a whole
+class UnsharpStage : public PipelineStage {
+private:
+    std::shared_ptr<const GaussianKernel> kernel;
+    double amount;
+    std::vector<double> scratch;
+    std::vector<unsigned char> blurred;
+    std::vector<const unsigned char*> window;
+
+public:
+    UnsharpStage(RowSource& upstream, int kernelSize, double amount)
+        : PipelineStage(upstream, kernelSize / 2), kernel(GaussianKernel::cached(kernelSize, 1.0)), amount(amount),
+          scratch(2 * upstream.get_width()), blurred(upstream.get_width()), window(2 * kernel->radius + 1) {}
+
+protected:
+    void produce(int i, bool, unsigned char* out) {
+        for (int t = -kernel->radius; t <= kernel->radius; ++t) {
+            window[t + kernel->radius] = input(i + t);
+        }
+        FilterKernels::gaussian_row(window.data(), get_width(), *kernel, scratch.data(), blurred.data());
+        FilterKernels::unsharp_row(input(i), blurred.data(), get_width(), amount, out);
+    }
+};
+
+// Pixel-wise add/subtract of another image, clamped like GrayscaleImage's operators.
+// The operand is read in step with the upstream rows.
+class ArithmeticStage : public PipelineStage {
+private:
+    std::unique_ptr<RowSource> operand;
+    bool subtract;
+
+public:
+    ArithmeticStage(RowSource& upstream, std::unique_ptr<RowSource> operand, bool subtract)
+        : PipelineStage(upstream, 0), operand(std::move(operand)), subtract(subtract) {}
+
+protected:
+    void produce(int i, bool first, unsigned char* out) {
+        if (first) {
+            operand->begin(i);
+        }
+        const unsigned char* a = input(i);
+        const unsigned char* b = operand->next_row();
+        int width = get_width();
+        if (subtract) {
+            for (int j = 0; j < width; ++j) out[j] = static_cast<unsigned char>(std::max(a[j] - b[j], 0));
+        } else {
+            for (int j = 0; j < width; ++j) out[j] = static_cast<unsigned char>(std::min(a[j] + b[j], 255));
+        }
+    }
+};
+
+// Split "a:b:c" on the given separator
+static std::vector<std::string> split(const std::string& text, char separator) {
+    std::vector<std::string> parts;
+    std::stringstream stream(text);
+    std::string part;
+    while (std::getline(stream, part, separator)) {
+        parts.push_back(part);
+    }
+    return parts;
+}
+
+Pipeline::Pipeline(const std::string& spec, bool streamOperands) {
+    std::vector<std::string> descriptions = split(spec, '|');
+    for (size_t s = 0; s < descriptions.size(); ++s) {
+        std::vector<std::string> fields = split(descriptions[s], ':');
+        if (fields.empty() || fields[0].empty()) {
+            throw std::invalid_argument("Empty stage in pipeline: " + spec);
+        }
+
+        StageSpec stage;
+        stage.op = fields[0];
+        stage.kernelSize = 3;
+        stage.parameter = 0.0;
+
+        if (stage.op == "mean" || stage.op == "gauss" || stage.op == "unsharp") {
+            if (fields.size() > 3) throw std::invalid_argument("Too many arguments for stage: " + descriptions[s]);
+            stage.parameter = (stage.op == "unsharp") ? 1.5 : 1.0;
+            if (fields.size() > 1) stage.kernelSize = std::stoi(fields[1]);
+            if (fields.size() > 2) {
+                if (stage.op == "mean") throw std::invalid_argument("Usage: mean:<kernel_size>");
+                stage.parameter = std::stod(fields[2]);
+            }
+            if (stage.kernelSize < 0) throw std::invalid_argument("Kernel size must not be negative.");
+        } else if (stage.op == "add" || stage.op == "sub") {
+            if (fields.size() != 2) throw std::invalid_argument("Usage: " + stage.op + ":<img>");
+            stage.operandPath = fields[1];
+            if (!streamOperands) {
+                stage.operand = std::make_shared<GrayscaleImage>(fields[1].c_str());
+            }
+        } else {
+            throw std::invalid_argument("Unknown pipeline stage: " + stage.op);
+        }
+        stages.push_back(stage);
+    }
+    if (stages.empty()) {
+        throw std::invalid_argument("Pipeline needs at least one stage.");
+    }
+}
+
+Pipeline Pipeline::single_filter(const std::string& op, int kernelSize, double parameter) {
+    if (kernelSize < 0) throw std::invalid_argument("Kernel size must not be negative.");
+    StageSpec stage;
+    stage.op = op;
+    stage.kernelSize = kernelSize;
+    stage.parameter = parameter;
+    Pipeline pipeline;
+    pipeline.stages.push_back(stage);
+    return pipeline;
+}
+
+Pipeline Pipeline::mean(int kernelSize) {
+    return single_filter("mean", kernelSize, 0.0);
+}
+
+Pipeline Pipeline::gaussian(int kernelSize, double sigma) {
+    return single_filter("gauss", kernelSize, sigma);
+}
+
+Pipeline Pipeline::unsharp(int kernelSize, double amount) {
+    return single_filter("unsharp", kernelSize, amount);
+}
+
+std::string Pipeline::describe() const {
+    std::ostringstream text;
+    text.precision(17);
+    for (size_t s = 0; s < stages.size(); ++s) {
+        const StageSpec& stage = stages[s];
+        text << (s == 0 ? "" : "|") << stage.op;
+        if (stage.operandPath.empty()) {
+            text << ":" << stage.kernelSize << ":" << stage.parameter;
+        } else if (stage.operand) {
+            text << ":pixels=" << std::hex << Compare::hash(*stage.operand) << std::dec;
+        } else {
+            std::ifstream file(stage.operandPath, std::ios::binary);
+            if (!file) throw std::runtime_error("Could not open " + stage.operandPath);
+            std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            text << ":file=" << std::hex
+                 << Checksum::xxh64(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size()) << std::dec;
+        }
+    }
+    return text.str();
+}
+
+int Pipeline::halo() const {
+    int total = 0;
+    for (size_t s = 0; s < stages.size(); ++s) {
+        total += stages[s].operandPath.empty() ? stages[s].kernelSize / 2 : 0;
+    }
+    return total;
+}
+
+std::vector<std::unique_ptr<PipelineStage>> Pipeline::build(RowSource& source) const {
+    std::vector<std::unique_ptr<PipelineStage>> chain;
+    RowSource* upstream = &source;
+    for (size_t s = 0; s < stages.size(); ++s) {
+        const StageSpec& spec = stages[s];
+        PipelineStage* stage;
+        if (spec.op == "mean") {
+            stage = new MeanStage(*upstream, spec.kernelSize);
+        } else if (spec.op == "gauss") {
+            stage = new GaussianStage(*upstream, spec.kernelSize, spec.parameter);
+        } else if (spec.op == "unsharp") {
+            stage = new UnsharpStage(*upstream, spec.kernelSize, spec.parameter);
+        } else {
+            std::unique_ptr<RowSource> operand;
+            if (spec.operand) {
+                operand.reset(new ImageRowSource(*spec.operand));
+            } else {
+                operand.reset(new PngRowReader(spec.operandPath));
+            }
+            if (operand->get_width() != source.get_width() || operand->get_height() != source.get_height()) {
+                throw std::invalid_argument("Images must have the same dimensions for " + std::string(spec.op == "add" ? "addition." : "subtraction."));
+            }
+            stage = new ArithmeticStage(*upstream, std::move(operand), spec.op == "sub");
+        }
+        chain.push_back(std::unique_ptr<PipelineStage>(stage));
+        upstream = stage;
+    }
+    return chain;
+}
+
+void Pipeline::run(const GrayscaleImage& src, GrayscaleImage& dst) const {
+    if (&src == &dst) {
+        throw std::invalid_argument("Pipeline source and destination must be different images.");
+    }
+    TRACE_SCOPE(scope, "pipeline");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(src.get_width()) * src.get_height(), static_cast<uint64_t>(src.get_width()) * src.get_height());
+    if (dst.get_width() != src.get_width() || dst.get_height() != src.get_height()) {
+        dst = GrayscaleImage(src.get_width(), src.get_height());
+    }
+
+    // Bands recompute their halo rows in every stage, so keep them several halos tall
+    int minBandRows = std::max(16, 4 * halo());
+    int width = src.get_width();
+    ThreadPool::shared().parallel_bands(src.get_height(), minBandRows, [&](int first, int last) {
+        ImageRowSource source(src);
+        std::vector<std::unique_ptr<PipelineStage>> chain = build(source);
+        PipelineStage& tail = *chain.back();
+        tail.begin(first);
+        for (int i = first; i < last; ++i) {
+            std::memcpy(dst.row(i), tail.next_row(), width);
+        }
+    });
+}
+
+void Pipeline::run(RowSource& source, RowSink& sink) const {
+    TRACE_SCOPE(scope, "pipeline.stream");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(source.get_width()) * source.get_height(),
+                 static_cast<uint64_t>(source.get_width()) * source.get_height());
+    std::vector<std::unique_ptr<PipelineStage>> chain = build(source);
+    PipelineStage& tail = *chain.back();
+    tail.begin(0);
+    for (int i = 0; i < source.get_height(); ++i) {
+        sink.write_row(tail.next_row());
+    }
+}
+
+// Each band writes its rows straight back except the `halo` rows at either
+// end, which the neighbouring bands still read as context; those are held
+// back and written once every band has finished. Within a band the chain has
+// already pulled row i + halo before row i comes out, so writing row i never
+// changes an input that is still to be read.
+void Pipeline::run(SecretImage& image) const {
+    TRACE_SCOPE(scope, "pipeline.secret");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(image.get_width()) * image.get_height(),
+                 static_cast<uint64_t>(image.get_width()) * image.get_height());
+    int width = image.get_width();
+    int margin = halo();
+    int minBandRows = std::max(16, 4 * margin);
+
+    std::mutex heldMutex;
+    std::vector<std::pair<int, std::vector<unsigned char>>> held;
+    ThreadPool::shared().parallel_bands(image.get_height(), minBandRows, [&](int first, int last) {
+        SecretImageRowSource source(image);
+        std::vector<std::unique_ptr<PipelineStage>> chain = build(source);
+        PipelineStage& tail = *chain.back();
+        tail.begin(first);
+
+        std::vector<std::pair<int, std::vector<unsigned char>>> edges;
+        for (int i = first; i < last; ++i) {
+            const unsigned char* row = tail.next_row();
+            if (i < first + margin || i >= last - margin) {
+                edges.push_back(std::make_pair(i, std::vector<unsigned char>(row, row + width)));
+            } else {
+                image.write_row(i, row);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(heldMutex);
+        for (size_t e = 0; e < edges.size(); ++e) {
+            held.push_back(std::move(edges[e]));
+        }
+    });
+
+    for (size_t e = 0; e < held.size(); ++e) {
+        image.write_row(held[e].first, held[e].second.data());
+    }
+}
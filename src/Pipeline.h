@@ -0,0 +1,167 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "GrayscaleImage.h"
+#include "SecretImage.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Hands out the rows of an image one at a time, top to bottom
+class RowSource {
+public:
+    virtual ~RowSource() {}
+
+    virtual int get_width() const = 0;
+    virtual int get_height() const = 0;
+
+    // Position the source so the next call to next_row() returns row `first`
+    virtual void begin(int first) = 0;
+
+    // Next row. The pointer stays valid until the following call, or for the
+    // lifetime of the source when rows_are_stable() is true.
+    virtual const unsigned char* next_row() = 0;
+    virtual bool rows_are_stable() const { return false; }
+};
+
+// Receives the rows of an image one at a time, top to bottom
+class RowSink {
+public:
+    virtual ~RowSink() {}
+
+    virtual void write_row(const unsigned char* row) = 0;
+};
+
+// Rows of an in-memory image, handed out without copying
+class ImageRowSource : public RowSource {
+private:
+    const GrayscaleImage& image;
+    int next;
+
+public:
+    explicit ImageRowSource(const GrayscaleImage& image) : image(image), next(0) {}
+
+    int get_width() const { return image.get_width(); }
+    int get_height() const { return image.get_height(); }
+    void begin(int first) { next = first; }
+    const unsigned char* next_row() { return image.row(next++); }
+    bool rows_are_stable() const { return true; }
+};
+
+// Rows of a secret image, gathered from its two triangular arrays
+class SecretImageRowSource : public RowSource {
+private:
+    const SecretImage& image;
+    std::vector<unsigned char> buffer;
+    int next;
+
+public:
+    explicit SecretImageRowSource(const SecretImage& image) : image(image), buffer(image.get_width()), next(0) {}
+
+    int get_width() const { return image.get_width(); }
+    int get_height() const { return image.get_height(); }
+    void begin(int first) { next = first; }
+    const unsigned char* next_row() {
+        image.read_row(next++, buffer.data());
+        return buffer.data();
+    }
+};
+
+// One filter stage. It keeps a rolling window of 2 * radius + 2 upstream rows
+// and produces its own rows one at a time, so nothing bigger than a few
+// lines lives between two stages.
+class PipelineStage : public RowSource {
+private:
+    RowSource& upstream;
+    int radius;
+    int ringRows;
+    std::vector<unsigned char> storage;       // Copies of upstream rows that are not stable
+    std::vector<const unsigned char*> ring;   // Upstream row r lives in slot r % ringRows
+    std::vector<unsigned char> output;
+    int nextInput;   // Next upstream row to pull
+    int nextOutput;  // Next row this stage produces
+    int firstOutput;
+
+    // Pull upstream rows until row `last` (clipped to the image) is in the ring
+    void fill_to(int last);
+
+protected:
+    // Upstream row r, or nullptr (zero padding) outside the image.
+    // Valid for r in [i - radius - 1, i + radius] while producing row i.
+    const unsigned char* input(int r) const;
+
+    // Compute output row i; i starts at the row passed to begin() and increases by one
+    virtual void produce(int i, bool first, unsigned char* out) = 0;
+
+public:
+    PipelineStage(RowSource& upstream, int radius);
+
+    int get_width() const { return upstream.get_width(); }
+    int get_height() const { return upstream.get_height(); }
+    int get_radius() const { return radius; }
+    void begin(int first);
+    const unsigned char* next_row();
+};
+
+// A chain of filters described as "op:arg:arg|op:arg|...", e.g.
+// "gauss:5:1.2|unsharp:3:1.5|mean:3". Supported stages:
+//   mean:<kernel_size>
+//   gauss:<kernel_size>:<sigma>
+//   unsharp:<kernel_size>:<amount>
+//   add:<img> / sub:<img>     pixel-wise with another image of the same size
+// All stages run fused in one sweep over the image; the result is identical
+// to applying the filters one after another.
+class Pipeline {
+private:
+    struct StageSpec {
+        std::string op;
+        int kernelSize;
+        double parameter;
+        std::string operandPath;                  // For add/sub
+        std::shared_ptr<GrayscaleImage> operand;  // Loaded operand, unless it is streamed
+    };
+    std::vector<StageSpec> stages;
+
+    Pipeline() {}
+
+    static Pipeline single_filter(const std::string& op, int kernelSize, double parameter);
+
+public:
+    // With streamOperands, add/sub operands are decoded row by row from their
+    // PNG files while the chain runs instead of being loaded up front
+    explicit Pipeline(const std::string& spec, bool streamOperands = false);
+
+    // One-filter chains, the same as the specs "mean:<k>", "gauss:<k>:<sigma>"
+    // and "unsharp:<k>:<amount>" without the round trip through text
+    static Pipeline mean(int kernelSize);
+    static Pipeline gaussian(int kernelSize, double sigma);
+    static Pipeline unsharp(int kernelSize, double amount);
+
+    // Number of stages
+    int size() const { return static_cast<int>(stages.size()); }
+
+    // Rows of context the whole chain needs above and below an output row
+    int halo() const;
+
+    // The chain as text that tells apart any two chains with different
+    // results: exact parameters, and add/sub operands by the hash of their
+    // pixels (of their file's bytes when streamed) rather than their path
+    std::string describe() const;
+
+    // Chain the stages onto `source`; the last element produces the final rows
+    std::vector<std::unique_ptr<PipelineStage>> build(RowSource& source) const;
+
+    // Run the chain over an image, in parallel row bands on the shared thread pool
+    void run(const GrayscaleImage& src, GrayscaleImage& dst) const;
+
+    // Run the chain from a row source into a row sink in a single sweep.
+    // Memory is a few rows per stage, independent of the image height.
+    void run(RowSource& source, RowSink& sink) const;
+
+    // Run the chain over a secret image in place, reading and writing its
+    // triangular arrays row by row, in parallel row bands. No full frame is
+    // reconstructed; the only extra memory is the halo rows at band edges.
+    void run(SecretImage& image) const;
+};
+
+#endif // PIPELINE_H
@@ -0,0 +1,59 @@
+#ifndef PIXEL_TRAITS_H
+#define PIXEL_TRAITS_H
+
+#include <cstdint>
+
+// What the image and filter templates need to know about a pixel type.
+// Integer pixels run from 0 to their largest value and saturate; float pixels
+// are nominally 0.0 (black) to 1.0 (white) and are never clamped, so
+// intermediate results may leave that range.
+template <typename Pixel>
+struct PixelTraits;
+
+template <>
+struct PixelTraits<unsigned char> {
+    typedef int Sum;     // Window sums, e.g. the mean filter's column sums
+    typedef int Value;   // get_pixel / set_pixel
+    static const bool INTEGRAL = true;
+    static const int BITS = 8;
+    static double white() { return 255.0; }
+
+    // Truncate towards zero and clamp (NaN to 0), like the 8-bit filters always have
+    static unsigned char saturate(double value) {
+        return !(value > 0.0) ? 0 : value >= 255.0 ? 255 : static_cast<unsigned char>(value);
+    }
+};
+
+template <>
+struct PixelTraits<uint16_t> {
+    typedef int64_t Sum;  // A 65535 * 65535 window still fits
+    typedef int Value;
+    static const bool INTEGRAL = true;
+    static const int BITS = 16;
+    static double white() { return 65535.0; }
+
+    static uint16_t saturate(double value) {
+        return !(value > 0.0) ? 0 : value >= 65535.0 ? 65535 : static_cast<uint16_t>(value);
+    }
+};
+
+template <>
+struct PixelTraits<float> {
+    typedef double Sum;   // Running sums in float would drift over a tall image
+    typedef float Value;
+    static const bool INTEGRAL = false;
+    static const int BITS = 32;
+    static double white() { return 1.0; }
+
+    static float saturate(double value) { return static_cast<float>(value); }
+};
+
+// Value of a pixel rescaled from one type's range to another's, rounded to
+// nearest for integer targets: 255 <-> 65535 <-> 1.0f
+template <typename To, typename From>
+inline To convert_pixel(From value) {
+    double scaled = value * (PixelTraits<To>::white() / PixelTraits<From>::white());
+    return PixelTraits<To>::saturate(PixelTraits<To>::INTEGRAL ? scaled + 0.5 : scaled);
+}
+
+#endif // PIXEL_TRAITS_H
@@ -0,0 +1,341 @@
+#include "PngEncoder.h"
+#include "Checksum.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+static const unsigned char PNG_SIGNATURE[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+
+// IDAT payload size the encoder aims for
+static const size_t IDAT_CHUNK_SIZE = 1 << 16;
+
+// Filtered bytes per band when encoding in parallel, at least; smaller bands
+// would lose too many matches at their edges
+static const size_t MIN_BAND_BYTES = 256 * 1024;
+
+static void put_u32(unsigned char* p, uint32_t value) {
+    p[0] = static_cast<unsigned char>(value >> 24);
+    p[1] = static_cast<unsigned char>(value >> 16);
+    p[2] = static_cast<unsigned char>(value >> 8);
+    p[3] = static_cast<unsigned char>(value);
+}
+
+// PNG colour type for a channel count: grey, grey + alpha, RGB, RGBA
+static unsigned char color_type(int channels) {
+    static const unsigned char types[4] = {0, 4, 2, 6};
+    return types[channels - 1];
+}
+
+// Native 16-bit samples as big-endian pairs
+static void put_samples16(const uint16_t* values, size_t count, unsigned char* out) {
+    for (size_t x = 0; x < count; ++x) {
+        out[2 * x] = static_cast<unsigned char>(values[x] >> 8);
+        out[2 * x + 1] = static_cast<unsigned char>(values[x]);
+    }
+}
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+static std::atomic<int>& default_level() {
+    static std::atomic<int> level(Deflater::BALANCED);
+    return level;
+}
+
+static std::atomic<bool>& default_parallel() {
+    static std::atomic<bool> parallel(false);
+    return parallel;
+}
+
+PngEncoder::Options PngEncoder::defaults() {
+    Options options;
+    options.level = static_cast<Deflater::Level>(default_level().load(std::memory_order_relaxed));
+    options.parallel = default_parallel().load(std::memory_order_relaxed);
+    return options;
+}
+
+void PngEncoder::set_defaults(const Options& options) {
+    default_level().store(options.level);
+    default_parallel().store(options.parallel);
+}
+
+Deflater::Level PngEncoder::parse_level(const std::string& name) {
+    if (name == "fastest") return Deflater::FASTEST;
+    if (name == "balanced") return Deflater::BALANCED;
+    if (name == "smallest") return Deflater::SMALLEST;
+    throw std::invalid_argument("Unknown PNG level '" + name + "' (fastest, balanced or smallest)");
+}
+
+PngEncoder::PngEncoder(int width, int height, Deflater::Level level, Writer output, int bitDepth, int channels)
+    : output(output), width(width), height(height), level(level), bitDepth(bitDepth), channels(channels),
+      rowsWritten(0), finished(false) {
+    if (width < 1 || height < 1) {
+        throw std::invalid_argument("Invalid PNG dimensions.");
+    }
+    if (bitDepth != 8 && bitDepth != 16) {
+        throw std::invalid_argument("PNG bit depth must be 8 or 16.");
+    }
+    if (channels < 1 || channels > 4) {
+        throw std::invalid_argument("PNG images have 1 to 4 channels.");
+    }
+    rowBytes = static_cast<size_t>(width) * channels * (bitDepth / 8);
+    previous.assign(rowBytes, 0);
+    candidates.assign(5 * (rowBytes + 1), 0);
+    if (bitDepth == 16 || channels > 1) {
+        samples.assign(rowBytes, 0);
+    }
+
+    output(PNG_SIGNATURE, 8);
+    unsigned char header[13];
+    put_u32(header, width);
+    put_u32(header + 4, height);
+    header[8] = static_cast<unsigned char>(bitDepth);
+    header[9] = color_type(channels);
+    header[10] = 0;  // Deflate
+    header[11] = 0;  // Adaptive filtering
+    header[12] = 0;  // Not interlaced
+    write_chunk("IHDR", header, 13);
+}
+
+void PngEncoder::write_chunk(const char* type, const unsigned char* data, size_t length) {
+    unsigned char bytes[8];
+    put_u32(bytes, static_cast<uint32_t>(length));
+    std::memcpy(bytes + 4, type, 4);
+    output(bytes, 8);
+    if (length > 0) {
+        output(data, length);
+    }
+    uint32_t crc = Checksum::crc32(reinterpret_cast<const unsigned char*>(type), 4);
+    put_u32(bytes, Checksum::crc32(data, length, crc));
+    output(bytes, 4);
+}
+
+void PngEncoder::add_idat(const unsigned char* data, size_t length) {
+    idat.insert(idat.end(), data, data + length);
+    flush_idat(false);
+}
+
+void PngEncoder::flush_idat(bool all) {
+    size_t done = 0;
+    while (idat.size() - done >= IDAT_CHUNK_SIZE || (all && done < idat.size())) {
+        size_t length = std::min(IDAT_CHUNK_SIZE, idat.size() - done);
+        write_chunk("IDAT", &idat[done], length);
+        done += length;
+    }
+    idat.erase(idat.begin(), idat.begin() + done);
+}
+
+const unsigned char* PngEncoder::filter_row(Deflater::Level level, const unsigned char* row, const unsigned char* up,
+                                            size_t rowBytes, int pixelBytes, unsigned char* candidates) {
+    size_t stride = rowBytes + 1;
+    int width = static_cast<int>(rowBytes);
+    int bpp = pixelBytes;
+
+    // Fastest: always Up, which does well on photographs and costs one subtraction
+    if (level == Deflater::FASTEST) {
+        unsigned char* line = candidates + 2 * stride;
+        line[0] = 2;
+        for (int x = 0; x < width; ++x) {
+            line[x + 1] = static_cast<unsigned char>(row[x] - up[x]);
+        }
+        return line;
+    }
+
+    // Otherwise try every filter and keep the one with the smallest sum of absolute values
+    const unsigned char* best = candidates;
+    long bestScore = -1;
+    for (int f = 0; f < 5; ++f) {
+        unsigned char* line = candidates + f * stride;
+        unsigned char* out = line + 1;
+        line[0] = static_cast<unsigned char>(f);
+        switch (f) {
+            case 0:
+                std::memcpy(out, row, width);
+                break;
+            case 1:
+                std::memcpy(out, row, bpp);
+                for (int x = bpp; x < width; ++x) out[x] = static_cast<unsigned char>(row[x] - row[x - bpp]);
+                break;
+            case 2:
+                for (int x = 0; x < width; ++x) out[x] = static_cast<unsigned char>(row[x] - up[x]);
+                break;
+            case 3:
+                for (int x = 0; x < bpp; ++x) out[x] = static_cast<unsigned char>(row[x] - (up[x] >> 1));
+                for (int x = bpp; x < width; ++x) out[x] = static_cast<unsigned char>(row[x] - ((row[x - bpp] + up[x]) >> 1));
+                break;
+            case 4:
+                for (int x = 0; x < bpp; ++x) out[x] = static_cast<unsigned char>(row[x] - up[x]);
+                for (int x = bpp; x < width; ++x) out[x] = static_cast<unsigned char>(row[x] - paeth(row[x - bpp], up[x], up[x - bpp]));
+                break;
+        }
+        long score = 0;
+        for (int x = 0; x < width; ++x) {
+            score += std::abs(static_cast<signed char>(out[x]));
+        }
+        if (bestScore < 0 || score < bestScore) {
+            bestScore = score;
+            best = line;
+        }
+    }
+    return best;
+}
+
+void PngEncoder::write_row(const unsigned char* row) {
+    if (finished || rowsWritten >= height) {
+        throw std::runtime_error("Too many rows written to a PNG");
+    }
+    if (!deflater) {
+        deflater.reset(new Deflater([this](const unsigned char* data, size_t length) { add_idat(data, length); }, level));
+    }
+    deflater->write(filter_row(level, row, previous.data(), rowBytes, channels * bitDepth / 8, candidates.data()), rowBytes + 1);
+    std::memcpy(previous.data(), row, rowBytes);
+    ++rowsWritten;
+}
+
+void PngEncoder::write_row(const uint16_t* row) {
+    if (bitDepth != 16) {
+        throw std::invalid_argument("16-bit row written to an 8-bit PNG");
+    }
+    put_samples16(row, rowBytes / 2, samples.data());
+    write_row(samples.data());
+}
+
+const unsigned char* PngEncoder::sample_row(const Planes& planes, int i, unsigned char* buffer) const {
+    size_t offset = static_cast<size_t>(i) * planes.stride;
+    if (channels == 1) {
+        if (bitDepth == 8) {
+            return planes.plane[0] + offset;
+        }
+        put_samples16(reinterpret_cast<const uint16_t*>(planes.plane[0] + offset), width, buffer);
+        return buffer;
+    }
+    for (int c = 0; c < channels; ++c) {
+        const unsigned char* row = planes.plane[c] + offset;
+        if (bitDepth == 8) {
+            for (int x = 0; x < width; ++x) {
+                buffer[x * channels + c] = row[x];
+            }
+        } else {
+            const uint16_t* values = reinterpret_cast<const uint16_t*>(row);
+            for (int x = 0; x < width; ++x) {
+                unsigned char* out = buffer + 2 * (x * channels + c);
+                out[0] = static_cast<unsigned char>(values[x] >> 8);
+                out[1] = static_cast<unsigned char>(values[x]);
+            }
+        }
+    }
+    return buffer;
+}
+
+void PngEncoder::finish() {
+    if (finished) {
+        return;
+    }
+    if (rowsWritten != height) {
+        throw std::runtime_error("Missing rows for a PNG");
+    }
+    if (deflater) {
+        deflater->finish();
+    }
+    flush_idat(true);
+    write_chunk("IEND", nullptr, 0);
+    finished = true;
+}
+
+void PngEncoder::encode(const unsigned char* pixels, int width, int height, int stride,
+                        const Options& options, Writer output) {
+    encode_planes(&pixels, 1, width, height, stride, options, output);
+}
+
+void PngEncoder::encode(const uint16_t* pixels, int width, int height, int stride,
+                        const Options& options, Writer output) {
+    encode_planes(&pixels, 1, width, height, stride, options, output);
+}
+
+void PngEncoder::encode_planes(const unsigned char* const* planes, int channels, int width, int height, int stride,
+                               const Options& options, Writer output) {
+    Planes source = {{nullptr, nullptr, nullptr, nullptr}, stride};
+    for (int c = 0; c < channels && c < 4; ++c) {
+        source.plane[c] = planes[c];
+    }
+    encode_image(source, width, height, 8, channels, options, output);
+}
+
+void PngEncoder::encode_planes(const uint16_t* const* planes, int channels, int width, int height, int stride,
+                               const Options& options, Writer output) {
+    Planes source = {{nullptr, nullptr, nullptr, nullptr}, stride};
+    for (int c = 0; c < channels && c < 4; ++c) {
+        source.plane[c] = reinterpret_cast<const unsigned char*>(planes[c]);
+    }
+    encode_image(source, width, height, 16, channels, options, output);
+}
+
+void PngEncoder::encode_image(const Planes& planes, int width, int height, int bitDepth, int channels,
+                              const Options& options, Writer output) {
+    PngEncoder encoder(width, height, options.level, output, bitDepth, channels);
+
+    size_t minRows = std::max<size_t>(1, MIN_BAND_BYTES / (encoder.rowBytes + 1));
+    int bands = options.parallel ? static_cast<int>(std::min<size_t>(ThreadPool::shared().size(), height / minRows)) : 1;
+    if (bands > 1) {
+        encode_parallel(planes, height, options.level, bands, encoder);
+    } else {
+        for (int i = 0; i < height; ++i) {
+            encoder.write_row(encoder.sample_row(planes, i, encoder.samples.data()));
+        }
+    }
+    encoder.finish();
+}
+
+// Each band is filtered against the row above it (in the image, so bands are
+// independent) and compressed into a raw segment; the segments go out in
+// order between one zlib header and the combined Adler-32
+void PngEncoder::encode_parallel(const Planes& planes, int height, Deflater::Level level, int bands, PngEncoder& encoder) {
+    struct Band {
+        std::vector<unsigned char> compressed;
+        uint32_t adler;
+        size_t length;
+    };
+    std::vector<Band> results(bands);
+    ThreadPool::shared().parallel_for(bands, [&](int b) {
+        int first = static_cast<int>(static_cast<long long>(height) * b / bands);
+        int last = static_cast<int>(static_cast<long long>(height) * (b + 1) / bands);
+        Band& band = results[b];
+        Deflater deflater([&band](const unsigned char* data, size_t length) {
+            band.compressed.insert(band.compressed.end(), data, data + length);
+        }, level, b + 1 == bands ? Deflater::LAST_SEGMENT : Deflater::SEGMENT);
+
+        // Two sample rows in turn, the current one and the one above it
+        size_t rowBytes = encoder.rowBytes;
+        std::vector<unsigned char> buffers(2 * rowBytes), zeros(rowBytes, 0);
+        std::vector<unsigned char> candidates(5 * (rowBytes + 1));
+        const unsigned char* up = first > 0 ? encoder.sample_row(planes, first - 1, &buffers[((first + 1) % 2) * rowBytes]) : zeros.data();
+        for (int i = first; i < last; ++i) {
+            const unsigned char* row = encoder.sample_row(planes, i, &buffers[(i % 2) * rowBytes]);
+            deflater.write(filter_row(level, row, up, rowBytes, encoder.channels * encoder.bitDepth / 8, candidates.data()), rowBytes + 1);
+            up = row;
+        }
+        deflater.finish();
+        band.adler = deflater.checksum();
+        band.length = static_cast<size_t>(last - first) * (rowBytes + 1);
+    });
+
+    unsigned char header[2];
+    Deflater::zlib_header(level, header);
+    encoder.add_idat(header, 2);
+    uint32_t adler = 1;
+    for (const Band& band : results) {
+        encoder.add_idat(band.compressed.data(), band.compressed.size());
+        adler = Checksum::adler32_combine(adler, band.adler, band.length);
+    }
+    unsigned char trailer[4];
+    put_u32(trailer, adler);
+    encoder.add_idat(trailer, 4);
+    encoder.rowsWritten = height;
+}
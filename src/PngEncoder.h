@@ -0,0 +1,108 @@
+#ifndef PNG_ENCODER_H
+#define PNG_ENCODER_H
+
+#include "Deflate.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Encodes 8- or 16-bit PNGs (grey, grey + alpha, RGB or RGBA), row by row or
+// a whole image at once, with a selectable speed/size tradeoff:
+//   fastest   the Up filter on every row and the quickest match search
+//   balanced  per row the filter with the smallest sum of absolute values
+//             (the stb_image_write heuristic) and a moderate match search
+//   smallest  the same filters and the most thorough match search
+// Whole images can also be encoded in parallel: bands of rows are filtered
+// and compressed on the shared thread pool as separate deflate segments and
+// joined into one zlib stream. Matches cannot reach across a band boundary,
+// so the file comes out slightly larger; it decodes the same.
+class PngEncoder {
+public:
+    typedef Deflater::Writer Writer;
+
+    struct Options {
+        Deflater::Level level;
+        bool parallel;  // Compress row bands on the shared thread pool
+
+        Options() : level(Deflater::BALANCED), parallel(false) {}
+    };
+
+    // Writes the signature and header right away; the rest follows as rows come in.
+    // bitDepth is 8 or 16 and channels 1 (grey), 2 (grey + alpha), 3 (RGB) or
+    // 4 (RGBA); throws std::invalid_argument otherwise.
+    PngEncoder(int width, int height, Deflater::Level level, Writer output, int bitDepth = 8, int channels = 1);
+
+    // A row as PNG samples: width * channels bytes, or for 16 bits as many
+    // big-endian pairs, channels interleaved
+    void write_row(const unsigned char* row);
+
+    // A row of native 16-bit samples, for 16-bit encoders
+    void write_row(const uint16_t* row);
+
+    // Write the last IDAT and IEND chunks; throws std::runtime_error if rows are missing
+    void finish();
+
+    // Encode a whole image whose rows are `stride` bytes apart, as an 8-bit or
+    // (from native uint16_t pixels) a 16-bit PNG
+    static void encode(const unsigned char* pixels, int width, int height, int stride,
+                       const Options& options, Writer output);
+    static void encode(const uint16_t* pixels, int width, int height, int stride,
+                       const Options& options, Writer output);
+
+    // Encode one plane per channel (see the constructor), all with rows
+    // `stride` bytes apart; the samples are interleaved row by row
+    static void encode_planes(const unsigned char* const* planes, int channels, int width, int height, int stride,
+                              const Options& options, Writer output);
+    static void encode_planes(const uint16_t* const* planes, int channels, int width, int height, int stride,
+                              const Options& options, Writer output);
+
+    // Options GrayscaleImage uses for PNG; process-wide, set from the command line
+    static Options defaults();
+    static void set_defaults(const Options& options);
+
+    // "fastest", "balanced" or "smallest"; throws std::invalid_argument otherwise
+    static Deflater::Level parse_level(const std::string& name);
+
+private:
+    Writer output;
+    int width, height;
+    Deflater::Level level;
+    int bitDepth;
+    int channels;
+    std::size_t rowBytes;                   // Sample bytes per row, without the filter byte
+    int rowsWritten;
+    std::vector<unsigned char> samples;     // A row interleaved and/or turned big-endian
+    std::vector<unsigned char> previous;
+    std::vector<unsigned char> candidates;  // One filtered row per filter type, each with its filter byte
+    std::vector<unsigned char> idat;        // Compressed bytes waiting for the next IDAT chunk
+    std::unique_ptr<Deflater> deflater;     // Created with the first row
+    bool finished;
+
+    void write_chunk(const char* type, const unsigned char* data, std::size_t length);
+    void add_idat(const unsigned char* data, std::size_t length);
+    void flush_idat(bool all);
+
+    // Channel planes of a whole image being encoded
+    struct Planes {
+        const unsigned char* plane[4];
+        int stride;
+    };
+
+    static void encode_image(const Planes& planes, int width, int height, int bitDepth, int channels,
+                             const Options& options, Writer output);
+    static void encode_parallel(const Planes& planes, int height, Deflater::Level level, int bands, PngEncoder& encoder);
+
+    // Row `i` of an image as PNG samples: the pixels themselves for 8-bit
+    // grey, otherwise an interleaved, big-endian copy in `buffer` (rowBytes long)
+    const unsigned char* sample_row(const Planes& planes, int i, unsigned char* buffer) const;
+
+    // Filter a row against the one above for the level; the left neighbour is
+    // `pixelBytes` back. `candidates` holds 5 * (rowBytes + 1) bytes; returns
+    // the chosen filter byte and filtered row in it.
+    static const unsigned char* filter_row(Deflater::Level level, const unsigned char* row, const unsigned char* up,
+                                           std::size_t rowBytes, int pixelBytes, unsigned char* candidates);
+};
+
+#endif // PNG_ENCODER_H
@@ -0,0 +1,298 @@
+#include "PngStream.h"
+#include "Checksum.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+static const unsigned char PNG_SIGNATURE[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+
+// Same limit stb_image applies
+static const int MAX_DIMENSION = 1 << 24;
+
+static uint32_t get_u32(const unsigned char* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+// Luma as stb_image computes it when asked for one channel
+static unsigned char luma(int r, int g, int b) {
+    return static_cast<unsigned char>((r * 77 + g * 150 + b * 29) >> 8);
+}
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+// PngRowReader
+
+PngRowReader::PngRowReader(const std::string& filename) : filename(filename) {
+    open();
+}
+
+void PngRowReader::read_exact(unsigned char* data, size_t length) {
+    file.read(reinterpret_cast<char*>(data), length);
+    if (static_cast<size_t>(file.gcount()) != length) {
+        throw std::runtime_error("PNG file is truncated: " + filename);
+    }
+}
+
+uint32_t PngRowReader::read_u32() {
+    unsigned char bytes[4];
+    read_exact(bytes, 4);
+    return get_u32(bytes);
+}
+
+void PngRowReader::open() {
+    file.close();
+    file.clear();
+    file.open(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open image file: " + filename);
+    }
+
+    unsigned char signature[8];
+    read_exact(signature, 8);
+    if (std::memcmp(signature, PNG_SIGNATURE, 8) != 0) {
+        throw std::runtime_error("Not a PNG file: " + filename);
+    }
+
+    bool haveHeader = false;
+    bool haveData = false;
+    palette.assign(256 * 3, 0);
+    while (true) {
+        uint32_t length = read_u32();
+        unsigned char type[4];
+        read_exact(type, 4);
+        if (length > 0x7FFFFFFFu) {
+            throw std::runtime_error("Corrupt PNG chunk length: " + filename);
+        }
+
+        if (std::memcmp(type, "IDAT", 4) == 0) {
+            haveData = haveHeader;
+            chunkLeft = length;
+            chunkCrc = Checksum::crc32(type, 4);
+            break;
+        }
+        if (std::memcmp(type, "IEND", 4) == 0) {
+            break;
+        }
+
+        std::vector<unsigned char> data(length);
+        read_exact(data.data(), length);
+        uint32_t crc = Checksum::crc32(data.data(), length, Checksum::crc32(type, 4));
+        if (read_u32() != crc) {
+            throw std::runtime_error("PNG chunk checksum mismatch: " + filename);
+        }
+
+        if (std::memcmp(type, "IHDR", 4) == 0 && length == 13) {
+            width = static_cast<int>(std::min<uint32_t>(get_u32(&data[0]), MAX_DIMENSION + 1u));
+            height = static_cast<int>(std::min<uint32_t>(get_u32(&data[4]), MAX_DIMENSION + 1u));
+            bitDepth = data[8];
+            colorType = data[9];
+            if (width < 1 || height < 1 || width > MAX_DIMENSION || height > MAX_DIMENSION) {
+                throw std::runtime_error("Unsupported PNG dimensions: " + filename);
+            }
+            if (data[10] != 0 || data[11] != 0) {
+                throw std::runtime_error("Unknown PNG compression or filter method: " + filename);
+            }
+            if (data[12] != 0) {
+                throw std::runtime_error("Interlaced PNGs cannot be streamed: " + filename);
+            }
+            switch (colorType) {
+                case 0: channels = 1; break;
+                case 2: channels = 3; break;
+                case 3: channels = 1; break;
+                case 4: channels = 2; break;
+                case 6: channels = 4; break;
+                default: throw std::runtime_error("Unknown PNG colour type: " + filename);
+            }
+            bool depthOk = (bitDepth == 8 || bitDepth == 16) ||
+                           ((colorType == 0 || colorType == 3) && (bitDepth == 1 || bitDepth == 2 || bitDepth == 4));
+            if (!depthOk || (colorType == 3 && bitDepth == 16)) {
+                throw std::runtime_error("Unsupported PNG bit depth: " + filename);
+            }
+            haveHeader = true;
+        } else if (std::memcmp(type, "PLTE", 4) == 0) {
+            std::copy(data.begin(), data.begin() + std::min<size_t>(length, palette.size()), palette.begin());
+        }
+    }
+    if (!haveData) {
+        throw std::runtime_error("PNG file has no image data: " + filename);
+    }
+
+    int bitsPerPixel = channels * bitDepth;
+    rowBytes = (static_cast<size_t>(width) * bitsPerPixel + 7) / 8;
+    filterStride = std::max(1, bitsPerPixel / 8);
+    scanline.assign(rowBytes, 0);
+    previous.assign(rowBytes, 0);
+    output.assign(width, 0);
+    dataDone = false;
+    nextRow = 0;
+    inflater.reset(new Inflater([this](unsigned char* data, size_t length) { return read_compressed(data, length); }));
+}
+
+size_t PngRowReader::read_compressed(unsigned char* data, size_t length) {
+    while (chunkLeft == 0) {
+        if (dataDone) {
+            return 0;
+        }
+        if (read_u32() != chunkCrc) {
+            throw std::runtime_error("PNG chunk checksum mismatch: " + filename);
+        }
+        uint32_t next = read_u32();
+        unsigned char type[4];
+        read_exact(type, 4);
+        if (std::memcmp(type, "IDAT", 4) != 0) {
+            dataDone = true;  // Image data must be contiguous, so this is the end of it
+            return 0;
+        }
+        chunkLeft = next;
+        chunkCrc = Checksum::crc32(type, 4);
+    }
+
+    size_t take = std::min<size_t>(length, chunkLeft);
+    read_exact(data, take);
+    chunkCrc = Checksum::crc32(data, take, chunkCrc);
+    chunkLeft -= static_cast<uint32_t>(take);
+    return take;
+}
+
+void PngRowReader::decode_row() {
+    unsigned char filter;
+    inflater->read(&filter, 1);
+    inflater->read(scanline.data(), rowBytes);
+
+    // Undo the row filter (PNG spec, section 9)
+    unsigned char* cur = scanline.data();
+    const unsigned char* up = previous.data();
+    size_t n = rowBytes;
+    int s = filterStride;
+    switch (filter) {
+        case 0:
+            break;
+        case 1:
+            for (size_t i = s; i < n; ++i) cur[i] += cur[i - s];
+            break;
+        case 2:
+            for (size_t i = 0; i < n; ++i) cur[i] += up[i];
+            break;
+        case 3:
+            for (size_t i = 0; i < n; ++i) cur[i] += ((i >= static_cast<size_t>(s) ? cur[i - s] : 0) + up[i]) >> 1;
+            break;
+        case 4:
+            for (size_t i = 0; i < n; ++i) {
+                bool left = i >= static_cast<size_t>(s);
+                cur[i] += paeth(left ? cur[i - s] : 0, up[i], left ? up[i - s] : 0);
+            }
+            break;
+        default:
+            throw std::runtime_error("Corrupt PNG row filter: " + filename);
+    }
+
+    // Convert to 8-bit grey
+    unsigned char* out = output.data();
+    if (bitDepth < 8) {
+        int perByte = 8 / bitDepth;
+        int mask = (1 << bitDepth) - 1;
+        int scale = 255 / mask;
+        for (int x = 0; x < width; ++x) {
+            int shift = 8 - bitDepth * (x % perByte + 1);
+            int v = (cur[x / perByte] >> shift) & mask;
+            out[x] = (colorType == 3) ? luma(palette[3 * v], palette[3 * v + 1], palette[3 * v + 2])
+                                      : static_cast<unsigned char>(v * scale);
+        }
+    } else if (bitDepth == 8) {
+        switch (colorType) {
+            case 0: std::memcpy(out, cur, width); break;
+            case 3:
+                for (int x = 0; x < width; ++x) out[x] = luma(palette[3 * cur[x]], palette[3 * cur[x] + 1], palette[3 * cur[x] + 2]);
+                break;
+            case 4:
+                for (int x = 0; x < width; ++x) out[x] = cur[2 * x];
+                break;
+            default:
+                for (int x = 0; x < width; ++x) {
+                    const unsigned char* p = cur + static_cast<size_t>(x) * channels;
+                    out[x] = luma(p[0], p[1], p[2]);
+                }
+        }
+    } else {
+        // 16-bit: stb_image converts colour to grey at 16 bits, then keeps the high byte
+        for (int x = 0; x < width; ++x) {
+            const unsigned char* p = cur + static_cast<size_t>(x) * channels * 2;
+            int v = (p[0] << 8) | p[1];
+            if (colorType == 2 || colorType == 6) {
+                v = (v * 77 + ((p[2] << 8) | p[3]) * 150 + ((p[4] << 8) | p[5]) * 29) >> 8;
+            }
+            out[x] = static_cast<unsigned char>(v >> 8);
+        }
+    }
+
+    std::swap(scanline, previous);
+}
+
+void PngRowReader::begin(int first) {
+    if (first < nextRow) {
+        open();
+    }
+    while (nextRow < first) {
+        next_row();
+    }
+}
+
+const unsigned char* PngRowReader::next_row() {
+    if (nextRow >= height) {
+        throw std::runtime_error("Read past the last row of " + filename);
+    }
+    decode_row();
+    if (++nextRow == height) {
+        inflater->finish();
+        if (chunkLeft == 0 && !dataDone && read_u32() != chunkCrc) {
+            throw std::runtime_error("PNG chunk checksum mismatch: " + filename);
+        }
+    }
+    return output.data();
+}
+
+// PngRowWriter
+
+PngRowWriter::PngRowWriter(const std::string& filename, int width, int height, Deflater::Level level)
+    : filename(filename), height(height), rowsWritten(0), finished(false) {
+    if (width < 1 || height < 1 || width > MAX_DIMENSION || height > MAX_DIMENSION) {
+        throw std::invalid_argument("Invalid PNG dimensions.");
+    }
+    file.open(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open file for writing: " + filename);
+    }
+    encoder.reset(new PngEncoder(width, height, level, [this](const unsigned char* data, size_t length) {
+        file.write(reinterpret_cast<const char*>(data), length);
+    }));
+}
+
+void PngRowWriter::write_row(const unsigned char* row) {
+    if (finished || rowsWritten >= height) {
+        throw std::runtime_error("Too many rows written to " + filename);
+    }
+    encoder->write_row(row);
+    ++rowsWritten;
+}
+
+void PngRowWriter::finish() {
+    if (finished) {
+        return;
+    }
+    if (rowsWritten != height) {
+        throw std::runtime_error("Missing rows for " + filename);
+    }
+    encoder->finish();
+    file.close();
+    if (!file) {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+    finished = true;
+}
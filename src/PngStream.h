@@ -0,0 +1,80 @@
+#ifndef PNG_STREAM_H
+#define PNG_STREAM_H
+
+#include "Deflate.h"
+#include "Pipeline.h"
+#include "PngEncoder.h"
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Decodes a PNG file one row at a time. Only the current and previous
+// scanline and the inflate window are in memory, whatever the image size.
+// Rows come out as 8-bit grey, converted the way stb_image does for
+// GrayscaleImage (so both paths see the same pixels). Any colour type and
+// bit depth is accepted; interlaced files are not (they cannot be streamed
+// row by row) and throw std::runtime_error, as do corrupt ones.
+class PngRowReader : public RowSource {
+private:
+    std::string filename;
+    std::ifstream file;
+    int width, height;
+    int bitDepth, colorType, channels;
+    size_t rowBytes;                   // Bytes of a filtered scanline, without the filter byte
+    int filterStride;                  // Byte distance to the "left" pixel for the PNG filters
+    std::vector<unsigned char> palette;
+    std::vector<unsigned char> scanline, previous;
+    std::vector<unsigned char> output;
+    std::unique_ptr<Inflater> inflater;
+    uint32_t chunkLeft;                // IDAT bytes not yet handed to the inflater
+    uint32_t chunkCrc;
+    bool dataDone;                     // Past the last IDAT chunk
+    int nextRow;
+
+    void read_exact(unsigned char* data, size_t length);
+    uint32_t read_u32();
+
+    // Open the file, read the header chunks and stop at the first IDAT
+    void open();
+
+    // Feed the inflater from consecutive IDAT chunks
+    size_t read_compressed(unsigned char* data, size_t length);
+
+    void decode_row();
+
+public:
+    explicit PngRowReader(const std::string& filename);
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+
+    // Rows are decoded in order; going back reopens the file
+    void begin(int first);
+    const unsigned char* next_row();
+};
+
+// Writes an 8-bit grey PNG file as rows come in, encoded by PngEncoder at
+// the given level. Rows are compressed straight into IDAT chunks, so memory
+// stays at a few rows plus the deflate window.
+class PngRowWriter : public RowSink {
+private:
+    std::ofstream file;
+    std::string filename;
+    int height;
+    int rowsWritten;
+    std::unique_ptr<PngEncoder> encoder;
+    bool finished;
+
+public:
+    PngRowWriter(const std::string& filename, int width, int height,
+                 Deflater::Level level = PngEncoder::defaults().level);
+
+    void write_row(const unsigned char* row);
+
+    // Write the last IDAT and IEND chunks; without this the file is incomplete.
+    // Throws if rows are missing.
+    void finish();
+};
+
+#endif // PNG_STREAM_H
@@ -0,0 +1,245 @@
+#include "ResultCache.h"
+#include "Checksum.h"
+#include "FilterKernels.h"
+#include "PngEncoder.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Bumped whenever the output of an operation changes for the same input and parameters
+static const char* const CACHE_FORMAT = "clearvision-cache-1";
+
+// Entry names are "<image hash>-<operation hash>", 16 hex digits each
+static const size_t KEY_LENGTH = 33;
+
+static bool is_entry(const std::string& name) {
+    return name.size() == KEY_LENGTH && name[16] == '-' &&
+           name.find_first_not_of("0123456789abcdef-") == std::string::npos;
+}
+
+static std::string hex64(uint64_t value) {
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(value));
+    return text;
+}
+
+ResultCache::ResultCache(const std::string& directory, uint64_t maxBytes)
+    : directory(directory), maxBytes(maxBytes), knownBytes(0), scanned(false) {
+    if (mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Could not create cache directory " + directory + ": " + std::strerror(errno));
+    }
+    struct stat info;
+    if (stat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+        throw std::runtime_error("Cache path is not a directory: " + directory);
+    }
+}
+
+// Add this process's counts to the shared totals
+ResultCache::~ResultCache() {
+    Stats mine = session();
+    if (mine.hits + mine.misses + mine.stores + mine.evictions == 0) {
+        return;
+    }
+    int fd = open((directory + "/stats").c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd < 0) {
+        return;
+    }
+    if (flock(fd, LOCK_EX) == 0) {
+        std::string text;
+        char buffer[256];
+        ssize_t length;
+        while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+            text.append(buffer, static_cast<size_t>(length));
+        }
+        Stats total;
+        std::istringstream in(text);
+        in >> total.hits >> total.misses >> total.stores >> total.evictions;
+        std::ostringstream out;
+        out << total.hits + mine.hits << " " << total.misses + mine.misses << " " << total.stores + mine.stores << " "
+            << total.evictions + mine.evictions << "\n";
+        std::string updated = out.str();
+        if (ftruncate(fd, 0) == 0) {
+            ssize_t written = pwrite(fd, updated.data(), updated.size(), 0);
+            (void)written;  // Statistics only; nothing to do about a failed write here
+        }
+        flock(fd, LOCK_UN);
+    }
+    close(fd);
+}
+
+std::string ResultCache::key(uint64_t imageHash, const std::string& operation, GrayscaleImageBase::Format format) {
+    PngEncoder::Options png = PngEncoder::defaults();
+    std::ostringstream canonical;
+    canonical << CACHE_FORMAT << '\n' << operation << '\n' << (format == GrayscaleImageBase::PGM ? "pgm" : "png")
+              << " level=" << png.level << " parallel=" << png.parallel << " exact=" << FilterKernels::exact();
+    std::string text = canonical.str();
+    uint64_t operationHash = Checksum::xxh64(reinterpret_cast<const unsigned char*>(text.data()), text.size());
+    return hex64(imageHash) + "-" + hex64(operationHash);
+}
+
+std::string ResultCache::number(double value) {
+    std::ostringstream text;
+    text.precision(17);
+    text << value;
+    return text.str();
+}
+
+// A name no other thread or process is writing, in the same directory as
+// `near` so the rename that publishes it stays atomic
+std::string ResultCache::temporary_path(const std::string& near) const {
+    static std::atomic<unsigned> counter(0);
+    size_t slash = near.find_last_of('/');
+    std::string dir = (slash == std::string::npos) ? "" : near.substr(0, slash + 1);
+    return dir + ".clearvision-tmp." + std::to_string(getpid()) + "." + std::to_string(counter++);
+}
+
+// Copy a file through a temporary name renamed over the target
+static bool copy_atomically(const std::string& from, const std::string& to, const std::string& temporary) {
+    std::ifstream in(from, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        out << in.rdbuf();
+        out.close();
+        if (!out || in.bad()) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temporary.c_str(), to.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ResultCache::fetch(const std::string& key, const std::string& path) {
+    std::string entry = directory + "/" + key;
+    // An entry evicted by another process between the two steps is just a miss
+    bool hit = copy_atomically(entry, path, temporary_path(path));
+    if (hit) {
+        utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);  // Now the most recently used
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    ++(hit ? counts.hits : counts.misses);
+    return hit;
+}
+
+void ResultCache::store(const std::string& key, const std::string& path) {
+    std::string entry = directory + "/" + key;
+    struct stat info;
+    uint64_t replaced = stat(entry.c_str(), &info) == 0 ? static_cast<uint64_t>(info.st_size) : 0;
+    if (!copy_atomically(path, entry, temporary_path(entry))) {
+        return;
+    }
+    uint64_t size = stat(entry.c_str(), &info) == 0 ? static_cast<uint64_t>(info.st_size) : 0;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ++counts.stores;
+    if (!scanned) {
+        int entries;
+        usage(entries, knownBytes);
+        scanned = true;
+    } else {
+        // Storing a key again replaces its entry: count only the change in size
+        knownBytes = knownBytes + size - std::min(replaced, knownBytes + size);
+    }
+    if (knownBytes > maxBytes) {
+        evict();
+    }
+}
+
+// Remove entries, least recently used first, until the directory fits. Other
+// processes may be adding entries meanwhile; a file already gone is skipped.
+void ResultCache::evict() {
+    struct Entry {
+        std::string path;
+        uint64_t size;
+        struct timespec used;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    DIR* dir = opendir(directory.c_str());
+    if (dir != nullptr) {
+        while (struct dirent* item = readdir(dir)) {
+            std::string name = item->d_name;
+            struct stat info;
+            if (!is_entry(name) || stat((directory + "/" + name).c_str(), &info) != 0) {
+                continue;
+            }
+            entries.push_back(Entry{directory + "/" + name, static_cast<uint64_t>(info.st_size), info.st_mtim});
+            total += static_cast<uint64_t>(info.st_size);
+        }
+        closedir(dir);
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec;
+    });
+    for (size_t i = 0; i < entries.size() && total > maxBytes; ++i) {
+        if (std::remove(entries[i].path.c_str()) == 0) {
+            ++counts.evictions;
+        }
+        total -= entries[i].size;
+    }
+    knownBytes = total;
+}
+
+ResultCache::Stats ResultCache::session() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counts;
+}
+
+ResultCache::Stats ResultCache::totals() const {
+    Stats total;
+    std::ifstream in(directory + "/stats");
+    in >> total.hits >> total.misses >> total.stores >> total.evictions;
+    return total;
+}
+
+void ResultCache::usage(int& entries, uint64_t& bytes) const {
+    entries = 0;
+    bytes = 0;
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+    while (struct dirent* item = readdir(dir)) {
+        std::string name = item->d_name;
+        struct stat info;
+        if (is_entry(name) && stat((directory + "/" + name).c_str(), &info) == 0) {
+            ++entries;
+            bytes += static_cast<uint64_t>(info.st_size);
+        }
+    }
+    closedir(dir);
+}
+
+uint64_t ResultCache::parse_size(const std::string& text) {
+    size_t digits = 0;
+    unsigned long long value = 0;
+    try {
+        value = std::stoull(text, &digits);
+    } catch (const std::exception&) {
+        digits = 0;
+    }
+    std::string unit = text.substr(digits);
+    uint64_t scale = unit.empty() ? 1 : unit == "K" || unit == "k" ? 1ULL << 10 : unit == "M" || unit == "m" ? 1ULL << 20
+                   : unit == "G" || unit == "g" ? 1ULL << 30 : 0;
+    if (digits == 0 || text[0] == '-' || scale == 0) {
+        throw std::invalid_argument("Cache size must be a byte count with an optional K, M or G suffix: " + text);
+    }
+    return static_cast<uint64_t>(value) * scale;
+}
@@ -0,0 +1,78 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "GrayscaleImage.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// On-disk cache of operation results, addressed by content. An entry's key
+// is the hash of the decoded input pixels (Compare::hash) plus a hash of the
+// canonical operation (e.g. "gauss 5 1.2"), the output format and the
+// process-wide settings that change the output bytes (exact arithmetic, PNG
+// level). A repeated request copies the stored file instead of filtering
+// and encoding again.
+//
+// Entries are plain files in one directory, written to a temporary name and
+// renamed into place, so concurrent processes never see half an entry.
+// Their modification time records the last use: a hit touches the entry, and
+// after a store the least recently used entries are removed until the
+// directory fits under its size cap. Hit, miss, store and eviction counts
+// are added to <directory>/stats (under flock) when the cache is destroyed.
+class ResultCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t stores = 0;
+        uint64_t evictions = 0;
+    };
+
+    // Cache in `directory`, created if missing, holding up to maxBytes of
+    // entries. Throws std::runtime_error if the directory can't be created.
+    ResultCache(const std::string& directory, uint64_t maxBytes);
+    ~ResultCache();
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    // Key of `operation` applied to an image with the given content hash
+    static std::string key(uint64_t imageHash, const std::string& operation, GrayscaleImageBase::Format format);
+
+    // A parameter written for an operation string: every double reads back
+    // exactly, so values that differ anywhere get different keys
+    static std::string number(double value);
+
+    // Copy the entry for key to path (through a temporary file renamed into
+    // place) and mark it used. Returns false on a miss.
+    bool fetch(const std::string& key, const std::string& path);
+
+    // Keep a copy of the file at path as the entry for key, then evict down
+    // to the size cap. Failures only cost the entry: the result at path stands.
+    void store(const std::string& key, const std::string& path);
+
+    // Counts of this process
+    Stats session() const;
+
+    // Counts of every process that has used the directory and finished
+    Stats totals() const;
+
+    // Number and total size of the entries on disk right now
+    void usage(int& entries, uint64_t& bytes) const;
+
+    // "512M", "2G", "100000" (bytes); throws std::invalid_argument otherwise
+    static uint64_t parse_size(const std::string& text);
+
+private:
+    std::string directory;
+    uint64_t maxBytes;
+    mutable std::mutex mutex;
+    Stats counts;
+    uint64_t knownBytes;  // Entry bytes as of the last scan plus stores since
+    bool scanned;
+
+    std::string temporary_path(const std::string& near) const;
+    void evict();
+};
+
+#endif // RESULT_CACHE_H
@@ -1,126 +1,285 @@
 #include "SecretImage.h"
+#include "Checksum.h"
+#include "FrameAllocator.h"
+#include "Trace.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char SECRET_MAGIC[4] = {'C', 'V', 'S', 'I'};
+
+// Little-endian 32-bit fields of the binary header
+static void put_u32(unsigned char* p, uint32_t value) {
+    p[0] = static_cast<unsigned char>(value);
+    p[1] = static_cast<unsigned char>(value >> 8);
+    p[2] = static_cast<unsigned char>(value >> 16);
+    p[3] = static_cast<unsigned char>(value >> 24);
+}
 
+static uint32_t get_u32(const unsigned char* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
 
+// Rows 0..h-1 hold max(0, w - r) upper pixels each
+int SecretImage::upper_size(int w, int h) {
+    return static_cast<int>(upper_row_start(w, h));
+}
 
-// Constructor: split image into upper and lower triangular arrays
-SecretImage::SecretImage(const GrayscaleImage& image) {
-// Get the width and height of the original image
-    width = image.get_width(); 
-    height = image.get_height(); 
-
-    // Dynamically allocate memory for the upper and lower triangular matrices
-    int upperSize = (width * (width + 1)) / 2; 
-    int lowerSize = (width * (width - 1)) / 2; 
-    upper_triangular = new int[upperSize](); // Initialize upper triangular matrix with zeros
-    lower_triangular = new int[lowerSize](); // Initialize lower triangular matrix with zeros
+int SecretImage::lower_size(int w, int h) {
+    return static_cast<int>(static_cast<size_t>(w) * h - upper_row_start(w, h));
+}
 
+int SecretImage::legacy_upper_size(int w) {
+    return (w * (w + 1)) / 2;
+}
 
-    // Fill the matrices with pixel data
-    int upperIndex = 0;
-    int lowerIndex = 0;
+int SecretImage::legacy_lower_size(int w) {
+    return (w * (w - 1)) / 2;
+}
 
+// Constructor: split image into upper and lower triangular arrays
+SecretImage::SecretImage(const GrayscaleImage& image) : SecretImage(image.get_width(), image.get_height()) {
+    TRACE_SCOPE(scope, "secret.split");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(width) * height, static_cast<uint64_t>(width) * height);
     for (int i = 0; i < height; ++i) {
-        for (int j = 0; j < width; ++j) {
-            int pixelValue = image.get_pixel(i, j);
-            if (j >= i) { 
-                upper_triangular[upperIndex++] = pixelValue;
-            } else { 
-                lower_triangular[lowerIndex++] = pixelValue;
-            }
-        }
+        write_row(i, image.row(i));
     }
 }
 
 // Constructor: instantiate based on data read from file
-SecretImage::SecretImage(int w, int h, int * upper, int * lower) {
+SecretImage::SecretImage(int w, int h, int * upper, int * lower) : SecretImage(w, h) {
+    int upperSize = upper_size(width, height);
+    int lowerSize = lower_size(width, height);
+
+    // Copy the parameters to instance variables, clamped to pixel range
+    for (int i = 0; i < upperSize; ++i) {
+        upper_triangular[i] = static_cast<unsigned char>(std::max(0, std::min(upper[i], 255)));
+    }
+    for (int i = 0; i < lowerSize; ++i) {
+        lower_triangular[i] = static_cast<unsigned char>(std::max(0, std::min(lower[i], 255)));
+    }
+}
+
+// Constructor: copy already packed triangular arrays
+SecretImage::SecretImage(int w, int h, const unsigned char * upper, const unsigned char * lower) : SecretImage(w, h) {
+    std::copy(upper, upper + upper_size(width, height), upper_triangular);
+    std::copy(lower, lower + lower_size(width, height), lower_triangular);
+}
 
-    width = w;
-    height = h;
+// The lower array starts on the next aligned boundary after the upper one
+size_t SecretImage::lower_frame_offset(int w, int h) {
+    const size_t alignment = FrameAllocator::FRAME_ALIGNMENT;
+    return (static_cast<size_t>(upper_size(w, h)) + alignment - 1) / alignment * alignment;
+}
+
+size_t SecretImage::frame_size(int w, int h) {
+    return lower_frame_offset(w, h) + static_cast<size_t>(lower_size(w, h));
+}
 
-    int upperSize = (width * (width + 1)) / 2;
-    int lowerSize = (width * (width - 1)) / 2;
+// Constructor: allocate zero-filled arrays, used when reading straight into them.
+// Both share one frame from the frame allocator.
+SecretImage::SecretImage(int w, int h) : width(w), height(h), mapping(nullptr), mapping_size(0) {
+    FrameAllocator& frames = FrameAllocator::current();
+    size_t bytes = frame_size(width, height);
+    unsigned char* frame = static_cast<unsigned char*>(frames.allocate(bytes));
+    std::memset(frame, 0, bytes);
+    allocator = &frames;
+    upper_triangular = frame;
+    lower_triangular = frame + lower_frame_offset(width, height);
+}
 
-    // Dynamically allocate memory for upper and lower matrices
-    upper_triangular = new int[upperSize];
-    lower_triangular = new int[lowerSize];
+// Constructor: point the arrays into a mapped binary file (header already validated)
+SecretImage::SecretImage(int w, int h, void* mapping, size_t mapping_size, size_t lower_offset)
+    : width(w), height(h), mapping(mapping), mapping_size(mapping_size), allocator(nullptr) {
+    upper_triangular = static_cast<unsigned char*>(mapping) + HEADER_SIZE;
+    lower_triangular = upper_triangular + lower_offset;
+}
 
-    // Copy the parameters to instance variables
-    std::copy(upper, upper + upperSize, upper_triangular);
-    std::copy(lower, lower + lowerSize, lower_triangular);
+// Copy constructor: the copy always owns its arrays, even if other is mapped
+SecretImage::SecretImage(const SecretImage& other) : SecretImage(other.width, other.height) {
+    std::copy(other.upper_triangular, other.upper_triangular + upper_size(width, height), upper_triangular);
+    std::copy(other.lower_triangular, other.lower_triangular + lower_size(width, height), lower_triangular);
+}
+
+// Move constructor: takes over the arrays (or the mapping), leaving other empty
+SecretImage::SecretImage(SecretImage&& other) noexcept
+    : upper_triangular(other.upper_triangular), lower_triangular(other.lower_triangular),
+      width(other.width), height(other.height), mapping(other.mapping), mapping_size(other.mapping_size),
+      allocator(other.allocator) {
+    other.upper_triangular = nullptr;
+    other.lower_triangular = nullptr;
+    other.width = 0;
+    other.height = 0;
+    other.mapping = nullptr;
+    other.mapping_size = 0;
+    other.allocator = nullptr;
+}
+
+// Copy assignment
+SecretImage& SecretImage::operator=(const SecretImage& other) {
+    if (this != &other) {
+        SecretImage copy(other);
+        swap(copy);
+    }
+    return *this;
+}
+
+// Move assignment
+SecretImage& SecretImage::operator=(SecretImage&& other) noexcept {
+    if (this != &other) {
+        SecretImage moved(std::move(other));
+        swap(moved);
+    }
+    return *this;
 }
 
 // Destructor: free the arrays
 SecretImage::~SecretImage() {
-    delete[] upper_triangular;
-    delete[] lower_triangular;
+    release();
+}
+
+// Unmap the file, or free the arrays we own
+void SecretImage::release() {
+    if (mapping) {
+        munmap(mapping, mapping_size);
+    } else if (allocator) {
+        allocator->deallocate(upper_triangular, frame_size(width, height));
+    }
+    mapping = nullptr;
+    mapping_size = 0;
+    allocator = nullptr;
+    upper_triangular = nullptr;
+    lower_triangular = nullptr;
+}
+
+// Swap arrays and dimensions with another secret image
+void SecretImage::swap(SecretImage& other) noexcept {
+    std::swap(upper_triangular, other.upper_triangular);
+    std::swap(lower_triangular, other.lower_triangular);
+    std::swap(width, other.width);
+    std::swap(height, other.height);
+    std::swap(mapping, other.mapping);
+    std::swap(mapping_size, other.mapping_size);
+    std::swap(allocator, other.allocator);
 }
 
 // Reconstructs and returns the full image from upper and lower triangular matrices.
 GrayscaleImage SecretImage::reconstruct() const {
-    
+    TRACE_SCOPE(scope, "secret.reconstruct");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(width) * height, static_cast<uint64_t>(width) * height);
     GrayscaleImage image(width, height);
-    
-    int upperIndex = 0;
-    int lowerIndex = 0;
-
-
     for (int i = 0; i < height; ++i) {
-        for (int j = 0; j < width; ++j) {
-            if (j >= i) { // Upper triangular
-                int value = upper_triangular[upperIndex]; 
-                image.set_pixel(i, j, value);
-                upperIndex++;
-            } else { // Lower triangular
-                int value = lower_triangular[lowerIndex];
-                image.set_pixel(i, j, value);
-                lowerIndex++; 
-            }
-        }
+        read_row(i, image.row(i));
     }
-
     return image;
 }
 
-
-
 // Save the filtered image back to the triangular arrays
 void SecretImage::save_back(const GrayscaleImage& image) {
-    // Update the lower and upper triangular matrices based on the GrayscaleImage
-    int upperIndex = 0;
-    int lowerIndex = 0;
-
     for (int i = 0; i < height; ++i) {
-        for (int j = 0; j < width; ++j) {
-            int pixelValue = image.get_pixel(i, j);
-            if (j >= i) { // Upper triangular
-                upper_triangular[upperIndex++] = pixelValue;
-            } else { // Lower triangular
-                lower_triangular[lowerIndex++] = pixelValue;
-            }
-        }
+        write_row(i, image.row(i));
+    }
+}
+
+// A row is at most two contiguous pieces, one from each array
+void SecretImage::read_row(int r, unsigned char* out) const {
+    RowSpan span = row_span(r);
+    std::memcpy(out, span.lower, span.split);
+    std::memcpy(out + span.split, span.upper, width - span.split);
+}
+
+void SecretImage::write_row(int r, const unsigned char* in) {
+    RowSpan span = row_span(r);
+    std::memcpy(span.lower, in, span.split);
+    std::memcpy(span.upper, in + span.split, width - span.split);
+}
+
+int SecretImage::get_pixel(int row, int col) const {
+    if (row < 0 || row >= height || col < 0 || col >= width) {
+        throw std::out_of_range("Pixel coordinates are out of range.");
+    }
+    return col >= row ? upper_triangular[upper_index(width, row, col)] : lower_triangular[lower_index(width, row, col)];
+}
+
+void SecretImage::set_pixel(int row, int col, int value) {
+    if (row < 0 || row >= height || col < 0 || col >= width) {
+        throw std::out_of_range("Pixel coordinates are out of range.");
+    }
+    unsigned char pixel = static_cast<unsigned char>(std::max(0, std::min(value, 255)));
+    if (col >= row) {
+        upper_triangular[upper_index(width, row, col)] = pixel;
+    } else {
+        lower_triangular[lower_index(width, row, col)] = pixel;
     }
 }
 
 // Save the upper and lower triangular arrays to a file
-void SecretImage::save_to_file(const std::string& filename) {
+void SecretImage::save_to_file(const std::string& filename, Format format) const {
+    TRACE_SCOPE(scope, "secret.save");
+    TRACE_AMOUNT(scope, static_cast<uint64_t>(width) * height, static_cast<uint64_t>(width) * height);
+    if (format == TEXT) {
+        save_text(filename);
+    } else {
+        save_binary(filename);
+    }
+}
+
+// Write the header followed by both packed triangles
+void SecretImage::save_binary(const std::string& filename) const {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open file for writing: " + filename);
+    }
+
+    int upperSize = upper_size(width, height);
+    int lowerSize = lower_size(width, height);
+    uint32_t crc = Checksum::crc32(upper_triangular, upperSize);
+    crc = Checksum::crc32(lower_triangular, lowerSize, crc);
+
+    unsigned char header[HEADER_SIZE] = {};
+    std::memcpy(header, SECRET_MAGIC, sizeof(SECRET_MAGIC));
+    put_u32(header + 4, FORMAT_VERSION);
+    put_u32(header + 8, width);
+    put_u32(header + 12, height);
+    put_u32(header + 16, upperSize);
+    put_u32(header + 20, lowerSize);
+    put_u32(header + 24, crc);
+
+    file.write(reinterpret_cast<const char*>(header), HEADER_SIZE);
+    file.write(reinterpret_cast<const char*>(upper_triangular), upperSize);
+    file.write(reinterpret_cast<const char*>(lower_triangular), lowerSize);
+    if (!file) {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+}
+
+// Legacy text format: "width height", then each triangle on its own line
+void SecretImage::save_text(const std::string& filename) const {
    std::ofstream file(filename);
     if (!file.is_open()) {
-        std::cerr << "Error opening file for writing: " << filename << std::endl;
-        return;
+        throw std::runtime_error("Could not open file for writing: " + filename);
     }
 
     // Write width and height on the first line
     file << width << " " << height << "\n";
 
     // Write the upper_triangular array to the second line
-    for (int i = 0; i < (width * (width + 1)) / 2; ++i) {
-        file << upper_triangular[i] << (i < ((width * (width + 1)) / 2 - 1) ? " " : "");
+    int upperSize = upper_size(width, height);
+    for (int i = 0; i < upperSize; ++i) {
+        file << static_cast<int>(upper_triangular[i]) << (i < upperSize - 1 ? " " : "");
     }
     file << "\n";
 
     // Write the lower_triangular array to the third line
-    for (int i = 0; i < (width * (width - 1)) / 2; ++i) {
-        file << lower_triangular[i] << (i < ((width * (width - 1)) / 2 - 1) ? " " : "");
+    int lowerSize = lower_size(width, height);
+    for (int i = 0; i < lowerSize; ++i) {
+        file << static_cast<int>(lower_triangular[i]) << (i < lowerSize - 1 ? " " : "");
     }
     file << "\n";
 
@@ -129,67 +288,157 @@ void SecretImage::save_to_file(const std::string& filename) {
 
 // Static function to load a SecretImage from a file
 SecretImage SecretImage::load_from_file(const std::string& filename) {
-    
+    TRACE_SCOPE(scope, "secret.load");
     if (filename.empty()) {
-        std::cerr << "Error: Filename is empty." << std::endl;
-        exit(1);
+        throw std::invalid_argument("Filename is empty.");
     }
 
-    std::ifstream file(filename);
+    std::ifstream file(filename, std::ios::binary);
     if (!file.is_open()) {
-        std::cerr << "Error: Could not open file in SecretImage " << filename << std::endl;
-        return SecretImage(0, 0, nullptr, nullptr);
+        throw std::runtime_error("Could not open file in SecretImage " + filename);
+    }
+
+    // Binary files start with the magic; anything else is parsed as text
+    char magic[sizeof(SECRET_MAGIC)] = {};
+    file.read(magic, sizeof(magic));
+    file.close();
+    if (std::memcmp(magic, SECRET_MAGIC, sizeof(SECRET_MAGIC)) != 0) {
+        return load_text(filename);
     }
 
+    return map_file(filename);
+}
+
+// Parse one line of decimal pixel values, clamped to 0..255.
+// Returns false if the line holds anything else.
+static bool read_value_line(std::istream& file, std::vector<unsigned char>& values) {
+    std::string line;
+    std::getline(file, line);  // A missing last line reads as empty
+    values.clear();
+    const char* p = line.c_str();
+    for (;;) {
+        char* end;
+        long value = std::strtol(p, &end, 10);
+        if (end == p) break;
+        values.push_back(static_cast<unsigned char>(std::max(0L, std::min(value, 255L))));
+        p = end;
+    }
+    while (*p == ' ' || *p == '\t' || *p == '\r') ++p;
+    return *p == '\0';
+}
+
+// Parse the legacy text format
+SecretImage SecretImage::load_text(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open file in SecretImage " + filename);
+    }
 
     int w, h;
 
-    if (!(file >> w >> h)) {
-        std::cerr << "Error reading width and height." << std::endl;
-        return SecretImage(0, 0, nullptr, nullptr);
+    if (!(file >> w >> h) || w < 0 || h < 0) {
+        throw std::runtime_error("Error reading width and height: " + filename);
     }
+    file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
 
-    // Calculate the sizes of the upper and lower triangular matrices
-    int upperSize = (w * (w + 1)) / 2;
-    int lowerSize = (w * (w - 1)) / 2;
+    // Each triangle is one line of values
+    std::vector<unsigned char> upper, lower;
+    if (!read_value_line(file, upper)) {
+        throw std::runtime_error("Error reading upper triangular matrix: " + filename);
+    }
+    if (!read_value_line(file, lower)) {
+        throw std::runtime_error("Error reading lower triangular matrix: " + filename);
+    }
 
-    // Allocate memory for both matrices
-    int* upperTri = new int[upperSize];
-    int* lowerTri = new int[lowerSize];
+    // Older files sized both lines from the width; their leading values are
+    // the same pixels, so take the prefixes when that layout covered the image
+    size_t upperSize = upper_size(w, h);
+    size_t lowerSize = lower_size(w, h);
+    bool current = upper.size() == upperSize && lower.size() == lowerSize;
+    bool legacy = h <= w && upper.size() == static_cast<size_t>(legacy_upper_size(w)) &&
+                  lower.size() == static_cast<size_t>(legacy_lower_size(w));
+    if (!current && !legacy) {
+        throw std::runtime_error("Triangular matrices do not match a " + std::to_string(w) + "x" +
+                                 std::to_string(h) + " image: " + filename);
+    }
 
-    // Read the upper triangular matrix
-    for (int i = 0; i < upperSize; ++i) {
-        if (!(file >> upperTri[i])) {
-            std::cerr << "Error reading upper triangular matrix" << std::endl;
-            delete[] upperTri;
-            delete[] lowerTri;
-            return SecretImage(0, 0, nullptr, nullptr); // Returns an invalid SecretImage
-        }
+    SecretImage image(w, h);
+    std::copy(upper.begin(), upper.begin() + upperSize, image.upper_triangular);
+    std::copy(lower.begin(), lower.begin() + lowerSize, image.lower_triangular);
+    return image;
+}
+
+// Map a binary file and check its header before handing out a view of it
+SecretImage SecretImage::map_file(const std::string& filename, bool verify_checksum) {
+    TRACE_SCOPE(scope, "secret.map");
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file in SecretImage " + filename);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < HEADER_SIZE) {
+        close(fd);
+        throw std::runtime_error("Secret image file is truncated: " + filename);
     }
 
-    // Read the lower triangular matrix
-    for (int i = 0; i < lowerSize; ++i) {
-        if (!(file >> lowerTri[i])) {
-            std::cerr << "Error reading lower triangular matrix" << std::endl;
-            delete[] upperTri;
-            delete[] lowerTri;
-            return SecretImage(0, 0, nullptr, nullptr); // Returns an invalid SecretImage
+    // Private, writable mapping: save_back() copies touched pages instead of changing the file
+    size_t size = static_cast<size_t>(info.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Could not map file: " + filename);
+    }
+
+    const unsigned char* header = static_cast<const unsigned char*>(mapping);
+    std::string problem;
+    uint32_t version = get_u32(header + 4);
+    uint32_t w = get_u32(header + 8);
+    uint32_t h = get_u32(header + 12);
+    uint32_t upperCount = get_u32(header + 16);
+    uint32_t lowerCount = get_u32(header + 20);
+    bool countsMatch = false;
+    if (w <= 46340 && h <= 46340) {  // Keeps every array size within int
+        if (version == 1) {
+            // Width-based sizes; their prefixes hold the image unless it is taller than wide
+            countsMatch = h <= w && upperCount == static_cast<uint32_t>(legacy_upper_size(w)) &&
+                          lowerCount == static_cast<uint32_t>(legacy_lower_size(w));
+        } else {
+            countsMatch = upperCount == static_cast<uint32_t>(upper_size(w, h)) &&
+                          lowerCount == static_cast<uint32_t>(lower_size(w, h));
         }
     }
+    if (std::memcmp(header, SECRET_MAGIC, sizeof(SECRET_MAGIC)) != 0) {
+        problem = "not a binary secret image";
+    } else if (version != 1 && version != static_cast<uint32_t>(FORMAT_VERSION)) {
+        problem = "unsupported format version " + std::to_string(version);
+    } else if (!countsMatch) {
+        problem = "inconsistent dimensions";
+    } else if (size < static_cast<size_t>(HEADER_SIZE) + upperCount + lowerCount) {
+        problem = "file is truncated";
+    } else if (verify_checksum &&
+               Checksum::crc32(header + HEADER_SIZE, static_cast<size_t>(upperCount) + lowerCount) != get_u32(header + 24)) {
+        problem = "checksum mismatch";
+    }
+    if (!problem.empty()) {
+        munmap(mapping, size);
+        throw std::runtime_error("Bad secret image file " + filename + ": " + problem);
+    }
 
-    // Close the file and return the SecretImage
-    file.close();
+    return SecretImage(static_cast<int>(w), static_cast<int>(h), mapping, size, upperCount);
+}
 
-    return SecretImage(w, h, upperTri, lowerTri);
+// True if the triangles are a view of a mapped file
+bool SecretImage::is_mapped() const {
+    return mapping != nullptr;
 }
 
 // Returns a pointer to the upper triangular part of the secret image.
-int * SecretImage::get_upper_triangular() const {
+unsigned char * SecretImage::get_upper_triangular() const {
     return upper_triangular;
 }
 
 // Returns a pointer to the lower triangular part of the secret image.
-int * SecretImage::get_lower_triangular() const {
+unsigned char * SecretImage::get_lower_triangular() const {
     return lower_triangular;
 }
 
@@ -8,41 +8,164 @@
 #include <sstream>
 #include <string>
 #include <limits>
+#include <utility>
+#include <cstddef>
 
 #include "GrayscaleImage.h"
 
+class FrameAllocator;
+
+// Pixel (row, col) is stored in the upper triangular array when col >= row,
+// otherwise in the lower one; both arrays hold their pixels in row-major
+// order. For a w x h image with m = min(w, h) that makes
+//   upper size  m * w - m * (m - 1) / 2      lower size  w * h - upper size
+// and row r starts at upper[upper_row_start(r)] and lower[r * w - upper_row_start(r)].
+//
+// Binary .dat layout (all integers little-endian uint32):
+//   offset  0  magic "CVSI"
+//           4  format version (2)
+//           8  width
+//          12  height
+//          16  number of upper triangular bytes
+//          20  number of lower triangular bytes
+//          24  CRC-32 of the upper and lower bytes
+//          28  reserved (0)
+//          32  upper triangular bytes, then lower triangular bytes
+// The older text format ("w h" then both arrays as decimals) is still read.
+// Version 1 files and older text files sized both arrays from the width alone
+// (w * (w + 1) / 2 and w * (w - 1) / 2); they are read wherever that covered
+// the image, i.e. unless the image is taller than wide.
 class SecretImage {
     
 private:
-    int *upper_triangular; // Array for upper triangular part (including diagonal)
-    int *lower_triangular; // Array for lower triangular part (excluding diagonal)
+    unsigned char *upper_triangular; // Array for upper triangular part (including diagonal)
+    unsigned char *lower_triangular; // Array for lower triangular part (excluding diagonal)
     int width, height;
+    void *mapping;       // Mapped binary file the arrays point into, or nullptr if they are owned
+    size_t mapping_size;
+    FrameAllocator *allocator;  // Where owned arrays came from (one frame, lower after upper)
+
+    // Constructor: allocate zero-filled triangular arrays for a w x h image
+    SecretImage(int w, int h);
+
+    // Bytes of the frame holding both owned arrays, and where the lower one starts in it
+    static size_t frame_size(int w, int h);
+    static size_t lower_frame_offset(int w, int h);
+
+    // Constructor: view the triangles of a mapped binary file; the lower
+    // array starts lower_offset bytes after the upper one
+    SecretImage(int w, int h, void *mapping, size_t mapping_size, size_t lower_offset);
+
+    // Sizes of the triangular arrays for a w x h image
+    static int upper_size(int w, int h);
+    static int lower_size(int w, int h);
+
+    // Array sizes written by format version 1 and the old text format
+    static int legacy_upper_size(int w);
+    static int legacy_lower_size(int w);
+
+    // Release the arrays or the mapping
+    void release();
+
+    void save_binary(const std::string &filename) const;
+    void save_text(const std::string &filename) const;
+    static SecretImage load_text(const std::string &filename);
 
 public:
+    // On-disk formats understood by save_to_file
+    enum Format { TEXT, BINARY };
+
+    static const int HEADER_SIZE = 32;
+    static const int FORMAT_VERSION = 2;
+
+    // One image row in the split layout: columns [0, split) are lower[0, split)
+    // and columns [split, width) are upper[0, width - split)
+    struct RowSpan {
+        unsigned char *lower;
+        unsigned char *upper;
+        int split;
+        int width;
+
+        unsigned char &operator[](int col) const { return col < split ? lower[col] : upper[col - split]; }
+    };
+
     // Constructor: takes a GrayscaleImage and splits it into two triangular arrays
     SecretImage(const GrayscaleImage &image);
 
-    // Constructor: instantiate based on data read from file
+    // Constructor: instantiate based on data read from file (values are clamped to 0..255)
     SecretImage(int w, int h, int *upper, int *lower);
+    SecretImage(int w, int h, const unsigned char *upper, const unsigned char *lower);
+
+    // Copy and move constructors
+    SecretImage(const SecretImage &other);
+    SecretImage(SecretImage &&other) noexcept;
+
+    // Copy and move assignment
+    SecretImage &operator=(const SecretImage &other);
+    SecretImage &operator=(SecretImage &&other) noexcept;
 
     // Destructor
     ~SecretImage();
 
+    // Exchange the triangular arrays with another secret image without copying
+    void swap(SecretImage &other) noexcept;
+
     // Function to reconstruct the image from two arrays
     GrayscaleImage reconstruct() const;
 
+    // Offset of row r's first pixel in the upper array (r * w pixels precede it in total)
+    static size_t upper_row_start(int w, int r) {
+        size_t m = static_cast<size_t>(std::min(r, w));
+        return m * static_cast<size_t>(w) - m * (m - 1) / 2;
+    }
+
+    // Array positions of pixel (row, col): upper for col >= row, lower otherwise
+    static size_t upper_index(int w, int row, int col) { return upper_row_start(w, row) + (col - row); }
+    static size_t lower_index(int w, int row, int col) {
+        return static_cast<size_t>(row) * w - upper_row_start(w, row) + col;
+    }
+
+    // Row r as views into both arrays, in O(1)
+    RowSpan row_span(int r) const {
+        RowSpan span;
+        span.split = std::min(r, width);
+        span.width = width;
+        span.lower = lower_triangular + (static_cast<size_t>(r) * width - upper_row_start(width, r));
+        span.upper = upper_triangular + upper_row_start(width, r);
+        return span;
+    }
+
+    // Copy row r out of / into the split layout (width pixels)
+    void read_row(int r, unsigned char *out) const;
+    void write_row(int r, const unsigned char *in);
+
+    // Get a specific pixel value; throws std::out_of_range outside the image
+    int get_pixel(int row, int col) const;
+
+    // Set a specific pixel value, clamped to 0..255
+    void set_pixel(int row, int col, int value);
+
     // Save back to triangular arrays after filtering
     void save_back(const GrayscaleImage &image);
 
-    // Saves a secret image into the given file
-    void save_to_file(const std::string &filename);
+    // Saves a secret image into the given file; throws std::runtime_error if it can't be written
+    void save_to_file(const std::string &filename, Format format = BINARY) const;
 
-    // Reads a secret image from the given file
+    // Reads a secret image from the given file, detecting binary or text format.
+    // Throws std::runtime_error if it is missing or corrupt.
     static SecretImage load_from_file(const std::string &filename);
 
+    // Maps a binary .dat file and views its triangles without copying them.
+    // The mapping is private: save_back() changes only this image, never the file.
+    // Throws std::runtime_error if the file is missing, truncated or corrupt.
+    static SecretImage map_file(const std::string &filename, bool verify_checksum = true);
+
+    // True if the triangles live in a mapped file
+    bool is_mapped() const;
+
     // Getters and setters for private instance variables
-    int *get_upper_triangular() const;
-    int *get_lower_triangular() const;
+    unsigned char *get_upper_triangular() const;
+    unsigned char *get_lower_triangular() const;
     int get_width() const;
     int get_height() const;
 };
@@ -0,0 +1,486 @@
+#include "Server.h"
+#include "BoundedQueue.h"
+#include "Crypto.h"
+#include "Filter.h"
+#include "GrayscaleImage.h"
+#include "Pipeline.h"
+#include "SecretImage.h"
+#include "SharedFrame.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+// Largest request or reply message
+static const size_t MAX_MESSAGE = 64 * 1024;
+
+struct Server::Request {
+    int connection;
+    std::vector<std::string> args;
+    int fd;  // Attached descriptor, or -1
+    bool truncated;  // Longer than MAX_MESSAGE or with too many descriptors
+    Clock::time_point received;
+};
+
+// Closes a descriptor on scope exit unless released
+struct Descriptor {
+    int fd;
+    explicit Descriptor(int fd) : fd(fd) {}
+    ~Descriptor() { if (fd >= 0) close(fd); }
+    int release() { int kept = fd; fd = -1; return kept; }
+};
+
+static std::string system_error(const std::string& what) {
+    return what + ": " + std::strerror(errno);
+}
+
+// One message with an optional descriptor; false if the peer is gone
+static bool send_message(int socket, const std::string& text, int fd) {
+    struct iovec part;
+    part.iov_base = const_cast<char*>(text.data());
+    part.iov_len = text.size();
+
+    struct msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    if (fd >= 0) {
+        std::memset(&control, 0, sizeof(control));
+        message.msg_control = control.space;
+        message.msg_controllen = sizeof(control.space);
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(header), &fd, sizeof(int));
+    }
+    return sendmsg(socket, &message, MSG_NOSIGNAL) == static_cast<ssize_t>(text.size());
+}
+
+// One message into text, its first descriptor into fd (-1 if none; extras are
+// closed). Returns the message length, 0 once the peer hung up, -1 on error.
+// A message cut short sets truncated and passes no descriptor.
+static ssize_t receive_message(int socket, std::string& text, int& fd, bool& truncated) {
+    std::vector<char> buffer(MAX_MESSAGE);
+    struct iovec part;
+    part.iov_base = buffer.data();
+    part.iov_len = buffer.size();
+
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(4 * sizeof(int))];
+    } control;
+    struct msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+
+    fd = -1;
+    ssize_t length = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+    if (length < 0) {
+        return -1;
+    }
+    for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int received;
+            std::memcpy(&received, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+            if (fd < 0) {
+                fd = received;
+            } else {
+                close(received);
+            }
+        }
+    }
+    truncated = (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0;
+    if (truncated && fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    text.assign(buffer.data(), static_cast<size_t>(length));
+    return length;
+}
+
+// "a\0b\0" -> {"a", "b"}; a missing final NUL is tolerated
+static std::vector<std::string> split_request(const std::string& message) {
+    std::vector<std::string> args;
+    size_t start = 0;
+    while (start < message.size()) {
+        size_t end = message.find('\0', start);
+        if (end == std::string::npos) end = message.size();
+        args.push_back(message.substr(start, end - start));
+        start = end + 1;
+    }
+    return args;
+}
+
+static void expect_args(const std::vector<std::string>& args, size_t count, const char* usage) {
+    if (args.size() != count) {
+        throw std::invalid_argument(std::string("Usage: ") + usage);
+    }
+}
+
+static int duplicate(int fd) {
+    int copy = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (copy < 0) {
+        throw std::runtime_error(system_error("Could not duplicate descriptor"));
+    }
+    return copy;
+}
+
+Server::Server(const Options& options)
+    : options(options), listenFd(-1), wakeFd(-1), stopping(false),
+      latencies(LATENCY_SAMPLES), requests(0), failures(0), queued(0) {
+    if (options.workers < 1 || options.queueCapacity < 1) {
+        throw std::invalid_argument("Server needs at least one worker and a queue of at least one request.");
+    }
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeFd < 0) {
+        throw std::runtime_error(system_error("Could not create eventfd"));
+    }
+}
+
+Server::~Server() {
+    if (listenFd >= 0) close(listenFd);
+    if (wakeFd >= 0) close(wakeFd);
+}
+
+void Server::stop() {
+    stopping.store(true);
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeFd, &one, sizeof(one));
+    (void)ignored;
+}
+
+void Server::run() {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (options.socketPath.empty() || options.socketPath.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("Socket path must be 1 to " + std::to_string(sizeof(address.sun_path) - 1) + " characters.");
+    }
+    std::strcpy(address.sun_path, options.socketPath.c_str());
+
+    // A socket file left behind by a server that died is replaced; anything else is not
+    struct stat info;
+    if (lstat(options.socketPath.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+        unlink(options.socketPath.c_str());
+    }
+    listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listenFd, SOMAXCONN) != 0) {
+        throw std::runtime_error(system_error("Could not listen on " + options.socketPath));
+    }
+
+    BoundedQueue<Request*> queue(options.queueCapacity);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < options.workers; ++i) {
+        workers.emplace_back([this, &queue] { worker_loop(queue); });
+    }
+
+    std::vector<int> connections;
+    std::set<int> busy;  // Connections with a request in flight
+    std::vector<pollfd> polled;
+    while (!stopping.load()) {
+        bool intake;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            intake = queued < options.queueCapacity;
+        }
+        polled.clear();
+        polled.push_back(pollfd{wakeFd, POLLIN, 0});
+        polled.push_back(pollfd{listenFd, POLLIN, 0});
+        if (intake) {
+            for (size_t i = 0; i < connections.size(); ++i) {
+                if (busy.count(connections[i]) == 0) {
+                    polled.push_back(pollfd{connections[i], POLLIN, 0});
+                }
+            }
+        }
+
+        if (poll(polled.data(), polled.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (polled[0].revents & POLLIN) {
+            uint64_t count;
+            ssize_t ignored = read(wakeFd, &count, sizeof(count));
+            (void)ignored;
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < finished.size(); ++i) {
+                busy.erase(finished[i]);
+            }
+            finished.clear();
+        }
+        if (polled[1].revents & POLLIN) {
+            int connection = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (connection >= 0) {
+                connections.push_back(connection);
+            }
+        }
+
+        for (size_t p = 2; p < polled.size(); ++p) {
+            if (polled[p].revents == 0) {
+                continue;
+            }
+            int connection = polled[p].fd;
+            std::string message;
+            int fd;
+            bool truncated;
+            if (receive_message(connection, message, fd, truncated) <= 0) {
+                close(connection);
+                connections.erase(std::find(connections.begin(), connections.end(), connection));
+                continue;
+            }
+
+            Request* request = new Request;
+            request->connection = connection;
+            request->args = split_request(message);
+            request->fd = fd;
+            request->truncated = truncated;
+            request->received = Clock::now();
+            busy.insert(connection);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++queued;
+            }
+            queue.push(request);  // Only blocks if several connections filled the last free slots at once
+        }
+    }
+
+    queue.close();
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+    for (size_t i = 0; i < connections.size(); ++i) {
+        close(connections[i]);
+    }
+    close(listenFd);
+    listenFd = -1;
+    unlink(options.socketPath.c_str());
+}
+
+void Server::worker_loop(BoundedQueue<Request*>& queue) {
+    Request* next;
+    while (queue.pop(next)) {
+        std::unique_ptr<Request> request(next);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --queued;
+        }
+
+        std::string text;
+        int replyFd = -1;
+        bool failed = false;
+        try {
+            TRACE_SCOPE(scope, "server.request");
+            if (request->truncated) {
+                throw std::invalid_argument("Request too long or carries too many descriptors");
+            }
+            handle(*request, text, replyFd);
+        } catch (const std::exception& e) {
+            text = e.what();
+            failed = true;
+            TRACE_COUNT("server.failed", 1);
+        }
+        Descriptor reply(replyFd);
+        Descriptor attached(request->fd);
+
+        send_message(request->connection, failed ? "ERR " + text : (text.empty() ? "OK" : "OK " + text),
+                     failed ? -1 : reply.fd);
+        uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - request->received).count();
+        finish(request->connection, static_cast<uint32_t>(std::min<uint64_t>(micros, UINT32_MAX)), failed);
+    }
+}
+
+// Record the response and hand the connection back to the event loop
+void Server::finish(int connection, uint32_t micros, bool failed) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        latencies[requests % LATENCY_SAMPLES] = micros;
+        ++requests;
+        if (failed) ++failures;
+        finished.push_back(connection);
+    }
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeFd, &one, sizeof(one));
+    (void)ignored;
+}
+
+void Server::handle(Request& request, std::string& text, int& replyFd) {
+    const std::vector<std::string>& args = request.args;
+    if (args.empty()) {
+        throw std::invalid_argument("Empty request");
+    }
+    const std::string& op = args[0];
+    if (op == "stats") {
+        expect_args(args, 1, "stats");
+        text = stats_text();
+        return;
+    }
+    if (request.fd < 0) {
+        throw std::invalid_argument(op + " needs a shared memory descriptor");
+    }
+
+    if (op == "reveal") {
+        expect_args(args, 1, "reveal");
+        SharedFrame::require_sealed(request.fd);
+        SecretImage secret = SecretImage::map_file(SharedFrame::path(request.fd));
+        SharedFrame out = SharedFrame::create(secret.get_width(), secret.get_height());
+        GrayscaleImage pixels = out.image();
+        for (int r = 0; r < secret.get_height(); ++r) {
+            secret.read_row(r, pixels.row(r));
+        }
+        replyFd = duplicate(out.fd());
+        return;
+    }
+
+    int fd = request.fd;
+    request.fd = -1;  // The frame owns it now
+    SharedFrame frame = SharedFrame::open(fd);
+    GrayscaleImage input = frame.image();
+
+    if (op == "mean" || op == "gauss" || op == "unsharp" || op == "pipeline" || op == "median" || op == "bilateral" ||
+        op == "erode" || op == "dilate" || op == "open" || op == "close") {
+        SharedFrame out = SharedFrame::create(input.get_width(), input.get_height());
+        GrayscaleImage output = out.image();
+        if (op == "mean") {
+            expect_args(args, 2, "mean <kernel_size>");
+            Filter::apply_mean_filter(input, output, std::stoi(args[1]));
+        } else if (op == "gauss") {
+            expect_args(args, 3, "gauss <kernel_size> <sigma>");
+            Filter::apply_gaussian_smoothing(input, output, std::stoi(args[1]), std::stof(args[2]));
+        } else if (op == "unsharp") {
+            expect_args(args, 3, "unsharp <kernel_size> <amount>");
+            Filter::apply_unsharp_mask(input, output, std::stoi(args[1]), std::stof(args[2]));
+        } else if (op == "median") {
+            expect_args(args, 2, "median <kernel_size>");
+            Filter::apply_median_filter(input, output, std::stoi(args[1]));
+        } else if (op == "bilateral") {
+            expect_args(args, 3, "bilateral <kernel_size> <sigma_range>");
+            Filter::apply_bilateral_filter(input, output, std::stoi(args[1]), std::stof(args[2]));
+        } else if (op != "pipeline") {
+            expect_args(args, 2, (op + " <kernel_size>").c_str());
+            Filter::apply_morphology(input, output, Filter::parse_morphology(op), std::stoi(args[1]));
+        } else {
+            expect_args(args, 2, "pipeline <stages>");
+            Pipeline(args[1]).run(input, output);
+        }
+        replyFd = duplicate(out.fd());
+    } else if (op == "enc") {
+        expect_args(args, 2, "enc <message>");
+        Crypto::embed_message(input, args[1]);
+    } else if (op == "dec") {
+        expect_args(args, 1, "dec");
+        text = Crypto::extract_message(input);
+    } else if (op == "disguise") {
+        expect_args(args, 1, "disguise");
+        SecretImage secret(input);
+        Descriptor memory(SharedFrame::create_memory("clearvision-secret"));
+        secret.save_to_file(SharedFrame::path(memory.fd));
+        struct stat info;
+        if (fstat(memory.fd, &info) != 0 || info.st_size < SecretImage::HEADER_SIZE) {
+            throw std::runtime_error("Could not write the secret image");
+        }
+        SharedFrame::seal(memory.fd);
+        replyFd = memory.release();
+    } else {
+        throw std::invalid_argument("Invalid operation for server mode: " + op);
+    }
+}
+
+std::string Server::stats_text() {
+    std::vector<uint32_t> samples;
+    uint64_t total, failed;
+    int waiting;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        total = requests;
+        failed = failures;
+        waiting = queued;
+        samples.assign(latencies.begin(), latencies.begin() + std::min<uint64_t>(requests, LATENCY_SAMPLES));
+    }
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double q) -> uint32_t {
+        if (samples.empty()) return 0;
+        return samples[std::min(samples.size() - 1, static_cast<size_t>(q * samples.size()))];
+    };
+
+    std::ostringstream text;
+    text << "requests=" << total << " failed=" << failed << " queued=" << waiting
+         << " p50_us=" << percentile(0.50) << " p90_us=" << percentile(0.90) << " p99_us=" << percentile(0.99)
+         << " max_us=" << (samples.empty() ? 0 : samples.back());
+    return text.str();
+}
+
+std::string Server::call(const std::string& socketPath, const std::vector<std::string>& request, int attachFd,
+                         int& replyFd) {
+    replyFd = -1;
+    std::string message;
+    for (size_t i = 0; i < request.size(); ++i) {
+        message += request[i];
+        message += '\0';
+    }
+    if (message.size() > MAX_MESSAGE) {
+        throw std::invalid_argument("Request too long");
+    }
+
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("Socket path too long: " + socketPath);
+    }
+    std::strcpy(address.sun_path, socketPath.c_str());
+
+    Descriptor connection(socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0));
+    if (connection.fd < 0 || connect(connection.fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        throw std::runtime_error(system_error("Could not connect to " + socketPath));
+    }
+    if (!send_message(connection.fd, message, attachFd)) {
+        throw std::runtime_error(system_error("Could not send request"));
+    }
+
+    std::string reply;
+    int fd;
+    bool truncated;
+    if (receive_message(connection.fd, reply, fd, truncated) <= 0) {
+        throw std::runtime_error("Server closed the connection without replying");
+    }
+    if (reply.compare(0, 4, "ERR ") == 0) {
+        if (fd >= 0) close(fd);
+        throw std::runtime_error(reply.substr(4));
+    }
+    if (reply.compare(0, 2, "OK") != 0) {
+        if (fd >= 0) close(fd);
+        throw std::runtime_error("Unexpected reply from server: " + reply);
+    }
+    replyFd = fd;
+    return reply.size() > 3 ? reply.substr(3) : "";
+}
@@ -0,0 +1,91 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+template <typename T> class BoundedQueue;
+
+// Long-running request server on a Unix-domain socket (SOCK_SEQPACKET), so
+// callers skip process startup per image.
+//
+// A request is one message: the operation and its arguments as NUL-terminated
+// strings, with at most one file descriptor attached (SCM_RIGHTS). Images go
+// both ways as SharedFrame memfds, so pixels never pass through the socket.
+// The reply is one message, "OK[ <text>]" or "ERR <text>", again with at most
+// one descriptor:
+//   mean <k>, gauss <k> <sigma>,     frame in, new frame out
+//   unsharp <k> <amount>, median <k>,
+//   bilateral <k> <sigma_range>,
+//   erode|dilate|open|close <k>,
+//   pipeline <stages>
+//   enc <message>                    frame in, message embedded in place
+//   dec                              frame in, "OK <message>"
+//   disguise                         frame in, CVSI secret image memfd out
+//   reveal                           sealed CVSI secret image memfd in, frame out
+//   stats                            "OK requests=.. failed=.. queued=.. p50_us=.. p90_us=.. p99_us=.. max_us=.."
+//
+// Requests wait in a bounded queue for the worker threads. A connection has
+// one request in flight at a time, and while the queue is full no connection
+// is read, so clients block in send() instead of the server queueing without
+// bound. Response times run from receipt to reply; the percentiles cover the
+// last LATENCY_SAMPLES requests.
+class Server {
+public:
+    static const int LATENCY_SAMPLES = 4096;
+
+    struct Options {
+        std::string socketPath;
+        int workers;        // Threads running requests
+        int queueCapacity;  // Requests waiting for a worker before intake stops
+
+        Options() : workers(2), queueCapacity(64) {}
+    };
+
+    explicit Server(const Options& options);
+    ~Server();
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // Serve until stop(); removes the socket file on the way out.
+    // Throws std::runtime_error if the socket can't be set up.
+    void run();
+
+    // Ask run() to return once the requests in flight are answered.
+    // Async-signal-safe, so it may be called from a signal handler.
+    void stop();
+
+    // Reply text of the stats request
+    std::string stats_text();
+
+    // Client side: send one request and wait for the reply. attachFd (if >= 0)
+    // goes with the request; a descriptor in the reply lands in replyFd, else
+    // it is -1. Returns the text after "OK"; throws std::runtime_error with
+    // the text of an ERR reply or if the server can't be reached.
+    static std::string call(const std::string& socketPath, const std::vector<std::string>& request,
+                            int attachFd, int& replyFd);
+
+private:
+    struct Request;
+
+    Options options;
+    int listenFd;
+    int wakeFd;  // eventfd: stop() and finished requests wake the event loop
+    std::atomic<bool> stopping;
+
+    std::mutex mutex;                 // Guards everything below
+    std::vector<int> finished;        // Connections whose reply went out
+    std::vector<uint32_t> latencies;  // Ring of the last response times in microseconds
+    uint64_t requests, failures;
+    int queued;
+
+    void worker_loop(BoundedQueue<Request*>& queue);
+    void handle(Request& request, std::string& text, int& replyFd);
+    void finish(int connection, uint32_t micros, bool failed);
+};
+
+#endif // SERVER_H
@@ -0,0 +1,168 @@
+#include "SharedFrame.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char FRAME_MAGIC[4] = {'C', 'V', 'F', 'R'};
+
+// Little-endian 32-bit header fields
+static void put_u32(unsigned char* p, uint32_t value) {
+    p[0] = static_cast<unsigned char>(value);
+    p[1] = static_cast<unsigned char>(value >> 8);
+    p[2] = static_cast<unsigned char>(value >> 16);
+    p[3] = static_cast<unsigned char>(value >> 24);
+}
+
+static uint32_t get_u32(const unsigned char* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// Rows start on the same boundary as in GrayscaleImage
+static int frame_stride(int w) {
+    return (w + GrayscaleImage::ROW_ALIGNMENT - 1) / GrayscaleImage::ROW_ALIGNMENT * GrayscaleImage::ROW_ALIGNMENT;
+}
+
+SharedFrame::SharedFrame() : descriptor(-1), mapping(nullptr), size(0), width(0), height(0), stride(0) {}
+
+SharedFrame::~SharedFrame() {
+    release();
+}
+
+SharedFrame::SharedFrame(SharedFrame&& other) noexcept
+    : descriptor(other.descriptor), mapping(other.mapping), size(other.size),
+      width(other.width), height(other.height), stride(other.stride) {
+    other.descriptor = -1;
+    other.mapping = nullptr;
+    other.size = 0;
+}
+
+SharedFrame& SharedFrame::operator=(SharedFrame&& other) noexcept {
+    if (this != &other) {
+        release();
+        descriptor = other.descriptor;
+        mapping = other.mapping;
+        size = other.size;
+        width = other.width;
+        height = other.height;
+        stride = other.stride;
+        other.descriptor = -1;
+        other.mapping = nullptr;
+        other.size = 0;
+    }
+    return *this;
+}
+
+// Unmap and close
+void SharedFrame::release() {
+    if (mapping != nullptr) {
+        munmap(mapping, size);
+        mapping = nullptr;
+    }
+    if (descriptor >= 0) {
+        ::close(descriptor);
+        descriptor = -1;
+    }
+    size = 0;
+}
+
+int SharedFrame::create_memory(const char* name) {
+    int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("Could not create shared memory: ") + std::strerror(errno));
+    }
+    return fd;
+}
+
+void SharedFrame::seal(int fd) {
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) != 0) {
+        throw std::runtime_error(std::string("Could not seal shared memory: ") + std::strerror(errno));
+    }
+}
+
+void SharedFrame::require_sealed(int fd) {
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & F_SEAL_SHRINK) == 0) {
+        throw std::runtime_error("Shared memory must be a memfd sealed against shrinking");
+    }
+}
+
+std::string SharedFrame::path(int fd) {
+    return "/proc/self/fd/" + std::to_string(fd);
+}
+
+SharedFrame SharedFrame::create(int w, int h) {
+    if (w < 0 || h < 0) {
+        throw std::invalid_argument("Frame dimensions must not be negative.");
+    }
+    SharedFrame frame;
+    frame.width = w;
+    frame.height = h;
+    frame.stride = frame_stride(w);
+    frame.size = HEADER_SIZE + static_cast<std::size_t>(frame.stride) * h;
+    frame.descriptor = create_memory("clearvision-frame");
+    if (ftruncate(frame.descriptor, static_cast<off_t>(frame.size)) != 0) {
+        throw std::runtime_error(std::string("Could not size shared memory: ") + std::strerror(errno));
+    }
+    seal(frame.descriptor);
+
+    void* memory = mmap(nullptr, frame.size, PROT_READ | PROT_WRITE, MAP_SHARED, frame.descriptor, 0);
+    if (memory == MAP_FAILED) {
+        throw std::runtime_error(std::string("Could not map shared memory: ") + std::strerror(errno));
+    }
+    frame.mapping = static_cast<unsigned char*>(memory);
+    std::memcpy(frame.mapping, FRAME_MAGIC, sizeof(FRAME_MAGIC));
+    put_u32(frame.mapping + 4, w);
+    put_u32(frame.mapping + 8, h);
+    put_u32(frame.mapping + 12, frame.stride);
+    return frame;
+}
+
+SharedFrame SharedFrame::from_image(const GrayscaleImage& image) {
+    SharedFrame frame = create(image.get_width(), image.get_height());
+    GrayscaleImage pixels = frame.image();
+    pixels = image;  // Same dimensions: copies the rows into the shared memory
+    return frame;
+}
+
+SharedFrame SharedFrame::open(int fd) {
+    SharedFrame frame;
+    frame.descriptor = fd;
+    require_sealed(fd);
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < HEADER_SIZE) {
+        throw std::runtime_error("Shared frame is truncated");
+    }
+    frame.size = static_cast<std::size_t>(info.st_size);
+    void* memory = mmap(nullptr, frame.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        throw std::runtime_error(std::string("Could not map shared frame: ") + std::strerror(errno));
+    }
+    frame.mapping = static_cast<unsigned char*>(memory);
+
+    uint32_t w = get_u32(frame.mapping + 4);
+    uint32_t h = get_u32(frame.mapping + 8);
+    uint32_t stride = get_u32(frame.mapping + 12);
+    if (std::memcmp(frame.mapping, FRAME_MAGIC, sizeof(FRAME_MAGIC)) != 0) {
+        throw std::runtime_error("Not a shared frame (bad magic)");
+    }
+    if (w > 0x7fffffffu || h > 0x7fffffffu || stride > 0x7fffffffu || stride < w ||
+        static_cast<uint64_t>(stride) * h > frame.size - HEADER_SIZE) {
+        throw std::runtime_error("Shared frame header does not match its size");
+    }
+    frame.width = static_cast<int>(w);
+    frame.height = static_cast<int>(h);
+    frame.stride = static_cast<int>(stride);
+    return frame;
+}
+
+GrayscaleImage SharedFrame::image() const {
+    return GrayscaleImage::wrap(mapping + HEADER_SIZE, width, height, stride);
+}
@@ -0,0 +1,63 @@
+#ifndef SHARED_FRAME_H
+#define SHARED_FRAME_H
+
+#include "GrayscaleImage.h"
+#include <cstddef>
+#include <string>
+
+// An image in shared memory (a memfd) that travels between processes as a
+// file descriptor, so the pixels are never copied through a socket.
+// Layout (integers little-endian uint32):
+//   offset  0  magic "CVFR"
+//           4  width
+//           8  height
+//          12  stride, the distance in bytes between row starts (>= width)
+//          16  reserved (0) up to HEADER_SIZE
+//          64  height rows of stride bytes
+// Frames are sealed against shrinking, so a peer cannot truncate the memory
+// under our mapping.
+class SharedFrame {
+private:
+    int descriptor;
+    unsigned char* mapping;
+    std::size_t size;
+    int width, height, stride;
+
+    SharedFrame();
+    void release();
+
+public:
+    static const int HEADER_SIZE = 64;
+
+    ~SharedFrame();
+    SharedFrame(SharedFrame&& other) noexcept;
+    SharedFrame& operator=(SharedFrame&& other) noexcept;
+    SharedFrame(const SharedFrame&) = delete;
+    SharedFrame& operator=(const SharedFrame&) = delete;
+
+    // A new black w x h frame; throws std::runtime_error if the memory can't be set up
+    static SharedFrame create(int w, int h);
+
+    // A new frame holding a copy of the image
+    static SharedFrame from_image(const GrayscaleImage& image);
+
+    // Map a frame received from a peer, taking ownership of fd. Throws
+    // std::runtime_error if it is not sealed or its header does not fit its size.
+    static SharedFrame open(int fd);
+
+    // The pixels as an image; writes go straight to the shared memory.
+    // Valid while this frame lives.
+    GrayscaleImage image() const;
+
+    int fd() const { return descriptor; }
+
+    // Helpers for other data in shared memory, e.g. a CVSI secret image:
+    // a new memfd (throws std::runtime_error), the seal frames carry, a check
+    // for it, and a path that opens the memory itself on Linux
+    static int create_memory(const char* name);
+    static void seal(int fd);
+    static void require_sealed(int fd);
+    static std::string path(int fd);
+};
+
+#endif // SHARED_FRAME_H
@@ -0,0 +1,191 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+
+// Which pool (if any) the current thread works for, and its queue index
+static thread_local ThreadPool* current_pool = nullptr;
+static thread_local int current_index = -1;
+
+ThreadPool::ThreadPool(int threads) : pending(0), nextQueue(0), stopping(false) {
+    int workerCount = std::max(threads, 1) - 1;
+    for (int i = 0; i < std::max(workerCount, 1); ++i) {
+        queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+    }
+    for (int i = 0; i < workerCount; ++i) {
+        workers.push_back(std::thread(&ThreadPool::worker_loop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    if (workers.empty()) {
+        task();  // Single-threaded pool: run inline
+        return;
+    }
+
+    // Workers push onto their own queue for locality, everyone else round-robins
+    int index = (current_pool == this) ? current_index : static_cast<int>(nextQueue++ % queues.size());
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        ++pending;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+bool ThreadPool::run_one(int home) {
+    std::function<void()> task;
+    int count = static_cast<int>(queues.size());
+
+    // Own queue first, newest task (still warm in cache)
+    if (home >= 0) {
+        std::lock_guard<std::mutex> lock(queues[home]->mutex);
+        if (!queues[home]->tasks.empty()) {
+            task = std::move(queues[home]->tasks.back());
+            queues[home]->tasks.pop_back();
+        }
+    }
+
+    // Then steal the oldest task from someone else
+    if (!task) {
+        int start = (home >= 0) ? home + 1 : static_cast<int>(nextQueue.load() % count);
+        for (int k = 0; k < count && !task; ++k) {
+            int victim = (start + k) % count;
+            if (victim == home) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(queues[victim]->mutex);
+            if (!queues[victim]->tasks.empty()) {
+                task = std::move(queues[victim]->tasks.front());
+                queues[victim]->tasks.pop_front();
+            }
+        }
+    }
+
+    if (!task) {
+        return false;
+    }
+    --pending;
+    try {
+        task();
+    } catch (...) {
+        // Standalone tasks have nobody to report to; parallel_for captures its own errors
+    }
+    return true;
+}
+
+void ThreadPool::worker_loop(int index) {
+    current_pool = this;
+    current_index = index;
+    while (true) {
+        if (run_one(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stopping || pending.load() > 0; });
+        if (stopping && pending.load() == 0) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::parallel_for(int count, const std::function<void(int)>& fn) {
+    if (count <= 0) {
+        return;
+    }
+    if (workers.empty() || count == 1) {
+        for (int i = 0; i < count; ++i) {
+            fn(i);
+        }
+        return;
+    }
+
+    struct Batch {
+        std::atomic<int> remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+    };
+    std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+    batch->remaining = count;
+
+    auto run = [batch, &fn](int i) {
+        try {
+            fn(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            if (!batch->error) batch->error = std::current_exception();
+        }
+        if (--batch->remaining == 0) {
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            batch->done.notify_all();
+        }
+    };
+
+    for (int i = 1; i < count; ++i) {
+        submit([run, i] { run(i); });
+    }
+    run(0);
+
+    // Help out until the whole batch is finished
+    int home = (current_pool == this) ? current_index : -1;
+    while (batch->remaining.load() > 0) {
+        if (run_one(home)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        batch->done.wait_for(lock, std::chrono::microseconds(200), [&batch] { return batch->remaining.load() == 0; });
+    }
+
+    if (batch->error) {
+        std::rethrow_exception(batch->error);
+    }
+}
+
+void ThreadPool::parallel_bands(int rows, int minBandRows, const std::function<void(int, int)>& fn) {
+    // A few bands per thread so stealing can even out uneven rows
+    int bands = std::max(1, std::min(rows / std::max(minBandRows, 1), size() * 4));
+    parallel_for(bands, [&](int band) {
+        int first = static_cast<int>(static_cast<long long>(rows) * band / bands);
+        int last = static_cast<int>(static_cast<long long>(rows) * (band + 1) / bands);
+        fn(first, last);
+    });
+}
+
+// Shared pool bookkeeping
+static std::mutex shared_mutex;
+static std::unique_ptr<ThreadPool> shared_pool;
+static int shared_threads = 0;
+
+int ThreadPool::default_threads() {
+    unsigned hardware = std::thread::hardware_concurrency();
+    return hardware > 0 ? static_cast<int>(hardware) : 1;
+}
+
+ThreadPool& ThreadPool::shared() {
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    if (!shared_pool) {
+        shared_pool.reset(new ThreadPool(shared_threads > 0 ? shared_threads : default_threads()));
+    }
+    return *shared_pool;
+}
+
+void ThreadPool::set_shared_threads(int threads) {
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    shared_threads = threads;
+    shared_pool.reset();
+}
@@ -0,0 +1,69 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Reusable work-stealing pool. Every worker owns a deque: it pops its own
+// work from the back and steals from the front of the others when it runs dry.
+// A pool of size N runs N - 1 worker threads; the thread that waits on a
+// parallel_for works through the queues too, so nested calls cannot deadlock
+// and a pool of size 1 runs everything inline.
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads that execute tasks, counting the calling thread
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+    // Queue a task for any worker
+    void submit(std::function<void()> task);
+
+    // Run fn(i) for every i in [0, count) and return once all calls finished.
+    // The first exception thrown by fn is rethrown here.
+    void parallel_for(int count, const std::function<void(int)>& fn);
+
+    // Split rows [0, rows) into bands of at least minBandRows rows and run
+    // fn(first, last) for each band in parallel
+    void parallel_bands(int rows, int minBandRows, const std::function<void(int, int)>& fn);
+
+    // Pool shared by the filters, created on first use
+    static ThreadPool& shared();
+
+    // Resize the shared pool; call before handing out work (e.g. from main)
+    static void set_shared_threads(int threads);
+
+    // Thread count used when nothing was configured: the hardware concurrency
+    static int default_threads();
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<int> pending;      // Tasks queued but not yet started
+    std::atomic<unsigned> nextQueue;
+    bool stopping;
+
+    void worker_loop(int index);
+
+    // Pop from our own queue, else steal; runs the task and returns true if one was found
+    bool run_one(int home);
+};
+
+#endif // THREAD_POOL_H
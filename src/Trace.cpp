@@ -0,0 +1,179 @@
+#include "Trace.h"
+#include "FrameAllocator.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+std::atomic<bool> Trace::active(false);
+thread_local uint64_t Trace::threadAllocations = 0;
+
+struct StageTotals {
+    uint64_t calls, nanos, bytes, pixels, allocations;
+};
+
+struct TraceEvent {
+    const char* name;
+    int thread;
+    uint64_t start, end, bytes, pixels;
+};
+
+struct TraceState {
+    std::mutex mutex;  // Guards everything below
+    std::map<std::string, StageTotals> stages;
+    std::map<std::string, uint64_t> counters;
+    std::vector<TraceEvent> events;
+    bool keepEvents;
+    uint64_t droppedEvents;
+    uint64_t origin;   // Clock at enable(), time zero of the trace file
+
+    TraceState() : keepEvents(false), droppedEvents(0), origin(0) {}
+};
+
+// Leaked, so scopes that end during static destruction still find it
+static TraceState& state() {
+    static TraceState* traceState = new TraceState();
+    return *traceState;
+}
+
+// Small sequential thread numbers for the trace file
+static int thread_number() {
+    static std::atomic<int> next(1);
+    thread_local int number = next++;
+    return number;
+}
+
+uint64_t Trace::now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+bool Trace::compiled_in() {
+#ifdef CLEARVISION_NO_TRACE
+    return false;
+#else
+    return true;
+#endif
+}
+
+void Trace::enable(bool events) {
+    TraceState& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.keepEvents = s.keepEvents || events;
+    if (!active.load()) {
+        s.origin = now();
+        active.store(true);
+    }
+}
+
+void Trace::record(const char* name, uint64_t start, uint64_t end, uint64_t bytes, uint64_t pixels,
+                   uint64_t allocations) {
+    int thread = thread_number();
+    TraceState& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    StageTotals& totals = s.stages.insert(std::make_pair(std::string(name), StageTotals())).first->second;
+    totals.calls += 1;
+    totals.nanos += end - start;
+    totals.bytes += bytes;
+    totals.pixels += pixels;
+    totals.allocations += allocations;
+    if (s.keepEvents) {
+        if (s.events.size() < MAX_EVENTS) {
+            TraceEvent event = {name, thread, start, end, bytes, pixels};
+            s.events.push_back(event);
+        } else {
+            ++s.droppedEvents;
+        }
+    }
+}
+
+void Trace::count(const char* name, uint64_t amount) {
+    TraceState& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.counters[name] += amount;
+}
+
+void Trace::write_summary(std::ostream& out) {
+    TraceState& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    if (!compiled_in()) {
+        out << "Instrumentation compiled out (CLEARVISION_NO_TRACE); frame allocator only" << std::endl;
+    }
+    std::vector<std::pair<std::string, StageTotals>> rows(s.stages.begin(), s.stages.end());
+    std::sort(rows.begin(), rows.end(), [](const std::pair<std::string, StageTotals>& a,
+                                           const std::pair<std::string, StageTotals>& b) {
+        return a.second.nanos > b.second.nanos;
+    });
+    if (!rows.empty()) {
+        out << std::left << std::setw(22) << "Stage" << std::right << std::setw(8) << "Calls"
+            << std::setw(12) << "Total ms" << std::setw(12) << "Mean us" << std::setw(10) << "MB/s"
+            << std::setw(10) << "Mpixel/s" << std::setw(8) << "Allocs" << std::endl;
+    }
+    for (const std::pair<std::string, StageTotals>& row : rows) {
+        const StageTotals& t = row.second;
+        double seconds = t.nanos / 1e9;
+        out << std::left << std::setw(22) << row.first << std::right << std::setw(8) << t.calls
+            << std::fixed << std::setprecision(3) << std::setw(12) << t.nanos / 1e6
+            << std::setprecision(1) << std::setw(12) << t.nanos / 1e3 / t.calls;
+        if (t.bytes > 0 && seconds > 0) {
+            out << std::setw(10) << t.bytes / 1e6 / seconds;
+        } else {
+            out << std::setw(10) << "-";
+        }
+        if (t.pixels > 0 && seconds > 0) {
+            out << std::setw(10) << t.pixels / 1e6 / seconds;
+        } else {
+            out << std::setw(10) << "-";
+        }
+        out << std::setw(8) << t.allocations << std::endl;
+    }
+    for (const std::pair<const std::string, uint64_t>& counter : s.counters) {
+        out << std::left << std::setw(22) << counter.first << std::right << std::setw(8) << counter.second << std::endl;
+    }
+
+    FrameAllocator::Stats frames = FrameAllocator::current().stats();
+    out << "Frames: " << frames.hits + frames.misses << " allocations (" << frames.hits << " from the pool), peak "
+        << std::fixed << std::setprecision(1) << frames.peakBytes / 1048576.0 << " MiB in use" << std::endl;
+    if (s.droppedEvents > 0) {
+        out << "Trace events dropped past " << MAX_EVENTS << ": " << s.droppedEvents << std::endl;
+    }
+}
+
+void Trace::write_chrome_trace(const std::string& path) {
+    TraceState& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open trace file for writing: " + path);
+    }
+    // Timestamps and durations in microseconds from enable()
+    file << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    uint64_t last = s.origin;
+    for (size_t i = 0; i < s.events.size(); ++i) {
+        const TraceEvent& e = s.events[i];
+        file << (i > 0 ? ",\n" : "\n") << "{\"name\":\"" << e.name << "\",\"cat\":\"clearvision\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+             << e.thread << ",\"ts\":" << (e.start - s.origin) / 1e3 << ",\"dur\":" << (e.end - e.start) / 1e3
+             << ",\"args\":{\"bytes\":" << e.bytes << ",\"pixels\":" << e.pixels << "}}";
+        last = std::max(last, e.end);
+    }
+    // Counters as one sample each at the end of the trace
+    bool first = s.events.empty();
+    for (const std::pair<const std::string, uint64_t>& counter : s.counters) {
+        file << (first ? "\n" : ",\n") << "{\"name\":\"" << counter.first << "\",\"ph\":\"C\",\"pid\":1,\"ts\":"
+             << (last - s.origin) / 1e3 << ",\"args\":{\"value\":" << counter.second << "}}";
+        first = false;
+    }
+    file << "\n]}\n";
+    file.close();
+    if (!file) {
+        throw std::runtime_error("Error writing trace file: " + path);
+    }
+}
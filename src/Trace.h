@@ -0,0 +1,117 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+// Timers and counters around the hot stages (load, save, filters, stego,
+// secret split). Probes are written with the TRACE_ macros at the bottom:
+//
+//   TRACE_SCOPE(scope, "gauss");           // times the rest of the block
+//   TRACE_AMOUNT(scope, bytes, pixels);    // what the stage processed
+//   TRACE_COUNT("server.failed", 1);       // a plain counter
+//
+// While tracing is off a probe costs one relaxed atomic load. Building with
+// -DCLEARVISION_NO_TRACE removes the probes altogether: the macros expand to
+// nothing and their arguments are not evaluated.
+//
+// While on, every finished scope adds to its stage totals: calls, time,
+// bytes, pixels and the frame allocations its own thread made (work handed
+// to pool threads is timed, but its allocations are not counted). With
+// events on, scopes are also kept for a Chrome trace-event file.
+class Trace {
+public:
+    // Most events kept for the trace file; later ones are only counted
+    static const std::size_t MAX_EVENTS = 1 << 20;
+
+    // Start collecting stage totals, and events if asked
+    static void enable(bool events);
+
+    static bool enabled() { return active.load(std::memory_order_relaxed); }
+
+    // Monotonic clock in nanoseconds
+    static uint64_t now();
+
+    // Times its own lifetime; names must be string literals (events keep the pointer)
+    class Scope {
+    public:
+        explicit Scope(const char* name) : name(name), running(enabled()), start(0), bytes(0), pixels(0), allocations(0) {
+            if (running) {
+                allocations = threadAllocations;
+                start = now();
+            }
+        }
+
+        ~Scope() {
+            if (running) {
+                record(name, start, now(), bytes, pixels, threadAllocations - allocations);
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        void add(uint64_t moreBytes, uint64_t morePixels) {
+            bytes += moreBytes;
+            pixels += morePixels;
+        }
+
+    private:
+        const char* name;
+        bool running;
+        uint64_t start, bytes, pixels, allocations;
+    };
+
+    // Add to a named counter
+    static void count(const char* name, uint64_t amount);
+
+    // Called by FrameAllocator for every buffer it hands out
+    static void note_allocation() {
+        if (enabled()) ++threadAllocations;
+    }
+
+    // Table of stage totals, counters and frame allocator stats
+    static void write_summary(std::ostream& out);
+
+    // Trace-event JSON (one complete event per scope) for chrome://tracing or
+    // Perfetto; throws std::runtime_error if the file can't be written
+    static void write_chrome_trace(const std::string& path);
+
+    // False when built with CLEARVISION_NO_TRACE
+    static bool compiled_in();
+
+private:
+    static std::atomic<bool> active;
+    static thread_local uint64_t threadAllocations;
+
+    static void record(const char* name, uint64_t start, uint64_t end, uint64_t bytes, uint64_t pixels,
+                       uint64_t allocations);
+};
+
+#ifndef CLEARVISION_NO_TRACE
+#define TRACE_SCOPE(var, name) Trace::Scope var(name)
+#define TRACE_AMOUNT(var, bytes, pixels) var.add((bytes), (pixels))
+#define TRACE_COUNT(name, amount) \
+    do { \
+        if (Trace::enabled()) Trace::count((name), (amount)); \
+    } while (0)
+#define TRACE_ALLOCATION() Trace::note_allocation()
+#else
+#define TRACE_SCOPE(var, name) \
+    do { \
+    } while (0)
+#define TRACE_AMOUNT(var, bytes, pixels) \
+    do { \
+    } while (0)
+#define TRACE_COUNT(name, amount) \
+    do { \
+    } while (0)
+#define TRACE_ALLOCATION() \
+    do { \
+    } while (0)
+#endif
+
+#endif // TRACE_H
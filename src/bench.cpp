@@ -0,0 +1,774 @@
+// Performance suite for ClearVision. Built by `make bench`.
+//
+// Benchmarks are registered like Google Benchmark ones and report in the
+// same JSON layout, so its compare.py and dashboards can read the results:
+//   clearvision_bench [--benchmark_filter=<regex>] [--benchmark_min_time=<s>]
+//                     [--benchmark_format=console|json] [--benchmark_out=<file>]
+// Times are per iteration. cpu_time is process CPU time, so it counts the
+// filter worker threads as well. The full matrix takes several minutes;
+// use a filter such as 'Gaussian/1024' for quick checks.
+
+#include "ColorImage.h"
+#include "Compare.h"
+#include "GrayscaleImage.h"
+#include "SecretImage.h"
+#include "Filter.h"
+#include "FilterKernels.h"
+#include "ThreadPool.h"
+#include "Crypto.h"
+#include "PngEncoder.h"
+#include "PngStream.h"
+#include "FrameAllocator.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Timing loop handed to each benchmark: everything before the first
+// keep_running() call is setup and is not measured
+class BenchState {
+private:
+    long long target;
+    long long done;
+    std::chrono::steady_clock::time_point wallStart;
+    std::clock_t cpuStart;
+
+public:
+    double realSeconds, cpuSeconds;
+    double bytesPerIteration, itemsPerIteration;
+
+    explicit BenchState(long long iterations)
+        : target(iterations), done(0), cpuStart(0), realSeconds(0), cpuSeconds(0),
+          bytesPerIteration(0), itemsPerIteration(0) {}
+
+    bool keep_running() {
+        if (done == 0) {
+            cpuStart = std::clock();
+            wallStart = std::chrono::steady_clock::now();
+        }
+        if (done == target) {
+            realSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+            cpuSeconds = static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+            return false;
+        }
+        ++done;
+        return true;
+    }
+
+    long long iterations() const { return target; }
+
+    // Throughput counters, reported as bytes_per_second / items_per_second
+    void set_bytes_per_iteration(double bytes) { bytesPerIteration = bytes; }
+    void set_items_per_iteration(double items) { itemsPerIteration = items; }
+};
+
+struct Benchmark {
+    std::string name;
+    std::function<void(BenchState&)> fn;
+};
+
+static std::vector<Benchmark>& registry() {
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+static void add(const std::string& name, std::function<void(BenchState&)> fn) {
+    Benchmark benchmark;
+    benchmark.name = name;
+    benchmark.fn = fn;
+    registry().push_back(benchmark);
+}
+
+// Keep the optimizer from discarding a result
+static volatile unsigned char sink;
+
+static void consume(const unsigned char* data) {
+    sink = data ? data[0] : 0;
+}
+
+// Deterministic test frame: smooth gradients plus noise, like a photo compresses
+static GrayscaleImage test_image(int width, int height) {
+    GrayscaleImage image(width, height);
+    unsigned state = 12345u;
+    for (int i = 0; i < height; ++i) {
+        unsigned char* row = image.row(i);
+        for (int j = 0; j < width; ++j) {
+            state = state * 1664525u + 1013904223u;
+            int value = (i * 3 + j * 5) / 8 + static_cast<int>((state >> 24) & 31);
+            row[j] = static_cast<unsigned char>(value & 255);
+        }
+    }
+    return image;
+}
+
+static std::string temp_path(const std::string& name) {
+    const char* dir = std::getenv("TMPDIR");
+    return std::string(dir ? dir : "/tmp") + "/clearvision_bench_" + std::to_string(getpid()) + "_" + name;
+}
+
+static const int IMAGE_SIZES[] = {256, 1024, 4096, 8192};
+static const int KERNEL_SIZES[] = {3, 5, 9, 15, 31};
+static const int MESSAGE_LENGTHS[] = {16, 256, 4096, 65536};
+
+static void register_filters() {
+    for (int size : IMAGE_SIZES) {
+        for (int k : KERNEL_SIZES) {
+            std::string suffix = "/" + std::to_string(size) + "/" + std::to_string(k);
+            double bytes = static_cast<double>(size) * size;
+
+            add("BM_MeanFilter" + suffix, [=](BenchState& state) {
+                GrayscaleImage src = test_image(size, size), dst(size, size);
+                while (state.keep_running()) {
+                    Filter::apply_mean_filter(src, dst, k);
+                    consume(dst.row(0));
+                }
+                state.set_bytes_per_iteration(bytes);
+            });
+            add("BM_GaussianSmoothing" + suffix, [=](BenchState& state) {
+                GrayscaleImage src = test_image(size, size), dst(size, size);
+                while (state.keep_running()) {
+                    Filter::apply_gaussian_smoothing(src, dst, k, k / 3.0);
+                    consume(dst.row(0));
+                }
+                state.set_bytes_per_iteration(bytes);
+            });
+            add("BM_UnsharpMask" + suffix, [=](BenchState& state) {
+                GrayscaleImage src = test_image(size, size), dst(size, size);
+                while (state.keep_running()) {
+                    Filter::apply_unsharp_mask(src, dst, k, 1.5);
+                    consume(dst.row(0));
+                }
+                state.set_bytes_per_iteration(bytes);
+            });
+            // The same filters with the double-precision arithmetic, for comparison with fixed point
+            add("BM_GaussianSmoothingExact" + suffix, [=](BenchState& state) {
+                GrayscaleImage src = test_image(size, size), dst(size, size);
+                FilterKernels::set_exact(true);
+                while (state.keep_running()) {
+                    Filter::apply_gaussian_smoothing(src, dst, k, k / 3.0);
+                    consume(dst.row(0));
+                }
+                FilterKernels::set_exact(false);
+                state.set_bytes_per_iteration(bytes);
+            });
+            add("BM_UnsharpMaskExact" + suffix, [=](BenchState& state) {
+                GrayscaleImage src = test_image(size, size), dst(size, size);
+                FilterKernels::set_exact(true);
+                while (state.keep_running()) {
+                    Filter::apply_unsharp_mask(src, dst, k, 1.5);
+                    consume(dst.row(0));
+                }
+                FilterKernels::set_exact(false);
+                state.set_bytes_per_iteration(bytes);
+            });
+        }
+        // The box approximation is parameterized by sigma rather than kernel size
+        for (int sigma : {1, 4, 16}) {
+            add("BM_GaussianBoxApproximation/" + std::to_string(size) + "/" + std::to_string(sigma), [=](BenchState& state) {
+                GrayscaleImage src = test_image(size, size), dst(size, size);
+                while (state.keep_running()) {
+                    Filter::apply_gaussian_box_approximation(src, dst, sigma);
+                    consume(dst.row(0));
+                }
+                state.set_bytes_per_iteration(static_cast<double>(size) * size);
+            });
+        }
+    }
+}
+
+// Median, bilateral and morphology, whose cost per pixel should stay flat
+// from the smallest kernel to the largest
+static void register_rank_filters() {
+    for (int size : {256, 1024, 4096}) {
+        for (int k : {3, 9, 31, 101}) {
+            std::string suffix = "/" + std::to_string(size) + "/" + std::to_string(k);
+            double bytes = static_cast<double>(size) * size;
+
+            add("BM_MedianFilter" + suffix, [=](BenchState& state) {
+                GrayscaleImage src = test_image(size, size), dst(size, size);
+                while (state.keep_running()) {
+                    Filter::apply_median_filter(src, dst, k);
+                    consume(dst.row(0));
+                }
+                state.set_bytes_per_iteration(bytes);
+            });
+            add("BM_BilateralFilter" + suffix, [=](BenchState& state) {
+                GrayscaleImage src = test_image(size, size), dst(size, size);
+                while (state.keep_running()) {
+                    Filter::apply_bilateral_filter(src, dst, k, 20.0);
+                    consume(dst.row(0));
+                }
+                state.set_bytes_per_iteration(bytes);
+            });
+            add("BM_Erode" + suffix, [=](BenchState& state) {
+                GrayscaleImage src = test_image(size, size), dst(size, size);
+                while (state.keep_running()) {
+                    Filter::apply_morphology(src, dst, Filter::ERODE, k);
+                    consume(dst.row(0));
+                }
+                state.set_bytes_per_iteration(bytes);
+            });
+            add("BM_Open" + suffix, [=](BenchState& state) {
+                GrayscaleImage src = test_image(size, size), dst(size, size);
+                while (state.keep_running()) {
+                    Filter::apply_morphology(src, dst, Filter::OPEN, k);
+                    consume(dst.row(0));
+                }
+                state.set_bytes_per_iteration(bytes);
+            });
+        }
+    }
+}
+
+// The filters on 16-bit and float frames with the same content, rescaled
+template <typename Pixel>
+static void register_pixel_type(const std::string& type) {
+    for (int size : {1024, 4096}) {
+        for (int k : {5, 15}) {
+            std::string suffix = "/" + std::to_string(size) + "/" + std::to_string(k);
+            double bytes = static_cast<double>(size) * size * sizeof(Pixel);
+
+            add("BM_MeanFilter" + type + suffix, [=](BenchState& state) {
+                BasicGrayscaleImage<Pixel> src = test_image(size, size).convert<Pixel>(), dst(size, size);
+                while (state.keep_running()) {
+                    Filter::apply_mean_filter(src, dst, k);
+                    consume(reinterpret_cast<const unsigned char*>(dst.row(0)));
+                }
+                state.set_bytes_per_iteration(bytes);
+            });
+            add("BM_GaussianSmoothing" + type + suffix, [=](BenchState& state) {
+                BasicGrayscaleImage<Pixel> src = test_image(size, size).convert<Pixel>(), dst(size, size);
+                while (state.keep_running()) {
+                    Filter::apply_gaussian_smoothing(src, dst, k, k / 3.0);
+                    consume(reinterpret_cast<const unsigned char*>(dst.row(0)));
+                }
+                state.set_bytes_per_iteration(bytes);
+            });
+            add("BM_UnsharpMask" + type + suffix, [=](BenchState& state) {
+                BasicGrayscaleImage<Pixel> src = test_image(size, size).convert<Pixel>(), dst(size, size);
+                while (state.keep_running()) {
+                    Filter::apply_unsharp_mask(src, dst, k, 1.5);
+                    consume(reinterpret_cast<const unsigned char*>(dst.row(0)));
+                }
+                state.set_bytes_per_iteration(bytes);
+            });
+        }
+    }
+}
+
+// An RGB frame whose planes are the test frame shifted by a few columns each
+static ColorImage test_color_image(int size) {
+    GrayscaleImage base = test_image(size + 8, size);
+    ColorImage image(size, size, 3);
+    for (int c = 0; c < 3; ++c) {
+        for (int i = 0; i < size; ++i) {
+            std::copy(base.row(i) + 4 * c, base.row(i) + 4 * c + size, image.plane(c).row(i));
+        }
+    }
+    return image;
+}
+
+// Planar RGB: the Gaussian over the three planes, and PNG encode and decode
+// with the channels interleaved and split again
+static void register_color() {
+    for (int size : {1024, 4096}) {
+        std::string suffix = "/" + std::to_string(size);
+        double bytes = 3.0 * size * size;
+        for (int k : {5, 15}) {
+            add("BM_ColorGaussianSmoothing" + suffix + "/" + std::to_string(k), [=](BenchState& state) {
+                ColorImage image = test_color_image(size);
+                while (state.keep_running()) {
+                    Filter::apply_gaussian_smoothing(image, k, k / 3.0);
+                    consume(image.plane(2).row(0));
+                }
+                state.set_bytes_per_iteration(bytes);
+            });
+        }
+        add("BM_ColorPngEncode" + suffix, [=](BenchState& state) {
+            ColorImage image = test_color_image(size);
+            while (state.keep_running()) {
+                std::vector<unsigned char> png = image.encode();
+                consume(png.data());
+            }
+            state.set_bytes_per_iteration(bytes);
+        });
+        add("BM_ColorPngDecode" + suffix, [=](BenchState& state) {
+            std::vector<unsigned char> png = test_color_image(size).encode();
+            while (state.keep_running()) {
+                ColorImage image = ColorImage::decode(png.data(), png.size());
+                consume(image.plane(0).row(0));
+            }
+            state.set_bytes_per_iteration(bytes);
+        });
+    }
+}
+
+// Frame construction and an in-place filter (one full-frame temporary per
+// call), drawing from a fresh pool or straight from the system
+static void register_allocator() {
+    for (int size : IMAGE_SIZES) {
+        for (int pooled = 0; pooled <= 1; ++pooled) {
+            std::string suffix = "/" + std::to_string(size) + (pooled ? "/Pool" : "/System");
+            double bytes = static_cast<double>(size) * size;
+            auto make_allocator = [pooled]() -> std::unique_ptr<FrameAllocator> {
+                if (pooled) return std::unique_ptr<FrameAllocator>(new FramePoolAllocator());
+                return std::unique_ptr<FrameAllocator>(new SystemFrameAllocator());
+            };
+
+            add("BM_ImageAllocation" + suffix, [=](BenchState& state) {
+                std::unique_ptr<FrameAllocator> allocator = make_allocator();
+                FrameAllocator::set_current(allocator.get());
+                while (state.keep_running()) {
+                    GrayscaleImage image(size, size);
+                    consume(image.row(0));
+                }
+                FrameAllocator::set_current(nullptr);
+                state.set_bytes_per_iteration(bytes);
+            });
+            add("BM_MeanFilterInPlace" + suffix, [=](BenchState& state) {
+                std::unique_ptr<FrameAllocator> allocator = make_allocator();
+                FrameAllocator::set_current(allocator.get());
+                {
+                    GrayscaleImage image = test_image(size, size);
+                    while (state.keep_running()) {
+                        Filter::apply_mean_filter(image, 3);
+                        consume(image.row(0));
+                    }
+                }
+                FrameAllocator::set_current(nullptr);
+                state.set_bytes_per_iteration(bytes);
+            });
+        }
+    }
+}
+
+static void register_crypto() {
+    for (int length : MESSAGE_LENGTHS) {
+        std::string suffix = "/" + std::to_string(length);
+        add("BM_EmbedLSBits" + suffix, [=](BenchState& state) {
+            GrayscaleImage image = test_image(1024, 1024);
+            PackedBits bits = Crypto::pack_message(std::string(length, 'q'));
+            while (state.keep_running()) {
+                Crypto::embed_bits(image, bits);
+                consume(image.get_data());
+            }
+            state.set_items_per_iteration(length);
+        });
+        add("BM_ExtractLSBits" + suffix, [=](BenchState& state) {
+            GrayscaleImage image = test_image(1024, 1024);
+            Crypto::embed_bits(image, Crypto::pack_message(std::string(length, 'q')));
+            SecretImage secret(image);
+            while (state.keep_running()) {
+                PackedBits bits = Crypto::extract_bits(secret, static_cast<size_t>(length) * 7);
+                sink = static_cast<unsigned char>(bits.data()[0]);
+            }
+            state.set_items_per_iteration(length);
+        });
+    }
+}
+
+// Comparing a frame with an identical copy (the worst case for the early
+// exits) and with a lightly filtered one, and hashing it
+static void register_compare() {
+    for (int size : {1024, 4096}) {
+        std::string suffix = "/" + std::to_string(size);
+        double bytes = 2.0 * size * size;
+
+        add("BM_CompareEqual" + suffix, [=](BenchState& state) {
+            GrayscaleImage a = test_image(size, size), b = test_image(size, size);
+            while (state.keep_running()) {
+                sink = Compare::equal(a, b);
+            }
+            state.set_bytes_per_iteration(bytes);
+        });
+        add("BM_CompareWithin" + suffix, [=](BenchState& state) {
+            GrayscaleImage a = test_image(size, size), b = test_image(size, size);
+            while (state.keep_running()) {
+                sink = Compare::within(a, b, 2);
+            }
+            state.set_bytes_per_iteration(bytes);
+        });
+        add("BM_CompareMetrics" + suffix, [=](BenchState& state) {
+            GrayscaleImage a = test_image(size, size), b(size, size);
+            Filter::apply_gaussian_smoothing(a, b, 3, 1.0);
+            while (state.keep_running()) {
+                sink = static_cast<unsigned char>(Compare::metrics(a, b).psnr);
+            }
+            state.set_bytes_per_iteration(bytes);
+        });
+        add("BM_ImageHash" + suffix, [=](BenchState& state) {
+            GrayscaleImage image = test_image(size, size);
+            while (state.keep_running()) {
+                sink = static_cast<unsigned char>(Compare::hash(image));
+            }
+            state.set_bytes_per_iteration(bytes / 2);
+        });
+    }
+}
+
+static void register_secret_image() {
+    for (int size : {256, 1024, 4096}) {
+        std::string suffix = "/" + std::to_string(size);
+        double bytes = static_cast<double>(size) * size;
+
+        add("BM_SecretImageConstruct" + suffix, [=](BenchState& state) {
+            GrayscaleImage image = test_image(size, size);
+            while (state.keep_running()) {
+                SecretImage secret(image);
+                consume(secret.get_upper_triangular());
+            }
+            state.set_bytes_per_iteration(bytes);
+        });
+        add("BM_SecretImageReconstruct" + suffix, [=](BenchState& state) {
+            SecretImage secret(test_image(size, size));
+            while (state.keep_running()) {
+                GrayscaleImage image = secret.reconstruct();
+                consume(image.row(0));
+            }
+            state.set_bytes_per_iteration(bytes);
+        });
+        add("BM_SecretImageGaussianRoundTrip" + suffix, [=](BenchState& state) {
+            SecretImage secret(test_image(size, size));
+            while (state.keep_running()) {
+                GrayscaleImage image = secret.reconstruct();
+                Filter::apply_gaussian_smoothing(image, 5, 1.2);
+                secret.save_back(image);
+            }
+            consume(secret.get_upper_triangular());
+            state.set_bytes_per_iteration(bytes);
+        });
+        add("BM_SecretImageGaussianInPlace" + suffix, [=](BenchState& state) {
+            SecretImage secret(test_image(size, size));
+            while (state.keep_running()) {
+                Filter::apply_gaussian_smoothing(secret, 5, 1.2);
+            }
+            consume(secret.get_upper_triangular());
+            state.set_bytes_per_iteration(bytes);
+        });
+        for (int format = SecretImage::TEXT; format <= SecretImage::BINARY; ++format) {
+            std::string kind = (format == SecretImage::TEXT) ? "Text" : "Binary";
+            std::string path = temp_path("secret_" + kind + std::to_string(size) + ".dat");
+            add("BM_SecretImageSave" + kind + suffix, [=](BenchState& state) {
+                SecretImage secret(test_image(size, size));
+                while (state.keep_running()) {
+                    secret.save_to_file(path, static_cast<SecretImage::Format>(format));
+                }
+                state.set_bytes_per_iteration(bytes);
+                std::remove(path.c_str());
+            });
+            add("BM_SecretImageLoad" + kind + suffix, [=](BenchState& state) {
+                SecretImage(test_image(size, size)).save_to_file(path, static_cast<SecretImage::Format>(format));
+                while (state.keep_running()) {
+                    SecretImage secret = SecretImage::load_from_file(path);
+                    consume(secret.get_lower_triangular());
+                }
+                state.set_bytes_per_iteration(bytes);
+                std::remove(path.c_str());
+            });
+        }
+    }
+}
+
+static void register_png() {
+    for (int size : {256, 1024, 4096}) {
+        std::string suffix = "/" + std::to_string(size);
+        std::string path = temp_path("image" + std::to_string(size) + ".png");
+        double bytes = static_cast<double>(size) * size;
+
+        add("BM_PngSave" + suffix, [=](BenchState& state) {
+            GrayscaleImage image = test_image(size, size);
+            while (state.keep_running()) {
+                image.save_to_file(path.c_str());
+            }
+            state.set_bytes_per_iteration(bytes);
+            std::remove(path.c_str());
+        });
+        add("BM_PngLoad" + suffix, [=](BenchState& state) {
+            test_image(size, size).save_to_file(path.c_str());
+            while (state.keep_running()) {
+                GrayscaleImage image(path.c_str());
+                consume(image.row(0));
+            }
+            state.set_bytes_per_iteration(bytes);
+            std::remove(path.c_str());
+        });
+        add("BM_PngStreamWrite" + suffix, [=](BenchState& state) {
+            GrayscaleImage image = test_image(size, size);
+            while (state.keep_running()) {
+                PngRowWriter writer(path, size, size);
+                for (int i = 0; i < size; ++i) writer.write_row(image.row(i));
+                writer.finish();
+            }
+            state.set_bytes_per_iteration(bytes);
+            std::remove(path.c_str());
+        });
+        add("BM_PngStreamRead" + suffix, [=](BenchState& state) {
+            test_image(size, size).save_to_file(path.c_str());
+            while (state.keep_running()) {
+                PngRowReader reader(path);
+                for (int i = 0; i < size; ++i) consume(reader.next_row());
+            }
+            state.set_bytes_per_iteration(bytes);
+            std::remove(path.c_str());
+        });
+        add("BM_PngEncodeToMemory" + suffix, [=](BenchState& state) {
+            GrayscaleImage image = test_image(size, size);
+            while (state.keep_running()) {
+                std::vector<unsigned char> encoded = image.encode();
+                consume(encoded.data());
+            }
+            state.set_bytes_per_iteration(bytes);
+        });
+        const char* levels[] = {"fastest", "balanced", "smallest"};
+        for (const char* level : levels) {
+            for (bool parallel : {false, true}) {
+                PngEncoder::Options options;
+                options.level = PngEncoder::parse_level(level);
+                options.parallel = parallel;
+                add(std::string(parallel ? "BM_PngEncodeParallel/" : "BM_PngEncode/") + level + suffix, [=](BenchState& state) {
+                    GrayscaleImage image = test_image(size, size);
+                    while (state.keep_running()) {
+                        std::vector<unsigned char> encoded = image.encode(GrayscaleImage::PNG, options);
+                        consume(encoded.data());
+                    }
+                    state.set_bytes_per_iteration(bytes);
+                });
+            }
+        }
+        add("BM_PngDecodeFromMemory" + suffix, [=](BenchState& state) {
+            std::vector<unsigned char> encoded = test_image(size, size).encode();
+            while (state.keep_running()) {
+                GrayscaleImage image = GrayscaleImage::decode(encoded.data(), encoded.size());
+                consume(image.row(0));
+            }
+            state.set_bytes_per_iteration(bytes);
+        });
+        std::string pgmPath = temp_path("image" + std::to_string(size) + ".pgm");
+        add("BM_PgmSave" + suffix, [=](BenchState& state) {
+            GrayscaleImage image = test_image(size, size);
+            while (state.keep_running()) {
+                image.save_to_file(pgmPath.c_str());
+            }
+            state.set_bytes_per_iteration(bytes);
+            std::remove(pgmPath.c_str());
+        });
+        add("BM_PgmLoad" + suffix, [=](BenchState& state) {
+            test_image(size, size).save_to_file(pgmPath.c_str());
+            while (state.keep_running()) {
+                GrayscaleImage image(pgmPath.c_str());
+                consume(image.row(0));
+            }
+            state.set_bytes_per_iteration(bytes);
+            std::remove(pgmPath.c_str());
+        });
+    }
+}
+
+// Cost of a probe while tracing is off (tracing cannot be turned off again,
+// so there is no enabled counterpart here; use --stats on the CLI for that)
+static void register_trace() {
+    add("BM_TraceScopeDisabled", [](BenchState& state) {
+        while (state.keep_running()) {
+            TRACE_SCOPE(scope, "bench");
+            TRACE_AMOUNT(scope, 1, 1);
+            sink = 0;
+        }
+        state.set_items_per_iteration(1);
+    });
+}
+
+struct Result {
+    std::string name;
+    long long iterations;
+    double realNs, cpuNs;       // Per iteration
+    double bytesPerSecond, itemsPerSecond;
+};
+
+// Run with growing iteration counts until one run lasts at least minTime
+static Result measure(const Benchmark& benchmark, double minTime) {
+    long long iterations = 1;
+    while (true) {
+        BenchState state(iterations);
+        benchmark.fn(state);
+        bool enough = state.realSeconds >= minTime || iterations >= 1000000000LL;
+        if (enough) {
+            Result result;
+            result.name = benchmark.name;
+            result.iterations = iterations;
+            result.realNs = state.realSeconds * 1e9 / iterations;
+            result.cpuNs = state.cpuSeconds * 1e9 / iterations;
+            result.bytesPerSecond = state.bytesPerIteration * iterations / state.realSeconds;
+            result.itemsPerSecond = state.itemsPerIteration * iterations / state.realSeconds;
+            return result;
+        }
+        // Aim 40% past the target, growing at most 10x per step
+        double scale = state.realSeconds > 0 ? 1.4 * minTime / state.realSeconds : 10.0;
+        iterations = std::max(iterations + 1, static_cast<long long>(iterations * std::min(scale, 10.0)));
+    }
+}
+
+static std::string json_escape(const std::string& text) {
+    std::string out;
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+static void write_json(std::ostream& out, const std::vector<Result>& results, const char* executable) {
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    char date[64];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+
+    out << "{\n  \"context\": {\n"
+        << "    \"date\": \"" << date << "\",\n"
+        << "    \"host_name\": \"" << json_escape(host) << "\",\n"
+        << "    \"executable\": \"" << json_escape(executable) << "\",\n"
+        << "    \"num_cpus\": " << ThreadPool::default_threads() << ",\n"
+        << "    \"threads\": " << ThreadPool::shared().size() << ",\n"
+        << "    \"simd_level\": \"" << FilterKernels::simd_level_name(FilterKernels::simd_level()) << "\",\n"
+        << "    \"library_build_type\": \"release\"\n"
+        << "  },\n  \"benchmarks\": [";
+    out << std::setprecision(10);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out << (i ? "," : "") << "\n    {\n"
+            << "      \"name\": \"" << json_escape(r.name) << "\",\n"
+            << "      \"run_name\": \"" << json_escape(r.name) << "\",\n"
+            << "      \"run_type\": \"iteration\",\n"
+            << "      \"repetitions\": 1,\n"
+            << "      \"repetition_index\": 0,\n"
+            << "      \"threads\": 1,\n"
+            << "      \"iterations\": " << r.iterations << ",\n"
+            << "      \"real_time\": " << r.realNs << ",\n"
+            << "      \"cpu_time\": " << r.cpuNs << ",\n"
+            << "      \"time_unit\": \"ns\"";
+        if (r.bytesPerSecond > 0) out << ",\n      \"bytes_per_second\": " << r.bytesPerSecond;
+        if (r.itemsPerSecond > 0) out << ",\n      \"items_per_second\": " << r.itemsPerSecond;
+        out << "\n    }";
+    }
+    out << "\n  ]\n}\n";
+}
+
+static void print_row(const Result& r) {
+    std::cout << std::left << std::setw(44) << r.name << std::right << std::fixed << std::setprecision(0)
+              << std::setw(16) << r.realNs << " ns" << std::setw(16) << r.cpuNs << " ns" << std::setw(12)
+              << r.iterations;
+    if (r.bytesPerSecond > 0) {
+        std::cout << std::setprecision(1) << std::setw(12) << r.bytesPerSecond / (1 << 20) << " MiB/s";
+    } else if (r.itemsPerSecond > 0) {
+        std::cout << std::setprecision(1) << std::setw(12) << r.itemsPerSecond / 1000 << " k/s";
+    }
+    std::cout << std::endl;
+}
+
+// Value of a "--name=value" argument, or nullptr if arg is a different option
+static const char* option_value(const std::string& arg, const char* name) {
+    std::string prefix = std::string("--") + name + "=";
+    return arg.compare(0, prefix.size(), prefix) == 0 ? arg.c_str() + prefix.size() : nullptr;
+}
+
+int main(int argc, char** argv) {
+    std::string filter = ".";
+    std::string format = "console";
+    std::string outPath;
+    double minTime = 0.5;
+    bool listOnly = false;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            const char* value;
+            if ((value = option_value(arg, "benchmark_filter"))) {
+                filter = value;
+            } else if ((value = option_value(arg, "benchmark_min_time"))) {
+                minTime = std::stod(value);
+            } else if ((value = option_value(arg, "benchmark_format"))) {
+                format = value;
+                if (format != "console" && format != "json") throw std::invalid_argument("Unknown format: " + format);
+            } else if ((value = option_value(arg, "benchmark_out"))) {
+                outPath = value;
+            } else if ((value = option_value(arg, "threads"))) {
+                ThreadPool::set_shared_threads(std::stoi(value));
+            } else if (arg == "--benchmark_list_tests") {
+                listOnly = true;
+            } else {
+                throw std::invalid_argument("Unknown option: " + arg);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    register_filters();
+    register_rank_filters();
+    register_pixel_type<uint16_t>("16");
+    register_pixel_type<float>("Float");
+    register_color();
+    register_allocator();
+    register_crypto();
+    register_compare();
+    register_secret_image();
+    register_png();
+    register_trace();
+
+    std::regex pattern(filter);
+    if (listOnly) {
+        for (const Benchmark& benchmark : registry()) {
+            if (std::regex_search(benchmark.name, pattern)) std::cout << benchmark.name << std::endl;
+        }
+        return 0;
+    }
+
+    std::vector<Result> results;
+    if (format == "console") {
+        std::cout << "SIMD: " << FilterKernels::simd_level_name(FilterKernels::simd_level())
+                  << ", threads: " << ThreadPool::shared().size() << std::endl
+                  << std::left << std::setw(44) << "Benchmark" << std::right << std::setw(19) << "Time"
+                  << std::setw(19) << "CPU" << std::setw(12) << "Iterations" << std::endl
+                  << std::string(110, '-') << std::endl;
+    }
+    for (const Benchmark& benchmark : registry()) {
+        if (!std::regex_search(benchmark.name, pattern)) {
+            continue;
+        }
+        try {
+            results.push_back(measure(benchmark, minTime));
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << benchmark.name << ": " << e.what() << std::endl;
+            return 1;
+        }
+        if (format == "console") {
+            print_row(results.back());
+        }
+    }
+
+    if (format == "json") {
+        write_json(std::cout, results, argv[0]);
+    }
+    if (!outPath.empty()) {
+        std::ofstream out(outPath);
+        if (!out) {
+            std::cerr << "Error: Could not write " << outPath << std::endl;
+            return 1;
+        }
+        write_json(out, results, argv[0]);
+    }
+    return 0;
+}
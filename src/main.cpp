@@ -1,65 +1,284 @@
+#include "ColorImage.h"
+#include "Compare.h"
 #include "GrayscaleImage.h"
 #include "SecretImage.h"
 #include "Filter.h"
+#include "FilterKernels.h"
+#include "ThreadPool.h"
 #include "Crypto.h"
+#include "Pipeline.h"
+#include "PngEncoder.h"
+#include "PngStream.h"
+#include "Batch.h"
+#include "Server.h"
+#include "SharedFrame.h"
+#include "Trace.h"
+#include "ResultCache.h"
+#include <chrono>
+#include <csignal>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <unistd.h>
+#include <iomanip>
 #include <iostream>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+// Pixel type for the single-image filters and convert: 8, 16 or 32 (float)
+static int pixel_depth = 8;
+
+// Keep the channels of colour inputs (--color) instead of reducing them to grey
+static bool color_images = false;
+
+// Calls fn<Image<Pixel>>(args..) for the pixel type --depth selected
+#define WITH_PIXEL(fn, Image, ...) \
+    (pixel_depth == 16 ? fn<Image<uint16_t>>(__VA_ARGS__) : pixel_depth == 32 ? fn<Image<float>>(__VA_ARGS__) \
+                       : fn<Image<unsigned char>>(__VA_ARGS__))
+
+// Calls fn<ImageType>(args..) for the image type --color and --depth selected
+#define WITH_IMAGE(fn, ...) \
+    (color_images ? WITH_PIXEL(fn, BasicColorImage, __VA_ARGS__) : WITH_PIXEL(fn, BasicGrayscaleImage, __VA_ARGS__))
+
 // Utility function to remove the file extension from a given filename
 std::string remove_extension(const std::string& filename) {
     size_t last_dot = filename.find_last_of(".");
     return (last_dot != std::string::npos && last_dot > 0) ? filename.substr(0, last_dot) : filename;
 }
 
+// On-disk cache of results (--cache), or nullptr
+static std::unique_ptr<ResultCache> result_cache;
+
+// Loads the input, applies `apply` and saves the result as `output`, unless
+// the --cache directory holds the result of the same operation on the same
+// pixels: then that file is copied instead. `operation` names the operation
+// and all its parameters.
+template <typename Image, typename Apply>
+void filter_and_save(const char* input_image, const std::string& operation, const std::string& output, Apply apply) {
+    Image img(input_image);
+    std::string key;
+    if (result_cache) {
+        key = ResultCache::key(Compare::hash(img), operation, GrayscaleImageBase::format_for(output));
+        if (result_cache->fetch(key, output)) return;
+    }
+    apply(img);
+    img.save_to_file(output.c_str());
+    if (result_cache) result_cache->store(key, output);
+}
+
 // Applies a mean filter to the input image and saves the result
+template <typename Image>
 void apply_mean_filter(const char* input_image, int kernel_size) {
-    GrayscaleImage img(input_image);
-    Filter::apply_mean_filter(img, kernel_size);
     std::string output_filename = "mean_filtered_" + remove_extension(input_image) + "_" + std::to_string(kernel_size) + ".png";
-    img.save_to_file(output_filename.c_str());
+    filter_and_save<Image>(input_image, "mean " + std::to_string(kernel_size), output_filename, [&](Image& img) {
+        Filter::apply_mean_filter(img, kernel_size);
+    });
 }
 
 // Applies Gaussian smoothing to the input image and saves the result
+template <typename Image>
 void apply_gaussian_smoothing(const char* input_image, int kernel_size, double sigma) {
-    GrayscaleImage img(input_image);
-    Filter::apply_gaussian_smoothing(img, kernel_size, sigma);
     std::string output_filename = "gaussian_filtered_" + remove_extension(input_image) + "_" + std::to_string(kernel_size) + "_" + std::to_string(sigma) + ".png";
-    img.save_to_file(output_filename.c_str());
+    std::string operation = "gauss " + std::to_string(kernel_size) + " " + ResultCache::number(sigma);
+    filter_and_save<Image>(input_image, operation, output_filename, [&](Image& img) {
+        Filter::apply_gaussian_smoothing(img, kernel_size, sigma);
+    });
 }
 
 // Applies an unsharp mask to the input image to enhance sharpness and saves the result
+template <typename Image>
 void apply_unsharp_mask(const char* input_image, int kernel_size, double amount) {
-    GrayscaleImage img(input_image);
-    Filter::apply_unsharp_mask(img, kernel_size, amount);
     std::string output_filename = "unsharp_filtered_" + remove_extension(input_image) + "_" + std::to_string(kernel_size) + "_" + std::to_string(amount) + ".png";
-    img.save_to_file(output_filename.c_str());
+    std::string operation = "unsharp " + std::to_string(kernel_size) + " " + ResultCache::number(amount);
+    filter_and_save<Image>(input_image, operation, output_filename, [&](Image& img) {
+        Filter::apply_unsharp_mask(img, kernel_size, amount);
+    });
+}
+
+// Applies a median filter to the input image and saves the result (8-bit pixels only)
+template <typename Image>
+void apply_median_filter(const char* input_image, int kernel_size) {
+    std::string output_filename = "median_filtered_" + remove_extension(input_image) + "_" + std::to_string(kernel_size) + ".png";
+    filter_and_save<Image>(input_image, "median " + std::to_string(kernel_size), output_filename, [&](Image& img) {
+        Filter::apply_median_filter(img, kernel_size);
+    });
+}
+
+// Applies an edge-preserving bilateral filter to the input image and saves the result (8-bit pixels only)
+template <typename Image>
+void apply_bilateral_filter(const char* input_image, int kernel_size, double sigma_range) {
+    std::string output_filename = "bilateral_filtered_" + remove_extension(input_image) + "_" + std::to_string(kernel_size) + "_" + std::to_string(sigma_range) + ".png";
+    std::string operation = "bilateral " + std::to_string(kernel_size) + " " + ResultCache::number(sigma_range);
+    filter_and_save<Image>(input_image, operation, output_filename, [&](Image& img) {
+        Filter::apply_bilateral_filter(img, kernel_size, sigma_range);
+    });
+}
+
+// Applies erode, dilate, open or close to the input image and saves the result
+template <typename Image>
+void apply_morphology(const char* input_image, const std::string& operation, int kernel_size) {
+    Filter::Morphology op = Filter::parse_morphology(operation);
+    std::string output_filename = operation + "_filtered_" + remove_extension(input_image) + "_" + std::to_string(kernel_size) + ".png";
+    filter_and_save<Image>(input_image, operation + " " + std::to_string(kernel_size), output_filename, [&](Image& img) {
+        Filter::apply_morphology(img, op, kernel_size);
+    });
+}
+
+// Runs a fused chain of filters (e.g. "gauss:5:1.2|unsharp:3:1.5|mean:3") and saves the result
+void run_pipeline(const char* input_image, const char* spec, const char* output_image) {
+    Pipeline pipeline(spec);
+    filter_and_save<GrayscaleImage>(input_image, "pipeline " + pipeline.describe(), output_image, [&](GrayscaleImage& img) {
+        GrayscaleImage result(img.get_width(), img.get_height());
+        pipeline.run(img, result);
+        img = std::move(result);
+    });
+}
+
+// Same as run_pipeline, but decodes, filters and encodes row by row so the
+// image never has to fit in memory
+void stream_pipeline(const char* input_image, const char* spec, const char* output_image) {
+    Pipeline pipeline(spec, true);
+    PngRowReader reader(input_image);
+    PngRowWriter writer(output_image, reader.get_width(), reader.get_height());
+    pipeline.run(reader, writer);
+    writer.finish();
+}
+
+// Re-encodes an image; the output format follows its extension (.pgm or PNG)
+template <typename Image>
+void convert_image(const char* input_image, const char* output_image) {
+    Image img(input_image);
+    img.save_to_file(output_image);
+}
+
+// Runs many jobs in one process: either every line of a manifest, or one
+// operation over every file a glob (or directory) matches. Returns the number of failed jobs.
+int run_batch(int argc, char** argv) {
+    Batch batch = (argc == 3) ? Batch::from_manifest(argv[2])
+                              : Batch::from_glob(argv[2], argv[3], std::vector<std::string>(argv + 4, argv + argc));
+    batch.set_cache(result_cache.get());
+    return batch.run(std::cout, std::cerr);
+}
+
+// Prints the hit, miss, store and eviction counts of every finished run that
+// used the cache directory, and what the directory holds now
+void print_cache_stats(const char* directory) {
+    ResultCache cache(directory, 0);
+    ResultCache::Stats totals = cache.totals();
+    int entries;
+    uint64_t bytes;
+    cache.usage(entries, bytes);
+    uint64_t lookups = totals.hits + totals.misses;
+    std::cout << "Hits:      " << totals.hits;
+    if (lookups > 0) std::cout << " (" << std::fixed << std::setprecision(1) << 100.0 * totals.hits / lookups << "%)";
+    std::cout << "\nMisses:    " << totals.misses << "\nStored:    " << totals.stores << "\nEvicted:   " << totals.evictions
+              << "\nEntries:   " << entries << " (" << bytes << " bytes)" << std::endl;
 }
 
 // Adds two images together and saves the resulting image
 void add_images(const char* img1, const char* img2) {
-    GrayscaleImage image1(img1), image2(img2);
-    GrayscaleImage result = image1 + image2;
+    GrayscaleImage image2(img2);
     std::string output_filename = "added_" + remove_extension(img1) + "_" + remove_extension(img2) + ".png";
-    result.save_to_file(output_filename.c_str());
+    std::string operation = "add " + std::to_string(Compare::hash(image2));
+    filter_and_save<GrayscaleImage>(img1, operation, output_filename, [&](GrayscaleImage& image1) {
+        image1 += image2;  // Reuse the first frame instead of allocating a third
+    });
 }
 
 // Subtracts the second image from the first and saves the resulting image
 void subtract_images(const char* img1, const char* img2) {
-    GrayscaleImage image1(img1), image2(img2);
-    GrayscaleImage result = image1 - image2;
+    GrayscaleImage image2(img2);
     std::string output_filename = "subtracted_" + remove_extension(img1) + "_" + remove_extension(img2) + ".png";
-    result.save_to_file(output_filename.c_str());
+    std::string operation = "sub " + std::to_string(Compare::hash(image2));
+    filter_and_save<GrayscaleImage>(img1, operation, output_filename, [&](GrayscaleImage& image1) {
+        image1 -= image2;  // Reuse the first frame instead of allocating a third
+    });
 }
 
 // Compares two images and prints whether they are identical
 void compare_images(const char* img1, const char* img2) {
     GrayscaleImage image1(img1), image2(img2);
-    bool are_equal = (image1 == image2);
+    bool are_equal = Compare::equal(image1, image2);
     std::cout << (are_equal ? "Images are equal." : "Images are not equal.") << std::endl;
 }
 
+// Prints how far apart two images are: differing samples, largest difference,
+// MSE, PSNR and SSIM. Returns 1 when they differ by more than the tolerance
+// (or in size), like cmp.
+template <typename Image>
+int measure_difference(const char* img1, const char* img2, double tolerance) {
+    if (!(tolerance >= 0.0)) throw std::invalid_argument("Tolerance must not be negative.");
+    Image image1(img1), image2(img2);
+    if (image1.get_width() != image2.get_width() || image1.get_height() != image2.get_height()) {
+        std::cout << "Images have different dimensions." << std::endl;
+        return 1;
+    }
+    Compare::Metrics metrics = Compare::metrics(image1, image2);
+    std::cout << "Differing samples: " << metrics.differing << "\n"
+              << "Max abs diff: " << metrics.maxAbsDiff << "\n"
+              << "MSE: " << metrics.mse << "\n"
+              << "PSNR: " << metrics.psnr << " dB\n"
+              << "SSIM: " << metrics.ssim << std::endl;
+    if (metrics.differing == 0) {
+        std::cout << "Images are equal." << std::endl;
+        return 0;
+    }
+    bool within = metrics.maxAbsDiff <= tolerance;
+    std::cout << (within ? "Images are equal within " : "Images differ by more than ") << tolerance << "." << std::endl;
+    return within ? 0 : 1;
+}
+
+// Prints "<hash>  <img>" for many images (files, directories or glob patterns),
+// hashed in parallel; equal hashes mean equal pixels. Returns the number of
+// images that could not be read.
+template <typename Image>
+int hash_images(const std::vector<std::string>& patterns) {
+    std::vector<std::string> paths;
+    for (const std::string& pattern : patterns) {
+        std::vector<std::string> matches = Batch::expand_pattern(pattern);
+        if (matches.empty()) matches.push_back(pattern);  // Reported as unreadable below
+        paths.insert(paths.end(), matches.begin(), matches.end());
+    }
+
+    std::vector<uint64_t> hashes(paths.size());
+    std::vector<std::string> errors(paths.size());
+    ThreadPool::shared().parallel_for(static_cast<int>(paths.size()), [&](int i) {
+        try {
+            hashes[i] = Compare::hash(Image(paths[i].c_str()));
+        } catch (const std::exception& e) {
+            errors[i] = e.what();
+        }
+    });
+
+    int failed = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (!errors[i].empty()) {
+            std::cerr << "Error: " << paths[i] << ": " << errors[i] << std::endl;
+            ++failed;
+        } else {
+            std::cout << std::hex << std::setw(16) << std::setfill('0') << hashes[i] << std::dec << std::setfill(' ')
+                      << "  " << paths[i] << std::endl;
+        }
+    }
+    return failed;
+}
+
+// compare <img1> <img2> [--tolerance <t>]  or  compare --hash <img|dir|glob> [..]
+int compare(int argc, char** argv) {
+    std::string usage = "Usage: clearvision compare <img1> <img2> [--tolerance <t>]  or  clearvision compare --hash <img|dir|glob> [..]";
+    if (argc >= 4 && std::string(argv[2]) == "--hash") {
+        return WITH_IMAGE(hash_images, std::vector<std::string>(argv + 3, argv + argc)) > 0 ? 1 : 0;
+    }
+    double tolerance = 0.0;
+    if (argc == 6 && std::string(argv[4]) == "--tolerance") {
+        tolerance = std::stod(argv[5]);
+    } else if (argc != 4) {
+        throw std::invalid_argument(usage);
+    }
+    return WITH_IMAGE(measure_difference, argv[2], argv[3], tolerance);
+}
+
 // Converts a GrayscaleImage to a SecretImage and saves it in a disguised format
 void disguise_image(const char* input_image) {
     GrayscaleImage img(input_image);
@@ -77,22 +296,302 @@ void reveal_image(const char* input_file) {
 }
 
 // Encrypts a message into the image using least significant bits (LSB) steganography
+template <typename Image>
 void encrypt_image(const char* input_image, const char* message) {
-    GrayscaleImage img(input_image);
-    SecretImage secret_img = Crypto::embed_LSBits(img, Crypto::encrypt_message(message));
-    GrayscaleImage modified_img = secret_img.reconstruct();
+    Image img(input_image);
+    Crypto::embed_message(img, message);
     std::string output_filename = "modified_secret_image_" + remove_extension(input_image) + ".png";
-    modified_img.save_to_file(output_filename.c_str());
+    img.save_to_file(output_filename.c_str());
 }
 
-// Extracts an encrypted message from the image and decrypts it
+// Extracts an encrypted message from the image and decrypts it, using its header
+template <typename Image>
+void decrypt_image(const char* input_image) {
+    Image img(input_image);
+    std::string message = Crypto::extract_message(img);
+    std::cout << "Decrypted Message: " << message << std::endl;
+}
+
+// Same for images written before messages had a header: the last 7 * message_length pixels
+template <typename Image>
 void decrypt_image(const char* input_image, int message_length) {
-    SecretImage secret_img(input_image);
-    std::string message = Crypto::decrypt_message(Crypto::extract_LSBits(secret_img, message_length));
+    if (message_length < 0) throw std::invalid_argument("Message length must not be negative.");
+    Image img(input_image);
+    std::string message = Crypto::unpack_message(Crypto::extract_bits(img, static_cast<size_t>(message_length) * 7));
     std::cout << "Decrypted Message: " << message << std::endl;
 }
 
+// Looks for messages in many images (files, directories or glob patterns) and
+// prints "<img>: <message>" for each one found. Images are checked in parallel
+// and those without a message header are dropped after reading its bits.
+// Returns the number of images that could not be read.
+int scan_images(const std::vector<std::string>& patterns) {
+    std::vector<std::string> paths;
+    for (const std::string& pattern : patterns) {
+        std::vector<std::string> matches = Batch::expand_pattern(pattern);
+        if (matches.empty()) matches.push_back(pattern);  // Reported as unreadable below
+        paths.insert(paths.end(), matches.begin(), matches.end());
+    }
+
+    struct ScanResult {
+        bool found = false;
+        std::string message;
+        std::string error;
+    };
+    std::vector<ScanResult> results(paths.size());
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ThreadPool::shared().parallel_for(static_cast<int>(paths.size()), [&](int i) {
+        try {
+            GrayscaleImage img(paths[i].c_str());
+            Crypto::MessageHeader header;
+            if (Crypto::read_message_header(img, header)) {
+                results[i].message = Crypto::extract_message(img, header);
+                results[i].found = true;
+            }
+        } catch (const std::exception& e) {
+            results[i].error = e.what();
+        }
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int found = 0, failed = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (!results[i].error.empty()) {
+            std::cerr << "Error: " << paths[i] << ": " << results[i].error << std::endl;
+            ++failed;
+        } else if (results[i].found) {
+            std::cout << paths[i] << ": " << results[i].message << std::endl;
+            ++found;
+        }
+    }
+    std::cout << "Scan: " << paths.size() << " images, " << found << " with a message, " << failed << " failed, "
+              << std::fixed << std::setprecision(3) << seconds << " s, " << std::setprecision(1)
+              << (seconds > 0 ? paths.size() / seconds : 0.0) << " images/sec" << std::endl;
+    return failed;
+}
+
+// Spreads a message over several images, each written as modified_secret_image_<img>.png.
+// Images are loaded, embedded and saved in parallel.
+void encrypt_multi(const char* message, const std::vector<std::string>& input_images) {
+    std::vector<GrayscaleImage> carriers(input_images.size(), GrayscaleImage(0, 0));
+    ThreadPool& pool = ThreadPool::shared();
+    pool.parallel_for(static_cast<int>(carriers.size()), [&](int i) {
+        carriers[i] = GrayscaleImage(input_images[i].c_str());
+    });
+    Crypto::embed_message_multi(carriers, message);
+    pool.parallel_for(static_cast<int>(carriers.size()), [&](int i) {
+        std::string output_filename = "modified_secret_image_" + remove_extension(input_images[i]) + ".png";
+        carriers[i].save_to_file(output_filename.c_str());
+    });
+}
+
+// Reassembles a message spread over several images (in any order) and prints it
+void decrypt_multi(const std::vector<std::string>& input_images) {
+    std::vector<GrayscaleImage> carriers(input_images.size(), GrayscaleImage(0, 0));
+    ThreadPool::shared().parallel_for(static_cast<int>(carriers.size()), [&](int i) {
+        carriers[i] = GrayscaleImage(input_images[i].c_str());
+    });
+    std::string message = Crypto::extract_message_multi(carriers);
+    std::cout << "Decrypted Message: " << message << std::endl;
+}
+
+static Server* running_server = nullptr;
+
+static void stop_server(int) {
+    if (running_server != nullptr) {
+        running_server->stop();
+    }
+}
+
+// Runs the request server until SIGINT or SIGTERM:
+// serve --socket <path> [--workers <n>] [--queue <n>]
+void serve(int argc, char** argv) {
+    Server::Options options;
+    options.workers = ThreadPool::default_threads();
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) throw std::invalid_argument("Missing value for " + arg);
+        if (arg == "--socket") options.socketPath = argv[++i];
+        else if (arg == "--workers") options.workers = std::stoi(argv[++i]);
+        else if (arg == "--queue") options.queueCapacity = std::stoi(argv[++i]);
+        else throw std::invalid_argument("Unknown serve option: " + arg);
+    }
+    if (options.socketPath.empty()) throw std::invalid_argument("Usage: clearvision serve --socket <path> [--workers <n>] [--queue <n>]");
+
+    Server server(options);
+    running_server = &server;
+    std::signal(SIGINT, stop_server);
+    std::signal(SIGTERM, stop_server);
+    std::cout << "Serving on " << options.socketPath << " with " << options.workers << " workers" << std::endl;
+    server.run();
+    running_server = nullptr;
+}
+
+// Copies a whole file into sealed shared memory
+static int file_to_memory(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error("Could not open " + path);
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    int fd = SharedFrame::create_memory("clearvision-file");
+    if (write(fd, bytes.data(), bytes.size()) != static_cast<ssize_t>(bytes.size())) {
+        close(fd);
+        throw std::runtime_error("Could not fill shared memory from " + path);
+    }
+    SharedFrame::seal(fd);
+    return fd;
+}
+
+// Copies shared memory into a file and closes it
+static void memory_to_file(int fd, const std::string& path) {
+    std::ofstream file(path, std::ios::binary);
+    char buffer[65536];
+    ssize_t length;
+    off_t offset = 0;
+    while ((length = pread(fd, buffer, sizeof(buffer), offset)) > 0) {
+        file.write(buffer, length);
+        offset += length;
+    }
+    close(fd);
+    if (!file) throw std::runtime_error("Could not write " + path);
+}
+
+// Sends one request to a running server:
+// call <socket> <input|-> <output|-> <operation> [<arg> ..]
+// The input is a PNG, or a .dat secret image for reveal; the output receives
+// the image (or, for disguise, the secret image) the server sends back.
+void call_server(int argc, char** argv) {
+    std::string input = argv[3], output = argv[4];
+    std::vector<std::string> request(argv + 5, argv + argc);
+    const std::string& op = request[0];
+
+    std::unique_ptr<SharedFrame> frame;
+    int attach = -1;
+    if (input != "-") {
+        if (op == "reveal") {
+            attach = file_to_memory(input);
+        } else {
+            frame.reset(new SharedFrame(SharedFrame::from_image(GrayscaleImage(input.c_str()))));
+            attach = frame->fd();
+        }
+    }
+
+    int replyFd;
+    std::string text;
+    try {
+        text = Server::call(argv[2], request, attach, replyFd);
+    } catch (...) {
+        if (!frame && attach >= 0) close(attach);
+        throw;
+    }
+    if (!frame && attach >= 0) close(attach);
+    if (!text.empty()) {
+        std::cout << text << std::endl;
+    }
+
+    if (replyFd >= 0 && output == "-") {
+        close(replyFd);
+    } else if (replyFd >= 0 && op == "disguise") {
+        memory_to_file(replyFd, output);
+    } else if (replyFd >= 0) {
+        SharedFrame::open(replyFd).image().save_to_file(output.c_str());
+    } else if (output != "-" && frame) {
+        frame->image().save_to_file(output.c_str());  // Changed in place, e.g. by enc
+    }
+}
+
+// Where --stats and --trace send their reports when main returns
+static bool print_stats = false;
+static std::string trace_path;
+
+// Removes global options from argv so the positional arguments line up again.
+// Recognised: --scalar (disable SIMD kernels), --exact (double-precision Gaussian
+// and unsharp instead of fixed point), --threads N (filter worker threads),
+// --png LEVEL (PNG encode effort), --png-parallel (encode row bands in parallel),
+// --depth 8|16|float (pixel type of mean, gauss, unsharp, morphology, convert
+// and compare), --color (keep colour channels in those and in enc/dec), --stats (per-stage timing summary), --trace FILE (Chrome trace-event JSON),
+// --cache DIR (reuse results stored there) and --cache-max SIZE (its size cap)
+int parse_global_options(int argc, char** argv) {
+    PngEncoder::Options png = PngEncoder::defaults();
+    std::string cache_directory;
+    uint64_t cache_max = 1ULL << 30;
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--scalar") {
+            FilterKernels::set_force_scalar(true);
+        } else if (arg == "--exact") {
+            FilterKernels::set_exact(true);
+        } else if (arg == "--threads") {
+            if (i + 1 >= argc) throw std::invalid_argument("Usage: --threads <count>");
+            int threads = std::stoi(argv[++i]);
+            if (threads < 1) throw std::invalid_argument("Thread count must be at least 1.");
+            ThreadPool::set_shared_threads(threads);
+        } else if (arg == "--png") {
+            if (i + 1 >= argc) throw std::invalid_argument("Usage: --png fastest|balanced|smallest");
+            png.level = PngEncoder::parse_level(argv[++i]);
+        } else if (arg == "--png-parallel") {
+            png.parallel = true;
+        } else if (arg == "--depth") {
+            if (i + 1 >= argc) throw std::invalid_argument("Usage: --depth 8|16|float");
+            std::string depth = argv[++i];
+            if (depth == "8") pixel_depth = 8;
+            else if (depth == "16") pixel_depth = 16;
+            else if (depth == "float") pixel_depth = 32;
+            else throw std::invalid_argument("Pixel depth must be 8, 16 or float.");
+        } else if (arg == "--color") {
+            color_images = true;
+        } else if (arg == "--stats") {
+            print_stats = true;
+        } else if (arg == "--trace") {
+            if (i + 1 >= argc) throw std::invalid_argument("Usage: --trace <file.json>");
+            trace_path = argv[++i];
+        } else if (arg == "--cache") {
+            if (i + 1 >= argc) throw std::invalid_argument("Usage: --cache <dir>");
+            cache_directory = argv[++i];
+        } else if (arg == "--cache-max") {
+            if (i + 1 >= argc) throw std::invalid_argument("Usage: --cache-max <bytes>[K|M|G]");
+            cache_max = ResultCache::parse_size(argv[++i]);
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    PngEncoder::set_defaults(png);
+    if (!cache_directory.empty()) {
+        result_cache.reset(new ResultCache(cache_directory, cache_max));
+    }
+    if (print_stats || !trace_path.empty()) {
+        Trace::enable(!trace_path.empty());
+    }
+    argv[kept] = nullptr;
+    return kept;
+}
+
+// Writes the --stats summary and the --trace file however main returns
+struct TraceReport {
+    ~TraceReport() {
+        try {
+            if (print_stats) Trace::write_summary(std::cerr);
+            if (print_stats && result_cache) {
+                ResultCache::Stats cache = result_cache->session();
+                std::cerr << "Cache: " << cache.hits << " hits, " << cache.misses << " misses, " << cache.stores
+                          << " stored, " << cache.evictions << " evicted" << std::endl;
+            }
+            if (!trace_path.empty()) Trace::write_chrome_trace(trace_path);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+};
+
 int main(int argc, char** argv) {
+    try {
+        argc = parse_global_options(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    TraceReport report;
+
     // Check if enough arguments are provided
     if (argc < 2) {
         throw std::invalid_argument(
@@ -101,13 +600,41 @@ int main(int argc, char** argv) {
             "clearvision mean <img> <kernel_size> \n"
             "clearvision gauss <img> <kernel_size> <sigma> \n"
             "clearvision unsharp <img> <kernel_size> <amount> \n"
+            "clearvision median <img> <kernel_size> \n"
+            "clearvision bilateral <img> <kernel_size> <sigma_range> \n"
+            "clearvision erode|dilate|open|close <img> <kernel_size> \n"
+            "clearvision pipeline <img> <stages> <out> \n"
+            "clearvision stream <img> <stages> <out> \n"
+            "clearvision batch <manifest> \n"
+            "clearvision batch <dir|glob> <operation> <args..> \n"
             "clearvision add <img1> <img2> \n"
             "clearvision sub <img1> <img2> \n"
             "clearvision equals <img1> <img2> \n"
+            "clearvision compare <img1> <img2> [--tolerance <t>] \n"
+            "clearvision compare --hash <img|dir|glob> [..] \n"
+            "clearvision convert <img> <out.png|out.pgm> \n"
             "clearvision disguise <img> <msg> \n"
             "clearvision reveal <img> <msg> \n"
             "clearvision enc <img> <msg> \n"
-            "clearvision dec <img> <msg_len>"
+            "clearvision dec <img> [<msg_len>]\n"
+            "clearvision scan <img|dir|glob> [..]\n"
+            "clearvision enc-multi <msg> <img1> [<img2> ..] \n"
+            "clearvision dec-multi <img1> [<img2> ..]\n"
+            "clearvision serve --socket <path> [--workers <n>] [--queue <n>]\n"
+            "clearvision call <socket> <in|-> <out|-> <operation> [<arg> ..]\n"
+            "clearvision cache-stats <dir>\n\n"
+            "Options: \n"
+            "--scalar       use the portable scalar filter loops instead of SSE2/AVX2 \n"
+            "--exact        bit-exact double-precision Gaussian and unsharp (default: fixed point) \n"
+            "--threads <n>  number of threads the filters run on (default: all cores) \n"
+            "--png <level>  PNG encoding: fastest, balanced (default) or smallest \n"
+            "--png-parallel compress PNG row bands on all threads (slightly larger files) \n"
+            "--depth <d>    pixel type for mean, gauss, unsharp, morphology, convert and compare: 8 (default), 16 or float \n"
+            "--color        keep RGB/RGBA channels in the filters, convert, compare, enc and dec \n"
+            "--stats        print time, throughput and allocations per stage to stderr \n"
+            "--trace <file> write a Chrome trace-event JSON of every timed stage \n"
+            "--cache <dir>  reuse results of the same operation on the same pixels stored in <dir> \n"
+            "--cache-max <size> cap on the cache directory, e.g. 500M (default: 1G; least recently used go first)"
         );
     }
 
@@ -117,15 +644,43 @@ int main(int argc, char** argv) {
         // Parse and execute the specified operation
         if (operation == "mean") {
             if (argc < 4) throw std::invalid_argument("Usage: clearvision mean <img> <kernel_size>");
-            apply_mean_filter(argv[2], std::stoi(argv[3]));
+            WITH_IMAGE(apply_mean_filter, argv[2], std::stoi(argv[3]));
 
         } else if (operation == "gauss") {
             if (argc < 5) throw std::invalid_argument("Usage: clearvision gauss <img> <kernel_size> <sigma>");
-            apply_gaussian_smoothing(argv[2], std::stoi(argv[3]), std::stof(argv[4]));
+            WITH_IMAGE(apply_gaussian_smoothing, argv[2], std::stoi(argv[3]), std::stof(argv[4]));
 
         } else if (operation == "unsharp") {
             if (argc < 5) throw std::invalid_argument("Usage: clearvision unsharp <img> <kernel_size> <amount>");
-            apply_unsharp_mask(argv[2], std::stoi(argv[3]), std::stof(argv[4]));
+            WITH_IMAGE(apply_unsharp_mask, argv[2], std::stoi(argv[3]), std::stof(argv[4]));
+
+        } else if (operation == "median") {
+            if (argc < 4) throw std::invalid_argument("Usage: clearvision median <img> <kernel_size>");
+            if (pixel_depth != 8) throw std::invalid_argument("The median filter works on 8-bit pixels only.");
+            if (color_images) apply_median_filter<ColorImage>(argv[2], std::stoi(argv[3]));
+            else apply_median_filter<GrayscaleImage>(argv[2], std::stoi(argv[3]));
+
+        } else if (operation == "bilateral") {
+            if (argc < 5) throw std::invalid_argument("Usage: clearvision bilateral <img> <kernel_size> <sigma_range>");
+            if (pixel_depth != 8) throw std::invalid_argument("The bilateral filter works on 8-bit pixels only.");
+            if (color_images) apply_bilateral_filter<ColorImage>(argv[2], std::stoi(argv[3]), std::stof(argv[4]));
+            else apply_bilateral_filter<GrayscaleImage>(argv[2], std::stoi(argv[3]), std::stof(argv[4]));
+
+        } else if (operation == "erode" || operation == "dilate" || operation == "open" || operation == "close") {
+            if (argc < 4) throw std::invalid_argument("Usage: clearvision " + operation + " <img> <kernel_size>");
+            WITH_IMAGE(apply_morphology, argv[2], operation, std::stoi(argv[3]));
+
+        } else if (operation == "pipeline") {
+            if (argc < 5) throw std::invalid_argument("Usage: clearvision pipeline <img> <stages> <out>  (stages like \"gauss:5:1.2|unsharp:3:1.5|mean:3\")");
+            run_pipeline(argv[2], argv[3], argv[4]);
+
+        } else if (operation == "stream") {
+            if (argc < 5) throw std::invalid_argument("Usage: clearvision stream <img.png> <stages> <out.png>  (bounded memory, same stages as pipeline)");
+            stream_pipeline(argv[2], argv[3], argv[4]);
+
+        } else if (operation == "batch") {
+            if (argc < 3) throw std::invalid_argument("Usage: clearvision batch <manifest>  or  clearvision batch <dir|glob> <operation> <args..>");
+            if (run_batch(argc, argv) > 0) return 1;
 
         } else if (operation == "add") {
             if (argc < 4) throw std::invalid_argument("Usage: clearvision add <img1> <img2>");
@@ -139,6 +694,13 @@ int main(int argc, char** argv) {
             if (argc < 4) throw std::invalid_argument("Usage: clearvision equals <img1> <img2>");
             compare_images(argv[2], argv[3]);
 
+        } else if (operation == "compare") {
+            return compare(argc, argv);
+
+        } else if (operation == "convert") {
+            if (argc < 4) throw std::invalid_argument("Usage: clearvision convert <img> <out>  (binary PGM if <out> ends in .pgm, else PNG)");
+            WITH_IMAGE(convert_image, argv[2], argv[3]);
+
         } else if (operation == "disguise") {
             if (argc < 3) throw std::invalid_argument("Usage: clearvision disguise <img>");
             disguise_image(argv[2]);
@@ -149,11 +711,46 @@ int main(int argc, char** argv) {
 
         } else if (operation == "enc") {
             if (argc < 4) throw std::invalid_argument("Usage: clearvision enc <img> <message>");
-            encrypt_image(argv[2], argv[3]);
+            if (color_images) {
+                encrypt_image<ColorImage>(argv[2], argv[3]);
+            } else {
+                encrypt_image<GrayscaleImage>(argv[2], argv[3]);
+            }
 
         } else if (operation == "dec") {
-            if (argc < 4) throw std::invalid_argument("Usage: clearvision dec <img> <msg_len>");
-            decrypt_image(argv[2], std::stoi(argv[3]));
+            if (argc < 3) throw std::invalid_argument("Usage: clearvision dec <img> [<msg_len>]  (the length only for images without a message header)");
+            if (argc == 3 && color_images) {
+                decrypt_image<ColorImage>(argv[2]);
+            } else if (argc == 3) {
+                decrypt_image<GrayscaleImage>(argv[2]);
+            } else if (color_images) {
+                decrypt_image<ColorImage>(argv[2], std::stoi(argv[3]));
+            } else {
+                decrypt_image<GrayscaleImage>(argv[2], std::stoi(argv[3]));
+            }
+
+        } else if (operation == "scan") {
+            if (argc < 3) throw std::invalid_argument("Usage: clearvision scan <img|dir|glob> [..]");
+            if (scan_images(std::vector<std::string>(argv + 2, argv + argc)) > 0) return 1;
+
+        } else if (operation == "enc-multi") {
+            if (argc < 4) throw std::invalid_argument("Usage: clearvision enc-multi <message> <img1> [<img2> ..]");
+            encrypt_multi(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+
+        } else if (operation == "dec-multi") {
+            if (argc < 3) throw std::invalid_argument("Usage: clearvision dec-multi <img1> [<img2> ..]");
+            decrypt_multi(std::vector<std::string>(argv + 2, argv + argc));
+
+        } else if (operation == "serve") {
+            serve(argc, argv);
+
+        } else if (operation == "call") {
+            if (argc < 6) throw std::invalid_argument("Usage: clearvision call <socket> <in|-> <out|-> <operation> [<arg> ..]");
+            call_server(argc, argv);
+
+        } else if (operation == "cache-stats") {
+            if (argc < 3) throw std::invalid_argument("Usage: clearvision cache-stats <dir>");
+            print_cache_stats(argv[2]);
 
         } else {
             throw std::invalid_argument("Invalid operation.");